@@ -11,3 +11,6 @@ COMPONENT_SRCDIRS := .
 COMPONENT_ADD_INCLUDEDIRS += . include
 CFLAGS += -Wno-error=unused-label -Wno-error=return-type -Wno-error=missing-braces -Wno-error=pointer-sign -Wno-error=parentheses -Wno-implicit-fallthrough
 
+CFLAGS += -DHAVE_CONFIG_H
+
+# The FPM_* and OPT_SPEED overrides are in Makefile.projbuild
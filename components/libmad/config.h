@@ -13,11 +13,17 @@
 /* Define to optimize for accuracy over speed. */
 /* #undef OPT_SPEED */
 
-/* Define to optimize for speed over accuracy. */
+/* Define to optimize for speed over accuracy. OPT_SPEED can be defined by
+   the build instead */
+#if !defined(OPT_SPEED)
 #define OPT_ACCURACY 1
+#endif
 
-/* Define to enable a fast subband synthesis approximation optimization. */
+/* Define to enable a fast subband synthesis approximation optimization.
+   Can be disabled by the build by defining OPT_NO_SSO */
+#if !defined(OPT_NO_SSO)
 #define OPT_SSO
+#endif
 
 /* Define to influence a strict interpretation of the ISO/IEC standards, even
    if this is in opposition with best accepted practices. */
@@ -69,7 +75,15 @@
 /* #undef inline */
 #endif
 
-#define FPM_DEFAULT
+/* Fixed-point multiply implementation. Can be selected by the build by
+   defining one of FPM_XTENSA, FPM_64BIT or FPM_DEFAULT */
+#if !defined(FPM_XTENSA) && !defined(FPM_64BIT) && !defined(FPM_DEFAULT)
+# if defined(__XTENSA__)
+#  define FPM_XTENSA
+# else
+#  define FPM_64BIT
+# endif
+#endif
 
 /* Define to `int' if <sys/types.h> does not define. */
 /* #undef pid_t */
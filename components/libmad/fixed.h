@@ -420,6 +420,22 @@ mad_fixed_t mad_f_mul_inline(mad_fixed_t x, mad_fixed_t y)
 
 #  define MAD_F_SCALEBITS  MAD_F_FRACBITS
 
+/* --- Xtensa -------------------------------------------------------------- */
+
+# elif defined(FPM_XTENSA)
+
+/*
+ * The Xtensa LX6 core of the ESP32 has a 32x32->64-bit multiplier, with the
+ * low and high (signed) words of the product obtained by MULL and MULSH.
+ * This is as accurate as FPM_64BIT, and the scaling of the 64-bit product is
+ * done by the default mad_f_scale64(), whose rounding depends on OPT_ACCURACY.
+ */
+#  define MAD_F_MLX(hi, lo, x, y)  \
+    asm ("mull	%0, %2, %3\n\t"  \
+	 "mulsh	%1, %2, %3"  \
+	 : "=&r" (lo), "=r" (hi)  \
+	 : "r" (x), "r" (y))
+
 /* --- Default ------------------------------------------------------------- */
 
 # elif defined(FPM_DEFAULT)
@@ -33,6 +33,7 @@
 # include "timer.h"
 # include "layer12.h"
 # include "layer3.h"
+# include "huffman.h"
 
 static
 unsigned long const bitrate_table[5][15] = {
@@ -95,7 +96,12 @@ void mad_frame_init(struct mad_frame *frame)
   frame->options = 0;
 
   frame->overlap = 0;
+  frame->worker = 0;
+  frame->sblimit = 32;
   mad_frame_mute(frame);
+
+  /* layer III Huffman lookup tables */
+  mad_huff_init();
 }
 
 /*
@@ -462,6 +468,19 @@ int mad_frame_decode(struct mad_frame *frame, struct mad_stream *stream)
   if (frame->header.layer != MAD_LAYER_III) {
     struct mad_bitptr next_frame;
 
+    /* downmix to a single channel, Layer III does it itself */
+    if (MAD_NCHANNELS(&frame->header) == 2 && MAD_NOUTCHANNELS(frame) == 1) {
+      unsigned int ns, s, sb;
+
+      ns = MAD_NSBSAMPLES(&frame->header);
+      for (s = 0; s < ns; ++s) {
+	for (sb = 0; sb < 32; ++sb) {
+	  frame->sbsample[0][s][sb] =
+	    (frame->sbsample[0][s][sb] >> 1) + (frame->sbsample[1][s][sb] >> 1);
+	}
+      }
+    }
+
     mad_bit_init(&next_frame, stream->next_frame);
 
     stream->anc_ptr    = stream->ptr;
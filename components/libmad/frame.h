@@ -64,6 +64,18 @@ struct mad_header {
   mad_timer_t duration;			/* audio playing time of frame */
 };
 
+/*
+ * Optional hook for running part of the decoding on another CPU core. If
+ * set, the layer III IMDCT and the synthesis of channel 1 are handed off via
+ * start(), in parallel with channel 0, and wait() must block until the
+ * handed off function has returned. One function is handed off at a time
+ */
+struct mad_worker {
+  void (*start)(void *ctx, void (*func)(void *), void *arg);
+  void (*wait)(void *ctx);
+  void *ctx;
+};
+
 struct mad_frame {
   struct mad_header header;		/* MPEG audio header */
 
@@ -71,9 +83,16 @@ struct mad_frame {
 
   mad_fixed_t sbsample[2][36][32];	/* synthesis subband filter samples */
   mad_fixed_t (*overlap)[2][32][18];	/* Layer III block overlap data */
+
+  struct mad_worker const *worker;	/* second core, if any (set by user) */
+  unsigned int sblimit;			/* Layer III subbands to decode, the
+					   higher ones are muted (set by user) */
 };
 
 # define MAD_NCHANNELS(header)		((header)->mode ? 2 : 1)
+# define MAD_NOUTCHANNELS(frame)  \
+    (((frame)->options & MAD_OPTION_SINGLECHANNEL) == MAD_OPTION_SINGLECHANNEL  \
+     ? 1 : MAD_NCHANNELS(&(frame)->header))
 # define MAD_NSBSAMPLES(header)  \
   ((header)->layer == MAD_LAYER_I ? 12 :  \
    (((header)->layer == MAD_LAYER_III &&  \
@@ -3107,3 +3107,126 @@ struct hufftable const mad_huff_pair_table[32] = {
   /* 30 */ { hufftab24, 11, 4 },
   /* 31 */ { hufftab24, 13, 4 }
 };
+
+/* first-level lookup tables */
+
+enum {
+  LOOKUP_TABLES = 16  /* distinct pair tables */
+};
+
+static
+unsigned short lookup_storage[LOOKUP_TABLES][1 << MAD_HUFF_LOOKUP_BITS];
+
+unsigned short const *mad_huff_pair_lookup[32];
+unsigned char mad_huff_quad_lookup[2][1 << MAD_HUFF_QUAD_BITS];
+
+/*
+ * NAME:	huff->init_pair_lookup()
+ * DESCRIPTION:	build the first-level lookup table for a pair table, by
+ *		walking the table for every possible value of the lookup bits
+ */
+static
+void init_pair_lookup(unsigned short *lookup, union huffpair const *table,
+		      unsigned int startbits)
+{
+  unsigned int value;
+
+  for (value = 0; value < (1 << MAD_HUFF_LOOKUP_BITS); ++value) {
+    union huffpair const *pair;
+    unsigned int pos, clumpsz;
+
+    pos     = 0;
+    clumpsz = startbits;
+    pair    = &table[(value >> (MAD_HUFF_LOOKUP_BITS - clumpsz)) &
+		     ((1 << clumpsz) - 1)];
+
+    while (!pair->final) {
+      pos += clumpsz;
+      clumpsz = pair->ptr.bits;
+
+      if (pos + clumpsz > MAD_HUFF_LOOKUP_BITS)
+	break;
+
+      pair = &table[pair->ptr.offset +
+		    ((value >> (MAD_HUFF_LOOKUP_BITS - pos - clumpsz)) &
+		     ((1 << clumpsz) - 1))];
+    }
+
+    if (pair->final) {
+      lookup[value] = MAD_HUFF_FINAL_ENTRY(pos + pair->value.hlen,
+					   pair->value.x, pair->value.y);
+    }
+    else
+      lookup[value] = MAD_HUFF_PTR_ENTRY(pos, pair - table);
+  }
+}
+
+/*
+ * NAME:	huff->init_quad_lookup()
+ * DESCRIPTION:	build the lookup table for a quad table
+ */
+static
+void init_quad_lookup(unsigned char *lookup, union huffquad const *table)
+{
+  unsigned int value;
+
+  for (value = 0; value < (1 << MAD_HUFF_QUAD_BITS); ++value) {
+    union huffquad const *quad;
+    unsigned int pos;
+
+    pos  = 0;
+    quad = &table[value >> (MAD_HUFF_QUAD_BITS - 4)];
+
+    /* quad tables have at most one extra lookup */
+    if (!quad->final) {
+      pos  = 4;
+      quad = &table[quad->ptr.offset +
+		    ((value >> (MAD_HUFF_QUAD_BITS - 4 - quad->ptr.bits)) &
+		     ((1 << quad->ptr.bits) - 1))];
+    }
+
+    lookup[value] = MAD_HUFF_QUAD_ENTRY(pos + quad->value.hlen,
+					quad->value.v, quad->value.w,
+					quad->value.x, quad->value.y);
+  }
+}
+
+/*
+ * NAME:	huff->init()
+ * DESCRIPTION:	build the lookup tables, if not yet done
+ */
+void mad_huff_init(void)
+{
+  static int initialized;
+  union huffpair const *tables[LOOKUP_TABLES];
+  unsigned int count, i, j;
+
+  if (initialized)
+    return;
+
+  for (i = count = 0; i < 32; ++i) {
+    struct hufftable const *entry = &mad_huff_pair_table[i];
+
+    if (entry->table == 0)
+      continue;
+
+    for (j = 0; j < count; ++j) {
+      if (tables[j] == entry->table)
+	break;
+    }
+
+    if (j == count) {
+      assert(count < LOOKUP_TABLES);
+
+      tables[count++] = entry->table;
+      init_pair_lookup(lookup_storage[j], entry->table, entry->startbits);
+    }
+
+    mad_huff_pair_lookup[i] = lookup_storage[j];
+  }
+
+  init_quad_lookup(mad_huff_quad_lookup[0], hufftabA);
+  init_quad_lookup(mad_huff_quad_lookup[1], hufftabB);
+
+  initialized = 1;
+}
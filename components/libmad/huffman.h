@@ -63,4 +63,34 @@ struct hufftable {
 extern union huffquad const *const mad_huff_quad_table[2];
 extern struct hufftable const mad_huff_pair_table[32];
 
+/*
+ * First-level lookup tables, indexed by the next MAD_HUFF_LOOKUP_BITS bits
+ * of the bitstream. Pair codes that fit are resolved with one lookup. For the
+ * longer ones, the entry tells how many bits to skip and the index of the
+ * pair table entry from which to continue. All quad codes fit in 6 bits.
+ */
+
+# define MAD_HUFF_LOOKUP_BITS	8
+# define MAD_HUFF_QUAD_BITS	6
+
+# define MAD_HUFF_FINAL		0x8000
+# define MAD_HUFF_FINAL_ENTRY(hlen, x, y)  \
+    (MAD_HUFF_FINAL | ((hlen) << 8) | ((x) << 4) | (y))
+# define MAD_HUFF_PTR_ENTRY(bits, index)	(((bits) << 9) | (index))
+
+# define MAD_HUFF_HLEN(entry)	(((entry) >> 8) & 0x0f)
+# define MAD_HUFF_X(entry)	(((entry) >> 4) & 0x0f)
+# define MAD_HUFF_Y(entry)	((entry) & 0x0f)
+# define MAD_HUFF_SKIP(entry)	((entry) >> 9)
+# define MAD_HUFF_INDEX(entry)	((entry) & 0x1ff)
+
+/* quad entries: hlen in bits 4-6, and v, w, x, y in bits 0-3 */
+# define MAD_HUFF_QUAD_ENTRY(hlen, v, w, x, y)  \
+    (((hlen) << 4) | (v) | ((w) << 1) | ((x) << 2) | ((y) << 3))
+
+extern unsigned short const *mad_huff_pair_lookup[32];
+extern unsigned char mad_huff_quad_lookup[2][1 << MAD_HUFF_QUAD_BITS];
+
+void mad_huff_init(void);
+
 # endif
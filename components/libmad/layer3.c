@@ -919,11 +919,35 @@ mad_fixed_t III_requantize(unsigned int value, signed int exp)
   return frac ? mad_f_mul(requantized, root_table[3 + frac]) : requantized;
 }
 
-/* we must take care that sz >= bits and sz < sizeof(long) lest bits == 0 */
-# define MASK(cache, sz, bits)	\
-    (((cache) >> ((sz) - (bits))) & ((1 << (bits)) - 1))
-# define MASK1BIT(cache, sz)  \
-    ((cache) & (1 << ((sz) - 1)))
+/*
+ * The bit cache is 32 bits wide and left-aligned, i.e. the next bit of the
+ * stream is its MSB. Bits below the cached ones are either zero or the
+ * following bits of the stream, so they can be ORed with new data.
+ * It is refilled up to 24..31 bits, a 32-bit word at a time while that stays
+ * within the guard area after the main data, and byte by byte near its end.
+ */
+# define PEEK(bits)	(cache >> (32 - (bits)))
+# define PEEK1BIT()	(cache & 0x80000000)
+# define CONSUME(bits)  \
+    do { cache <<= (bits); cachesz -= (bits); bits_left -= (bits); } while (0)
+# define REFILL()  \
+    do {  \
+      if (byte + 4 <= byte_end) {  \
+	cache |= (((unsigned int) byte[0] << 24) |  \
+		  ((unsigned int) byte[1] << 16) |  \
+		  ((unsigned int) byte[2] <<  8) | byte[3]) >> cachesz;  \
+	byte    += (31 - cachesz) >> 3;  \
+	cachesz |= 24;  \
+      }  \
+      else {  \
+	while (cachesz <= 24) {  \
+	  cache |= (unsigned int) *byte++ << (24 - cachesz);  \
+	  cachesz += 8;  \
+	}  \
+      }  \
+    } while (0)
+# define NEED(bits)  \
+    do { if (cachesz < (signed) (bits)) REFILL(); } while (0)
 
 /*
  * NAME:	III_huffdecode()
@@ -937,27 +961,28 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 {
   signed int exponents[39], exp;
   signed int const *expptr;
-  struct mad_bitptr peek;
+  unsigned char const *byte, *byte_end;
   signed int bits_left, cachesz;
   register mad_fixed_t *xrptr;
   mad_fixed_t const *sfbound;
-  register unsigned long bitcache;
+  register unsigned int cache;
 
+  /* bits_left is the number of bits until the end of part3 */
   bits_left = (signed) channel->part2_3_length - (signed) part2_length;
   if (bits_left < 0)
     return MAD_ERROR_BADPART3LEN;
 
   III_exponents(channel, sfbwidth, exponents);
 
-  peek = *ptr;
-  mad_bit_skip(ptr, bits_left);
+  /* start with the rest of the current byte */
+  byte    = ptr->byte;
+  cachesz = mad_bit_bitsleft(ptr);
+  cache   = (unsigned int) (*byte++ & ((1 << cachesz) - 1)) << (32 - cachesz);
 
-  /* align bit reads to byte boundaries */
-  cachesz  = mad_bit_bitsleft(&peek);
-  cachesz += ((32 - 1 - 24) + (24 - cachesz)) & ~7;
+  mad_bit_skip(ptr, bits_left);
+  byte_end = mad_bit_nextbyte(ptr) + MAD_BUFFER_GUARD;
 
-  bitcache   = mad_bit_read(&peek, cachesz);
-  bits_left -= cachesz;
+  REFILL();
 
   xrptr = &xr[0];
 
@@ -966,16 +991,17 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
     unsigned int region, rcount;
     struct hufftable const *entry;
     union huffpair const *table;
-    unsigned int linbits, startbits, big_values, reqhits;
+    unsigned short const *lookup;
+    unsigned int linbits, big_values, reqhits;
     mad_fixed_t reqcache[16];
 
     sfbound = xrptr + *sfbwidth++;
     rcount  = channel->region0_count + 1;
 
-    entry     = &mad_huff_pair_table[channel->table_select[region = 0]];
-    table     = entry->table;
-    linbits   = entry->linbits;
-    startbits = entry->startbits;
+    entry   = &mad_huff_pair_table[channel->table_select[region = 0]];
+    table   = entry->table;
+    linbits = entry->linbits;
+    lookup  = mad_huff_pair_lookup[channel->table_select[region]];
 
     if (table == 0)
       return MAD_ERROR_BADHUFFTABLE;
@@ -986,9 +1012,8 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 
     big_values = channel->big_values;
 
-    while (big_values-- && cachesz + bits_left > 0) {
-      union huffpair const *pair;
-      unsigned int clumpsz, value;
+    while (big_values-- && bits_left > 0) {
+      unsigned int value, x, y;
       register mad_fixed_t requantized;
 
       if (xrptr == sfbound) {
@@ -1002,10 +1027,10 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 	  else
 	    rcount = 0;  /* all remaining */
 
-	  entry     = &mad_huff_pair_table[channel->table_select[++region]];
-	  table     = entry->table;
-	  linbits   = entry->linbits;
-	  startbits = entry->startbits;
+	  entry   = &mad_huff_pair_table[channel->table_select[++region]];
+	  table   = entry->table;
+	  linbits = entry->linbits;
+	  lookup  = mad_huff_pair_lookup[channel->table_select[region]];
 
 	  if (table == 0)
 	    return MAD_ERROR_BADHUFFTABLE;
@@ -1019,135 +1044,129 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 	++expptr;
       }
 
-      if (cachesz < 21) {
-	unsigned int bits;
+      /* hcod (0..19), the lookups may peek up to 21 bits */
 
-	bits       = ((32 - 1 - 21) + (21 - cachesz)) & ~7;
-	bitcache   = (bitcache << bits) | mad_bit_read(&peek, bits);
-	cachesz   += bits;
-	bits_left -= bits;
-      }
+      NEED(21);
 
-      /* hcod (0..19) */
+      value = lookup[PEEK(MAD_HUFF_LOOKUP_BITS)];
 
-      clumpsz = startbits;
-      pair    = &table[MASK(bitcache, cachesz, clumpsz)];
+      if (value & MAD_HUFF_FINAL) {
+	x = MAD_HUFF_X(value);
+	y = MAD_HUFF_Y(value);
+	CONSUME(MAD_HUFF_HLEN(value));
+      }
+      else {
+	union huffpair const *pair;
+	unsigned int clumpsz;
 
-      while (!pair->final) {
-	cachesz -= clumpsz;
+	CONSUME(MAD_HUFF_SKIP(value));
+	pair = &table[MAD_HUFF_INDEX(value)];
 
-	clumpsz = pair->ptr.bits;
-	pair    = &table[pair->ptr.offset + MASK(bitcache, cachesz, clumpsz)];
-      }
+	do {
+	  clumpsz = pair->ptr.bits;
+	  pair    = &table[pair->ptr.offset + PEEK(clumpsz)];
+	  if (!pair->final)
+	    CONSUME(clumpsz);
+	}
+	while (!pair->final);
 
-      cachesz -= pair->value.hlen;
+	x = pair->value.x;
+	y = pair->value.y;
+	CONSUME(pair->value.hlen);
+      }
 
       if (linbits) {
 	/* x (0..14) */
 
-	value = pair->value.x;
-
-	switch (value) {
+	switch (x) {
 	case 0:
 	  xrptr[0] = 0;
 	  break;
 
 	case 15:
-	  if (cachesz < linbits + 2) {
-	    bitcache   = (bitcache << 16) | mad_bit_read(&peek, 16);
-	    cachesz   += 16;
-	    bits_left -= 16;
-	  }
+	  NEED(linbits + 1);
 
-	  value += MASK(bitcache, cachesz, linbits);
-	  cachesz -= linbits;
+	  value = 15 + PEEK(linbits);
+	  CONSUME(linbits);
 
 	  requantized = III_requantize(value, exp);
 	  goto x_final;
 
 	default:
-	  if (reqhits & (1 << value))
-	    requantized = reqcache[value];
+	  if (reqhits & (1 << x))
+	    requantized = reqcache[x];
 	  else {
-	    reqhits |= (1 << value);
-	    requantized = reqcache[value] = III_requantize(value, exp);
+	    reqhits |= (1 << x);
+	    requantized = reqcache[x] = III_requantize(x, exp);
 	  }
 
 	x_final:
-	  xrptr[0] = MASK1BIT(bitcache, cachesz--) ?
-	    -requantized : requantized;
+	  xrptr[0] = PEEK1BIT() ? -requantized : requantized;
+	  CONSUME(1);
 	}
 
 	/* y (0..14) */
 
-	value = pair->value.y;
-
-	switch (value) {
+	switch (y) {
 	case 0:
 	  xrptr[1] = 0;
 	  break;
 
 	case 15:
-	  if (cachesz < linbits + 1) {
-	    bitcache   = (bitcache << 16) | mad_bit_read(&peek, 16);
-	    cachesz   += 16;
-	    bits_left -= 16;
-	  }
+	  NEED(linbits + 1);
 
-	  value += MASK(bitcache, cachesz, linbits);
-	  cachesz -= linbits;
+	  value = 15 + PEEK(linbits);
+	  CONSUME(linbits);
 
 	  requantized = III_requantize(value, exp);
 	  goto y_final;
 
 	default:
-	  if (reqhits & (1 << value))
-	    requantized = reqcache[value];
+	  NEED(1);
+
+	  if (reqhits & (1 << y))
+	    requantized = reqcache[y];
 	  else {
-	    reqhits |= (1 << value);
-	    requantized = reqcache[value] = III_requantize(value, exp);
+	    reqhits |= (1 << y);
+	    requantized = reqcache[y] = III_requantize(y, exp);
 	  }
 
 	y_final:
-	  xrptr[1] = MASK1BIT(bitcache, cachesz--) ?
-	    -requantized : requantized;
+	  xrptr[1] = PEEK1BIT() ? -requantized : requantized;
+	  CONSUME(1);
 	}
       }
       else {
-	/* x (0..1) */
-
-	value = pair->value.x;
+	/* x (0..1), at least 2 bits are left in the cache after hcod */
 
-	if (value == 0)
+	if (x == 0)
 	  xrptr[0] = 0;
 	else {
-	  if (reqhits & (1 << value))
-	    requantized = reqcache[value];
+	  if (reqhits & (1 << x))
+	    requantized = reqcache[x];
 	  else {
-	    reqhits |= (1 << value);
-	    requantized = reqcache[value] = III_requantize(value, exp);
+	    reqhits |= (1 << x);
+	    requantized = reqcache[x] = III_requantize(x, exp);
 	  }
 
-	  xrptr[0] = MASK1BIT(bitcache, cachesz--) ?
-	    -requantized : requantized;
+	  xrptr[0] = PEEK1BIT() ? -requantized : requantized;
+	  CONSUME(1);
 	}
 
 	/* y (0..1) */
 
-	value = pair->value.y;
-
-	if (value == 0)
+	if (y == 0)
 	  xrptr[1] = 0;
 	else {
-	  if (reqhits & (1 << value))
-	    requantized = reqcache[value];
+	  if (reqhits & (1 << y))
+	    requantized = reqcache[y];
 	  else {
-	    reqhits |= (1 << value);
-	    requantized = reqcache[value] = III_requantize(value, exp);
+	    reqhits |= (1 << y);
+	    requantized = reqcache[y] = III_requantize(y, exp);
 	  }
 
-	  xrptr[1] = MASK1BIT(bitcache, cachesz--) ?
-	    -requantized : requantized;
+	  xrptr[1] = PEEK1BIT() ? -requantized : requantized;
+	  CONSUME(1);
 	}
       }
 
@@ -1155,40 +1174,27 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
     }
   }
 
-  if (cachesz + bits_left < 0)
+  if (bits_left < 0)
     return MAD_ERROR_BADHUFFDATA;  /* big_values overrun */
 
   /* count1 */
   {
-    union huffquad const *table;
+    unsigned char const *lookup;
     register mad_fixed_t requantized;
 
-    table = mad_huff_quad_table[channel->flags & count1table_select];
+    lookup = mad_huff_quad_lookup[channel->flags & count1table_select];
 
     requantized = III_requantize(1, exp);
 
-    while (cachesz + bits_left > 0 && xrptr <= &xr[572]) {
-      union huffquad const *quad;
-
-      /* hcod (1..6) */
+    while (bits_left > 0 && xrptr <= &xr[572]) {
+      unsigned int quad;
 
-      if (cachesz < 10) {
-	bitcache   = (bitcache << 16) | mad_bit_read(&peek, 16);
-	cachesz   += 16;
-	bits_left -= 16;
-      }
-
-      quad = &table[MASK(bitcache, cachesz, 4)];
-
-      /* quad tables guaranteed to have at most one extra lookup */
-      if (!quad->final) {
-	cachesz -= 4;
+      /* hcod (1..6) and up to 4 sign bits */
 
-	quad = &table[quad->ptr.offset +
-		      MASK(bitcache, cachesz, quad->ptr.bits)];
-      }
+      NEED(10);
 
-      cachesz -= quad->value.hlen;
+      quad = lookup[PEEK(MAD_HUFF_QUAD_BITS)];
+      CONSUME(quad >> 4);
 
       if (xrptr == sfbound) {
 	sfbound += *sfbwidth++;
@@ -1203,13 +1209,21 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 
       /* v (0..1) */
 
-      xrptr[0] = quad->value.v ?
-	(MASK1BIT(bitcache, cachesz--) ? -requantized : requantized) : 0;
+      if (quad & 1) {
+	xrptr[0] = PEEK1BIT() ? -requantized : requantized;
+	CONSUME(1);
+      }
+      else
+	xrptr[0] = 0;
 
       /* w (0..1) */
 
-      xrptr[1] = quad->value.w ?
-	(MASK1BIT(bitcache, cachesz--) ? -requantized : requantized) : 0;
+      if (quad & 2) {
+	xrptr[1] = PEEK1BIT() ? -requantized : requantized;
+	CONSUME(1);
+      }
+      else
+	xrptr[1] = 0;
 
       xrptr += 2;
 
@@ -1226,21 +1240,28 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 
       /* x (0..1) */
 
-      xrptr[0] = quad->value.x ?
-	(MASK1BIT(bitcache, cachesz--) ? -requantized : requantized) : 0;
+      if (quad & 4) {
+	xrptr[0] = PEEK1BIT() ? -requantized : requantized;
+	CONSUME(1);
+      }
+      else
+	xrptr[0] = 0;
 
       /* y (0..1) */
 
-      xrptr[1] = quad->value.y ?
-	(MASK1BIT(bitcache, cachesz--) ? -requantized : requantized) : 0;
+      if (quad & 8) {
+	xrptr[1] = PEEK1BIT() ? -requantized : requantized;
+	CONSUME(1);
+      }
+      else
+	xrptr[1] = 0;
 
       xrptr += 2;
     }
 
-    if (cachesz + bits_left < 0) {
+    if (bits_left < 0) {
 # if 0 && defined(DEBUG)
-      fprintf(stderr, "huffman count1 overrun (%d bits)\n",
-	      -(cachesz + bits_left));
+      fprintf(stderr, "huffman count1 overrun (%d bits)\n", -bits_left);
 # endif
 
       /* technically the bitstream is misformatted, but apparently
@@ -1253,10 +1274,8 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
   assert(-bits_left <= MAD_BUFFER_GUARD * CHAR_BIT);
 
 # if 0 && defined(DEBUG)
-  if (bits_left < 0)
-    fprintf(stderr, "read %d bits too many\n", -bits_left);
-  else if (cachesz + bits_left > 0)
-    fprintf(stderr, "%d stuffing bits\n", cachesz + bits_left);
+  if (bits_left > 0)
+    fprintf(stderr, "%d stuffing bits\n", bits_left);
 # endif
 
   /* rzero */
@@ -1270,8 +1289,11 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
   return MAD_ERROR_NONE;
 }
 
-# undef MASK
-# undef MASK1BIT
+# undef PEEK
+# undef PEEK1BIT
+# undef CONSUME
+# undef REFILL
+# undef NEED
 
 /*
  * NAME:	III_reorder()
@@ -2342,6 +2364,118 @@ void III_freqinver(mad_fixed_t sample[18][32], unsigned int sb)
 # endif
 }
 
+/*
+ * NAME:	III_channel_job()
+ * DESCRIPTION:	reordering, alias reduction, IMDCT, overlap-add and frequency
+ *		inversion of one channel of a granule. The channels are
+ *		independent at this point, so they can be processed in parallel
+ */
+struct III_channel_job {
+  mad_fixed_t *xr;
+  struct channel const *channel;
+  unsigned char const *sfbwidth;
+  mad_fixed_t (*sample)[32];
+  mad_fixed_t (*overlap)[18];
+  unsigned int lines;
+};
+
+static
+void III_channel_job(void *arg)
+{
+  struct III_channel_job const *job = arg;
+  mad_fixed_t *xr = job->xr;
+  struct channel const *channel = job->channel;
+  unsigned char const *sfbwidth = job->sfbwidth;
+  mad_fixed_t (*sample)[32] = job->sample;
+  mad_fixed_t (*overlap)[18] = job->overlap;
+  unsigned int lines = job->lines;
+  unsigned int sb, l, i, sblimit;
+  mad_fixed_t output[36];
+
+  if (channel->block_type == 2) {
+    III_reorder(xr, channel, sfbwidth);
+
+# if !defined(OPT_STRICT)
+    /*
+     * According to ISO/IEC 11172-3, "Alias reduction is not applied for
+     * granules with block_type == 2 (short block)." However, other
+     * sources suggest alias reduction should indeed be performed on the
+     * lower two subbands of mixed blocks. Most other implementations do
+     * this, so by default we will too.
+     */
+    if (channel->flags & mixed_block_flag)
+      III_aliasreduce(xr, 36);
+# endif
+  }
+  else
+    III_aliasreduce(xr, lines);
+
+  l = 0;
+
+  /* subbands 0-1 */
+
+  if (channel->block_type != 2 || (channel->flags & mixed_block_flag)) {
+    unsigned int block_type;
+
+    block_type = channel->block_type;
+    if (channel->flags & mixed_block_flag)
+      block_type = 0;
+
+    /* long blocks */
+    for (sb = 0; sb < 2; ++sb, l += 18) {
+      III_imdct_l(&xr[l], output, block_type);
+      III_overlap(output, overlap[sb], sample, sb);
+    }
+  }
+  else {
+    /* short blocks */
+    for (sb = 0; sb < 2; ++sb, l += 18) {
+      III_imdct_s(&xr[l], output);
+      III_overlap(output, overlap[sb], sample, sb);
+    }
+  }
+
+  III_freqinver(sample, 1);
+
+  /* (nonzero) subbands 2-31, lines above the limit are treated as zero */
+
+  i = lines;
+  while (i > 36 && xr[i - 1] == 0)
+    --i;
+
+  sblimit = 32 - (576 - i) / 18;
+
+  if (channel->block_type != 2) {
+    /* long blocks */
+    for (sb = 2; sb < sblimit; ++sb, l += 18) {
+      III_imdct_l(&xr[l], output, channel->block_type);
+      III_overlap(output, overlap[sb], sample, sb);
+
+      if (sb & 1)
+	III_freqinver(sample, sb);
+    }
+  }
+  else {
+    /* short blocks */
+    for (sb = 2; sb < sblimit; ++sb, l += 18) {
+      III_imdct_s(&xr[l], output);
+      III_overlap(output, overlap[sb], sample, sb);
+
+      if (sb & 1)
+	III_freqinver(sample, sb);
+    }
+  }
+
+  /* remaining (zero) subbands */
+
+  for (sb = sblimit; sb < 32; ++sb) {
+    III_overlap_z(overlap[sb], sample, sb);
+
+    if (sb & 1)
+      III_freqinver(sample, sb);
+  }
+}
+
 /*
  * NAME:	III_decode()
  * DESCRIPTION:	decode frame main_data
@@ -2351,7 +2485,7 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
 			  struct sideinfo *si, unsigned int nch)
 {
   struct mad_header *header = &frame->header;
-  unsigned int sfreqi, ngr, gr;
+  unsigned int sfreqi, ngr, gr, lines;
 
   {
     unsigned int sfreq;
@@ -2369,6 +2503,14 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
       sfreqi += 3;
   }
 
+  /* subband limit, subbands 0-1 are always decoded */
+
+  lines = 18 * frame->sblimit;
+  if (lines < 36)
+    lines = 36;
+  else if (lines > 576)
+    lines = 576;
+
   /* scalefactors, Huffman decoding, requantization */
 
   ngr = (header->flags & MAD_FLAG_LSF_EXT) ? 1 : 2;
@@ -2377,7 +2519,8 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
     struct granule *granule = &si->gr[gr];
     unsigned char const *sfbwidth[2];
     mad_fixed_t xr[2][576];
-    unsigned int ch;
+    struct III_channel_job jobs[2];
+    unsigned int ch, njobs, i;
     enum mad_error error;
 
     for (ch = 0; ch < nch; ++ch) {
@@ -2413,96 +2556,72 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
 	return error;
     }
 
-    /* reordering, alias reduction, IMDCT, overlap-add, frequency inversion */
+    /* downmix to a single channel */
 
-    for (ch = 0; ch < nch; ++ch) {
-      struct channel const *channel = &granule->ch[ch];
-      mad_fixed_t (*sample)[32] = &frame->sbsample[ch][18 * gr];
-      unsigned int sb, l, i, sblimit;
-      mad_fixed_t output[36];
+    njobs = nch;
 
-      if (channel->block_type == 2) {
-	III_reorder(xr[ch], channel, sfbwidth[ch]);
+    if (nch == 2 && MAD_NOUTCHANNELS(frame) == 1) {
+      struct channel const *ch0 = &granule->ch[0], *ch1 = &granule->ch[1];
 
-# if !defined(OPT_STRICT)
+      if (ch0->block_type == ch1->block_type &&
+	  (ch0->flags & mixed_block_flag) == (ch1->flags & mixed_block_flag)) {
 	/*
-	 * According to ISO/IEC 11172-3, "Alias reduction is not applied for
-	 * granules with block_type == 2 (short block)." However, other
-	 * sources suggest alias reduction should indeed be performed on the
-	 * lower two subbands of mixed blocks. Most other implementations do
-	 * this, so by default we will too.
+	 * The rest of the decoding is linear and the same for both
+	 * channels, so it's done only once, on the mid channel. The
+	 * overlap of channel 0 is that of the mid channel
 	 */
-	if (channel->flags & mixed_block_flag)
-	  III_aliasreduce(xr[ch], 36);
-# endif
-      }
-      else
-	III_aliasreduce(xr[ch], 576);
+	for (i = 0; i < 576; ++i)
+	  xr[0][i] = (xr[0][i] >> 1) + (xr[1][i] >> 1);
 
-      l = 0;
-
-      /* subbands 0-1 */
-
-      if (channel->block_type != 2 || (channel->flags & mixed_block_flag)) {
-	unsigned int block_type;
-
-	block_type = channel->block_type;
-	if (channel->flags & mixed_block_flag)
-	  block_type = 0;
-
-	/* long blocks */
-	for (sb = 0; sb < 2; ++sb, l += 18) {
-	  III_imdct_l(&xr[ch][l], output, block_type);
-	  III_overlap(output, (*frame->overlap)[ch][sb], sample, sb);
-	}
+	njobs = 1;
       }
       else {
-	/* short blocks */
-	for (sb = 0; sb < 2; ++sb, l += 18) {
-	  III_imdct_s(&xr[ch][l], output);
-	  III_overlap(output, (*frame->overlap)[ch][sb], sample, sb);
+	/* different block types, decode both and mix the subband samples */
+	for (i = 0; i < 576; ++i) {
+	  xr[0][i] >>= 1;
+	  xr[1][i] >>= 1;
 	}
       }
+    }
 
-      III_freqinver(sample, 1);
-
-      /* (nonzero) subbands 2-31 */
+    /* reordering, alias reduction, IMDCT, overlap-add, frequency inversion */
 
-      i = 576;
-      while (i > 36 && xr[ch][i - 1] == 0)
-	--i;
+    for (ch = 0; ch < njobs; ++ch) {
+      jobs[ch].xr       = xr[ch];
+      jobs[ch].channel  = &granule->ch[ch];
+      jobs[ch].sfbwidth = sfbwidth[ch];
+      jobs[ch].sample   = &frame->sbsample[ch][18 * gr];
+      jobs[ch].overlap  = (*frame->overlap)[ch];
+      jobs[ch].lines    = lines;
+    }
 
-      sblimit = 32 - (576 - i) / 18;
+    if (njobs == 2 && frame->worker) {
+      /* channel 1 on the other core */
+      frame->worker->start(frame->worker->ctx, III_channel_job, &jobs[1]);
+      III_channel_job(&jobs[0]);
+      frame->worker->wait(frame->worker->ctx);
+    }
+    else {
+      for (ch = 0; ch < njobs; ++ch)
+	III_channel_job(&jobs[ch]);
+    }
 
-      if (channel->block_type != 2) {
-	/* long blocks */
-	for (sb = 2; sb < sblimit; ++sb, l += 18) {
-	  III_imdct_l(&xr[ch][l], output, channel->block_type);
-	  III_overlap(output, (*frame->overlap)[ch][sb], sample, sb);
+    if (njobs == 2 && MAD_NOUTCHANNELS(frame) == 1) {
+      mad_fixed_t (*overlap)[32][18] = *frame->overlap;
+      unsigned int s, sb;
 
-	  if (sb & 1)
-	    III_freqinver(sample, sb);
-	}
+      for (s = 18 * gr; s < 18 * gr + 18; ++s) {
+	for (sb = 0; sb < 32; ++sb)
+	  frame->sbsample[0][s][sb] += frame->sbsample[1][s][sb];
       }
-      else {
-	/* short blocks */
-	for (sb = 2; sb < sblimit; ++sb, l += 18) {
-	  III_imdct_s(&xr[ch][l], output);
-	  III_overlap(output, (*frame->overlap)[ch][sb], sample, sb);
 
-	  if (sb & 1)
-	    III_freqinver(sample, sb);
+      /* keep all of the overlap in channel 0, for the mid channel */
+      for (sb = 0; sb < 32; ++sb) {
+	for (i = 0; i < 18; ++i) {
+	  overlap[0][sb][i] += overlap[1][sb][i];
+	  overlap[1][sb][i]  = 0;
 	}
       }
-
-      /* remaining (zero) subbands */
-
-      for (sb = sblimit; sb < 32; ++sb) {
-	III_overlap_z((*frame->overlap)[ch][sb], sample, sb);
-
-	if (sb & 1)
-	  III_freqinver(sample, sb);
-      }
     }
   }
 
@@ -24,7 +24,13 @@
 extern "C" {
 # endif
 
-# define FPM_INTEL
+# if !defined(FPM_XTENSA) && !defined(FPM_64BIT) && !defined(FPM_DEFAULT)
+#  if defined(__XTENSA__)
+#   define FPM_XTENSA
+#  else
+#   define FPM_64BIT
+#  endif
+# endif
 
 
 
@@ -465,6 +471,22 @@ mad_fixed_t mad_f_mul_inline(mad_fixed_t x, mad_fixed_t y)
 
 #  define MAD_F_SCALEBITS  MAD_F_FRACBITS
 
+/* --- Xtensa -------------------------------------------------------------- */
+
+# elif defined(FPM_XTENSA)
+
+/*
+ * The Xtensa LX6 core of the ESP32 has a 32x32->64-bit multiplier, with the
+ * low and high (signed) words of the product obtained by MULL and MULSH.
+ * This is as accurate as FPM_64BIT, and the scaling of the 64-bit product is
+ * done by the default mad_f_scale64(), whose rounding depends on OPT_ACCURACY.
+ */
+#  define MAD_F_MLX(hi, lo, x, y)  \
+    asm ("mull	%0, %2, %3\n\t"  \
+	 "mulsh	%1, %2, %3"  \
+	 : "=&r" (lo), "=r" (hi)  \
+	 : "r" (x), "r" (y))
+
 /* --- Default ------------------------------------------------------------- */
 
 # elif defined(FPM_DEFAULT)
@@ -719,12 +741,12 @@ struct mad_stream {
 
 enum {
   MAD_OPTION_IGNORECRC      = 0x0001,	/* ignore CRC errors */
-  MAD_OPTION_HALFSAMPLERATE = 0x0002	/* generate PCM at 1/2 sample rate */
+  MAD_OPTION_HALFSAMPLERATE = 0x0002,	/* generate PCM at 1/2 sample rate */
 # if 0  /* not yet implemented */
   MAD_OPTION_LEFTCHANNEL    = 0x0010,	/* decode left channel only */
   MAD_OPTION_RIGHTCHANNEL   = 0x0020,	/* decode right channel only */
-  MAD_OPTION_SINGLECHANNEL  = 0x0030	/* combine channels */
 # endif
+  MAD_OPTION_SINGLECHANNEL  = 0x0030	/* combine channels */
 };
 
 void mad_stream_init(struct mad_stream *);
@@ -787,6 +809,18 @@ struct mad_header {
   mad_timer_t duration;			/* audio playing time of frame */
 };
 
+/*
+ * Optional hook for running part of the decoding on another CPU core. If
+ * set, the layer III IMDCT and the synthesis of channel 1 are handed off via
+ * start(), in parallel with channel 0, and wait() must block until the
+ * handed off function has returned. One function is handed off at a time
+ */
+struct mad_worker {
+  void (*start)(void *ctx, void (*func)(void *), void *arg);
+  void (*wait)(void *ctx);
+  void *ctx;
+};
+
 struct mad_frame {
   struct mad_header header;		/* MPEG audio header */
 
@@ -794,9 +828,16 @@ struct mad_frame {
 
   mad_fixed_t sbsample[2][36][32];	/* synthesis subband filter samples */
   mad_fixed_t (*overlap)[2][32][18];	/* Layer III block overlap data */
+
+  struct mad_worker const *worker;	/* second core, if any (set by user) */
+  unsigned int sblimit;			/* Layer III subbands to decode, the
+					   higher ones are muted (set by user) */
 };
 
 # define MAD_NCHANNELS(header)		((header)->mode ? 2 : 1)
+# define MAD_NOUTCHANNELS(frame)  \
+    (((frame)->options & MAD_OPTION_SINGLECHANNEL) == MAD_OPTION_SINGLECHANNEL  \
+     ? 1 : MAD_NCHANNELS(&(frame)->header))
 # define MAD_NSBSAMPLES(header)  \
   ((header)->layer == MAD_LAYER_I ? 12 :  \
    (((header)->layer == MAD_LAYER_III &&  \
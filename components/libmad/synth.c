@@ -29,6 +29,10 @@
 # include "frame.h"
 # include "synth.h"
 
+# if defined(OPT_SYNTH_VECTOR)
+static void synth_window_init(void);
+# endif
+
 /*
  * NAME:	synth->init()
  * DESCRIPTION:	initialize synth struct
@@ -42,6 +46,10 @@ void mad_synth_init(struct mad_synth *synth)
   synth->pcm.samplerate = 0;
   synth->pcm.channels   = 0;
   synth->pcm.length     = 0;
+
+# if defined(OPT_SYNTH_VECTOR)
+  synth_window_init();
+# endif
 }
 
 /*
@@ -548,17 +556,174 @@ mad_fixed_t const D[17][32] = {
 
 # if defined(ASO_SYNTH)
 void synth_full(struct mad_synth *, struct mad_frame const *,
-		unsigned int, unsigned int);
+		unsigned int, unsigned int, unsigned int);
+# elif defined(OPT_SYNTH_VECTOR)
+/*
+ * The D[] coefficients used by each phase are gathered into rows of 8 values
+ * in filter order, so that every output sample is a couple of dot products
+ * of contiguous vectors, which the compiler can vectorize. The rows depend
+ * only on the even (pe) or the odd (po) phase offset:
+ *
+ * Dpe[pe / 2][sb] = { D[sb][pe + (16 - 2i) % 16], D[sb][15 + 2i - pe] }
+ * Dpo[po / 2][sb] = { D[sb][po + (16 - 2i) % 16], D[sb][15 + 2i - po] }
+ *
+ * One row is 64 bytes, a cache line. Both channels are synthesized in the
+ * same loop, so that each row is loaded once per sample for both of them.
+ * The products are the same as those of the default implementation, and so
+ * is the output.
+ */
+static
+mad_fixed_t Dpe[8][17][16], Dpo[8][17][16];
+
+/*
+ * NAME:	synth_window_init()
+ * DESCRIPTION:	fill the per-phase coefficient rows from D[]
+ */
+static
+void synth_window_init(void)
+{
+  static int initialized;
+  unsigned int p, sb, i;
+
+  if (initialized)
+    return;
+
+  for (p = 0; p < 8; ++p) {
+    for (sb = 0; sb < 17; ++sb) {
+      for (i = 0; i < 8; ++i) {
+	Dpe[p][sb][i]     = D[sb][2 * p + (16 - 2 * i) % 16];
+	Dpe[p][sb][8 + i] = D[sb][15 + 2 * i - 2 * p];
+	Dpo[p][sb][i]     = D[sb][2 * p + 1 + (16 - 2 * i) % 16];
+	Dpo[p][sb][8 + i] = D[sb][14 + 2 * i - 2 * p];
+      }
+    }
+  }
+
+  initialized = 1;
+}
+
+/*
+ * NAME:	synth_sb()
+ * DESCRIPTION:	calculate the samples of subband sb from its filterbank
+ *		values fe = [0][phase & 1][sb], fo = [1][~phase & 1][sb - 1]
+ *		and coefficient rows we = Dpe[pe / 2][sb], wo = Dpo[po / 2][sb]
+ */
+static
+void synth_sb(mad_fixed_t *pcm1, mad_fixed_t *pcm2,
+	      mad_fixed_t const fe[8], mad_fixed_t const fo[8],
+	      mad_fixed_t const we[16], mad_fixed_t const wo[16])
+{
+# if defined(OPT_SSO)
+  /*
+   * With SSO the products are plain 32-bit ones, so they are computed
+   * element-wise and summed up once, which maps to vector instructions
+   */
+  mad_fixed_t a[8], b[8], sa = 0, sb = 0;
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i) {
+    a[i] = fe[i] * we[i] - fo[i] * wo[i];
+    b[i] = fe[i] * we[8 + i] + fo[i] * wo[8 + i];
+  }
+  for (i = 0; i < 8; ++i) {
+    sa += a[i];
+    sb += b[i];
+  }
+
+  *pcm1 = SHIFT(sa);
+  *pcm2 = SHIFT(sb);
+# else
+  mad_fixed64hi_t hi;
+  mad_fixed64lo_t lo;
+  unsigned int i;
+
+  ML0(hi, lo, fo[0], wo[0]);
+  for (i = 1; i < 8; ++i)
+    MLA(hi, lo, fo[i], wo[i]);
+  MLN(hi, lo);
+  for (i = 0; i < 8; ++i)
+    MLA(hi, lo, fe[i], we[i]);
+
+  *pcm1 = SHIFT(MLZ(hi, lo));
+
+  ML0(hi, lo, fe[0], we[8]);
+  for (i = 1; i < 8; ++i)
+    MLA(hi, lo, fe[i], we[8 + i]);
+  for (i = 0; i < 8; ++i)
+    MLA(hi, lo, fo[i], wo[8 + i]);
+
+  *pcm2 = SHIFT(MLZ(hi, lo));
+# endif
+}
+
+/*
+ * NAME:	synth->full()
+ * DESCRIPTION:	perform full frequency PCM synthesis of channels [ch, nch)
+ */
+static
+void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
+		unsigned int ch, unsigned int nch, unsigned int ns)
+{
+  unsigned int phase, s, sb, c, i;
+  mad_fixed_t *pcm, unused;
+  mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
+  mad_fixed_t (*we)[16], (*wo)[16];
+  mad_fixed64hi_t hi;
+  mad_fixed64lo_t lo;
+
+  phase = synth->phase;
+
+  for (s = 0; s < ns; ++s) {
+    for (c = ch; c < nch; ++c) {
+      dct32(frame->sbsample[c][s], phase >> 1,
+	    synth->filter[c][0][phase & 1], synth->filter[c][1][phase & 1]);
+    }
+
+    we = Dpe[phase >> 1];
+    wo = Dpo[(((phase - 1) & 0xf) | 1) >> 1];
+
+    for (c = ch; c < nch; ++c) {
+      fx  = synth->filter[c][0][~phase & 1];
+      fe  = synth->filter[c][0][ phase & 1];
+      fo  = synth->filter[c][1][~phase & 1];
+      pcm = synth->pcm.samples[c] + 32 * s;
+
+      /* the second sample of subband 0 would be pcm[32], it's not used */
+
+      synth_sb(&pcm[0], &unused, fe[0], fx[0], we[0], wo[0]);
+
+      ML0(hi, lo, fo[15][0], wo[16][0]);
+      for (i = 1; i < 8; ++i)
+	MLA(hi, lo, fo[15][i], wo[16][i]);
+
+      pcm[16] = SHIFT(-MLZ(hi, lo));
+    }
+
+    /* D[32 - sb][i] == -D[sb][31 - i] */
+
+    for (sb = 1; sb < 16; ++sb) {
+      for (c = ch; c < nch; ++c) {
+	fe  = synth->filter[c][0][ phase & 1];
+	fo  = synth->filter[c][1][~phase & 1];
+	pcm = synth->pcm.samples[c] + 32 * s;
+
+	synth_sb(&pcm[sb], &pcm[32 - sb], fe[sb], fo[sb - 1], we[sb], wo[sb]);
+      }
+    }
+
+    phase = (phase + 1) % 16;
+  }
+}
 # else
 /*
  * NAME:	synth->full()
- * DESCRIPTION:	perform full frequency PCM synthesis
+ * DESCRIPTION:	perform full frequency PCM synthesis of channels [ch, nch)
  */
 static
 void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
-		unsigned int nch, unsigned int ns)
+		unsigned int ch, unsigned int nch, unsigned int ns)
 {
-  unsigned int phase, ch, s, sb, pe, po;
+  unsigned int phase, s, sb, pe, po;
   mad_fixed_t *pcm1, *pcm2, (*filter)[2][2][16][8];
   mad_fixed_t const (*sbsample)[36][32];
   register mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
@@ -566,7 +731,7 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
   register mad_fixed64hi_t hi;
   register mad_fixed64lo_t lo;
 
-  for (ch = 0; ch < nch; ++ch) {
+  for (; ch < nch; ++ch) {
     sbsample = &frame->sbsample[ch];
     filter   = &synth->filter[ch];
     phase    = synth->phase;
@@ -689,13 +854,13 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
 
 /*
  * NAME:	synth->half()
- * DESCRIPTION:	perform half frequency PCM synthesis
+ * DESCRIPTION:	perform half frequency PCM synthesis of channels [ch, nch)
  */
 static
 void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
-		unsigned int nch, unsigned int ns)
+		unsigned int ch, unsigned int nch, unsigned int ns)
 {
-  unsigned int phase, ch, s, sb, pe, po;
+  unsigned int phase, s, sb, pe, po;
   mad_fixed_t *pcm1, *pcm2, (*filter)[2][2][16][8];
   mad_fixed_t const (*sbsample)[36][32];
   register mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
@@ -703,7 +868,7 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
   register mad_fixed64hi_t hi;
   register mad_fixed64lo_t lo;
 
-  for (ch = 0; ch < nch; ++ch) {
+  for (; ch < nch; ++ch) {
     sbsample = &frame->sbsample[ch];
     filter   = &synth->filter[ch];
     phase    = synth->phase;
@@ -829,13 +994,30 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
  * NAME:	synth->frame()
  * DESCRIPTION:	perform PCM synthesis of frame subband samples
  */
+struct synth_job {
+  void (*synth_frame)(struct mad_synth *, struct mad_frame const *,
+		      unsigned int, unsigned int, unsigned int);
+  struct mad_synth *synth;
+  struct mad_frame const *frame;
+  unsigned int ch;
+  unsigned int ns;
+};
+
+static
+void synth_job(void *arg)
+{
+  struct synth_job const *job = arg;
+
+  job->synth_frame(job->synth, job->frame, job->ch, job->ch + 1, job->ns);
+}
+
 void mad_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
 {
   unsigned int nch, ns;
   void (*synth_frame)(struct mad_synth *, struct mad_frame const *,
-		      unsigned int, unsigned int);
+		      unsigned int, unsigned int, unsigned int);
 
-  nch = MAD_NCHANNELS(&frame->header);
+  nch = MAD_NOUTCHANNELS(frame);
   ns  = MAD_NSBSAMPLES(&frame->header);
 
   synth->pcm.samplerate = frame->header.samplerate;
@@ -851,7 +1033,22 @@ void mad_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
     synth_frame = synth_half;
   }
 
-  synth_frame(synth, frame, nch, ns);
+  if (nch == 2 && frame->worker) {
+    /* the channels are independent, synthesize channel 1 on the other core */
+    struct synth_job job;
+
+    job.synth_frame = synth_frame;
+    job.synth       = synth;
+    job.frame       = frame;
+    job.ch          = 1;
+    job.ns          = ns;
+
+    frame->worker->start(frame->worker->ctx, synth_job, &job);
+    synth_frame(synth, frame, 0, 1, ns);
+    frame->worker->wait(frame->worker->ctx);
+  }
+  else
+    synth_frame(synth, frame, 0, nch, ns);
 
   synth->phase = (synth->phase + ns) % 16;
 }
@@ -44,6 +44,8 @@ char const mad_build[] = ""
 
 # if defined(FPM_64BIT)
   "FPM_64BIT "
+# elif defined(FPM_XTENSA)
+  "FPM_XTENSA "
 # elif defined(FPM_INTEL)
   "FPM_INTEL "
 # elif defined(FPM_ARM)
@@ -85,6 +87,10 @@ char const mad_build[] = ""
   "OPT_DCTO "
 # endif
 
+# if defined(OPT_SYNTH_VECTOR)
+  "OPT_SYNTH_VECTOR "
+# endif
+
 # if defined(OPT_STRICT)
   "OPT_STRICT "
 # endif
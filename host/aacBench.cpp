@@ -0,0 +1,216 @@
+/* Host benchmark and test of DecoderAac. The input is fed in chunks of random
+ * size, as the decoder gets it from a ring buffer that wraps around, with
+ * output buffers of one and two MP3 frames, i.e. with HE-AAC frames output in
+ * parts and in place. The output must be the same as that of decoding each
+ * ADTS frame directly.
+ * With the Helix decoder (AAC_HELIX_DIR in CMakeLists.txt), decodes the given
+ * ADTS files, and reports the decode time and realtime factor. With the stub of
+ * it that the host build uses otherwise, decodes synthetic streams instead,
+ * with garbage before the first frame and some frames that fail to decode
+ * Usage: aacBench [-r repeats] [-c maxChunk] [file.aac...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+#include <decoderAac.hpp>
+
+struct Result
+{
+    std::vector<int16_t> pcm;
+    StreamFormat fmt;
+    int64_t usElapsed = 0;
+};
+
+// Decodes each frame directly with the Helix API. Returns the number of frames
+static int decodeFrames(const std::vector<uint8_t>& input, Result& res)
+{
+    HAACDecoder helix = AACInitDecoder();
+    std::vector<int16_t> out(AAC_MAX_NSAMPS * AAC_MAX_NCHANS * 2);
+    int frames = 0;
+    AdtsHeader hdr;
+    int offset = AdtsHeader::find(input.data(), input.size(), hdr);
+    // skip to the first frame that is followed by another one
+    AdtsHeader next;
+    while (offset >= 0 && !(offset + hdr.frameSize + AdtsHeader::kHeaderSize <= (int)input.size() &&
+        next.parse(input.data() + offset + hdr.frameSize) && next.sameStream(hdr))) {
+        int found = AdtsHeader::find(input.data() + offset + 1, input.size() - offset - 1, hdr);
+        offset = found < 0 ? -1 : offset + 1 + found;
+    }
+    while (offset >= 0 && offset + AdtsHeader::kHeaderSize <= (int)input.size() && hdr.parse(input.data() + offset)
+           && offset + hdr.frameSize <= (int)input.size()) {
+        auto inPtr = (unsigned char*)input.data() + offset;
+        int bytesLeft = hdr.frameSize;
+        if (AACDecode(helix, &inPtr, &bytesLeft, out.data()) == ERR_AAC_NONE) {
+            AACFrameInfo info;
+            AACGetLastFrameInfo(helix, &info);
+            res.pcm.insert(res.pcm.end(), out.data(), out.data() + info.outputSamps);
+            frames++;
+        }
+        offset += hdr.frameSize;
+    }
+    AACFreeDecoder(helix);
+    return frames;
+}
+
+// Decodes the stream with DecoderAac, the input split in chunks of up to maxChunk bytes
+static bool decodeChunked(const std::vector<uint8_t>& input, int outBufSize, int maxChunk, Result& res)
+{
+    DecoderAac decoder;
+    std::vector<char> out(outBufSize);
+    size_t pos = 0;
+    uint32_t seed = 1;
+    for (;;) {
+        decoder.setOutputBuf(out.data(), outBufSize);
+        int needed = decoder.inputBytesNeeded();
+        int ret;
+        ElapsedTimer timer;
+        if (needed > 0) {
+            seed = seed * 1103515245 + 12345;
+            int size = std::min({ needed, (int)(input.size() - pos), 1 + (int)((seed >> 8) % maxChunk) });
+            ret = decoder.decode((const char*)input.data() + pos, size);
+            pos += size;
+        } else {
+            int size = 0;
+            ret = decoder.decode(nullptr, size);
+        }
+        res.usElapsed += timer.usElapsed();
+        if (ret == AudioNode::kNeedMoreData) {
+            if (pos >= input.size()) {
+                return true;
+            }
+            continue;
+        } else if (ret <= 0) {
+            fprintf(stderr, "Decode error %d\n", ret);
+            return false;
+        }
+        res.fmt = decoder.outputFmt();
+        res.pcm.insert(res.pcm.end(), (int16_t*)out.data(), (int16_t*)(out.data() + ret));
+    }
+}
+
+#ifdef AAC_HELIX_STUB
+// ADTS stream with random frame sizes and content
+static void generateStream(std::vector<uint8_t>& data, int sampleRateIdx, int channels, int numFrames,
+    uint32_t seed, int rawBlocks=1)
+{
+    auto rand = [&seed](uint32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % range;
+    };
+    for (int i = 0; i < 300; i++) { // garbage, with sync words
+        data.push_back(rand(4) ? rand(256) : 0xff);
+    }
+    for (int i = 0; i < numFrames; i++) {
+        int frameSize = 100 + rand(AdtsHeader::kMaxFrameSize - 100);
+        size_t start = data.size();
+        data.resize(start + frameSize);
+        auto p = data.data() + start;
+        p[0] = 0xff;
+        p[1] = 0xf1; // MPEG-4, no CRC
+        p[2] = (1 << 6) | (sampleRateIdx << 2) | (channels >> 2); // AAC LC
+        p[3] = (channels << 6) | (frameSize >> 11);
+        p[4] = frameSize >> 3;
+        p[5] = (frameSize << 5) | 0x1f;
+        p[6] = 0xfc | (rawBlocks - 1);
+        for (int j = AdtsHeader::kHeaderSize; j < frameSize; j++) {
+            p[j] = rand(256);
+        }
+        p[AdtsHeader::kHeaderSize] = (rand(20) == 0) ? 0xee : 0; // a frame that fails to decode
+    }
+}
+#endif
+
+static bool loadFile(const char* fname, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        perror("Error opening input file");
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 3;
+    int maxChunk = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:c:")) != -1) {
+        switch (opt) {
+            case 'r': repeats = std::max(1, atoi(optarg)); break;
+            case 'c': maxChunk = std::max(1, atoi(optarg)); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repeats] [-c maxChunk] [file.aac...]\n", argv[0]);
+                return 2;
+        }
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR); // each decoder instance logs the stream format
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> inputs;
+#ifdef AAC_HELIX_STUB
+    inputs.emplace_back("stub 44.1 kHz stereo", std::vector<uint8_t>());
+    generateStream(inputs.back().second, 4, 2, 500, 1);
+    inputs.emplace_back("stub 22.05 kHz stereo, SBR", std::vector<uint8_t>());
+    generateStream(inputs.back().second, 7, 2, 500, 2);
+    inputs.emplace_back("stub 24 kHz mono, SBR", std::vector<uint8_t>());
+    generateStream(inputs.back().second, 6, 1, 500, 3);
+    // frames of several raw data blocks must be rejected, not skipped as garbage
+    std::vector<uint8_t> multiBlock;
+    generateStream(multiBlock, 4, 2, 50, 4, 2);
+    Result rejected;
+    if (decodeChunked(multiBlock, 1152 * 4, maxChunk, rejected)) {
+        fprintf(stderr, "Frames of 2 raw data blocks were not rejected\n");
+        return 1;
+    }
+#endif
+    for (int i = optind; i < argc; i++) {
+        inputs.emplace_back(argv[i], std::vector<uint8_t>());
+        if (!loadFile(argv[i], inputs.back().second)) {
+            return 1;
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "No input files\n");
+        return 2;
+    }
+    // one MP3 frame per PCM block (HE-AAC frames are output in parts), and two
+    static const int kOutBufSizes[] = { 1152 * 4, 1152 * 8 };
+    for (auto& input: inputs) {
+        Result ref;
+        int frames = decodeFrames(input.second, ref);
+        if (!frames) {
+            fprintf(stderr, "%s: no frames decoded\n", input.first.c_str());
+            return 1;
+        }
+        for (auto outBufSize: kOutBufSizes) {
+            Result res;
+            if (!decodeChunked(input.second, outBufSize, maxChunk, res)) {
+                return 1;
+            }
+            if (res.pcm != ref.pcm) {
+                fprintf(stderr, "%s: output with %d-byte buffer differs from the frame by frame decode (%zu vs %zu samples)\n",
+                    input.first.c_str(), outBufSize, res.pcm.size(), ref.pcm.size());
+                return 1;
+            }
+            for (int i = 1; i < repeats; i++) {
+                Result rerun;
+                decodeChunked(input.second, outBufSize, maxChunk, rerun);
+                res.usElapsed = std::min(res.usElapsed, rerun.usElapsed);
+            }
+            double seconds = (double)res.pcm.size() / res.fmt.channels() / res.fmt.samplerate;
+            printf("%s, %d-byte output: %d frames, %d Hz, %d ch, %.1f us/frame, %.0fx realtime\n",
+                input.first.c_str(), outBufSize, frames, res.fmt.samplerate, res.fmt.channels(),
+                (double)res.usElapsed / frames, seconds * 1000000 / res.usElapsed);
+        }
+    }
+    return 0;
+}
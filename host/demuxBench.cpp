@@ -0,0 +1,726 @@
+/* Host test of DemuxNode: source -> DemuxNode -> DecoderNode. Synthetic ADTS,
+ * MP4 (with the moov box before and after the mdat box), MP3 (with ID3v2 and
+ * APEv2 tags, large ones skipped with a seek, and with the bit reservoir, which
+ * needs the stream to be passed through) and Ogg Opus streams are fed by
+ * a source that splits its buffers at a wrap-around point, like the HTTP ring
+ * buffer, and can seek like HttpNode with Range requests. The output must be
+ * the same as that of the decoder finding the frames itself - for MP4, that of
+ * an ADTS stream of the same frames - and the packet timestamps must follow the
+ * sample count. MP3 streams are also seeked by time, by the bitrate and by the
+ * seek table of the Xing tag, during playback.
+ * Reports how many bytes were read and how many seeks were done per stream
+ * Usage: demuxBench [-r repeats] [-w wrapSize] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+#include <decoderNode.hpp>
+#include <demuxNode.hpp>
+#include <adts.hpp>
+#include "mp3Gen.hpp"
+
+// Feeds an in-memory stream to the pipeline, with byte seeking
+class MemSourceNode: public AudioNode
+{
+protected:
+    const std::vector<uint8_t>& mData;
+    CodecType mCodec;
+    size_t mPos = 0;
+    int mWrapSize;
+    bool mSeekable;
+    bool mFlushPending = false;
+public:
+    int seeks = 0;
+    int64_t bytesRead = 0;
+    MemSourceNode(const std::vector<uint8_t>& data, CodecType codec, int wrapSize, bool seekable)
+    : AudioNode("memsrc"), mData(data), mCodec(codec), mWrapSize(wrapSize), mSeekable(seekable) {}
+    virtual Type type() const { return kTypeUnknown; }
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout)
+    {
+        if (mFlushPending) {
+            mFlushPending = false;
+            return kStreamFlush;
+        }
+        if (mPos >= mData.size()) {
+            return kStreamStopped;
+        }
+        dpr.fmt = StreamFormat(mCodec);
+        if (!dpr.size) {
+            return kNoError;
+        }
+        dpr.buf = (char*)mData.data() + mPos;
+        dpr.size = std::min(dpr.size, (int)(mData.size() - mPos));
+        if (mWrapSize) {
+            dpr.size = std::min(dpr.size, (int)(mWrapSize - mPos % mWrapSize));
+        }
+        return kNoError;
+    }
+    virtual void confirmRead(int size) { mPos += size; bytesRead += size; }
+    virtual bool seekToByte(int64_t pos)
+    {
+        if (!mSeekable) {
+            return false;
+        }
+        mPos = std::min((size_t)pos, mData.size());
+        mFlushPending = true;
+        seeks++;
+        return true;
+    }
+    virtual int64_t streamLength() const { return mData.size(); }
+};
+
+struct Input
+{
+    std::string name;
+    CodecType codec;
+    std::vector<uint8_t> data;
+    // stream that the decoder frames itself, with the same output
+    CodecType refCodec;
+    std::vector<uint8_t> ref;
+    int samplesPerPacket = 0; // 0 if packets have no pts
+    int samplerate = 0;
+    int packets = 0; // audio packets, excluding config ones. 0 if passed through
+    int minSeeks = 0;
+    int64_t maxRead = 0; // of the source, if the demuxer must seek past something
+    bool seekable = true;
+};
+
+static uint32_t sSeed = 1;
+static uint32_t rand(uint32_t range)
+{
+    sSeed = sSeed * 1103515245 + 12345;
+    return (sSeed >> 8) % range;
+}
+
+static void putBe(std::vector<uint8_t>& out, uint32_t val, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        out.push_back(val >> (8 * i));
+    }
+}
+
+// Payloads of the AAC stub decoder, one of them fails to decode
+static std::vector<std::vector<uint8_t>> makeAacFrames(int count)
+{
+    std::vector<std::vector<uint8_t>> frames(count);
+    for (int i = 0; i < count; i++) {
+        frames[i].resize(50 + rand(AdtsHeader::kMaxFrameSize - 100));
+        for (auto& b: frames[i]) {
+            b = rand(256);
+        }
+        frames[i][0] = (i == count / 3) ? 0xee : 0;
+    }
+    return frames;
+}
+
+static void appendAdts(std::vector<uint8_t>& out, const std::vector<uint8_t>& payload, int rateIdx, int channels)
+{
+    int frameSize = payload.size() + AdtsHeader::kHeaderSize;
+    out.push_back(0xff);
+    out.push_back(0xf1); // MPEG-4, no CRC
+    out.push_back((1 << 6) | (rateIdx << 2) | (channels >> 2)); // AAC LC
+    out.push_back((channels << 6) | (frameSize >> 11));
+    out.push_back(frameSize >> 3);
+    out.push_back((frameSize << 5) | 0x1f);
+    out.push_back(0xfc);
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+static void makeAdts(Input& input, int rateIdx, int channels)
+{
+    input.codec = input.refCodec = kCodecAac;
+    input.samplerate = AdtsHeader::sampleRateFromIndex(rateIdx);
+    input.samplesPerPacket = 1024;
+    for (int i = 0; i < 300; i++) { // garbage, with sync words
+        input.data.push_back(rand(4) ? rand(256) : 0xff);
+    }
+    auto frames = makeAacFrames(400);
+    for (auto& frame: frames) {
+        appendAdts(input.data, frame, rateIdx, channels);
+    }
+    input.packets = frames.size();
+    input.ref = input.data;
+}
+
+// Box with its content, written by fill
+template <class F>
+static void putBox(std::vector<uint8_t>& out, const char* type, F&& fill)
+{
+    size_t start = out.size();
+    putBe(out, 0, 4);
+    out.insert(out.end(), type, type + 4);
+    fill();
+    uint32_t size = out.size() - start;
+    for (int i = 0; i < 4; i++) {
+        out[start + i] = size >> (24 - 8 * i);
+    }
+}
+
+// An M4A file with the frames in chunks of varying sample counts, and gaps
+// between the chunks. With moovLast, the moov box follows a large mdat box
+static void makeMp4(Input& input, int rateIdx, int channels, bool moovLast, bool co64)
+{
+    input.codec = kCodecM4a;
+    input.refCodec = kCodecAac;
+    input.samplerate = AdtsHeader::sampleRateFromIndex(rateIdx);
+    input.samplesPerPacket = 1024;
+    auto frames = makeAacFrames(300);
+    input.packets = frames.size();
+    for (auto& frame: frames) {
+        appendAdts(input.ref, frame, rateIdx, channels);
+    }
+    // chunk layout: sample counts 3 (x4), then 5, last chunk shorter
+    std::vector<int> chunkSamples;
+    for (int left = frames.size(); left > 0;) {
+        int n = std::min(left, chunkSamples.size() < 4 ? 3 : 5);
+        chunkSamples.push_back(n);
+        left -= n;
+    }
+    std::vector<uint8_t> mdat;
+    std::vector<uint64_t> chunkOffsets; // relative to the mdat payload
+    size_t idx = 0;
+    for (auto n: chunkSamples) {
+        mdat.resize(mdat.size() + rand(100), 0x55); // gap, i.e. data of another track
+        chunkOffsets.push_back(mdat.size());
+        for (int i = 0; i < n; i++) {
+            mdat.insert(mdat.end(), frames[idx].begin(), frames[idx].end());
+            idx++;
+        }
+    }
+    auto& out = input.data;
+    putBox(out, "ftyp", [&] { out.insert(out.end(), { 'M', '4', 'A', ' ', 0, 0, 0, 0, 'i', 's', 'o', 'm' }); });
+    size_t mdatStart = 0;
+    auto writeMdat = [&] {
+        putBox(out, "free", [&] { out.resize(out.size() + 20); });
+        mdatStart = out.size() + 8;
+        putBox(out, "mdat", [&] { out.insert(out.end(), mdat.begin(), mdat.end()); });
+    };
+    auto writeMoov = [&](uint64_t mdatPos) {
+        putBox(out, "moov", [&] {
+            putBox(out, "mvhd", [&] { out.resize(out.size() + 100); });
+            // a video track first, which must be skipped
+            putBox(out, "trak", [&] {
+                putBox(out, "mdia", [&] {
+                    putBox(out, "hdlr", [&] { putBe(out, 0, 8); out.insert(out.end(), { 'v', 'i', 'd', 'e' }); putBe(out, 0, 13); });
+                    putBox(out, "minf", [&] { out.resize(out.size() + 300); });
+                });
+            });
+            putBox(out, "trak", [&] {
+                putBox(out, "tkhd", [&] { out.resize(out.size() + 84); });
+                putBox(out, "mdia", [&] {
+                    putBox(out, "mdhd", [&] {
+                        putBe(out, 0, 12);
+                        putBe(out, input.samplerate, 4);
+                        putBe(out, frames.size() * 1024, 4);
+                        putBe(out, 0, 4);
+                    });
+                    putBox(out, "hdlr", [&] { putBe(out, 0, 8); out.insert(out.end(), { 's', 'o', 'u', 'n' }); putBe(out, 0, 13); });
+                    putBox(out, "minf", [&] {
+                        putBox(out, "smhd", [&] { putBe(out, 0, 8); });
+                        putBox(out, "stbl", [&] {
+                            putBox(out, "stsd", [&] {
+                                putBe(out, 0, 4);
+                                putBe(out, 1, 4);
+                                putBox(out, "mp4a", [&] {
+                                    putBe(out, 0, 6);
+                                    putBe(out, 1, 2); // data reference index
+                                    putBe(out, 0, 8);
+                                    putBe(out, channels, 2);
+                                    putBe(out, 16, 2);
+                                    putBe(out, 0, 4);
+                                    putBe(out, input.samplerate << 16, 4);
+                                    putBox(out, "esds", [&] {
+                                        putBe(out, 0, 4);
+                                        // ES_Descriptor, with a multi-byte length
+                                        out.insert(out.end(), { 3, 0x80, 0x80, 0x80, 25, 0, 1, 0 });
+                                        // DecoderConfigDescriptor
+                                        out.insert(out.end(), { 4, 17, 0x40, 0x15 });
+                                        putBe(out, 0, 11);
+                                        // AudioSpecificConfig: AAC LC
+                                        out.insert(out.end(), { 5, 2, (uint8_t)((2 << 3) | (rateIdx >> 1)),
+                                            (uint8_t)(((rateIdx & 1) << 7) | (channels << 3)) });
+                                        out.insert(out.end(), { 6, 1, 2 }); // SLConfigDescriptor
+                                    });
+                                });
+                            });
+                            putBox(out, "stts", [&] {
+                                putBe(out, 0, 4);
+                                putBe(out, 1, 4);
+                                putBe(out, frames.size(), 4);
+                                putBe(out, 1024, 4);
+                            });
+                            putBox(out, "stsc", [&] {
+                                putBe(out, 0, 4);
+                                bool lastShort = chunkSamples.back() != 5;
+                                putBe(out, lastShort ? 3 : 2, 4);
+                                putBe(out, 1, 4); putBe(out, 3, 4); putBe(out, 1, 4);
+                                putBe(out, 5, 4); putBe(out, 5, 4); putBe(out, 1, 4);
+                                if (lastShort) {
+                                    putBe(out, chunkSamples.size(), 4); putBe(out, chunkSamples.back(), 4); putBe(out, 1, 4);
+                                }
+                            });
+                            putBox(out, "stsz", [&] {
+                                putBe(out, 0, 8);
+                                putBe(out, frames.size(), 4);
+                                for (auto& frame: frames) {
+                                    putBe(out, frame.size(), 4);
+                                }
+                            });
+                            putBox(out, co64 ? "co64" : "stco", [&] {
+                                putBe(out, 0, 4);
+                                putBe(out, chunkOffsets.size(), 4);
+                                for (auto offs: chunkOffsets) {
+                                    putBe(out, (uint64_t)(mdatPos + offs) >> 32, co64 ? 4 : 0);
+                                    putBe(out, mdatPos + offs, 4);
+                                }
+                            });
+                        });
+                    });
+                });
+            });
+            putBox(out, "udta", [&] { out.resize(out.size() + 200, 0x77); });
+        });
+    };
+    if (moovLast) {
+        writeMdat();
+        writeMoov(mdatStart);
+        input.minSeeks = 2; // to the moov box, and back to the first sample
+    } else {
+        // the size of the moov box doesn't depend on the offsets, so write it twice
+        std::vector<uint8_t> start = out;
+        writeMoov(0);
+        uint64_t mdatPos = out.size() + 28 + 8;
+        out = start;
+        writeMoov(mdatPos);
+        writeMdat();
+        myassert(mdatStart == mdatPos);
+    }
+}
+
+static void putId3(std::vector<uint8_t>& out, int tagSize)
+{
+    out.insert(out.end(), { 'I', 'D', '3', 4, 0, 0, (uint8_t)((tagSize >> 21) & 0x7f),
+        (uint8_t)((tagSize >> 14) & 0x7f), (uint8_t)((tagSize >> 7) & 0x7f), (uint8_t)(tagSize & 0x7f) });
+    for (int i = 0; i < tagSize; i++) { // looks like frame headers, if not skipped
+        out.push_back((i % 417 == 0) ? 0xff : (i % 417 == 1) ? 0xfb : rand(256));
+    }
+}
+
+// APEv2 tag with a header, as it can be at the start of a file
+static void putApe(std::vector<uint8_t>& out, int itemsSize)
+{
+    auto putApeHeader = [&](bool header) {
+        out.insert(out.end(), { 'A', 'P', 'E', 'T', 'A', 'G', 'E', 'X', 0xd0, 0x07, 0, 0 });
+        uint32_t size = itemsSize + 32; // including the footer
+        uint32_t flags = (1u << 31) | (header ? (1u << 29) : 0);
+        for (auto val: { size, 1u, flags }) {
+            for (int i = 0; i < 4; i++) {
+                out.push_back(val >> (8 * i));
+            }
+        }
+        out.resize(out.size() + 8);
+    };
+    putApeHeader(true);
+    for (int i = 0; i < itemsSize; i++) {
+        out.push_back((i % 300 == 0) ? 0xff : (i % 300 == 1) ? 0xfb : rand(256));
+    }
+    putApeHeader(false);
+}
+
+// MP3 frames after an ID3v2 tag (optionally followed by an APEv2 tag), and some garbage
+static void makeMp3(Input& input, bool mono, int tagSize, bool ape, int reservoir=0)
+{
+    input.codec = input.refCodec = kCodecMp3;
+    input.samplerate = 44100;
+    input.samplesPerPacket = 1152;
+    auto& out = input.data;
+    putId3(out, tagSize);
+    if (ape) {
+        putApe(out, 2000);
+    }
+    size_t audioStart = out.size();
+    for (int i = 0; i < 100; i++) {
+        out.push_back(rand(255));
+    }
+    Mp3Gen gen(3, mono, 128);
+    gen.setReservoir(reservoir);
+    gen.appendFrames(out, 200);
+    // the decoder on its own needs data after the last frame to decode it
+    out.resize(out.size() + MAD_BUFFER_GUARD);
+    // the decoder skips the tags itself
+    input.ref = out;
+    if (input.seekable && tagSize > 100000) {
+        input.minSeeks = 1;
+        input.maxRead = out.size() - audioStart + 65536;
+    }
+}
+
+// Ogg page with whole packets of less than 255 bytes
+static void putOggPage(std::vector<uint8_t>& out, uint32_t seq, int64_t granule,
+    const std::vector<std::vector<uint8_t>>& packets)
+{
+    size_t start = out.size();
+    out.insert(out.end(), { 'O', 'g', 'g', 'S', 0, (uint8_t)(seq == 0 ? 2 : 0) });
+    for (int i = 0; i < 8; i++) {
+        out.push_back(granule >> (8 * i));
+    }
+    out.insert(out.end(), { 0x34, 0x12, 0, 0 });
+    for (int i = 0; i < 4; i++) {
+        out.push_back(seq >> (8 * i));
+    }
+    out.insert(out.end(), { 0, 0, 0, 0, (uint8_t)packets.size() });
+    for (auto& pkt: packets) {
+        out.push_back(pkt.size());
+    }
+    for (auto& pkt: packets) {
+        out.insert(out.end(), pkt.begin(), pkt.end());
+    }
+    uint32_t crc = 0;
+    for (size_t i = start; i < out.size(); i++) {
+        crc ^= (uint32_t)out[i] << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        out[start + 22 + i] = crc >> (8 * i);
+    }
+}
+
+static void makeOpus(Input& input)
+{
+    input.codec = input.refCodec = kCodecOgg;
+    auto& out = input.data;
+    uint32_t seq = 0;
+    putOggPage(out, seq++, 0, { { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2, 0x38, 1, 0x80, 0xbb, 0, 0, 0, 0, 0 } });
+    putOggPage(out, seq++, 0, { { 'O', 'p', 'u', 's', 'T', 'a', 'g', 's', 0, 0, 0, 0, 0, 0, 0, 0 } });
+    int64_t granule = 0;
+    for (int page = 0; page < 40; page++) {
+        std::vector<std::vector<uint8_t>> packets(1 + rand(10));
+        for (auto& pkt: packets) {
+            pkt.push_back(31 << 3); // 20 ms CELT
+            pkt.resize(20 + rand(200));
+            for (size_t i = 1; i < pkt.size(); i++) {
+                pkt[i] = rand(256);
+            }
+            granule += 960;
+        }
+        input.packets += packets.size();
+        putOggPage(out, seq++, granule, packets);
+    }
+    input.ref = out;
+}
+
+struct Result
+{
+    std::vector<uint8_t> pcm;
+    StreamFormat fmt;
+    int64_t bytesRead = 0;
+    int seeks = 0;
+    int64_t usElapsed = 0;
+};
+
+// Pulls the decoded stream, as I2sOutputNode does
+static bool play(const std::vector<uint8_t>& data, CodecType codec, bool demux, int wrapSize, bool seekable,
+    Result& res)
+{
+    MemSourceNode src(data, codec, wrapSize, seekable);
+    DemuxNode demuxer;
+    DecoderNode decoder;
+    if (demux) {
+        demuxer.linkToPrev(&src);
+        decoder.linkToPrev(&demuxer);
+    } else {
+        decoder.linkToPrev(&src);
+    }
+    for (;;) {
+        AudioNode::DataPullReq dpr(10240);
+        PcmBlockRef block;
+        ElapsedTimer timer;
+        AudioNode::StreamError err;
+        bool useBlock = decoder.hasBlockOutput();
+        if (useBlock) {
+            err = decoder.pullBlock(block, -1);
+            if (!err) {
+                dpr.buf = block->data;
+                dpr.size = block->size;
+                dpr.fmt = block->fmt;
+            }
+        } else {
+            err = decoder.pullData(dpr, -1);
+        }
+        res.usElapsed += timer.usElapsed();
+        if (err == AudioNode::kStreamStopped) {
+            res.bytesRead = src.bytesRead;
+            res.seeks = src.seeks;
+            return true;
+        } else if (err) {
+            fprintf(stderr, "pull error %d\n", err);
+            return false;
+        }
+        res.fmt = dpr.fmt;
+        res.pcm.insert(res.pcm.end(), dpr.buf, dpr.buf + dpr.size);
+        if (!useBlock) {
+            decoder.confirmRead(dpr.size);
+        }
+    }
+}
+
+// Pulls the packets from the demuxer, and checks their count and timestamps
+static bool checkPackets(const Input& input, int wrapSize)
+{
+    MemSourceNode src(input.data, input.codec, wrapSize, input.seekable);
+    DemuxNode demuxer;
+    demuxer.linkToPrev(&src);
+    AudioNode::DataPullReq dpr(0);
+    if (demuxer.pullData(dpr, -1) || demuxer.hasPacketOutput() != (input.packets != 0)) {
+        fprintf(stderr, "%s: %s packet output\n", input.name.c_str(), input.packets ? "no" : "unexpected");
+        return false;
+    }
+    if (!input.packets) {
+        return true;
+    }
+    int count = 0;
+    for (;;) {
+        AudioNode::PacketPullReq pkt;
+        auto err = demuxer.pullPacket(pkt, -1);
+        if (err == AudioNode::kStreamStopped) {
+            break;
+        } else if (err) {
+            fprintf(stderr, "%s: packet pull error %d\n", input.name.c_str(), err);
+            return false;
+        }
+        if (!pkt.size) {
+            fprintf(stderr, "%s: empty packet\n", input.name.c_str());
+            return false;
+        }
+        if (!(pkt.flags & AudioNode::PacketPullReq::kFlagConfig)) {
+            if (input.samplesPerPacket) {
+                int64_t pts = (int64_t)count * input.samplesPerPacket * 1000000 / input.samplerate;
+                if (pkt.pts < pts - 1 || pkt.pts > pts + 1) {
+                    fprintf(stderr, "%s: packet %d has pts %lld, expected %lld\n", input.name.c_str(),
+                        count, (long long)pkt.pts, (long long)pts);
+                    return false;
+                }
+            }
+            count++;
+        }
+        demuxer.confirmRead(pkt.size);
+    }
+    if (count != input.packets) {
+        fprintf(stderr, "%s: %d packets, expected %d\n", input.name.c_str(), count, input.packets);
+        return false;
+    }
+    return true;
+}
+
+// CBR MP3 stream for the seek test, optionally with a Xing tag frame with an
+// evenly spaced seek table. The Mp3Gen frames are all of the same size
+struct SeekInput
+{
+    enum { kFrames = 300, kFrameSize = 417 };
+    std::string name;
+    std::vector<uint8_t> data;
+    size_t firstFrame = 0; // offset of the first audio frame
+    bool seekable = true;
+    int afterMs = 0; // of output when the seek is requested
+    int ms = 0;
+};
+
+static void makeSeekMp3(SeekInput& input, bool xing, int reservoir=0)
+{
+    auto& out = input.data;
+    putId3(out, 3000);
+    if (xing) {
+        std::vector<uint8_t> frame = { 0xff, 0xfb, 9 << 4, 0 }; // 128 kbps, 44.1 kHz
+        frame.resize(4 + 32); // side info
+        frame.insert(frame.end(), { 'X', 'i', 'n', 'g' });
+        putBe(frame, 7, 4); // frames, bytes and seek table
+        putBe(frame, SeekInput::kFrames, 4);
+        putBe(frame, (SeekInput::kFrames + 1) * SeekInput::kFrameSize, 4);
+        for (int i = 0; i < 100; i++) {
+            frame.push_back(i * 256 / 100);
+        }
+        frame.resize(SeekInput::kFrameSize);
+        out.insert(out.end(), frame.begin(), frame.end());
+    }
+    input.firstFrame = out.size();
+    Mp3Gen gen(5, false, 128);
+    gen.setReservoir(reservoir);
+    gen.appendFrames(out, SeekInput::kFrames);
+    out.resize(out.size() + MAD_BUFFER_GUARD);
+}
+
+// Seeks by time during playback. The output after the kStreamFlush of the seek
+// must be that of the stream decoded from a frame within a few frames of the time
+static bool checkTimeSeek(const SeekInput& input, int wrapSize)
+{
+    MemSourceNode src(input.data, kCodecMp3, wrapSize, input.seekable);
+    DemuxNode demuxer;
+    DecoderNode decoder;
+    demuxer.linkToPrev(&src);
+    decoder.linkToPrev(&demuxer);
+    std::vector<uint8_t> pcm;
+    size_t seekAfter = (int64_t)input.afterMs * 44100 / 1000 * 4;
+    size_t played = 0;
+    bool seekRequested = false;
+    bool flushed = false;
+    for (;;) {
+        PcmBlockRef block;
+        auto err = decoder.pullBlock(block, -1);
+        if (err == AudioNode::kStreamStopped) {
+            break;
+        } else if (err == AudioNode::kStreamFlush && seekRequested && !flushed) {
+            flushed = true;
+            pcm.clear();
+            continue;
+        } else if (err) {
+            fprintf(stderr, "%s: pull error %d\n", input.name.c_str(), err);
+            return false;
+        }
+        pcm.insert(pcm.end(), block->data, block->data + block->size);
+        played += block->size;
+        if (!seekRequested && played >= seekAfter) {
+            if (!demuxer.seekToTime(input.ms)) {
+                fprintf(stderr, "%s: seek refused\n", input.name.c_str());
+                return false;
+            }
+            seekRequested = true;
+        }
+    }
+    if (input.ms >= (int64_t)SeekInput::kFrames * 1152 * 1000 / 44100) {
+        // past the end, the seek is refused and the stream plays to the end
+        if (flushed || src.seeks || played < (size_t)(SeekInput::kFrames - 1) * 1152 * 4) {
+            fprintf(stderr, "%s: the seek was not refused\n", input.name.c_str());
+            return false;
+        }
+        printf("%-32s %5d ms -> refused, played %zu bytes\n", input.name.c_str(), input.ms, played);
+        return true;
+    }
+    if (!flushed || demuxer.lastSeekLatencyMs() < 0) {
+        fprintf(stderr, "%s: the seek was not done\n", input.name.c_str());
+        return false;
+    }
+    int expected = (int64_t)input.ms * 44100 / 1152 / 1000;
+    for (int k = std::max(0, expected - 3); k <= expected + 3; k++) {
+        size_t start = input.firstFrame + k * SeekInput::kFrameSize;
+        Result ref;
+        if (!play(std::vector<uint8_t>(input.data.begin() + start, input.data.end()), kCodecMp3,
+            false, 0, true, ref)) {
+            fprintf(stderr, "%s: reference decode failed\n", input.name.c_str());
+            return false;
+        }
+        if (ref.pcm == pcm) {
+            printf("%-32s %5d ms -> frame %3d (%+d), read %7lld, %d seeks, %d ms to the first data\n",
+                input.name.c_str(), input.ms, k, k - expected, (long long)src.bytesRead, src.seeks,
+                demuxer.lastSeekLatencyMs());
+            return true;
+        }
+    }
+    fprintf(stderr, "%s: the output after the seek doesn't start within 3 frames of frame %d\n",
+        input.name.c_str(), expected);
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 3;
+    int wrapSize = 5003; // so that frames straddle the wrap-around point
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:v")) != -1) {
+        switch (opt) {
+            case 'r': repeats = std::max(1, atoi(optarg)); break;
+            case 'w': wrapSize = atoi(optarg); break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repeats] [-w wrapSize] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    esp_log_level_set("*", verbose ? ESP_LOG_DEBUG : ESP_LOG_ERROR);
+    std::vector<Input> inputs(10);
+    inputs[0].name = "ADTS 44.1 kHz stereo";
+    makeAdts(inputs[0], 4, 2);
+    inputs[1].name = "M4A faststart";
+    makeMp4(inputs[1], 4, 2, false, false);
+    inputs[2].name = "M4A moov at end";
+    makeMp4(inputs[2], 3, 2, true, false);
+    inputs[3].name = "M4A moov at end, co64, SBR";
+    makeMp4(inputs[3], 6, 1, true, true);
+    inputs[4].name = "MP3 with ID3v2";
+    makeMp3(inputs[4], false, 5000, false);
+    inputs[5].name = "MP3 mono with ID3v2 and APEv2";
+    makeMp3(inputs[5], true, 3000, true);
+    inputs[6].name = "MP3 with cover art";
+    makeMp3(inputs[6], false, 300000, false);
+    inputs[7].name = "MP3 with cover art, no seek";
+    inputs[7].seekable = false;
+    makeMp3(inputs[7], false, 300000, true);
+    inputs[8].name = "MP3 with bit reservoir";
+    makeMp3(inputs[8], false, 3000, false, 200);
+    inputs[9].name = "Ogg Opus";
+    makeOpus(inputs[9]);
+    for (auto& input: inputs) {
+        Result ref;
+        if (!play(input.ref, input.refCodec, false, 0, true, ref) || ref.pcm.empty()) {
+            fprintf(stderr, "%s: reference decode failed\n", input.name.c_str());
+            return 1;
+        }
+        if (!checkPackets(input, wrapSize)) {
+            return 1;
+        }
+        Result res;
+        if (!play(input.data, input.codec, true, wrapSize, input.seekable, res)) {
+            fprintf(stderr, "%s: demuxed decode failed\n", input.name.c_str());
+            return 1;
+        }
+        if (res.pcm != ref.pcm || res.fmt != ref.fmt) {
+            fprintf(stderr, "%s: demuxed output differs from the reference (%zu vs %zu bytes)\n",
+                input.name.c_str(), res.pcm.size(), ref.pcm.size());
+            return 1;
+        }
+        if (res.seeks < input.minSeeks) {
+            fprintf(stderr, "%s: %d seeks, expected at least %d\n", input.name.c_str(), res.seeks, input.minSeeks);
+            return 1;
+        }
+        if (input.maxRead && res.bytesRead > input.maxRead) {
+            fprintf(stderr, "%s: read %lld bytes, expected at most %lld\n", input.name.c_str(),
+                (long long)res.bytesRead, (long long)input.maxRead);
+            return 1;
+        }
+        for (int i = 1; i < repeats; i++) {
+            Result rerun;
+            play(input.data, input.codec, true, wrapSize, input.seekable, rerun);
+            res.usElapsed = std::min(res.usElapsed, rerun.usElapsed);
+        }
+        printf("%-32s %7zu bytes, read %7lld, %d seeks, %.2f ms decode\n", input.name.c_str(),
+            input.data.size(), (long long)res.bytesRead, res.seeks, res.usElapsed / 1000.0);
+    }
+    std::vector<SeekInput> seekInputs(6);
+    seekInputs[0] = { "MP3 CBR seek forward", {}, 0, true, 500, 5000 };
+    makeSeekMp3(seekInputs[0], false);
+    seekInputs[1] = { "MP3 Xing seek back", {}, 0, true, 6000, 2000 };
+    makeSeekMp3(seekInputs[1], true);
+    seekInputs[2] = { "MP3 Xing seek forward, no seek", {}, 0, false, 500, 5000 };
+    makeSeekMp3(seekInputs[2], true);
+    seekInputs[3] = { "MP3 CBR seek to the start", {}, 0, true, 3000, 0 };
+    makeSeekMp3(seekInputs[3], false);
+    // the first frame after the seek can't be decoded without the previous one
+    seekInputs[4] = { "MP3 bit reservoir seek forward", {}, 0, true, 500, 5000 };
+    makeSeekMp3(seekInputs[4], false, 200);
+    seekInputs[5] = { "MP3 CBR seek past the end", {}, 0, true, 500, 20000 };
+    makeSeekMp3(seekInputs[5], false);
+    for (auto& input: seekInputs) {
+        if (!checkTimeSeek(input, wrapSize)) {
+            return 1;
+        }
+    }
+    printf("All outputs match\n");
+    return 0;
+}
+
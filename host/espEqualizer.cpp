@@ -0,0 +1,71 @@
+/* Host replacement for the prebuilt Espressif equalizer library (libeq.a),
+ * implementing its API with the in-tree biquad Equalizer. The output is not
+ * bit-exact with the ESP32 library, but has the same cost profile per sample
+ */
+#include <esp_equalizer.h>
+#include <equalizer.hpp>
+#include <stdint.h>
+
+namespace {
+struct HostEqualizer
+{
+    enum { kMaxChannels = 2 };
+    Equalizer eq[kMaxChannels];
+    int nch;
+};
+}
+
+extern "C" {
+
+void* esp_equalizer_init(int nch, int g_rate, int n_band, int use_xmms_original_freqs)
+{
+    if (nch < 1 || nch > HostEqualizer::kMaxChannels || n_band != 10) {
+        return nullptr;
+    }
+    auto self = new HostEqualizer;
+    self->nch = nch;
+    for (auto& eq: self->eq) {
+        eq.init(g_rate);
+    }
+    return self;
+}
+
+void esp_equalizer_uninit(void* handle)
+{
+    delete static_cast<HostEqualizer*>(handle);
+}
+
+int esp_equalizer_process(void* handle, unsigned char* pcm_buf, int length, int g_rate, int nch)
+{
+    auto self = static_cast<HostEqualizer*>(handle);
+    auto sample = (int16_t*)pcm_buf;
+    auto end = sample + length / 2;
+    while (sample < end) {
+        for (int ch = 0; ch < self->nch; ch++) {
+            *sample = self->eq[ch].processInt(*sample);
+            sample++;
+        }
+    }
+    return length;
+}
+
+void esp_equalizer_set_band_value(void* handle, float value, int index, int nch)
+{
+    auto self = static_cast<HostEqualizer*>(handle);
+    if (nch < HostEqualizer::kMaxChannels) {
+        self->eq[nch].setBandGain(index, value);
+    }
+}
+
+int esp_equalizer_get_band_count(void* handle)
+{
+    return 10;
+}
+
+float esp_equalizer_get_band_value(void* handle, int index, int nch)
+{
+    auto self = static_cast<HostEqualizer*>(handle);
+    return (nch < HostEqualizer::kMaxChannels) ? self->eq[nch].bandGain(index) : 0;
+}
+
+}
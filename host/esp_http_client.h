@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_HTTP_CLIENT_H
+#define HOST_ESP_HTTP_CLIENT_H
+/* Only the types needed to compile audioNode.hpp. HttpNode is not part of
+ * the host build
+ */
+#include "esp_err.h"
+
+typedef struct esp_http_client* esp_http_client_handle_t;
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HOST_ESP_HTTP_SERVER_H
+#define HOST_ESP_HTTP_SERVER_H
+/* Only the declarations needed to compile utils.hpp and utils.cpp. There is no web server
+ * in the host build
+ */
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+typedef struct httpd_req httpd_req_t;
+typedef void* httpd_handle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* There is never a query string */
+size_t httpd_req_get_url_query_len(httpd_req_t* req);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,309 @@
+/* Host benchmark and test of DecoderFlac. Streams generated by flacEnc.hpp are
+ * decoded with the input fed in chunks of random size, as with aacBench, and
+ * the output must be the same as the encoded samples (scaled to the output
+ * sample width). The streams are a typical 16- and 24-bit encode, and coverage
+ * streams with all the subframe and frame header variants, with garbage between
+ * some frames, and without the max frame size in STREAMINFO, and one whose last
+ * frame is shorter than the longest frame header. A stream with blocks larger
+ * than the decoder supports must be rejected.
+ * Reports the decode time and realtime factor on the host, and an estimate for
+ * the ESP32, from the number of operations that decoding takes and the cycles
+ * each takes (see kEsp32Cycles). Given FLAC files are decoded as well, and their
+ * output compared with that of decoding them in one piece
+ * Usage: flacBench [-r repeats] [-c maxChunk] [file.flac...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+#include <decoderFlac.hpp>
+#include "flacEnc.hpp"
+
+struct Result
+{
+    std::vector<uint8_t> pcm;
+    StreamFormat fmt;
+    int64_t usElapsed = 0;
+};
+
+// Decodes the stream with DecoderFlac, the input split in chunks of up to maxChunk bytes
+static bool decodeChunked(const std::vector<uint8_t>& input, int outBits, bool mono, int outBufSize,
+    int maxChunk, Result& res)
+{
+    DecoderFlac decoder;
+    decoder.setPcmFormat(outBits, false);
+    decoder.setMonoOutput(mono);
+    std::vector<char> out(outBufSize);
+    size_t pos = 0;
+    uint32_t seed = 1;
+    for (;;) {
+        decoder.setOutputBuf(out.data(), outBufSize);
+        int needed = decoder.inputBytesNeeded();
+        int ret;
+        bool flush = pos >= input.size();
+        ElapsedTimer timer;
+        if (needed > 0 && !flush) {
+            seed = seed * 1103515245 + 12345;
+            int size = std::min({ needed, (int)(input.size() - pos), 1 + (int)((seed >> 8) % maxChunk) });
+            ret = decoder.decode((const char*)input.data() + pos, size);
+            pos += size;
+        } else { // at the end of the stream, as DecoderNode does on a stream change
+            int size = 0;
+            ret = decoder.decode(nullptr, size);
+        }
+        res.usElapsed += timer.usElapsed();
+        if (ret == AudioNode::kNeedMoreData) {
+            if (flush) {
+                return true;
+            }
+            continue;
+        } else if (ret <= 0) {
+            fprintf(stderr, "Decode error %d\n", ret);
+            return false;
+        }
+        res.fmt = decoder.outputFmt();
+        res.pcm.insert(res.pcm.end(), out.data(), out.data() + ret);
+    }
+}
+
+// Cycles per operation on the ESP32 at 240 MHz, for the decode time estimate.
+// Assumed from the instruction counts of the inner loops, with the 64-bit bit
+// cache taking pairs of 32-bit instructions
+static const struct
+{
+    double mac32 = 3; // load, mull, add
+    double mac64 = 8; // load, mull, mulsh, add with carry
+    double fixed = 5;
+    double residual = 30; // rice decode, with the cache refill
+    double verbatim = 15;
+    double output = 6; // per output sample, decorrelation and conversion
+    double byte = 6; // CRC-16, by table
+} kEsp32Cycles;
+static const double kEsp32Mhz = 240;
+
+static double esp32Seconds(const FlacEnc::Stats& st, int channels)
+{
+    double cycles = st.lpcMacs32 * kEsp32Cycles.mac32 + st.lpcMacs64 * kEsp32Cycles.mac64 +
+        st.fixedSamples * kEsp32Cycles.fixed + st.residuals * kEsp32Cycles.residual +
+        st.verbatim * kEsp32Cycles.verbatim + st.samples * channels * kEsp32Cycles.output +
+        st.bytes * kEsp32Cycles.byte;
+    return cycles / (kEsp32Mhz * 1e6);
+}
+
+// Music-like test signal - a few partials with vibrato and some noise, with
+// silent (constant) and low-resolution (wasted bits) sections, and a burst of
+// full scale noise that compresses only as verbatim subframes
+static void generateSignal(std::vector<int32_t>* chans, int channels, int bps, int sampleRate, int nsamples,
+    uint32_t seed)
+{
+    auto rand = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (int32_t)(seed >> 8) - (1 << 23);
+    };
+    double amp = (1 << (bps - 1)) * 0.25;
+    int32_t max = (1 << (bps - 1)) - 1;
+    for (int ch = 0; ch < channels; ch++) {
+        chans[ch].resize(nsamples);
+    }
+    for (int i = 0; i < nsamples; i++) {
+        double t = (double)i / sampleRate;
+        double base = 0;
+        for (int p = 1; p <= 5; p++) {
+            base += sin(2 * M_PI * 220 * p * t + 3 * sin(2 * M_PI * 5 * t)) / p;
+        }
+        int section = (i * 10 / nsamples);
+        for (int ch = 0; ch < channels; ch++) {
+            double val = base * amp + sin(2 * M_PI * (330 + 110 * ch) * t) * amp * 0.5;
+            int32_t s = (int32_t)val + (rand() >> (24 - bps + 6));
+            if (section == 3) {
+                s = 0;
+            } else if (section == 5) {
+                s &= ~0x0f;
+            } else if (section == 7 && (i / 4096) % 4 == 0) {
+                s = rand() >> (24 - bps);
+            }
+            chans[ch][i] = std::max(-max - 1, std::min(max, s));
+        }
+    }
+}
+
+struct Input
+{
+    std::string name;
+    std::vector<uint8_t> data;
+    int channels = 0;
+    int bps = 0;
+    std::vector<int32_t> samples[2]; // empty if not known
+    FlacEnc::Stats stats;
+};
+
+// silentTail samples of silence are appended, for a short last frame
+static void encodeStream(Input& input, int sampleRate, int channels, int bps, int blockSize, bool coverage,
+    int seconds, int silentTail = 0)
+{
+    input.channels = channels;
+    input.bps = bps;
+    generateSignal(input.samples, channels, bps, sampleRate, sampleRate * seconds, channels * 100 + bps);
+    for (int ch = 0; ch < channels; ch++) {
+        input.samples[ch].resize(input.samples[ch].size() + silentTail, 0);
+    }
+    FlacEnc enc(input.data, sampleRate, channels, bps, blockSize, coverage);
+    enc.writeHeader(coverage, coverage ? 40000 : 8192);
+    int total = input.samples[0].size();
+    uint32_t seed = 7;
+    for (int pos = 0; pos < total; pos += blockSize) {
+        const int32_t* chans[2] = { input.samples[0].data() + pos, input.samples[channels - 1].data() + pos };
+        enc.writeFrame(chans, std::min(blockSize, total - pos));
+        if (coverage && (pos / blockSize) % 7 == 3) { // garbage, with sync codes
+            for (int i = 0; i < 60; i++) {
+                seed = seed * 1103515245 + 12345;
+                input.data.push_back((i % 10 == 0) ? 0xff : (i % 10 == 1) ? 0xf8 : seed >> 16);
+            }
+        }
+    }
+    enc.finish(!coverage);
+    input.stats = enc.stats();
+}
+
+// The encoded samples, as the decoder outputs them
+static std::vector<uint8_t> expectedOutput(const Input& input, int outBits, bool mono)
+{
+    std::vector<uint8_t> out;
+    int shift = outBits - input.bps;
+    int32_t max = (1 << (outBits - 1)) - 1;
+    int nch = mono ? 1 : input.channels;
+    for (size_t i = 0; i < input.samples[0].size(); i++) {
+        for (int ch = 0; ch < nch; ch++) {
+            int32_t val = input.samples[ch][i];
+            if (mono && input.channels == 2) {
+                val = (input.samples[0][i] + input.samples[1][i]) >> 1;
+            }
+            val = (shift >= 0) ? val * (1 << shift) : std::min(max, (val + (1 << (-shift - 1))) >> -shift);
+            for (int b = 0; b < outBits / 8; b++) {
+                out.push_back(val >> (8 * b));
+            }
+        }
+    }
+    return out;
+}
+
+static bool loadFile(const char* fname, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        perror("Error opening input file");
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 3;
+    int maxChunk = 4096;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:c:")) != -1) {
+        switch (opt) {
+            case 'r': repeats = std::max(1, atoi(optarg)); break;
+            case 'c': maxChunk = std::max(1, atoi(optarg)); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repeats] [-c maxChunk] [file.flac...]\n", argv[0]);
+                return 2;
+        }
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR); // each decoder instance logs the stream format
+    std::vector<Input> inputs(6);
+    inputs[0].name = "16-bit stereo 44.1 kHz";
+    encodeStream(inputs[0], 44100, 2, 16, 4096, false, 10);
+    inputs[1].name = "24-bit stereo 96 kHz";
+    encodeStream(inputs[1], 96000, 2, 24, 4096, false, 5);
+    inputs[2].name = "coverage 16-bit stereo";
+    encodeStream(inputs[2], 44100, 2, 16, 1152, true, 4);
+    inputs[3].name = "coverage 20-bit stereo";
+    encodeStream(inputs[3], 48000, 2, 20, 4608, true, 4);
+    inputs[4].name = "coverage 24-bit mono";
+    encodeStream(inputs[4], 22050, 1, 24, 576, true, 4);
+    inputs[5].name = "short last frame"; // of 4 silent samples, a constant subframe
+    encodeStream(inputs[5], 16000, 1, 16, 4000, false, 1, 4);    for (int i = optind; i < argc; i++) {
+        inputs.emplace_back();
+        inputs.back().name = argv[i];
+        if (!loadFile(argv[i], inputs.back().data)) {
+            return 1;
+        }
+    }
+    {
+        Input large;
+        encodeStream(large, 44100, 2, 16, 8192, false, 1);
+        Result res;
+        if (decodeChunked(large.data, 16, false, 1152 * 4, maxChunk, res)) {
+            fprintf(stderr, "Stream of 8192-sample blocks not rejected (%zu bytes output)\n", res.pcm.size());
+            return 1;
+        }
+        printf("Stream of 8192-sample blocks rejected\n");
+    }
+    for (auto& input: inputs) {
+        for (int outBits = 16; outBits <= 24; outBits += 8) {
+            for (int mono = 0; mono < (input.channels == 2 ? 2 : 1); mono++) {
+                std::vector<uint8_t> expected;
+                if (input.channels) {
+                    expected = expectedOutput(input, outBits, mono);
+                } else {
+                    Result whole;
+                    if (!decodeChunked(input.data, outBits, mono, 1152 * 2 * outBits / 4, input.data.size(), whole)) {
+                        return 1;
+                    }
+                    expected = std::move(whole.pcm);
+                }
+                // one MP3 frame per PCM block as sized by DecoderNode, and two
+                for (int frames = 1; frames <= 2; frames++) {
+                    int outBufSize = 1152 * 2 * outBits / 8 * frames;
+                    Result res;
+                    if (!decodeChunked(input.data, outBits, mono, outBufSize, maxChunk, res)) {
+                        fprintf(stderr, "%s: decode failed\n", input.name.c_str());
+                        return 1;
+                    }
+                    if (res.pcm != expected) {
+                        size_t diff = 0;
+                        while (diff < std::min(res.pcm.size(), expected.size()) && res.pcm[diff] == expected[diff]) {
+                            diff++;
+                        }
+                        fprintf(stderr, "%s: %d-bit%s output with %d-byte buffer differs from the expected one "
+                            "at byte %zu (%zu vs %zu bytes)\n", input.name.c_str(), outBits, mono ? " mono" : "",
+                            outBufSize, diff, res.pcm.size(), expected.size());
+                        return 1;
+                    }
+                    if (frames == 2 || mono) {
+                        continue; // timed with one buffer size and stereo output only
+                    }
+                    for (int i = 1; i < repeats; i++) {
+                        Result rerun;
+                        decodeChunked(input.data, outBits, mono, outBufSize, maxChunk, rerun);
+                        res.usElapsed = std::min(res.usElapsed, rerun.usElapsed);
+                    }
+                    int nch = res.fmt.channels();
+                    double seconds = (double)res.pcm.size() / (nch * outBits / 8) / res.fmt.samplerate;
+                    printf("%s, %d-bit output: %.1f s of audio, %d Hz, %d ch, %.0f us/s of audio, %.0fx realtime",
+                        input.name.c_str(), outBits, seconds, res.fmt.samplerate, nch, res.usElapsed / seconds,
+                        seconds * 1000000 / res.usElapsed);
+                    if (input.stats.samples) {
+                        double esp32 = esp32Seconds(input.stats, input.channels);
+                        printf(", ESP32 estimate %.1fx realtime (%.0f MHz)", seconds / esp32,
+                            esp32 / seconds * kEsp32Mhz);
+                    }
+                    printf("\n");
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,569 @@
+#ifndef HOST_FLAC_ENC_HPP
+#define HOST_FLAC_ENC_HPP
+/* Minimal FLAC encoder, to generate test streams for DecoderFlac. Each subframe
+ * is encoded with the cheapest of the fixed predictors and an LPC predictor, as
+ * a typical encoder would do, or, in coverage mode, with a type, LPC order,
+ * coefficient precision, residual coding method and partitioning that cycle
+ * through all the variants, as do the stereo modes and the frame header fields.
+ * The encoder also counts the basic operations that decoding the stream takes,
+ * for estimating the decode time on the target
+ */
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+class FlacEnc
+{
+public:
+    struct Stats
+    {
+        int64_t samples = 0; // per channel
+        int64_t lpcMacs32 = 0; // multiply-accumulates with a 32-bit accumulator
+        int64_t lpcMacs64 = 0;
+        int64_t fixedSamples = 0;
+        int64_t residuals = 0; // rice-coded
+        int64_t verbatim = 0; // verbatim, warmup and escaped samples
+        int64_t bytes = 0;
+    };
+protected:
+    struct BitWriter
+    {
+        std::vector<uint8_t> data;
+        uint64_t acc = 0;
+        int nbits = 0;
+        void put(uint32_t val, int bits) // bits <= 32
+        {
+            if (!bits) {
+                return;
+            }
+            acc = (acc << bits) | (val & (((uint64_t)1 << bits) - 1));
+            nbits += bits;
+            while (nbits >= 8) {
+                data.push_back(acc >> (nbits - 8));
+                nbits -= 8;
+            }
+        }
+        void putUnary(uint32_t zeros)
+        {
+            for (; zeros >= 32; zeros -= 32) {
+                put(0, 32);
+            }
+            put(1, zeros + 1);
+        }
+        void align() { put(0, (8 - nbits) & 7); }
+    };
+    struct Subframe
+    {
+        int type; // 0: constant, 1: verbatim, 8-12: fixed, 32-63: LPC
+        int order = 0;
+        int precision = 0;
+        int shift = 0;
+        int32_t coefs[32];
+        std::vector<int32_t> residual;
+        int64_t cost;
+    };
+    std::vector<uint8_t>& mOut;
+    int mSampleRate;
+    int mChannels;
+    int mBps;
+    int mBlockSize;
+    bool mCoverage;
+    uint32_t mFrameNum = 0;
+    uint32_t mCycle = 0; // for the coverage mode
+    size_t mStreamInfoPos = 0;
+    int mMinFrameSize = 0xffffff;
+    int mMaxFrameSize = 0;
+    Stats mStats;
+    static uint8_t crc8(const uint8_t* data, size_t len)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < len; i++) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+            }
+        }
+        return crc;
+    }
+    static uint16_t crc16(const uint8_t* data, size_t len)
+    {
+        uint16_t crc = 0;
+        for (size_t i = 0; i < len; i++) {
+            crc ^= data[i] << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+            }
+        }
+        return crc;
+    }
+    static uint32_t zigzag(int32_t val) { return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31); }
+    // Rice parameter for the partition, and the resulting size in bits
+    static int riceParam(const int32_t* res, int n, int maxParam, int64_t& bits)
+    {
+        uint64_t sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += zigzag(res[i]);
+        }
+        int k = 0;
+        while (k < maxParam && ((uint64_t)n << (k + 1)) < sum) {
+            k++;
+        }
+        bits = 0;
+        for (int i = 0; i < n; i++) {
+            bits += (zigzag(res[i]) >> k) + 1 + k;
+        }
+        return k;
+    }
+    // Size in bits of the residual with a single partition, to compare predictors
+    static int64_t residualCost(const std::vector<int32_t>& res)
+    {
+        int64_t bits;
+        riceParam(res.data(), res.size(), 30, bits);
+        return bits;
+    }
+    bool fixedResidual(const int32_t* x, int n, int order, Subframe& sf)
+    {
+        if (order >= n) {
+            return false;
+        }
+        sf.type = 8 + order;
+        sf.order = order;
+        sf.residual.resize(n - order);
+        for (int i = order; i < n; i++) {
+            int64_t pred;
+            switch (order) {
+                case 0: pred = 0; break;
+                case 1: pred = x[i - 1]; break;
+                case 2: pred = 2 * (int64_t)x[i - 1] - x[i - 2]; break;
+                case 3: pred = 3 * ((int64_t)x[i - 1] - x[i - 2]) + x[i - 3]; break;
+                default: pred = 4 * ((int64_t)x[i - 1] + x[i - 3]) - 6 * (int64_t)x[i - 2] - x[i - 4]; break;
+            }
+            int64_t res = x[i] - pred;
+            if (res >= (1 << 30) || res < -(1 << 30)) {
+                return false;
+            }
+            sf.residual[i - order] = res;
+        }
+        return true;
+    }
+    // LPC coefficients by the autocorrelation method, quantized to the precision
+    bool lpcResidual(const int32_t* x, int n, int order, int precision, Subframe& sf)
+    {
+        if (order >= n) {
+            return false;
+        }
+        std::vector<double> wx(n);
+        for (int i = 0; i < n; i++) { // Welch window
+            double t = (2.0 * i - (n - 1)) / (n + 1);
+            wx[i] = x[i] * (1 - t * t);
+        }
+        double r[33] = { 0 };
+        for (int lag = 0; lag <= order; lag++) {
+            for (int i = lag; i < n; i++) {
+                r[lag] += wx[i] * wx[i - lag];
+            }
+        }
+        if (r[0] == 0) {
+            return false;
+        }
+        r[0] *= 1.0 + 1e-9;
+        // Levinson-Durbin
+        double a[33] = { 0 };
+        double tmp[33];
+        double err = r[0];
+        for (int i = 1; i <= order; i++) {
+            double k = r[i];
+            for (int j = 1; j < i; j++) {
+                k -= a[j] * r[i - j];
+            }
+            k /= err;
+            memcpy(tmp, a, sizeof(a));
+            a[i] = k;
+            for (int j = 1; j < i; j++) {
+                a[j] = tmp[j] - k * tmp[i - j];
+            }
+            err *= 1 - k * k;
+            if (err <= 0) {
+                return false;
+            }
+        }
+        double cmax = 0;
+        for (int i = 1; i <= order; i++) {
+            cmax = std::max(cmax, fabs(a[i]));
+        }
+        if (cmax == 0) {
+            return false;
+        }
+        int exp;
+        frexp(cmax, &exp);
+        int shift = std::min(precision - 1 - exp, 15);
+        if (shift < 0) {
+            return false;
+        }
+        int32_t qmax = (1 << (precision - 1)) - 1;
+        double qerr = 0;
+        for (int i = 0; i < order; i++) {
+            qerr += a[i + 1] * (1 << shift);
+            int32_t q = (int32_t)lround(qerr);
+            q = std::max(-qmax - 1, std::min(qmax, q));
+            qerr -= q;
+            sf.coefs[i] = q;
+        }
+        sf.type = 32 + order - 1;
+        sf.order = order;
+        sf.precision = precision;
+        sf.shift = shift;
+        sf.residual.resize(n - order);
+        for (int i = order; i < n; i++) {
+            int64_t sum = 0;
+            for (int j = 0; j < order; j++) {
+                sum += (int64_t)sf.coefs[j] * x[i - 1 - j];
+            }
+            int64_t res = x[i] - (sum >> shift);
+            if (res >= (1 << 30) || res < -(1 << 30)) {
+                return false;
+            }
+            sf.residual[i - order] = res;
+        }
+        return true;
+    }
+    void writeResidual(BitWriter& bw, const Subframe& sf, int n)
+    {
+        // partition order: the cheapest one, or cycled through in coverage mode
+        int maxPartOrder = 0;
+        while (maxPartOrder < 8 && (n % (2 << maxPartOrder)) == 0 && (n >> (maxPartOrder + 1)) >= sf.order
+            && (n >> (maxPartOrder + 1)) >= 16) {
+            maxPartOrder++;
+        }
+        bool rice2 = mBps > 16;
+        int bestOrder = 0;
+        if (mCoverage) {
+            bestOrder = mCycle % (maxPartOrder + 1);
+            rice2 = rice2 || (mCycle % 3 == 0);
+        } else {
+            int64_t bestBits = INT64_MAX;
+            for (int po = 0; po <= maxPartOrder; po++) {
+                int64_t total = 0;
+                int partSize = n >> po;
+                for (int p = 0, i = 0; p < (1 << po); p++) {
+                    int len = partSize - (p ? 0 : sf.order);
+                    int64_t bits;
+                    riceParam(sf.residual.data() + i, len, rice2 ? 30 : 14, bits);
+                    total += bits + (rice2 ? 5 : 4);
+                    i += len;
+                }
+                if (total < bestBits) {
+                    bestBits = total;
+                    bestOrder = po;
+                }
+            }
+        }
+        int paramBits = rice2 ? 5 : 4;
+        bw.put(rice2 ? 1 : 0, 2);
+        bw.put(bestOrder, 4);
+        int partSize = n >> bestOrder;
+        for (int p = 0, i = 0; p < (1 << bestOrder); p++) {
+            int len = partSize - (p ? 0 : sf.order);
+            auto res = sf.residual.data() + i;
+            i += len;
+            int64_t bits;
+            int k = riceParam(res, len, rice2 ? 30 : 14, bits);
+            if (mCoverage && (mCycle + p) % 11 == 0) { // escaped partition
+                int32_t maxAbs = 0;
+                for (int j = 0; j < len; j++) {
+                    maxAbs = std::max(maxAbs, res[j] < 0 ? -(res[j] + 1) : res[j]);
+                }
+                int width = maxAbs ? 33 - __builtin_clz(maxAbs) : 0;
+                for (int j = 0; j < len && !width; j++) {
+                    if (res[j]) {
+                        width = 1;
+                    }
+                }
+                bw.put((1 << paramBits) - 1, paramBits);
+                bw.put(width, 5);
+                for (int j = 0; j < len; j++) {
+                    bw.put(res[j], width);
+                }
+                mStats.verbatim += len;
+                continue;
+            }
+            bw.put(k, paramBits);
+            for (int j = 0; j < len; j++) {
+                uint32_t u = zigzag(res[j]);
+                bw.putUnary(u >> k);
+                bw.put(u, k);
+            }
+            mStats.residuals += len;
+        }
+    }
+    void writeSubframe(BitWriter& bw, const int32_t* in, int n, int bps)
+    {
+        std::vector<int32_t> x(in, in + n);
+        uint32_t bitsOr = 0;
+        for (auto val: x) {
+            bitsOr |= val;
+        }
+        int wasted = bitsOr ? std::min(__builtin_ctz(bitsOr), bps - 1) : 0;
+        if (wasted) {
+            for (auto& val: x) {
+                val >>= wasted;
+            }
+            bps -= wasted;
+        }
+        bool constant = std::all_of(x.begin(), x.end(), [&x](int32_t val) { return val == x[0]; });
+        Subframe best;
+        best.type = 1;
+        best.cost = (int64_t)n * bps;
+        if (constant) {
+            best.type = 0;
+        } else {
+            std::vector<Subframe> candidates;
+            Subframe sf;
+            for (int order = 0; order <= 4; order++) {
+                if (fixedResidual(x.data(), n, order, sf)) {
+                    sf.cost = residualCost(sf.residual) + order * bps;
+                    candidates.push_back(sf);
+                }
+            }
+            static const int kCoverOrders[] = { 1, 2, 3, 5, 6, 8, 10, 12, 16, 24, 32 };
+            int lpcOrder = mCoverage ? kCoverOrders[mCycle % 11] : 8;
+            int precision = mCoverage ? 5 + mCycle % 11 : (bps > 16 ? 15 : 12);
+            if (lpcResidual(x.data(), n, lpcOrder, precision, sf)) {
+                sf.cost = residualCost(sf.residual) + lpcOrder * (bps + precision) + 9;
+                candidates.push_back(sf);
+            }
+            if (mCoverage) { // cycle through the candidates, and verbatim
+                int idx = mCycle % (candidates.size() + 1);
+                if (idx < (int)candidates.size()) {
+                    best = candidates[idx];
+                }
+            } else {
+                for (auto& cand: candidates) {
+                    if (cand.cost < best.cost) {
+                        best = cand;
+                    }
+                }
+            }
+        }
+        mCycle++;
+        bw.put(0, 1);
+        bw.put(best.type, 6);
+        if (wasted) {
+            bw.put(1, 1);
+            bw.putUnary(wasted - 1);
+        } else {
+            bw.put(0, 1);
+        }
+        if (best.type == 0) {
+            bw.put(x[0], bps);
+            return;
+        } else if (best.type == 1) {
+            for (auto val: x) {
+                bw.put(val, bps);
+            }
+            mStats.verbatim += n;
+            return;
+        }
+        for (int i = 0; i < best.order; i++) {
+            bw.put(x[i], bps);
+        }
+        mStats.verbatim += best.order;
+        if (best.type >= 32) {
+            bw.put(best.precision - 1, 4);
+            bw.put(best.shift, 5);
+            for (int i = 0; i < best.order; i++) {
+                bw.put(best.coefs[i], best.precision);
+            }
+            // same condition as in the decoder
+            bool acc32 = bps + best.precision + 31 - __builtin_clz(best.order) <= 32;
+            (acc32 ? mStats.lpcMacs32 : mStats.lpcMacs64) += (int64_t)(n - best.order) * best.order;
+        } else {
+            mStats.fixedSamples += n - best.order;
+        }
+        writeResidual(bw, best, n);
+    }
+    static void putUtf8(BitWriter& bw, uint32_t val)
+    {
+        if (val < 0x80) {
+            bw.put(val, 8);
+            return;
+        }
+        int extra = 1;
+        while (extra < 5 && val >= (1u << (6 + 5 * extra))) {
+            extra++;
+        }
+        bw.put((0xff00 >> (extra + 1)) | (val >> (6 * extra)), 8);
+        for (int i = extra - 1; i >= 0; i--) {
+            bw.put(0x80 | ((val >> (6 * i)) & 0x3f), 8);
+        }
+    }
+public:
+    FlacEnc(std::vector<uint8_t>& out, int sampleRate, int channels, int bps, int blockSize, bool coverage)
+    : mOut(out), mSampleRate(sampleRate), mChannels(channels), mBps(bps), mBlockSize(blockSize),
+      mCoverage(coverage)
+    {}
+    const Stats& stats() const { return mStats; }
+    // Stream marker and metadata, with an ID3v2 tag before it, and a metadata block
+    // of paddingSize bytes after STREAMINFO
+    void writeHeader(bool id3, int paddingSize)
+    {
+        if (id3) {
+            static const uint8_t kTag[] = { 'I', 'D', '3', 3, 0, 0, 0, 0, 2, 0 }; // 256 bytes
+            mOut.insert(mOut.end(), kTag, kTag + sizeof(kTag));
+            mOut.insert(mOut.end(), 256, 'T');
+        }
+        mOut.insert(mOut.end(), { 'f', 'L', 'a', 'C' });
+        BitWriter bw;
+        bw.put(paddingSize ? 0 : 1, 1); // last metadata block
+        bw.put(0, 7);
+        bw.put(34, 24);
+        bw.put(mBlockSize, 16);
+        bw.put(mBlockSize, 16);
+        bw.put(0, 24); // min and max frame size, set by finish()
+        bw.put(0, 24);
+        bw.put(mSampleRate, 20);
+        bw.put(mChannels - 1, 3);
+        bw.put(mBps - 1, 5);
+        bw.put(0, 32); // total samples and MD5, not known
+        bw.put(0, 4);
+        for (int i = 0; i < 4; i++) {
+            bw.put(0, 32);
+        }
+        mStreamInfoPos = mOut.size() + 4;
+        mOut.insert(mOut.end(), bw.data.begin(), bw.data.end());
+        if (paddingSize) {
+            mOut.push_back(0x80 | 1);
+            mOut.push_back(paddingSize >> 16);
+            mOut.push_back(paddingSize >> 8);
+            mOut.push_back(paddingSize);
+            mOut.insert(mOut.end(), paddingSize, 0);
+        }
+    }
+    // Encodes a frame with the given samples of each channel, n <= block size
+    void writeFrame(const int32_t* const* samples, int n)
+    {
+        BitWriter bw;
+        bw.put(0xfff8, 16);
+        static const int kBlockSizes[] = { 0, 192, 576, 1152, 2304, 4608, 0, 0, 256, 512, 1024, 2048,
+            4096, 8192, 16384, 32768 };
+        int bsCode = std::find(kBlockSizes + 1, kBlockSizes + 16, n) - kBlockSizes;
+        int bsExtra = n - 1;
+        if (bsCode == 16 || (mCoverage && mFrameNum % 4 == 1)) {
+            bsCode = (n <= 256) ? 6 : 7;
+        }
+        static const int kRates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+            32000, 44100, 48000, 96000 };
+        int srCode = 0;
+        int srExtra = 0;
+        if (!(mCoverage && mFrameNum % 3 == 0)) {
+            srCode = std::find(kRates + 1, kRates + 12, mSampleRate) - kRates;
+            if (srCode == 12 || (mCoverage && mFrameNum % 3 == 1)) {
+                if (mSampleRate % 1000 == 0 && mSampleRate / 1000 < 256) {
+                    srCode = 12;
+                    srExtra = mSampleRate / 1000;
+                } else if (mSampleRate < 65536) {
+                    srCode = 13;
+                    srExtra = mSampleRate;
+                } else {
+                    srCode = 14;
+                    srExtra = mSampleRate / 10;
+                }
+            }
+        }
+        bw.put(bsCode, 4);
+        bw.put(srCode, 4);
+        // stereo mode: the cheapest one, or cycled through in coverage mode
+        int mode = 0;
+        std::vector<int32_t> side, mid;
+        if (mChannels == 2) {
+            side.resize(n);
+            mid.resize(n);
+            for (int i = 0; i < n; i++) {
+                side[i] = samples[0][i] - samples[1][i];
+                mid[i] = (samples[0][i] + samples[1][i]) >> 1;
+            }
+            if (mCoverage) {
+                mode = mFrameNum % 4;
+            } else {
+                Subframe sf;
+                int64_t costs[4];
+                const int32_t* chans[4] = { samples[0], samples[1], side.data(), mid.data() };
+                for (int i = 0; i < 4; i++) {
+                    costs[i] = fixedResidual(chans[i], n, 2, sf) ? residualCost(sf.residual) : INT64_MAX / 4;
+                }
+                int64_t modeCosts[4] = { costs[0] + costs[1], costs[0] + costs[2], costs[1] + costs[2],
+                    costs[3] + costs[2] };
+                mode = std::min_element(modeCosts, modeCosts + 4) - modeCosts;
+            }
+        }
+        bw.put(mode ? 7 + mode : mChannels - 1, 4);
+        static const int kBpsCodes[] = { 8, 1, 12, 2, 16, 4, 20, 5, 24, 6 };
+        int bpsCode = 0;
+        if (!(mCoverage && mFrameNum % 5 == 0)) {
+            for (int i = 0; i < 10; i += 2) {
+                if (kBpsCodes[i] == mBps) {
+                    bpsCode = kBpsCodes[i + 1];
+                }
+            }
+        }
+        bw.put(bpsCode, 3);
+        bw.put(0, 1);
+        putUtf8(bw, mFrameNum);
+        if (bsCode == 6) {
+            bw.put(bsExtra, 8);
+        } else if (bsCode == 7) {
+            bw.put(bsExtra, 16);
+        }
+        if (srCode == 12) {
+            bw.put(srExtra, 8);
+        } else if (srCode >= 13) {
+            bw.put(srExtra, 16);
+        }
+        bw.put(crc8(bw.data.data(), bw.data.size()), 8);
+        switch (mode) {
+            case 0:
+                for (int ch = 0; ch < mChannels; ch++) {
+                    writeSubframe(bw, samples[ch], n, mBps);
+                }
+                break;
+            case 1: // left/side
+                writeSubframe(bw, samples[0], n, mBps);
+                writeSubframe(bw, side.data(), n, mBps + 1);
+                break;
+            case 2: // right/side
+                writeSubframe(bw, side.data(), n, mBps + 1);
+                writeSubframe(bw, samples[1], n, mBps);
+                break;
+            default: // mid/side
+                writeSubframe(bw, mid.data(), n, mBps);
+                writeSubframe(bw, side.data(), n, mBps + 1);
+                break;
+        }
+        bw.align();
+        uint16_t crc = crc16(bw.data.data(), bw.data.size());
+        bw.put(crc, 16);
+        mOut.insert(mOut.end(), bw.data.begin(), bw.data.end());
+        int size = bw.data.size();
+        mMinFrameSize = std::min(mMinFrameSize, size);
+        mMaxFrameSize = std::max(mMaxFrameSize, size);
+        mStats.samples += n;
+        mStats.bytes += size;
+        mFrameNum++;
+    }
+    // Sets the min and max frame size in STREAMINFO, unless they should remain unknown
+    void finish(bool knownFrameSize)
+    {
+        if (!knownFrameSize || !mStreamInfoPos) {
+            return;
+        }
+        auto p = &mOut[mStreamInfoPos + 4];
+        for (int i = 0; i < 3; i++) {
+            p[i] = mMinFrameSize >> (16 - 8 * i);
+            p[3 + i] = mMaxFrameSize >> (16 - 8 * i);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,135 @@
+/* Host benchmark of the libmad fixed-point multiply (FPM) configurations. It is
+ * built once per libmad variant (see CMakeLists.txt), decodes the same synthetic
+ * stream, and reports the decode speed and the SNR of the output relative to
+ * that of the reference variant.
+ * libmad has no floating-point build (FPM_FLOAT is not implemented), so the
+ * reference is its most accurate one - FPM_64BIT with rounding and without the
+ * subband synthesis optimization.
+ * Usage: fpmBench [-n frames] [-k kbps] [-o ref.pcm] [-r ref.pcm] [-s minSnr]
+ *   -o  write the decoded samples, to be used as reference
+ *   -r  compare with the reference samples
+ *   -s  exit with a non-zero code if the SNR is below the specified dB
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include <utils.hpp>
+#include "mp3Gen.hpp"
+
+// Decodes the whole stream, returns the elapsed microseconds
+static int64_t decode(const std::vector<uint8_t>& input, std::vector<mad_fixed_t>& pcm)
+{
+    mad_stream stream;
+    mad_frame frame;
+    mad_synth synth;
+    mad_stream_init(&stream);
+    mad_frame_init(&frame);
+    mad_synth_init(&synth);
+    mad_stream_buffer(&stream, input.data(), input.size());
+    pcm.clear();
+    ElapsedTimer timer;
+    int64_t usElapsed = 0;
+    for (;;) {
+        if (mad_frame_decode(&frame, &stream)) {
+            if (MAD_RECOVERABLE(stream.error)) {
+                continue;
+            }
+            break;
+        }
+        mad_synth_frame(&synth, &frame);
+        usElapsed += timer.usElapsed();
+        for (int ch = 0; ch < synth.pcm.channels; ch++) {
+            pcm.insert(pcm.end(), synth.pcm.samples[ch], synth.pcm.samples[ch] + synth.pcm.length);
+        }
+        timer.reset();
+    }
+    mad_synth_finish(&synth);
+    mad_frame_finish(&frame);
+    mad_stream_finish(&stream);
+    return usElapsed;
+}
+
+static bool loadRef(const char* fname, std::vector<mad_fixed_t>& ref)
+{
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        perror("Error opening reference file");
+        return false;
+    }
+    mad_fixed_t buf[1024];
+    size_t len;
+    while ((len = fread(buf, sizeof(buf[0]), 1024, file)) > 0) {
+        ref.insert(ref.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int numFrames = 500;
+    int kbps = 128;
+    const char* outName = nullptr;
+    const char* refName = nullptr;
+    double minSnr = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:o:r:s:")) != -1) {
+        switch (opt) {
+            case 'n': numFrames = atoi(optarg); break;
+            case 'k': kbps = atoi(optarg); break;
+            case 'o': outName = optarg; break;
+            case 'r': refName = optarg; break;
+            case 's': minSnr = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames] [-k kbps] [-o ref.pcm] [-r ref.pcm] [-s minSnr]\n", argv[0]);
+                return 2;
+        }
+    }
+    std::vector<uint8_t> input;
+    Mp3Gen gen(1, false, kbps);
+    gen.setGainRange(80, 130); // loud, but without clipping
+    gen.appendFrames(input, numFrames);
+    input.resize(input.size() + MAD_BUFFER_GUARD);
+
+    std::vector<mad_fixed_t> pcm;
+    int64_t usElapsed = INT64_MAX;
+    for (int i = 0; i < 3; i++) {
+        usElapsed = std::min(usElapsed, decode(input, pcm));
+    }
+    printf("%s: %.0f frames/s", mad_build, numFrames * 1000000.0 / usElapsed);
+    if (outName) {
+        FILE* out = fopen(outName, "wb");
+        if (!out || fwrite(pcm.data(), sizeof(pcm[0]), pcm.size(), out) != pcm.size()) {
+            perror("\nError writing output file");
+            return 1;
+        }
+        fclose(out);
+    }
+    if (!refName) {
+        printf("\n");
+        return 0;
+    }
+    std::vector<mad_fixed_t> ref;
+    if (!loadRef(refName, ref)) {
+        return 1;
+    }
+    if (ref.size() != pcm.size()) {
+        fprintf(stderr, "\nReference has %zu samples, but decoded %zu\n", ref.size(), pcm.size());
+        return 1;
+    }
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < pcm.size(); i++) {
+        double diff = (double)pcm[i] - ref[i];
+        signal += (double)ref[i] * ref[i];
+        noise += diff * diff;
+    }
+    double snr = noise ? 10 * log10(signal / noise) : INFINITY;
+    printf(", SNR %.1f dB\n", snr);
+    if (snr < minSnr) {
+        fprintf(stderr, "SNR is below %.1f dB\n", minSnr);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+/* Host (Linux) stand-in for the subset of the FreeRTOS API used by the player.
+ * Everything is implemented on top of pthreads in freertosShim.cpp
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h> /* pulled in by FreeRTOSConfig.h on the target */
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define portNUM_PROCESSORS 2
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define tskNO_AFFINITY 0x7fffffff
+
+#endif
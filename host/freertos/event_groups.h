@@ -0,0 +1,29 @@
+#ifndef HOST_FREERTOS_EVENT_GROUPS_H
+#define HOST_FREERTOS_EVENT_GROUPS_H
+#include <pthread.h>
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t EventBits_t;
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    EventBits_t bits;
+} StaticEventGroup_t;
+typedef StaticEventGroup_t* EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* mem);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+    BaseType_t clearOnExit, BaseType_t waitForAll, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char* name, uint32_t stackSize,
+    void* arg, UBaseType_t prio, TaskHandle_t* handle, BaseType_t core);
+static inline BaseType_t xTaskCreate(TaskFunction_t func, const char* name, uint32_t stackSize,
+    void* arg, UBaseType_t prio, TaskHandle_t* handle)
+{
+    return xTaskCreatePinnedToCore(func, name, stackSize, arg, prio, handle, tskNO_AFFINITY);
+}
+/* Only deleting the calling task (task == NULL) is supported */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xPortGetCoreID(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,483 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_http_server.h>
+#include <soc/rtc.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <string>
+
+esp_log_level_t hostLogLevel = ESP_LOG_WARN;
+
+struct HostTask
+{
+    pthread_t thread;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond;
+    uint32_t notifyValue = 0;
+    TaskFunction_t func = nullptr;
+    void* arg = nullptr;
+    std::string name;
+    BaseType_t core = tskNO_AFFINITY;
+    HostTask()
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+};
+
+static thread_local HostTask* tlsCurrentTask = nullptr;
+
+static void condInitMonotonic(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static timespec ticksToDeadline(TickType_t ticks)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec += ns % 1000000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+// Waits on cond until pred() is true. Returns false on timeout.
+// Must be called with mutex locked
+template <class P>
+static bool condWait(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t ticks, P pred)
+{
+    if (ticks == portMAX_DELAY) {
+        while (!pred()) {
+            pthread_cond_wait(cond, mutex);
+        }
+        return true;
+    }
+    auto deadline = ticksToDeadline(ticks);
+    while (!pred()) {
+        if (pthread_cond_timedwait(cond, mutex, &deadline) == ETIMEDOUT) {
+            return pred();
+        }
+    }
+    return true;
+}
+
+static void* taskEntry(void* ctx)
+{
+    auto task = static_cast<HostTask*>(ctx);
+    tlsCurrentTask = task;
+    pthread_setname_np(pthread_self(), task->name.substr(0, 15).c_str());
+    task->func(task->arg);
+    return nullptr;
+}
+
+extern "C" {
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char* name, uint32_t stackSize,
+    void* arg, UBaseType_t prio, TaskHandle_t* handle, BaseType_t core)
+{
+    auto task = new HostTask;
+    task->func = func;
+    task->arg = arg;
+    task->name = name ? name : "task";
+    task->core = core;
+    if (handle) {
+        *handle = task;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // The ESP32 stack sizes are tuned for a 32-bit target, give some headroom
+    pthread_attr_setstacksize(&attr, stackSize * 4 + 65536);
+    auto ret = pthread_create(&task->thread, &attr, taskEntry, task);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        if (handle) {
+            *handle = nullptr;
+        }
+        delete task;
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task && task != tlsCurrentTask) {
+        ESP_LOGE("SHIM", "vTaskDelete: Deleting another task is not supported");
+        abort();
+    }
+    // The task object is intentionally leaked - a stale handle may still
+    // be notified by another thread
+    pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    timespec ts = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!tlsCurrentTask) { // a thread not created via xTaskCreate, i.e. main()
+        auto task = new HostTask;
+        task->thread = pthread_self();
+        task->name = "main";
+        tlsCurrentTask = task;
+    }
+    return tlsCurrentTask;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    auto task = xTaskGetCurrentTaskHandle();
+    return (task->core == tskNO_AFFINITY) ? 0 : task->core;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->mutex);
+    task->notifyValue++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    auto task = xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&task->mutex);
+    condWait(&task->cond, &task->mutex, ticks, [task]() { return task->notifyValue != 0; });
+    auto ret = task->notifyValue;
+    if (ret) {
+        task->notifyValue = clearOnExit ? 0 : ret - 1;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return ret;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* mem)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mem->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return mem;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&sem->mutex) == 0;
+    }
+    auto deadline = ticksToDeadline(ticks);
+    return pthread_mutex_clocklock(&sem->mutex, CLOCK_MONOTONIC, &deadline) == 0;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    return pthread_mutex_unlock(&sem->mutex) == 0;
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* mem)
+{
+    pthread_mutex_init(&mem->mutex, nullptr);
+    condInitMonotonic(&mem->cond);
+    mem->bits = 0;
+    return mem;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->mutex);
+    auto ret = group->bits;
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    auto ret = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    auto ret = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+    BaseType_t clearOnExit, BaseType_t waitForAll, TickType_t ticks)
+{
+    pthread_mutex_lock(&group->mutex);
+    auto satisfied = [group, bits, waitForAll]() {
+        return waitForAll ? ((group->bits & bits) == bits) : ((group->bits & bits) != 0);
+    };
+    bool ok = condWait(&group->cond, &group->mutex, ticks, satisfied);
+    auto ret = group->bits;
+    if (ok && clearOnExit) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t len, UBaseType_t itemSize, uint8_t* storage, StaticQueue_t* mem)
+{
+    pthread_mutex_init(&mem->mutex, nullptr);
+    condInitMonotonic(&mem->cond);
+    mem->storage = storage;
+    mem->len = len;
+    mem->itemSize = itemSize;
+    mem->head = mem->count = 0;
+    return mem;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (!condWait(&q->cond, &q->mutex, ticks, [q]() { return q->count < q->len; })) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    auto idx = (q->head + q->count) % q->len;
+    memcpy(q->storage + idx * q->itemSize, item, q->itemSize);
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (!condWait(&q->cond, &q->mutex, ticks, [q]() { return q->count > 0; })) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    memcpy(item, q->storage + q->head * q->itemSize, q->itemSize);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->mutex);
+    auto ret = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    hostLogLevel = level;
+}
+
+const char* esp_err_to_name(esp_err_t err)
+{
+    switch (err) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        default: return "(unknown)";
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+} // extern "C"
+
+// Each running timer has its own thread, which sleeps until the timer expires
+// or is stopped
+struct HostTimer
+{
+    esp_timer_create_args_t args;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint64_t period = 0;
+    bool isOneShot = true;
+    bool running = false;
+    bool stopRequest = false;
+    HostTimer(const esp_timer_create_args_t& aArgs): args(aArgs)
+    {
+        condInitMonotonic(&cond);
+    }
+    static void* threadFunc(void* ctx)
+    {
+        auto self = static_cast<HostTimer*>(ctx);
+        pthread_mutex_lock(&self->mutex);
+        for (;;) {
+            auto deadline = ticksToDeadline(0);
+            uint64_t ns = deadline.tv_nsec + self->period * 1000;
+            deadline.tv_sec += ns / 1000000000;
+            deadline.tv_nsec = ns % 1000000000;
+            while (!self->stopRequest) {
+                if (pthread_cond_timedwait(&self->cond, &self->mutex, &deadline) == ETIMEDOUT) {
+                    break;
+                }
+            }
+            if (self->stopRequest) {
+                break;
+            }
+            pthread_mutex_unlock(&self->mutex);
+            self->args.callback(self->args.arg);
+            pthread_mutex_lock(&self->mutex);
+            if (self->isOneShot) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&self->mutex);
+        return nullptr;
+    }
+    esp_err_t start(uint64_t us, bool oneShot)
+    {
+        if (running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        period = us;
+        isOneShot = oneShot;
+        stopRequest = false;
+        running = true;
+        return pthread_create(&thread, nullptr, threadFunc, this) ? ESP_FAIL : ESP_OK;
+    }
+    esp_err_t stop()
+    {
+        if (!running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        pthread_mutex_lock(&mutex);
+        stopRequest = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+        if (pthread_equal(thread, pthread_self())) {
+            pthread_detach(thread); // stopped from within the callback
+        } else {
+            pthread_join(thread, nullptr);
+        }
+        running = false;
+        return ESP_OK;
+    }
+};
+
+extern "C" {
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle)
+{
+    *handle = new HostTimer(*args);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t us)
+{
+    return timer->start(us, true);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t us)
+{
+    return timer->start(us, false);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    return timer->stop();
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer->running) {
+        timer->stop();
+    }
+    if (pthread_equal(timer->thread, pthread_self())) {
+        return ESP_OK; // deleted from within its own callback, leak it
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return mallinfo2().fordblks;
+}
+
+void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t* out_config)
+{
+    out_config->source_freq_mhz = 480;
+    out_config->div = 2;
+    out_config->freq_mhz = 240;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t* req)
+{
+    return 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+char* itoa(int value, char* str, int base)
+{
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char* wptr = str;
+    unsigned uval = (value < 0 && base == 10) ? -(unsigned)value : (unsigned)value;
+    do {
+        *wptr++ = digits[uval % base];
+        uval /= base;
+    } while (uval);
+    if (value < 0 && base == 10) {
+        *wptr++ = '-';
+    }
+    *wptr = 0;
+    for (char* start = str; start < --wptr; start++) {
+        char ch = *start;
+        *start = *wptr;
+        *wptr = ch;
+    }
+    return str;
+}
+
+} // extern "C"
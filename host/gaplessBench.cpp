@@ -0,0 +1,294 @@
+/* Host test of gapless MP3 playback. Synthetic tracks start with an Info tag
+ * frame with the LAME encoder delay and padding, and are played back-to-back by
+ * a source that signals the track boundaries like HttpNode, by toggling the
+ * format counter. The output of each track must be exactly its decoded audio
+ * without the delay and padding - the same samples as a decode of the track on
+ * its own, with no tag frame - and the tracks must follow each other with nothing
+ * in between. Runs through DecoderNode with and without DemuxNode. A seek by
+ * time within a track must keep the trimming of its end, and of its start after
+ * a seek back to it
+ * Usage: gaplessBench [-r repeats] [-w wrapSize] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utils.hpp>
+#include <decoderNode.hpp>
+#include <demuxNode.hpp>
+#include <mp3InfoTag.hpp>
+#include "mp3Gen.hpp"
+
+// Plays the tracks one after the other, switching to the format of the next
+// track once the previous one has been consumed
+class TrackSourceNode: public AudioNode
+{
+protected:
+    const std::vector<std::vector<uint8_t>>& mTracks;
+    int mWrapSize;
+    size_t mTrack = 0;
+    size_t mPos = 0;
+    StreamFormat mFmt;
+    bool mFlushPending = false;
+public:
+    TrackSourceNode(const std::vector<std::vector<uint8_t>>& tracks, int wrapSize)
+    : AudioNode("tracksrc"), mTracks(tracks), mWrapSize(wrapSize), mFmt(kCodecMp3) {}
+    virtual Type type() const { return kTypeUnknown; }
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout)
+    {
+        if (mFlushPending) {
+            mFlushPending = false;
+            return kStreamFlush;
+        }
+        while (mPos >= mTracks[mTrack].size()) {
+            if (mTrack + 1 >= mTracks.size()) {
+                return kStreamStopped;
+            }
+            mTrack++;
+            mPos = 0;
+            mFmt.reset();
+            mFmt.codec = kCodecMp3;
+        }
+        dpr.fmt = mFmt;
+        if (!dpr.size) {
+            return kNoError;
+        }
+        auto& data = mTracks[mTrack];
+        dpr.buf = (char*)data.data() + mPos;
+        dpr.size = std::min(dpr.size, (int)(data.size() - mPos));
+        if (mWrapSize) {
+            dpr.size = std::min(dpr.size, (int)(mWrapSize - mPos % mWrapSize));
+        }
+        return kNoError;
+    }
+    virtual void confirmRead(int size) { mPos += size; }
+    // within the current track
+    virtual bool seekToByte(int64_t pos)
+    {
+        mPos = std::min((size_t)pos, mTracks[mTrack].size());
+        mFlushPending = true;
+        return true;
+    }
+};
+
+struct Track
+{
+    bool mono;
+    int frames;
+    int encoderDelay;
+    int padding;
+    std::vector<uint8_t> data; // with the Info tag
+    std::vector<uint8_t> audio; // without it
+};
+
+static void putBe(uint8_t* p, uint32_t val)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = val >> (8 * (3 - i));
+    }
+}
+
+// Info tag frame of a 128 kbps, 44.1 kHz stream, as LAME writes for CBR files.
+// The side info is all zero, so the frame decodes to silence
+static void putInfoFrame(std::vector<uint8_t>& out, const Track& track, uint32_t bytes)
+{
+    std::vector<uint8_t> frame(144 * 128000 / 44100, 0);
+    frame[0] = 0xff;
+    frame[1] = 0xfb;
+    frame[2] = 9 << 4; // 128 kbps
+    frame[3] = track.mono ? 0xc0 : 0;
+    int pos = 4 + (track.mono ? 17 : 32);
+    memcpy(&frame[pos], "Info", 4);
+    putBe(&frame[pos + 4], Mp3InfoTag::kHasFrames | Mp3InfoTag::kHasBytes | Mp3InfoTag::kHasToc);
+    putBe(&frame[pos + 8], track.frames);
+    putBe(&frame[pos + 12], bytes);
+    for (int i = 0; i < 100; i++) {
+        frame[pos + 16 + i] = i * 256 / 100;
+    }
+    pos += 116;
+    memcpy(&frame[pos], "LAME3.100", 9);
+    frame[pos + 21] = track.encoderDelay >> 4;
+    frame[pos + 22] = ((track.encoderDelay & 0x0f) << 4) | (track.padding >> 8);
+    frame[pos + 23] = track.padding;
+    out.insert(out.end(), frame.begin(), frame.end());
+}
+
+static void makeTrack(Track& track, uint32_t seed)
+{
+    Mp3Gen gen(seed, track.mono, 128);
+    gen.appendFrames(track.audio, track.frames); // ends with the last frame
+    putInfoFrame(track.data, track, 0);
+    putBe(&track.data[4 + (track.mono ? 17 : 32) + 12], track.data.size() + track.audio.size());
+    track.data.insert(track.data.end(), track.audio.begin(), track.audio.end());
+}
+
+struct Result
+{
+    std::vector<uint8_t> pcm;
+    int64_t usElapsed = 0;
+};
+
+// Pulls the decoded stream, as I2sOutputNode does
+static bool play(const std::vector<std::vector<uint8_t>>& tracks, bool demux, int wrapSize, Result& res)
+{
+    TrackSourceNode src(tracks, wrapSize);
+    DemuxNode demuxer;
+    DecoderNode decoder;
+    if (demux) {
+        demuxer.linkToPrev(&src);
+        decoder.linkToPrev(&demuxer);
+    } else {
+        decoder.linkToPrev(&src);
+    }
+    for (;;) {
+        PcmBlockRef block;
+        ElapsedTimer timer;
+        auto err = decoder.pullBlock(block, -1);
+        res.usElapsed += timer.usElapsed();
+        if (err == AudioNode::kStreamStopped) {
+            return true;
+        } else if (err) {
+            fprintf(stderr, "pull error %d\n", err);
+            return false;
+        }
+        res.pcm.insert(res.pcm.end(), block->data, block->data + block->size);
+    }
+}
+
+// Seeks by time within the track, after its first block is output. Decoding
+// restarts from a frame near the time, so the output differs from that of the
+// whole track for the first frames after the seek, and then must be the same
+// up to the trimmed end of the track. A seek to the start must output the whole
+// trimmed track
+static bool checkSeek(const Track& track, const std::vector<uint8_t>& trimmed, int ms, int wrapSize)
+{
+    std::vector<std::vector<uint8_t>> streams = { track.data };
+    TrackSourceNode src(streams, wrapSize);
+    DemuxNode demuxer;
+    DecoderNode decoder;
+    demuxer.linkToPrev(&src);
+    decoder.linkToPrev(&demuxer);
+    std::vector<uint8_t> pcm;
+    bool seekRequested = false;
+    bool flushed = false;
+    for (;;) {
+        PcmBlockRef block;
+        auto err = decoder.pullBlock(block, -1);
+        if (err == AudioNode::kStreamStopped) {
+            break;
+        } else if (err == AudioNode::kStreamFlush && seekRequested && !flushed) {
+            flushed = true;
+            pcm.clear();
+            continue;
+        } else if (err) {
+            fprintf(stderr, "seek to %d ms: pull error %d\n", ms, err);
+            return false;
+        }
+        pcm.insert(pcm.end(), block->data, block->data + block->size);
+        if (!seekRequested) {
+            if (!demuxer.seekToTime(ms)) {
+                fprintf(stderr, "seek to %d ms: seek refused\n", ms);
+                return false;
+            }
+            seekRequested = true;
+        }
+    }
+    if (!flushed) {
+        fprintf(stderr, "seek to %d ms: the seek was not done\n", ms);
+        return false;
+    }
+    size_t warmup = ms ? 2 * 1152 * 4 : 0;
+    if (pcm.size() <= warmup || pcm.size() > trimmed.size() || (!ms && pcm.size() != trimmed.size())
+        || !std::equal(pcm.begin() + warmup, pcm.end(), trimmed.end() - (pcm.size() - warmup))) {
+        fprintf(stderr, "seek to %d ms: the output is not the trimmed end of the track (%zu of %zu bytes)\n",
+            ms, pcm.size(), trimmed.size());
+        return false;
+    }
+    printf("seek to %4d ms   %7zu bytes of PCM, trimmed\n", ms, pcm.size());
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 3;
+    int wrapSize = 5003; // so that frames straddle the wrap-around point
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:v")) != -1) {
+        switch (opt) {
+            case 'r': repeats = std::max(1, atoi(optarg)); break;
+            case 'w': wrapSize = atoi(optarg); break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repeats] [-w wrapSize] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    esp_log_level_set("*", verbose ? ESP_LOG_DEBUG : ESP_LOG_ERROR);
+    // the mono track changes the output format, and is decoded from a reset state
+    std::vector<Track> tracks = {
+        { false, 120, 576, 1152 + 600, {}, {} },
+        { false, 3, 576, 1000, {}, {} }, // shorter than the delay and padding of a frame
+        { false, 150, 1105, 529, {}, {} },
+        { true, 80, 576, 1300, {}, {} },
+        { false, 90, 576, 2000, {}, {} }
+    };
+    std::vector<std::vector<uint8_t>> streams;
+    std::vector<std::vector<uint8_t>> trimmed;
+    std::vector<uint8_t> expected;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        auto& track = tracks[i];
+        makeTrack(track, i + 1);
+        streams.push_back(track.data);
+        // the track decoded on its own, trimmed
+        Result ref;
+        if (!play({ track.audio }, false, 0, ref)) {
+            fprintf(stderr, "track %zu: reference decode failed\n", i);
+            return 1;
+        }
+        int sampleSize = (track.mono ? 1 : 2) * 2;
+        int64_t start = (track.encoderDelay + Mp3InfoTag::kDecoderDelay) * sampleSize;
+        int64_t len = ((int64_t)track.frames * 1152 - track.encoderDelay - track.padding) * sampleSize;
+        if ((int64_t)ref.pcm.size() < start + len) {
+            fprintf(stderr, "track %zu: reference decode is too short\n", i);
+            return 1;
+        }
+        trimmed.emplace_back(ref.pcm.begin() + start, ref.pcm.begin() + start + len);
+        expected.insert(expected.end(), trimmed.back().begin(), trimmed.back().end());
+    }
+    for (int demux = 0; demux < 2; demux++) {
+        const char* name = demux ? "demuxed" : "decoder framing";
+        Result res;
+        if (!play(streams, demux, wrapSize, res)) {
+            fprintf(stderr, "%s: decode failed\n", name);
+            return 1;
+        }
+        if (res.pcm != expected) {
+            size_t diff = 0;
+            while (diff < std::min(res.pcm.size(), expected.size()) && res.pcm[diff] == expected[diff]) {
+                diff++;
+            }
+            fprintf(stderr, "%s: output differs from the trimmed tracks at byte %zu (%zu vs %zu bytes)\n",
+                name, diff, res.pcm.size(), expected.size());
+            return 1;
+        }
+        for (int i = 1; i < repeats; i++) {
+            Result rerun;
+            play(streams, demux, wrapSize, rerun);
+            res.usElapsed = std::min(res.usElapsed, rerun.usElapsed);
+        }
+        printf("%-16s %zu tracks, %7zu bytes of PCM, %.2f ms decode\n", name, tracks.size(),
+            res.pcm.size(), res.usElapsed / 1000.0);
+    }
+    // forward to the middle of the track, and back to its start
+    for (int ms: { 1500, 0 }) {
+        if (!checkSeek(tracks[0], trimmed[0], ms, wrapSize)) {
+            return 1;
+        }
+    }
+    printf("All tracks trimmed and joined\n");
+    return 0;
+}
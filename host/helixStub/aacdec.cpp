@@ -0,0 +1,103 @@
+#include "aacdec.h"
+#include <adts.hpp>
+
+struct StubDecoder
+{
+    AACFrameInfo info;
+    bool raw = false;
+    int rawChans = 0;
+    int rawSampleRate = 0;
+};
+
+HAACDecoder AACInitDecoder(void)
+{
+    return new StubDecoder();
+}
+
+void AACFreeDecoder(HAACDecoder hAACDecoder)
+{
+    delete static_cast<StubDecoder*>(hAACDecoder);
+}
+
+int AACDecode(HAACDecoder hAACDecoder, unsigned char** inbuf, int* bytesLeft, short* outbuf)
+{
+    auto dec = static_cast<StubDecoder*>(hAACDecoder);
+    if (!dec || !inbuf || !bytesLeft || !outbuf) {
+        return ERR_AAC_NULL_POINTER;
+    }
+    const uint8_t* data;
+    int dataLen, frameSize, channels, sampleRate, objectType;
+    if (dec->raw) {
+        if (*bytesLeft <= 0) {
+            return ERR_AAC_INDATA_UNDERFLOW;
+        }
+        data = *inbuf;
+        dataLen = frameSize = *bytesLeft;
+        channels = dec->rawChans;
+        sampleRate = dec->rawSampleRate;
+        objectType = dec->info.profile + 1;
+    } else {
+        if (*bytesLeft < AdtsHeader::kHeaderSize) {
+            return ERR_AAC_INDATA_UNDERFLOW;
+        }
+        AdtsHeader hdr;
+        if (!hdr.parse(*inbuf)) {
+            return ERR_AAC_INVALID_ADTS_HEADER;
+        }
+        if (*bytesLeft < hdr.frameSize) {
+            return ERR_AAC_INDATA_UNDERFLOW;
+        }
+        data = *inbuf + hdr.headerSize();
+        dataLen = hdr.frameSize - hdr.headerSize();
+        frameSize = hdr.frameSize;
+        channels = hdr.channels;
+        sampleRate = hdr.sampleRate;
+        objectType = hdr.objectType;
+    }
+    *inbuf += frameSize;
+    *bytesLeft -= frameSize;
+    if (data[0] == 0xee) {
+        return ERR_AAC_INVALID_FRAME;
+    }
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < dataLen; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    bool sbr = sampleRate <= 24000;
+    int nsamples = channels * AAC_MAX_NSAMPS * (sbr ? 2 : 1);
+    for (int i = 0; i < nsamples; i++) {
+        hash = hash * 1103515245 + 12345;
+        outbuf[i] = hash >> 16;
+    }
+    auto& info = dec->info;
+    info.nChans = channels;
+    info.sampRateCore = sampleRate;
+    info.sampRateOut = sampleRate * (sbr ? 2 : 1);
+    info.bitRate = frameSize * 8 * sampleRate / AAC_MAX_NSAMPS;
+    info.bitsPerSample = 16;
+    info.outputSamps = nsamples;
+    info.profile = objectType - 1;
+    info.tnsUsed = info.pnsUsed = 0;
+    return ERR_AAC_NONE;
+}
+
+void AACGetLastFrameInfo(HAACDecoder hAACDecoder, AACFrameInfo* aacFrameInfo)
+{
+    *aacFrameInfo = static_cast<StubDecoder*>(hAACDecoder)->info;
+}
+
+int AACSetRawBlockParams(HAACDecoder hAACDecoder, int copyLast, AACFrameInfo* aacFrameInfo)
+{
+    auto dec = static_cast<StubDecoder*>(hAACDecoder);
+    if (!dec || !aacFrameInfo) {
+        return ERR_AAC_NULL_POINTER;
+    }
+    if (aacFrameInfo->nChans < 1 || aacFrameInfo->nChans > AAC_MAX_NCHANS || aacFrameInfo->sampRateCore <= 0) {
+        return ERR_AAC_INVALID_FRAME;
+    }
+    dec->raw = true;
+    dec->rawChans = aacFrameInfo->nChans;
+    dec->rawSampleRate = aacFrameInfo->sampRateCore;
+    dec->info.profile = aacFrameInfo->profile;
+    return ERR_AAC_NONE;
+}
@@ -0,0 +1,52 @@
+#ifndef HOST_HELIX_STUB_AACDEC_H
+#define HOST_HELIX_STUB_AACDEC_H
+/* Stand-in for the Helix AAC decoder API, used by the host build when the real
+ * decoder is not available (see AAC_HELIX_DIR in CMakeLists.txt). It validates
+ * the ADTS framing of the input and outputs PCM derived from a hash of the frame
+ * data, so that DecoderAac's framing and buffering can be tested without real
+ * AAC streams. Frames with a 0xee byte right after the header fail to decode.
+ * Streams with a samplerate of 24 kHz or less are output at twice that rate,
+ * like HE-AAC with implicit SBR signalling. After AACSetRawBlockParams(), the
+ * input is taken as raw access units (as demuxed from MP4), with the whole
+ * input being the frame data
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AAC_MAX_NCHANS 2
+#define AAC_MAX_NSAMPS 1024
+
+enum {
+    ERR_AAC_NONE = 0,
+    ERR_AAC_INDATA_UNDERFLOW = -1,
+    ERR_AAC_NULL_POINTER = -2,
+    ERR_AAC_INVALID_ADTS_HEADER = -3,
+    ERR_AAC_INVALID_FRAME = -5
+};
+
+typedef void* HAACDecoder;
+
+typedef struct _AACFrameInfo {
+    int bitRate;
+    int nChans;
+    int sampRateCore;
+    int sampRateOut;
+    int bitsPerSample;
+    int outputSamps;
+    int profile;
+    int tnsUsed;
+    int pnsUsed;
+} AACFrameInfo;
+
+HAACDecoder AACInitDecoder(void);
+void AACFreeDecoder(HAACDecoder hAACDecoder);
+int AACDecode(HAACDecoder hAACDecoder, unsigned char** inbuf, int* bytesLeft, short* outbuf);
+void AACGetLastFrameInfo(HAACDecoder hAACDecoder, AACFrameInfo* aacFrameInfo);
+int AACSetRawBlockParams(HAACDecoder hAACDecoder, int copyLast, AACFrameInfo* aacFrameInfo);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
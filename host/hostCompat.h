@@ -0,0 +1,18 @@
+#ifndef HOST_COMPAT_H
+#define HOST_COMPAT_H
+/* Force-included in all host sources. Provides the newlib extensions that the
+ * ESP32 code uses, but glibc lacks
+ */
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+char* itoa(int value, char* str, int base);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+/* Host benchmark of libmad frame decoding and synthesis, comparing the serial
+ * decode with the one that hands the second stereo channel off to a CoreWorker,
+ * the reduced-quality decode modes (see Decoder::Quality) with full quality, and
+ * the decode with downmix to mono (MAD_OPTION_SINGLECHANNEL) with the stereo one.
+ * Usage: madBench [-n frames] [-k kbps] [-r repeats]
+ * Exits with a non-zero code if the parallel decode output is not bit-exact
+ * with the serial one, a reduced-quality mode outputs the wrong sample count,
+ * or the mono output differs from the downmixed stereo output by more than
+ * rounding errors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include <coreWorker.hpp>
+#include <utils.hpp>
+#include "mp3Gen.hpp"
+
+// Decodes the whole stream, appending the synthesized PCM to pcm, if specified.
+// Returns the elapsed microseconds
+// options and sblimit select the quality mode, as set by DecoderMp3
+static int64_t decode(const std::vector<uint8_t>& input, const mad_worker* worker,
+    std::vector<mad_fixed_t>* pcm, int options=0, unsigned sblimit=32)
+{
+    mad_stream stream;
+    mad_frame frame;
+    mad_synth synth;
+    mad_stream_init(&stream);
+    mad_frame_init(&frame);
+    mad_synth_init(&synth);
+    frame.worker = worker;
+    frame.sblimit = sblimit;
+    mad_stream_options(&stream, options);
+    mad_stream_buffer(&stream, input.data(), input.size());
+    ElapsedTimer timer;
+    int64_t usElapsed = 0;
+    for (;;) {
+        if (mad_frame_decode(&frame, &stream)) {
+            if (MAD_RECOVERABLE(stream.error)) {
+                continue;
+            }
+            break;
+        }
+        mad_synth_frame(&synth, &frame);
+        if (pcm) {
+            usElapsed += timer.usElapsed();
+            for (int ch = 0; ch < synth.pcm.channels; ch++) {
+                pcm->insert(pcm->end(), synth.pcm.samples[ch], synth.pcm.samples[ch] + synth.pcm.length);
+            }
+            timer.reset();
+        }
+    }
+    usElapsed += timer.usElapsed();
+    mad_synth_finish(&synth);
+    mad_frame_finish(&frame);
+    mad_stream_finish(&stream);
+    return usElapsed;
+}
+
+// About the accuracy of the SSO synthesis itself
+enum { kMinMonoSnr = 50 };
+
+int main(int argc, char** argv)
+{
+    int numFrames = 1000;
+    int kbps = 320;
+    int repeats = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:r:")) != -1) {
+        switch (opt) {
+            case 'n': numFrames = atoi(optarg); break;
+            case 'k': kbps = atoi(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames] [-k kbps] [-r repeats]\n", argv[0]);
+                return 2;
+        }
+    }
+    std::vector<uint8_t> input;
+    Mp3Gen(1, false, kbps).appendFrames(input, numFrames);
+    input.resize(input.size() + MAD_BUFFER_GUARD);
+
+    CoreWorker worker(1, 15);
+    if (!worker.isRunning()) {
+        fprintf(stderr, "Error starting worker\n");
+        return 1;
+    }
+    std::vector<mad_fixed_t> serialPcm, parallelPcm;
+    decode(input, nullptr, &serialPcm);
+    decode(input, worker.madWorker(), &parallelPcm);
+    if (serialPcm.size() != (size_t)numFrames * Mp3Gen::samplesPerFrame() * 2) {
+        fprintf(stderr, "Expected %d frames, but got %zu samples\n", numFrames, serialPcm.size() / 2);
+        return 1;
+    }
+    if (serialPcm != parallelPcm) {
+        fprintf(stderr, "Parallel decode output differs from the serial one\n");
+        return 1;
+    }
+    int64_t usSerial = INT64_MAX, usParallel = INT64_MAX;
+    for (int i = 0; i < repeats; i++) {
+        usSerial = std::min(usSerial, decode(input, nullptr, nullptr));
+        usParallel = std::min(usParallel, decode(input, worker.madWorker(), nullptr));
+    }
+    printf("%d kbps stereo, %d frames: serial %.1f us/frame, parallel %.1f us/frame, speedup %.2fx (%ld cpus)\n",
+        kbps, numFrames, (double)usSerial / numFrames, (double)usParallel / numFrames,
+        (double)usSerial / usParallel, sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct QualityMode { const char* name; int options; unsigned sblimit; };
+    static const QualityMode kModes[] = {
+        { "half rate", MAD_OPTION_HALFSAMPLERATE, 16 },
+        { "16 bands", 0, 16 },
+        { "8 bands", 0, 8 }
+    };
+    for (auto& mode: kModes) {
+        std::vector<mad_fixed_t> pcm;
+        decode(input, nullptr, &pcm, mode.options, mode.sblimit);
+        auto expected = serialPcm.size() / ((mode.options & MAD_OPTION_HALFSAMPLERATE) ? 2 : 1);
+        if (pcm.size() != expected) {
+            fprintf(stderr, "%s: expected %zu samples, but got %zu\n", mode.name, expected, pcm.size());
+            return 1;
+        }
+        int64_t usElapsed = INT64_MAX;
+        for (int i = 0; i < repeats; i++) {
+            usElapsed = std::min(usElapsed, decode(input, nullptr, nullptr, mode.options, mode.sblimit));
+        }
+        printf("%s: %.1f us/frame, %.0f%% of full quality\n", mode.name, (double)usElapsed / numFrames,
+            100.0 * usElapsed / usSerial);
+    }
+
+    // The mono decode downmixes in the frequency domain, compare it with
+    // downmixing the decoded stereo channels. The default stream clips, which
+    // makes the decode non-linear, so a quieter one is used for that
+    std::vector<uint8_t> quietInput;
+    Mp3Gen quietGen(1, false, kbps);
+    quietGen.setGainRange(80, 130);
+    quietGen.appendFrames(quietInput, numFrames);
+    quietInput.resize(quietInput.size() + MAD_BUFFER_GUARD);
+    std::vector<mad_fixed_t> stereoPcm, monoPcm;
+    decode(quietInput, nullptr, &stereoPcm);
+    decode(quietInput, nullptr, &monoPcm, MAD_OPTION_SINGLECHANNEL);
+    if (monoPcm.size() != stereoPcm.size() / 2) {
+        fprintf(stderr, "mono: expected %zu samples, but got %zu\n", stereoPcm.size() / 2, monoPcm.size());
+        return 1;
+    }
+    const int frameLen = Mp3Gen::samplesPerFrame();
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < monoPcm.size(); i++) {
+        size_t left = (i / frameLen) * frameLen * 2 + i % frameLen; // frames are stored as L block, R block
+        double mix = ((double)stereoPcm[left] + stereoPcm[left + frameLen]) / 2;
+        double diff = monoPcm[i] - mix;
+        signal += mix * mix;
+        noise += diff * diff;
+    }
+    double snr = noise ? 10 * log10(signal / noise) : INFINITY;
+    int64_t usStereo = INT64_MAX, usMono = INT64_MAX;
+    for (int i = 0; i < repeats; i++) {
+        usStereo = std::min(usStereo, decode(quietInput, nullptr, nullptr));
+        usMono = std::min(usMono, decode(quietInput, nullptr, nullptr, MAD_OPTION_SINGLECHANNEL));
+    }
+    printf("mono: %.1f us/frame, %.0f%% of stereo, SNR vs downmixed stereo %.1f dB\n",
+        (double)usMono / numFrames, 100.0 * usMono / usStereo, snr);
+    if (snr < kMinMonoSnr) {
+        fprintf(stderr, "Mono output differs from the downmixed stereo output, SNR below %d dB\n", kMinMonoSnr);
+        return 1;
+    }
+    return 0;
+}
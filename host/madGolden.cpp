@@ -0,0 +1,181 @@
+/* Golden-output test of libmad. Decodes a corpus of synthetic streams (several
+ * bitrates, stereo and mono), plus any MP3 files given, and compares a hash of
+ * the output of each one with the hash recorded in the golden file. Used to
+ * verify that decoder optimizations are bit-exact. Also reports the average
+ * time spent in frame decoding (everything before synthesis) and in synthesis,
+ * the best of several runs.
+ * Usage: madGolden [-w] [-r runs] golden.txt [file.mp3...]
+ *   -w  (re)write the golden file instead of comparing with it
+ * The hashes depend on the libmad configuration, the golden file is for the
+ * default host one
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+#include "mp3Gen.hpp"
+
+struct Result
+{
+    uint64_t hash = 1469598103934665603ULL; // FNV-1a
+    int frames = 0;
+    int64_t usDecode = 0;
+    int64_t usSynth = 0;
+    void addSamples(const mad_fixed_t* samples, int count)
+    {
+        auto bytes = (const uint8_t*)samples;
+        for (size_t i = 0; i < count * sizeof(mad_fixed_t); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+};
+
+static Result decode(const std::vector<uint8_t>& input)
+{
+    mad_stream stream;
+    mad_frame frame;
+    mad_synth synth;
+    mad_stream_init(&stream);
+    mad_frame_init(&frame);
+    mad_synth_init(&synth);
+    mad_stream_buffer(&stream, input.data(), input.size());
+    Result result;
+    for (;;) {
+        ElapsedTimer timer;
+        auto err = mad_frame_decode(&frame, &stream);
+        result.usDecode += timer.usElapsed();
+        if (err) {
+            if (MAD_RECOVERABLE(stream.error)) {
+                continue;
+            }
+            break;
+        }
+        timer.reset();
+        mad_synth_frame(&synth, &frame);
+        result.usSynth += timer.usElapsed();
+        result.frames++;
+        for (int ch = 0; ch < synth.pcm.channels; ch++) {
+            result.addSamples(synth.pcm.samples[ch], synth.pcm.length);
+        }
+    }
+    mad_synth_finish(&synth);
+    mad_frame_finish(&frame);
+    mad_stream_finish(&stream);
+    return result;
+}
+
+static bool loadFile(const char* fname, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        perror("Error opening input file");
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool write = false;
+    int runs = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "wr:")) != -1) {
+        switch (opt) {
+            case 'w': write = true; break;
+            case 'r': runs = std::max(1, atoi(optarg)); break;
+            default:
+                fprintf(stderr, "Usage: %s [-w] [-r runs] golden.txt [file.mp3...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Golden file not specified\n");
+        return 2;
+    }
+    const char* goldenName = argv[optind++];
+    std::map<std::string, uint64_t> golden;
+    if (!write) {
+        FILE* file = fopen(goldenName, "r");
+        if (!file) {
+            perror("Error opening golden file");
+            return 1;
+        }
+        char name[256];
+        unsigned long long hash;
+        while (fscanf(file, "%255s %llx", name, &hash) == 2) {
+            golden[name] = hash;
+        }
+        fclose(file);
+    }
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> corpus;
+    static const int kBitrates[] = { 32, 64, 128, 192, 320 };
+    for (int mono = 0; mono < 2; mono++) {
+        for (auto kbps: kBitrates) {
+            char name[32];
+            snprintf(name, sizeof(name), "gen-%d-%s", kbps, mono ? "mono" : "stereo");
+            corpus.emplace_back(name, std::vector<uint8_t>());
+            Mp3Gen(kbps, mono, kbps).appendFrames(corpus.back().second, 100);
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        corpus.emplace_back(argv[i], std::vector<uint8_t>());
+        if (!loadFile(argv[i], corpus.back().second)) {
+            return 1;
+        }
+    }
+    FILE* out = nullptr;
+    if (write && !(out = fopen(goldenName, "w"))) {
+        perror("Error creating golden file");
+        return 1;
+    }
+    int failed = 0;
+    int64_t totalFrames = 0, usDecode = 0, usSynth = 0;
+    for (auto& item: corpus) {
+        auto& name = item.first;
+        item.second.resize(item.second.size() + MAD_BUFFER_GUARD);
+        auto result = decode(item.second);
+        for (int i = 1; i < runs; i++) {
+            auto rerun = decode(item.second);
+            result.usDecode = std::min(result.usDecode, rerun.usDecode);
+            result.usSynth = std::min(result.usSynth, rerun.usSynth);
+        }
+        totalFrames += result.frames;
+        usDecode += result.usDecode;
+        usSynth += result.usSynth;
+        const char* status = "";
+        if (out) {
+            fprintf(out, "%s %016llx\n", name.c_str(), (unsigned long long)result.hash);
+        } else {
+            auto it = golden.find(name);
+            if (it == golden.end()) {
+                status = " (not in golden file)";
+            } else if (it->second != result.hash) {
+                status = " MISMATCH";
+                failed++;
+            }
+        }
+        printf("%-24s %016llx %4d frames, decode %.1f us/frame, synth %.1f us/frame%s\n",
+            name.c_str(), (unsigned long long)result.hash, result.frames,
+            (double)result.usDecode / result.frames, (double)result.usSynth / result.frames, status);
+    }
+    if (out) {
+        fclose(out);
+    }
+    printf("Total: %lld frames, decode %.1f us/frame, synth %.1f us/frame\n", (long long)totalFrames,
+        (double)usDecode / totalFrames, (double)usSynth / totalFrames);
+    if (failed) {
+        fprintf(stderr, "%d streams don't match the golden output\n", failed);
+        return 1;
+    }
+    return 0;
+}
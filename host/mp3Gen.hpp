@@ -0,0 +1,183 @@
+#ifndef HOST_MP3_GEN_HPP
+#define HOST_MP3_GEN_HPP
+/* Generates a deterministic stream of valid MPEG1 Layer III frames with
+ * pseudo-random side info and main data - random Huffman tables, block types,
+ * scalefactors, gains and stereo modes. Each frame is self-contained
+ * (main_data_begin = 0) unless the bit reservoir is enabled, and is validated by
+ * decoding it with libmad, so the stream exercises the complete layer III decode
+ * path without needing real MP3 files. The audio content is noise, so it is meant
+ * only for benchmarking and for bit-exactness comparisons between decoder
+ * implementations
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <mad.h>
+
+class Mp3Gen
+{
+protected:
+    uint32_t mSeed;
+    bool mMono;
+    int mKbps;
+    int mMinGain = 120;
+    int mMaxGain = 210;
+    int mReservoir = 0;
+    std::vector<uint8_t> mFrame;
+    int mBitPos = 0;
+    mad_stream mStream;
+    mad_frame mMadFrame;
+    uint32_t rand(uint32_t range)
+    {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 8) % range;
+    }
+    void putBits(uint32_t val, int nbits)
+    {
+        while (nbits--) {
+            auto& byte = mFrame[mBitPos >> 3];
+            int shift = 7 - (mBitPos & 7);
+            byte = (byte & ~(1 << shift)) | (((val >> nbits) & 1) << shift);
+            mBitPos++;
+        }
+    }
+    int tableSelect()
+    {
+        for (;;) { // tables 4 and 14 don't exist
+            int table = rand(32);
+            if (table != 4 && table != 14) {
+                return table;
+            }
+        }
+    }
+    int frameLen() const { return 144 * mKbps * 1000 / 44100; }
+    int sideInfoLen() const { return mMono ? 17 : 32; }
+    // Generates a frame with mainDataLen bytes of main data after the side info,
+    // followed by zero padding
+    void generateFrame(int mainDataLen)
+    {
+        // 44.1 kHz, no CRC, no padding
+        int bitrateIdx = bitrateIndex(mKbps);
+        int nch = mMono ? 1 : 2;
+        mFrame.assign(frameLen(), 0);
+        mBitPos = 0;
+        putBits(0xfffb, 16);
+        putBits(bitrateIdx, 4);
+        putBits(0, 2); // 44100 Hz
+        putBits(0, 2); // no padding, private bit
+        int mode = mMono ? 3 : rand(2); // stereo or joint stereo
+        putBits(mode, 2);
+        putBits(rand(4), 2); // mode extension - M/S and intensity stereo
+        putBits(0, 4); // copyright, original, emphasis
+        int mainDataBits = mainDataLen * 8;
+        putBits(0, 9); // main_data_begin
+        putBits(0, mMono ? 5 : 3); // private bits
+        putBits(0, 4 * nch); // scfsi
+        int part23Len = mainDataBits / (2 * nch);
+        for (int gr = 0; gr < 2; gr++) {
+            for (int ch = 0; ch < nch; ch++) {
+                putBits(part23Len, 12);
+                putBits(rand(289), 9); // big_values
+                putBits(mMinGain + rand(mMaxGain - mMinGain), 8); // global_gain
+                putBits(rand(16), 4); // scalefac_compress
+                bool winSwitch = rand(4) == 0;
+                putBits(winSwitch, 1);
+                if (winSwitch) {
+                    putBits(1 + rand(3), 2); // block_type
+                    putBits(0, 1); // mixed_block_flag
+                    putBits(tableSelect(), 5);
+                    putBits(tableSelect(), 5);
+                    putBits(rand(8), 3); // subblock_gain
+                    putBits(rand(8), 3);
+                    putBits(rand(8), 3);
+                } else {
+                    putBits(tableSelect(), 5);
+                    putBits(tableSelect(), 5);
+                    putBits(tableSelect(), 5);
+                    putBits(rand(16), 4); // region0_count
+                    putBits(rand(8), 3); // region1_count
+                }
+                putBits(rand(8), 3); // preflag, scalefac_scale, count1table_select
+            }
+        }
+        int start = 4 + sideInfoLen();
+        for (int i = start; i < start + mainDataLen; i++) {
+            mFrame[i] = rand(256);
+        }
+    }
+    bool validateFrame()
+    {
+        std::vector<uint8_t> buf(mFrame);
+        buf.resize(buf.size() + MAD_BUFFER_GUARD);
+        mad_stream_buffer(&mStream, buf.data(), buf.size());
+        return mad_frame_decode(&mMadFrame, &mStream) == 0;
+    }
+    static int bitrateIndex(int kbps)
+    {
+        static const int kBitrates[] = { 32, 40, 48, 56, 64, 80, 96, 112, 128,
+            160, 192, 224, 256, 320 };
+        for (int i = 0; i < (int)(sizeof(kBitrates) / sizeof(kBitrates[0])); i++) {
+            if (kBitrates[i] == kbps) {
+                return i + 1;
+            }
+        }
+        abort();
+    }
+public:
+    // kbps must be a valid MPEG1 Layer III bitrate, 0 selects 128 kbps stereo
+    // and 64 kbps mono
+    Mp3Gen(uint32_t seed, bool mono=false, int kbps=0)
+    : mSeed(seed), mMono(mono), mKbps(kbps ? kbps : (mono ? 64 : 128))
+    {
+        mad_stream_init(&mStream);
+        mad_frame_init(&mMadFrame);
+    }
+    ~Mp3Gen()
+    {
+        mad_frame_finish(&mMadFrame);
+        mad_stream_finish(&mStream);
+    }
+    // The default range is loud enough to clip often. The accuracy of the decoder
+    // can be measured only without clipping
+    void setGainRange(int minGain, int maxGain) { mMinGain = minGain; mMaxGain = maxGain; }
+    // With a reservoir, the main data of each frame after the first one starts
+    // this many bytes before the frame, in the space left unused by the previous
+    // one, as encoders do with the bit reservoir. Then the frames can be decoded
+    // only in sequence
+    void setReservoir(int bytes) { mReservoir = bytes; }
+    static int samplesPerFrame() { return 1152; }
+    static int samplerate() { return 44100; }
+    void appendFrames(std::vector<uint8_t>& out, int numFrames)
+    {
+        // The frames are validated on their own. With a reservoir, their main data
+        // is then joined, and split again into the space after each side info
+        int headerLen = 4 + sideInfoLen();
+        int space = frameLen() - headerLen;
+        std::vector<uint8_t> headers;
+        std::vector<uint8_t> mainData;
+        for (int i = 0; i < numFrames; i++) {
+            int mainDataLen = (i == 0) ? space - mReservoir : space;
+            do {
+                generateFrame(mainDataLen);
+            } while (!validateFrame());
+            if (!mReservoir) {
+                out.insert(out.end(), mFrame.begin(), mFrame.end());
+                continue;
+            }
+            if (i) {
+                mBitPos = 32;
+                putBits(mReservoir, 9); // main_data_begin
+            }
+            headers.insert(headers.end(), mFrame.begin(), mFrame.begin() + headerLen);
+            mainData.insert(mainData.end(), mFrame.begin() + headerLen, mFrame.begin() + headerLen + mainDataLen);
+        }
+        mainData.resize(mainData.size() + mReservoir);
+        for (int i = 0; i < (int)headers.size() / headerLen; i++) {
+            out.insert(out.end(), headers.begin() + i * headerLen, headers.begin() + (i + 1) * headerLen);
+            out.insert(out.end(), mainData.begin() + i * space, mainData.begin() + (i + 1) * space);
+        }
+    }
+};
+
+#endif
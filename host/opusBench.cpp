@@ -0,0 +1,304 @@
+/* Host benchmark and test of DecoderOpus and OggDemux. As with aacBench, the
+ * input is fed in chunks of random size, with output buffers of one and two MP3
+ * frames, so that long packets are output in parts.
+ * With libopus (OPUS_DIR in CMakeLists.txt), decodes the given Ogg Opus files,
+ * compares the output with that of decoding each file in one piece, and reports
+ * the decode time and realtime factor. With the stub of libopus that the host
+ * build uses otherwise, decodes a synthetic chained stream instead - garbage
+ * before the first page, packets spanning pages, packets of up to 120 ms, one
+ * that fails to decode, and a second stream with different parameters - and
+ * compares the output with the packet by packet decode
+ * Usage: opusBench [-r repeats] [-c maxChunk] [file.opus...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+#include <decoderOpus.hpp>
+
+struct Result
+{
+    std::vector<int16_t> pcm;
+    StreamFormat fmt;
+    int64_t usElapsed = 0;
+};
+
+// Decodes the stream with DecoderOpus, the input split in chunks of up to maxChunk bytes
+static bool decodeChunked(const std::vector<uint8_t>& input, int outBufSize, int maxChunk, bool mono,
+    Result& res)
+{
+    DecoderOpus decoder(kCodecOgg);
+    decoder.setMonoOutput(mono);
+    std::vector<char> out(outBufSize);
+    size_t pos = 0;
+    uint32_t seed = 1;
+    for (;;) {
+        decoder.setOutputBuf(out.data(), outBufSize);
+        int needed = decoder.inputBytesNeeded();
+        int ret;
+        ElapsedTimer timer;
+        if (needed > 0) {
+            seed = seed * 1103515245 + 12345;
+            int size = std::min({ needed, (int)(input.size() - pos), 1 + (int)((seed >> 8) % maxChunk) });
+            ret = decoder.decode((const char*)input.data() + pos, size);
+            pos += size;
+        } else {
+            int size = 0;
+            ret = decoder.decode(nullptr, size);
+        }
+        res.usElapsed += timer.usElapsed();
+        if (ret == AudioNode::kNeedMoreData) {
+            if (pos >= input.size()) {
+                return true;
+            }
+            continue;
+        } else if (ret <= 0) {
+            fprintf(stderr, "Decode error %d\n", ret);
+            return false;
+        }
+        res.fmt = decoder.outputFmt();
+        res.pcm.insert(res.pcm.end(), (int16_t*)out.data(), (int16_t*)(out.data() + ret));
+    }
+}
+
+#ifdef OPUS_STUB
+// Generates Ogg pages of a logical stream, and the expected decoder output
+class OggOpusGen
+{
+protected:
+    std::vector<uint8_t>& mOut;
+    uint32_t mSerial;
+    uint32_t mPageSeq = 0;
+    int64_t mGranule = 0;
+    std::vector<std::vector<uint8_t>> mPackets; // of the current page
+    static uint32_t crc(const uint8_t* data, size_t len)
+    {
+        uint32_t crc = 0;
+        for (size_t i = 0; i < len; i++) {
+            crc ^= (uint32_t)data[i] << 24;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+            }
+        }
+        return crc;
+    }
+    static void putLe(uint8_t* p, uint64_t val, int bytes)
+    {
+        for (int i = 0; i < bytes; i++) {
+            p[i] = val >> (8 * i);
+        }
+    }
+public:
+    OggOpusGen(std::vector<uint8_t>& out, uint32_t serial): mOut(out), mSerial(serial) {}
+    // Writes the page with the packets added so far. A packet can be split
+    // across pages by writing the page with part of it
+    void writePage(bool continued, const std::vector<uint8_t>* partial = nullptr)
+    {
+        std::vector<uint8_t> header(27), body;
+        memcpy(header.data(), "OggS", 4);
+        header[5] = (mPageSeq == 0 ? 2 : 0) | (continued ? 1 : 0);
+        putLe(&header[6], partial ? (uint64_t)-1 : mGranule, 8);
+        putLe(&header[14], mSerial, 4);
+        putLe(&header[18], mPageSeq++, 4);
+        for (auto& pkt: mPackets) {
+            for (size_t len = pkt.size();; len -= 255) {
+                header.push_back(len >= 255 ? 255 : len);
+                if (len < 255) {
+                    break;
+                }
+            }
+            body.insert(body.end(), pkt.begin(), pkt.end());
+        }
+        if (partial) { // 255-byte segments, without a terminating one
+            for (size_t i = 0; i < partial->size() / 255; i++) {
+                header.push_back(255);
+            }
+            body.insert(body.end(), partial->begin(), partial->begin() + partial->size() / 255 * 255);
+        }
+        header[26] = header.size() - 27;
+        size_t start = mOut.size();
+        mOut.insert(mOut.end(), header.begin(), header.end());
+        mOut.insert(mOut.end(), body.begin(), body.end());
+        putLe(&mOut[start + 22], crc(&mOut[start], mOut.size() - start), 4);
+        mPackets.clear();
+    }
+    void addPacket(const std::vector<uint8_t>& pkt, int samples48k)
+    {
+        mPackets.push_back(pkt);
+        mGranule += samples48k;
+    }
+    int pendingSegments() const
+    {
+        int count = 0;
+        for (auto& pkt: mPackets) {
+            count += pkt.size() / 255 + 1;
+        }
+        return count;
+    }
+};
+
+// A chained stream of two logical streams. Appends the expected output to `expected`
+static void generateStream(std::vector<uint8_t>& data, bool mono, std::vector<int16_t>& expected)
+{
+    uint32_t seed = 1;
+    auto rand = [&seed](uint32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % range;
+    };
+    for (int i = 0; i < 500; i++) { // garbage, with partial capture patterns
+        data.push_back(rand(8) ? rand(256) : 'O');
+    }
+    std::vector<int16_t> pcm(5760 * 2);
+    for (int stream = 0; stream < 2; stream++) {
+        int channels = 2 - stream;
+        int preSkip = 312 + stream * 100;
+        OggOpusGen gen(data, 0x1234 + stream);
+        std::vector<uint8_t> head = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, (uint8_t)channels,
+            (uint8_t)preSkip, (uint8_t)(preSkip >> 8), 0x80, 0xbb, 0, 0, 0, 0, 0 };
+        gen.addPacket(head, 0);
+        gen.writePage(false);
+        std::vector<uint8_t> tags(700, 't'); // spans two pages
+        memcpy(tags.data(), "OpusTags", 8);
+        gen.writePage(false, &tags);
+        tags.erase(tags.begin(), tags.begin() + tags.size() / 255 * 255);
+        gen.addPacket(tags, 0);
+        gen.writePage(true);
+
+        int err;
+        OpusDecoder* ref = opus_decoder_create(48000, mono ? 1 : channels, &err);
+        int skip = preSkip;
+        for (int i = 0; i < 300; i++) {
+            std::vector<uint8_t> pkt;
+            int kind = rand(10);
+            if (kind == 0) { // 120 ms - two 60 ms SILK frames
+                pkt.push_back((3 << 3) | 1);
+            } else if (kind == 1) { // code 3, 6 x 20 ms CELT frames
+                pkt.push_back((31 << 3) | 3);
+                pkt.push_back(6);
+            } else { // 20 ms CELT
+                pkt.push_back(31 << 3);
+            }
+            int size = (i % 50 == 7) ? 510 : (i % 50 == 8) ? 3000 : 20 + rand(300);
+            while ((int)pkt.size() < size) {
+                pkt.push_back(rand(256));
+            }
+            if (i == 100) {
+                pkt[1] = 0xee; // fails to decode
+            }
+            int nsamples = opus_packet_get_nb_samples(pkt.data(), pkt.size(), 48000);
+            int out = opus_decode(ref, pkt.data(), pkt.size(), pcm.data(), nsamples, 0);
+            if (out > 0) {
+                int drop = std::min(skip, out);
+                skip -= drop;
+                int nch = mono ? 1 : channels;
+                expected.insert(expected.end(), pcm.data() + drop * nch, pcm.data() + out * nch);
+            }
+            if (size == 3000 || gen.pendingSegments() + pkt.size() / 255 + 1 > 255) {
+                gen.writePage(false);
+                if (size == 3000) { // split it across two pages
+                    gen.writePage(false, &pkt);
+                    pkt.erase(pkt.begin(), pkt.begin() + pkt.size() / 255 * 255);
+                    gen.addPacket(pkt, nsamples);
+                    gen.writePage(true);
+                    continue;
+                }
+            }
+            gen.addPacket(pkt, nsamples);
+        }
+        gen.writePage(false);
+        opus_decoder_destroy(ref);
+    }
+}
+#endif
+
+static bool loadFile(const char* fname, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        perror("Error opening input file");
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 3;
+    int maxChunk = 4096;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:c:")) != -1) {
+        switch (opt) {
+            case 'r': repeats = std::max(1, atoi(optarg)); break;
+            case 'c': maxChunk = std::max(1, atoi(optarg)); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repeats] [-c maxChunk] [file.opus...]\n", argv[0]);
+                return 2;
+        }
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR); // each decoder instance logs the stream format
+    struct Input
+    {
+        std::string name;
+        std::vector<uint8_t> data;
+        bool mono;
+        std::vector<int16_t> expected; // empty if not known
+    };
+    std::vector<Input> inputs;
+#ifdef OPUS_STUB
+    for (int mono = 0; mono < 2; mono++) {
+        inputs.push_back({ mono ? "stub chained, mono output" : "stub chained", {}, (bool)mono, {} });
+        generateStream(inputs.back().data, mono, inputs.back().expected);
+    }
+#endif
+    for (int i = optind; i < argc; i++) {
+        inputs.push_back({ argv[i], {}, false, {} });
+        if (!loadFile(argv[i], inputs.back().data)) {
+            return 1;
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "No input files\n");
+        return 2;
+    }
+    // one MP3 frame per PCM block, and two
+    static const int kOutBufSizes[] = { 1152 * 4, 1152 * 8 };
+    for (auto& input: inputs) {
+        if (input.expected.empty()) {
+            Result whole;
+            if (!decodeChunked(input.data, 1152 * 8, input.data.size(), input.mono, whole)) {
+                return 1;
+            }
+            input.expected = std::move(whole.pcm);
+        }
+        for (auto outBufSize: kOutBufSizes) {
+            Result res;
+            if (!decodeChunked(input.data, outBufSize, maxChunk, input.mono, res)) {
+                return 1;
+            }
+            if (res.pcm != input.expected) {
+                fprintf(stderr, "%s: output with %d-byte buffer differs from the expected one (%zu vs %zu samples)\n",
+                    input.name.c_str(), outBufSize, res.pcm.size(), input.expected.size());
+                return 1;
+            }
+            for (int i = 1; i < repeats; i++) {
+                Result rerun;
+                decodeChunked(input.data, outBufSize, maxChunk, input.mono, rerun);
+                res.usElapsed = std::min(res.usElapsed, rerun.usElapsed);
+            }
+            double seconds = (double)res.pcm.size() / res.fmt.channels() / res.fmt.samplerate;
+            printf("%s, %d-byte output: %.1f s of audio, %d Hz, %d ch, %.0f us/s of audio, %.0fx realtime\n",
+                input.name.c_str(), outBufSize, seconds, res.fmt.samplerate, res.fmt.channels(),
+                res.usElapsed / seconds, seconds * 1000000 / res.usElapsed);
+        }
+    }
+    return 0;
+}
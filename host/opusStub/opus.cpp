@@ -0,0 +1,82 @@
+#include "opus.h"
+
+struct OpusDecoder
+{
+    opus_int32 rate;
+    int channels;
+};
+
+OpusDecoder* opus_decoder_create(opus_int32 Fs, int channels, int* error)
+{
+    if ((Fs != 8000 && Fs != 12000 && Fs != 16000 && Fs != 24000 && Fs != 48000) ||
+        channels < 1 || channels > 2) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusDecoder{Fs, channels};
+}
+
+void opus_decoder_destroy(OpusDecoder* st)
+{
+    delete st;
+}
+
+int opus_decoder_ctl(OpusDecoder* st, int request, ...)
+{
+    return request == OPUS_SET_GAIN_REQUEST ? OPUS_OK : OPUS_BAD_ARG;
+}
+
+int opus_packet_get_nb_samples(const unsigned char packet[], opus_int32 len, opus_int32 Fs)
+{
+    if (len < 1) {
+        return OPUS_BAD_ARG;
+    }
+    int config = packet[0] >> 3;
+    int frameSamples;
+    if (config < 12) { // SILK: 10, 20, 40, 60 ms
+        static const int kMs[] = { 10, 20, 40, 60 };
+        frameSamples = Fs * kMs[config & 3] / 1000;
+    } else if (config < 16) { // hybrid: 10, 20 ms
+        frameSamples = Fs / ((config & 1) ? 50 : 100);
+    } else { // CELT: 2.5, 5, 10, 20 ms
+        frameSamples = (Fs / 400) << (config & 3);
+    }
+    int frames;
+    switch (packet[0] & 3) {
+        case 0: frames = 1; break;
+        case 3:
+            if (len < 2) {
+                return OPUS_INVALID_PACKET;
+            }
+            frames = packet[1] & 0x3f;
+            break;
+        default: frames = 2; break;
+    }
+    int nsamples = frames * frameSamples;
+    return (nsamples * 25 > Fs * 3) ? OPUS_INVALID_PACKET : nsamples; // max 120 ms
+}
+
+int opus_decode(OpusDecoder* st, const unsigned char* data, opus_int32 len, opus_int16* pcm,
+    int frame_size, int decode_fec)
+{
+    int nsamples = opus_packet_get_nb_samples(data, len, st->rate);
+    if (nsamples < 0) {
+        return nsamples;
+    }
+    if (nsamples > frame_size) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    if (len > 1 && data[1] == 0xee) {
+        return OPUS_INVALID_PACKET;
+    }
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    for (int i = 0; i < nsamples * st->channels; i++) {
+        hash = hash * 1103515245 + 12345;
+        pcm[i] = hash >> 16;
+    }
+    return nsamples;
+}
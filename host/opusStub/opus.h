@@ -0,0 +1,38 @@
+#ifndef HOST_OPUS_STUB_H
+#define HOST_OPUS_STUB_H
+/* Stand-in for the libopus decoder API, used by the host build when libopus is
+ * not available (see OPUS_DIR in CMakeLists.txt). Packet durations are derived
+ * from the TOC byte as by libopus, and the output is a hash of the packet data,
+ * so that the Ogg demuxing and buffering of DecoderOpus can be tested without
+ * real Opus streams. Packets whose second byte is 0xee fail to decode
+ */
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int16_t opus_int16;
+typedef int32_t opus_int32;
+typedef struct OpusDecoder OpusDecoder;
+
+#define OPUS_OK 0
+#define OPUS_BAD_ARG -1
+#define OPUS_BUFFER_TOO_SMALL -2
+#define OPUS_INVALID_PACKET -4
+
+#define OPUS_SET_GAIN_REQUEST 4034
+#define OPUS_SET_GAIN(x) OPUS_SET_GAIN_REQUEST, (opus_int32)(x)
+
+OpusDecoder* opus_decoder_create(opus_int32 Fs, int channels, int* error);
+void opus_decoder_destroy(OpusDecoder* st);
+int opus_decoder_ctl(OpusDecoder* st, int request, ...);
+int opus_decode(OpusDecoder* st, const unsigned char* data, opus_int32 len, opus_int16* pcm,
+    int frame_size, int decode_fec);
+int opus_packet_get_nb_samples(const unsigned char packet[], opus_int32 len, opus_int32 Fs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
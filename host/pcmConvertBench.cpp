@@ -0,0 +1,204 @@
+/* Test and benchmark of PcmConverter, the conversion of libmad samples to PCM.
+ * Checks that overdriven input saturates at the PCM full scale in all output
+ * formats, with and without dither, that in-range input is rounded correctly
+ * and that the dither averages out, and compares the speed of the kernels
+ * with that of the original per-sample conversion.
+ * Usage: pcmConvertBench [-n frames] [-r repeats]
+ * Exits with a non-zero code if any of the checks fails
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include <utils.hpp>
+#include <pcmConvert.hpp>
+
+enum { kFrameLen = 1152 };
+static const mad_fixed_t kOne = MAD_F_ONE;
+
+// The conversion that DecoderMp3 used before PcmConverter, which wraps around
+// instead of saturating
+static inline uint16_t legacyScale(mad_fixed_t sample) {
+    auto isNeg = sample & 0x80000000;
+    sample >>= (29 - 15);
+    return isNeg ? (sample | 0x8000) : (sample & 0x7fff);
+}
+static int legacyConvert(const mad_fixed_t* const* in, int nch, int nsamples, void* out)
+{
+    auto wptr = (uint8_t*)out;
+    for (int i = 0; i < nsamples; i++) {
+        for (int ch = 0; ch < nch; ch++) {
+            uint16_t sample = legacyScale(in[ch][i]);
+            *(wptr++) = sample & 0xff;
+            *(wptr++) = sample >> 8;
+        }
+    }
+    return wptr - (uint8_t*)out;
+}
+
+// Reads sample i of a converted buffer, in units of the 16-bit LSB
+static double readSample(const void* buf, int bits, int i)
+{
+    switch (bits) {
+        case 24: {
+            auto p = (const uint8_t*)buf + 3 * i;
+            int32_t s = (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+            return s / 256.0;
+        }
+        case 32:
+            return ((const int32_t*)buf)[i] / 65536.0;
+        default:
+            return ((const int16_t*)buf)[i];
+    }
+}
+
+static int failed = 0;
+static void check(bool ok, const char* fmt, int bits, bool dither, int i, double val)
+{
+    if (!ok) {
+        fprintf(stderr, "%d-bit%s, sample %d: ", bits, dither ? " dither" : "", i);
+        fprintf(stderr, fmt, val);
+        fprintf(stderr, "\n");
+        failed++;
+    }
+}
+
+// Stereo ramps from -8.0 to 8.0, i.e. overdriven 4 times beyond the level that
+// maps to the PCM full scale, in opposite directions in the two channels
+static void testClipping(int bits, bool dither)
+{
+    std::vector<mad_fixed_t> left(kFrameLen), right(kFrameLen);
+    for (int i = 0; i < kFrameLen; i++) {
+        left[i] = (mad_fixed_t)(-8.0 * kOne + 16.0 * kOne * i / (kFrameLen - 1));
+        right[i] = -left[i];
+    }
+    left[0] = -0x7fffffff - 1; // the extremes of mad_fixed_t must not overflow the rounding
+    right[0] = 0x7fffffff;
+    const mad_fixed_t* in[2] = { left.data(), right.data() };
+    std::vector<uint8_t> out(kFrameLen * 2 * 4);
+    PcmConverter conv(bits, dither);
+    int written = conv.convert(in, 2, kFrameLen, out.data());
+    check(written == kFrameLen * 2 * bits / 8, "wrong output size %.0f", bits, dither, 0, written);
+    // 32-bit output has the 30 bits of libmad's precision
+    const double lsb = bits == 32 ? 4 / 65536.0 : 65536.0 / (1LL << bits);
+    const double maxVal = 32768 - lsb;
+    for (int i = 0; i < kFrameLen * 2; i++) {
+        double in = (i & 1 ? right : left)[i / 2] / (double)kOne;
+        double val = readSample(out.data(), bits, i);
+        if (in >= 2.0) {
+            check(val == maxVal, "overdriven positive sample converted to %.2f", bits, dither, i, val);
+        } else if (in <= -2.0) {
+            check(val == -32768, "overdriven negative sample converted to %.2f", bits, dither, i, val);
+        } else {
+            // the rounding and dither error is within one LSB
+            double expected = in * 16384;
+            check(fabs(val - expected) <= (dither ? 1.5 : 0.5) * lsb + 1e-9,
+                "in-range sample off by %.3f", bits, dither, i, val - expected);
+        }
+    }
+}
+
+// A constant input halfway between two 16-bit values must average to that
+// value with dither, while without it it's always rounded to the same value
+static void testDitherMean()
+{
+    const int n = kFrameLen * 16;
+    std::vector<mad_fixed_t> mono(n, (mad_fixed_t)(kOne / 16384 * 100.5));
+    const mad_fixed_t* in[1] = { mono.data() };
+    std::vector<int16_t> out(n);
+    for (int dither = 0; dither < 2; dither++) {
+        PcmConverter conv(16, dither);
+        conv.convert(in, 1, n, out.data());
+        double sum = 0;
+        int distinct = 0;
+        for (int i = 0; i < n; i++) {
+            sum += out[i];
+            distinct |= 1 << (out[i] - 99);
+        }
+        double mean = sum / n;
+        printf("16-bit%s: constant 100.5 LSB averages to %.3f\n", dither ? " dither" : "", mean);
+        if (dither) {
+            check(fabs(mean - 100.5) < 0.05, "dithered mean is %.3f", 16, true, 0, mean);
+            check((distinct & 0b0110) == 0b0110 && !(distinct & ~0b1111),
+                "dither doesn't span the neighbouring values, mask %.0f", 16, true, 0, distinct);
+        } else {
+            check(mean == 101, "undithered mean is %.3f", 16, false, 0, mean);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int numFrames = 2000;
+    int repeats = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': numFrames = atoi(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames] [-r repeats]\n", argv[0]);
+                return 2;
+        }
+    }
+    for (int bits: { 16, 24, 32 }) {
+        for (int dither = 0; dither < 2; dither++) {
+            testClipping(bits, dither);
+        }
+    }
+    testDitherMean();
+
+    // show what the original conversion does with an overdriven sample
+    mad_fixed_t hot = (mad_fixed_t)(2.5 * kOne);
+    const mad_fixed_t* hotIn[1] = { &hot };
+    int16_t hotOut;
+    PcmConverter().convert(hotIn, 1, 1, &hotOut);
+    printf("Sample at 2.5: original conversion %d, PcmConverter %d\n", (int16_t)legacyScale(hot), hotOut);
+
+    // a loud signal, with overdriven peaks in one channel
+    std::vector<mad_fixed_t> left(kFrameLen), right(kFrameLen);
+    for (int i = 0; i < kFrameLen; i++) {
+        left[i] = (mad_fixed_t)(2.2 * kOne * sin(i * 0.05));
+        right[i] = (mad_fixed_t)(1.5 * kOne * cos(i * 0.031));
+    }
+    const mad_fixed_t* in[2] = { left.data(), right.data() };
+    std::vector<uint8_t> out(kFrameLen * 2 * 4);
+    struct Kernel { const char* name; int bits; bool dither; bool legacy; };
+    static const Kernel kKernels[] = {
+        { "original 16-bit", 16, false, true },
+        { "16-bit", 16, false, false },
+        { "16-bit dither", 16, true, false },
+        { "24-bit", 24, false, false },
+        { "24-bit dither", 24, true, false },
+        { "32-bit", 32, false, false }
+    };
+    double nsLegacy = 0;
+    for (auto& kernel: kKernels) {
+        PcmConverter conv(kernel.bits, kernel.dither);
+        int64_t usElapsed = INT64_MAX;
+        for (int r = 0; r < repeats; r++) {
+            ElapsedTimer timer;
+            for (int i = 0; i < numFrames; i++) {
+                if (kernel.legacy) {
+                    legacyConvert(in, 2, kFrameLen, out.data());
+                } else {
+                    conv.convert(in, 2, kFrameLen, out.data());
+                }
+                asm volatile("" : : "r"(out.data()) : "memory");
+            }
+            usElapsed = std::min(usElapsed, timer.usElapsed());
+        }
+        double ns = usElapsed * 1000.0 / ((double)numFrames * kFrameLen * 2);
+        if (kernel.legacy) {
+            nsLegacy = ns;
+        }
+        printf("%-16s %.2f ns/sample, %.1f us/frame, %.2fx the original\n", kernel.name, ns,
+            ns * kFrameLen * 2 / 1000, nsLegacy / ns);
+    }
+    if (failed) {
+        fprintf(stderr, "%d checks failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
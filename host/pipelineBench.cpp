@@ -0,0 +1,231 @@
+/* Host benchmark of the decode pipeline: source -> DecoderNode -> EqualizerNode.
+ * Runs the same node code as the ESP32 firmware, against the FreeRTOS shim,
+ * so it can be profiled with perf, valgrind etc.
+ * Usage: pipelineBench [-e] [-b] [-t frames] [-s frames] [-p] [-m] [-f frames] [-w size] [-v] [-n frames] [-o out.raw] [file.mp3]
+ *   -e  include the equalizer node
+ *   -b  pull pooled PCM blocks instead of buffers
+ *   -t  decode in a separate task, up to the specified number of frames ahead
+ *   -s  with -t, stall the synthetic stream after the specified number of frames, and stop
+ *       the decode task while the output waits for data, as AudioPlayer::stop()
+ *       does. The output must get kStreamStopped
+ *   -p  decode the two stereo channels in parallel
+ *   -m  downmix to mono in the decoder
+ *   -f  decode up to the specified number of frames per output block
+ *   -w  split the input buffers returned by the source at multiples of size, like
+ *       a ring buffer without a mirror area does at the wrap-around point
+ *   -v  verbose logging
+ *   -n  number of synthetic frames to generate, if no file is given
+ *   -o  dump the PCM output
+ * Exits with a non-zero code if the input was not completely decoded
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <thread>
+#include <stdint.h>
+#include <decoderNode.hpp>
+#include <equalizerNode.hpp>
+#include <prefetchNode.hpp>
+#include "mp3Gen.hpp"
+
+// Feeds an in-memory MP3 stream to the pipeline
+class MemSourceNode: public AudioNode
+{
+protected:
+    const std::vector<uint8_t>& mData;
+    size_t mPos = 0;
+    int mWrapSize;
+public:
+    size_t stallPos = SIZE_MAX; // no more data after it, as with a network stall
+    MemSourceNode(const std::vector<uint8_t>& data, int wrapSize)
+    : AudioNode("memsrc"), mData(data), mWrapSize(wrapSize) {}
+    virtual Type type() const { return kTypeUnknown; }
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout)
+    {
+        if (mPos >= stallPos) {
+            usleep(std::max(timeout, 0) * 1000);
+            return kTimeout;
+        }
+        if (mPos >= mData.size()) {
+            return kStreamStopped;
+        }
+        dpr.fmt = StreamFormat(kCodecMp3);
+        dpr.buf = (char*)mData.data() + mPos;
+        dpr.size = std::min(dpr.size, (int)(mData.size() - mPos));
+        if (mWrapSize) {
+            dpr.size = std::min(dpr.size, (int)(mWrapSize - mPos % mWrapSize));
+        }
+        return kNoError;
+    }
+    virtual void confirmRead(int size) { mPos += size; }
+    bool stalled() const { return mPos >= stallPos; }
+};
+
+static bool loadFile(const char* fname, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        perror("Error opening input file");
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool useEq = false;
+    bool useBlocks = false;
+    int prefetchFrames = 0;
+    int stopFrames = 0;
+    bool parallel = false;
+    bool mono = false;
+    int framesPerBlock = 1;
+    int wrapSize = 0;
+    int numFrames = 2000;
+    const char* outName = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "ebt:s:pmf:w:vn:o:")) != -1) {
+        switch (opt) {
+            case 'e': useEq = true; break;
+            case 'b': useBlocks = true; break;
+            case 't': prefetchFrames = atoi(optarg); break;
+            case 's': stopFrames = atoi(optarg); break;
+            case 'p': parallel = true; break;
+            case 'm': mono = true; break;
+            case 'f': framesPerBlock = atoi(optarg); break;
+            case 'w': wrapSize = atoi(optarg); break;
+            case 'v': esp_log_level_set("*", ESP_LOG_INFO); break;
+            case 'n': numFrames = atoi(optarg); break;
+            case 'o': outName = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-e] [-b] [-t frames] [-s frames] [-p] [-m] [-f frames] [-w size] [-v] [-n frames] [-o out.raw] [file.mp3]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (stopFrames && (!prefetchFrames || optind < argc)) {
+        fprintf(stderr, "-s needs -t and the synthetic stream\n");
+        return 2;
+    }
+    std::vector<uint8_t> input;
+    bool synthetic = optind >= argc;
+    if (synthetic) {
+        Mp3Gen(1).appendFrames(input, numFrames);
+    } else if (!loadFile(argv[optind], input)) {
+        return 1;
+    }
+    FILE* out = nullptr;
+    if (outName && !(out = fopen(outName, "wb"))) {
+        perror("Error creating output file");
+        return 1;
+    }
+    MemSourceNode src(input, wrapSize);
+    if (stopFrames) {
+        src.stallPos = input.size() * stopFrames / numFrames;
+    }
+    DecoderNode decoder(prefetchFrames, framesPerBlock);
+    decoder.linkToPrev(&src);
+    if (parallel) {
+        decoder.enableParallelDecode(1);
+    }
+    decoder.setMonoOutput(mono);
+    EqualizerNode eq;
+    eq.linkToPrev(&decoder);
+    AudioNode* pcmSource = useEq ? (AudioNode*)&eq : (AudioNode*)&decoder;
+    PrefetchNode prefetch(prefetchFrames);
+    if (prefetchFrames) {
+        prefetch.linkToPrev(pcmSource);
+        prefetch.run();
+        pcmSource = &prefetch;
+    }
+    AudioNode& sink = *pcmSource;
+    // once the output has taken all that was decoded before the stall
+    std::thread stopper;
+    if (stopFrames) {
+        stopper = std::thread([&src, &prefetch]() {
+            while (!src.stalled() || prefetch.queuedFrames()) {
+                usleep(10000);
+            }
+            usleep(100000);
+            prefetch.stop();
+        });
+    }
+
+    int64_t pcmBytes = 0;
+    StreamFormat fmt;
+    AudioNode::StreamError err;
+    ElapsedTimer timer;
+    for (;;) {
+        AudioNode::DataPullReq dpr(10240);
+        PcmBlockRef block;
+        if (useBlocks) {
+            err = sink.pullBlock(block, -1);
+            if (!err) {
+                dpr.buf = block->data;
+                dpr.size = block->size;
+                dpr.fmt = block->fmt;
+            }
+        } else {
+            err = sink.pullData(dpr, -1);
+        }
+        if (err) {
+            break;
+        }
+        fmt = dpr.fmt;
+        pcmBytes += dpr.size;
+        if (out) {
+            fwrite(dpr.buf, 1, dpr.size, out);
+        }
+        if (!block) {
+            sink.confirmRead(dpr.size);
+        }
+    }
+    auto usElapsed = timer.usElapsed();
+    if (stopper.joinable()) {
+        stopper.join();
+    }
+    if (out) {
+        fclose(out);
+    }
+    if (!fmt) {
+        fprintf(stderr, "No audio decoded\n");
+        return 1;
+    }
+    int64_t samples = pcmBytes / (fmt.channels() * fmt.bits() / 8);
+    double secs = (double)samples / fmt.samplerate;
+    printf("%s%s%s%s%s%s%s: %.1f s of %d Hz %d-ch audio decoded in %.3f s, %.1fx realtime, %.1f us per 1152 samples\n",
+        synthetic ? "synthetic" : argv[optind], useEq ? " +eq" : "", useBlocks ? " +blocks" : "",
+        prefetchFrames ? " +task" : "", parallel ? " +parallel" : "", mono ? " +mono" : "",
+        framesPerBlock > 1 ? " +batch" : "", secs, (int)fmt.samplerate,
+        fmt.channels(), usElapsed / 1000000.0, secs * 1000000 / usElapsed,
+        (double)usElapsed * 1152 / samples);
+    // pullData() latencies are inclusive of the upstream nodes
+    AudioNode* nodes[] = { &src, &decoder, useEq ? &eq : nullptr,
+        prefetchFrames ? &prefetch : nullptr };
+    for (auto node: nodes) {
+        if (!node) {
+            continue;
+        }
+        auto& hist = node->pullLatency();
+        printf("  %-10s pull: %u calls, avg %u us, max %u us\n",
+            node->tag(), hist.count(), hist.avg(), hist.max());
+    }
+    if (err != AudioNode::kStreamStopped) {
+        fprintf(stderr, "Pipeline returned error %d\n", err);
+        return 1;
+    }
+    if (stopFrames) {
+        printf("  stopped after %lld samples\n", (long long)samples);
+    } else if (synthetic && samples != (int64_t)numFrames * Mp3Gen::samplesPerFrame()) {
+        fprintf(stderr, "Expected %d frames, but got %lld samples\n", numFrames, (long long)samples);
+        return 1;
+    }
+    return 0;
+}
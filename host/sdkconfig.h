@@ -0,0 +1,8 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+/* Host build configuration, in place of the one that ESP-IDF generates from Kconfig */
+#define CONFIG_NETPLAYER_AAC 1
+#define CONFIG_NETPLAYER_AAC_SBR 1
+#define CONFIG_NETPLAYER_OPUS 1
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HOST_SOC_RTC_H
+#define HOST_SOC_RTC_H
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t source_freq_mhz;
+    uint32_t div;
+    uint32_t freq_mhz;
+} rtc_cpu_freq_config_t;
+
+/* Reports the maximum ESP32 CPU frequency */
+void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t* out_config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,296 @@
+/* Host test and benchmark of DecoderWav in the pipeline: source -> DecoderNode.
+ * WAV streams of several formats, with chunks before and after the audio data,
+ * are fed by a source that splits its buffers at a wrap-around point, like the
+ * HTTP ring buffer. The sink pulls like I2sOutputNode - buffers with pullData()
+ * if it doesn't modify the samples, which are passed through from the source when
+ * they need no conversion, or blocks that it modifies in place, which must leave
+ * the source data intact. The output must be the PCM payload, converted to the
+ * output format where needed.
+ * Reports how much of the output was passed through without copying, and the
+ * CPU time per second of audio
+ * Usage: wavBench [-r repeats] [-w wrapSize]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+#include <decoderNode.hpp>
+
+// Feeds an in-memory WAV stream to the pipeline
+class MemSourceNode: public AudioNode
+{
+protected:
+    const std::vector<uint8_t>& mData;
+    size_t mPos = 0;
+    int mWrapSize;
+public:
+    MemSourceNode(const std::vector<uint8_t>& data, int wrapSize)
+    : AudioNode("memsrc"), mData(data), mWrapSize(wrapSize) {}
+    virtual Type type() const { return kTypeUnknown; }
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout)
+    {
+        if (mPos >= mData.size()) {
+            return kStreamStopped;
+        }
+        dpr.fmt = StreamFormat(kCodecWav);
+        if (!dpr.size) {
+            return kNoError;
+        }
+        dpr.buf = (char*)mData.data() + mPos;
+        dpr.size = std::min(dpr.size, (int)(mData.size() - mPos));
+        if (mWrapSize) {
+            dpr.size = std::min(dpr.size, (int)(mWrapSize - mPos % mWrapSize));
+        }
+        return kNoError;
+    }
+    virtual void confirmRead(int size) { mPos += size; }
+};
+
+struct Input
+{
+    std::string name;
+    std::vector<uint8_t> data;
+    std::vector<int32_t> samples; // interleaved
+    int channels = 2;
+    int bits = 16;
+    int samplerate = 44100;
+    bool raw = false;
+};
+
+static void putLe(std::vector<uint8_t>& out, uint32_t val, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(val >> (8 * i));
+    }
+}
+
+static void putChunkHeader(std::vector<uint8_t>& out, const char* id, uint32_t size)
+{
+    out.insert(out.end(), id, id + 4);
+    putLe(out, size, 4);
+}
+
+// A sweep with some noise, with a few full scale samples
+static void makeInput(Input& input, int seconds, bool extensible, bool liveSize)
+{
+    uint32_t seed = input.bits * 10 + input.channels;
+    int nframes = input.samplerate * seconds;
+    int32_t max = (1 << (input.bits - 1)) - 1;
+    for (int i = 0; i < nframes; i++) {
+        for (int ch = 0; ch < input.channels; ch++) {
+            seed = seed * 1103515245 + 12345;
+            double t = (double)i / input.samplerate;
+            int32_t s = (int32_t)(sin(2 * M_PI * (200 + 100 * ch + 500 * t) * t) * max * 0.8)
+                + (int32_t)((seed >> 8) & 0xff) - 128;
+            if (i % 10000 < 4) {
+                s = (i & 1) ? max : -max - 1;
+            }
+            input.samples.push_back(std::max(-max - 1, std::min(max, s)));
+        }
+    }
+    auto& out = input.data;
+    int blockAlign = input.channels * input.bits / 8;
+    uint32_t dataSize = nframes * blockAlign;
+    if (!input.raw) {
+        out.insert(out.end(), { 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E' });
+        putChunkHeader(out, "fmt ", extensible ? 40 : 16);
+        putLe(out, extensible ? 0xfffe : 1, 2);
+        putLe(out, input.channels, 2);
+        putLe(out, input.samplerate, 4);
+        putLe(out, input.samplerate * blockAlign, 4);
+        putLe(out, blockAlign, 2);
+        putLe(out, input.bits, 2);
+        if (extensible) {
+            putLe(out, 22, 2);
+            putLe(out, input.bits, 2);
+            putLe(out, input.channels == 2 ? 3 : 4, 4);
+            // KSDATAFORMAT_SUBTYPE_PCM
+            out.insert(out.end(), { 1, 0, 0, 0, 0, 0, 0x10, 0, 0x80, 0, 0, 0xaa, 0, 0x38, 0x9b, 0x71 });
+        }
+        const char info[] = "INFOISFT\x0b\0\0\0Lavf58.76.0"; // odd size, padded
+        putChunkHeader(out, "LIST", sizeof(info) - 1);
+        out.insert(out.end(), info, info + sizeof(info) - 1);
+        out.push_back(0);
+        putChunkHeader(out, "data", liveSize ? 0xffffffff : dataSize);
+    }
+    for (auto s: input.samples) {
+        putLe(out, (input.bits == 8) ? s + 128 : s, input.bits / 8);
+    }
+    if (!input.raw && !liveSize) { // must not be played
+        putChunkHeader(out, "id3 ", 1000);
+        out.resize(out.size() + 1000, 0x55);
+    }
+    if (!input.raw) {
+        uint32_t riffSize = out.size() - 8;
+        memcpy(out.data() + 4, &riffSize, 4);
+    }
+}
+
+static std::vector<uint8_t> expectedOutput(const Input& input, int outBits, bool mono)
+{
+    int bits = (input.bits == 16) ? 16 : outBits;
+    int64_t max = (1 << (bits - 1)) - 1;
+    int nch = (mono && input.channels == 2) ? 1 : input.channels;
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < input.samples.size(); i += input.channels) {
+        for (int ch = 0; ch < nch; ch++) {
+            // left-aligned to 32 bits, rounded if the output is narrower
+            int64_t val = (int64_t)input.samples[i + ch] << (32 - input.bits);
+            if (nch < input.channels) {
+                val = (((int64_t)input.samples[i] + input.samples[i + 1]) << (32 - input.bits)) >> 1;
+            }
+            val = (bits >= input.bits) ? val >> (32 - bits) : std::min(max, (val + ((int64_t)1 << (31 - bits))) >> (32 - bits));
+            putLe(out, val, bits / 8);
+        }
+    }
+    return out;
+}
+
+struct Result
+{
+    std::vector<uint8_t> pcm;
+    int64_t passthrough = 0; // output bytes that were in the input buffer
+    int64_t usElapsed = 0;
+};
+
+// Pulls the decoded stream, as I2sOutputNode does without or with processing the samples
+static bool play(const Input& input, int outBits, bool mono, bool blocksOnly, int wrapSize, Result& res)
+{
+    MemSourceNode src(input.data, wrapSize);
+    DecoderNode decoder(0, 1, outBits);
+    decoder.linkToPrev(&src);
+    decoder.setMonoOutput(mono);
+    auto inStart = (const char*)input.data.data();
+    auto inEnd = inStart + input.data.size();
+    for (;;) {
+        AudioNode::DataPullReq dpr(10240);
+        PcmBlockRef block;
+        ElapsedTimer timer;
+        AudioNode::StreamError err;
+        bool useBlock = blocksOnly;
+        if (useBlock) {
+            err = decoder.pullBlock(block, -1);
+            if (!err) {
+                dpr.buf = block->data;
+                dpr.size = block->size;
+                dpr.fmt = block->fmt;
+            }
+        } else {
+            err = decoder.pullData(dpr, -1);
+        }
+        res.usElapsed += timer.usElapsed(); // excluding the copy to the result below
+        if (err == AudioNode::kStreamStopped) {
+            return true;
+        } else if (err) {
+            fprintf(stderr, "%s: pull error %d\n", input.name.c_str(), err);
+            return false;
+        }
+        if (dpr.fmt.bits() != ((input.bits == 16) ? 16 : outBits) || dpr.fmt.samplerate != (uint32_t)input.samplerate) {
+            fprintf(stderr, "%s: unexpected output format %d bits, %d Hz\n", input.name.c_str(),
+                dpr.fmt.bits(), (int)dpr.fmt.samplerate);
+            return false;
+        }
+        if (dpr.buf >= inStart && dpr.buf < inEnd) {
+            res.passthrough += dpr.size;
+        }
+        res.pcm.insert(res.pcm.end(), dpr.buf, dpr.buf + dpr.size);
+        if (useBlock) {
+            memset(block->data, 0, block->size); // as the volume processing would
+        } else {
+            timer.reset();
+            decoder.confirmRead(dpr.size);
+            res.usElapsed += timer.usElapsed();
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 3;
+    int wrapSize = 32771; // odd, so that sample frames straddle the wrap-around point
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:")) != -1) {
+        switch (opt) {
+            case 'r': repeats = std::max(1, atoi(optarg)); break;
+            case 'w': wrapSize = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repeats] [-w wrapSize]\n", argv[0]);
+                return 2;
+        }
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    std::vector<Input> inputs(6);
+    inputs[0].name = "16-bit stereo";
+    makeInput(inputs[0], 10, false, false);
+    inputs[1].name = "16-bit stereo extensible, live";
+    makeInput(inputs[1], 3, true, true);
+    inputs[2].name = "8-bit mono";
+    inputs[2].bits = 8;
+    inputs[2].channels = 1;
+    inputs[2].samplerate = 22050;
+    makeInput(inputs[2], 3, false, false);
+    inputs[3].name = "24-bit stereo 96 kHz";
+    inputs[3].bits = 24;
+    inputs[3].samplerate = 96000;
+    makeInput(inputs[3], 3, false, false);
+    inputs[4].name = "32-bit mono";
+    inputs[4].bits = 32;
+    inputs[4].channels = 1;
+    makeInput(inputs[4], 2, true, false);
+    inputs[5].name = "raw 16-bit stereo";
+    inputs[5].raw = true;
+    makeInput(inputs[5], 3, false, true);
+    for (auto& input: inputs) {
+        auto original = input.data;
+        for (int outBits = 16; outBits <= 24; outBits += 8) {
+            for (int mono = 0; mono < (input.channels == 2 ? 2 : 1); mono++) {
+                auto expected = expectedOutput(input, outBits, mono);
+                bool canPassthrough = (input.bits == 16 || input.bits == outBits) && !(mono && input.channels == 2);
+                for (int blocksOnly = 0; blocksOnly < 2; blocksOnly++) {
+                    Result res;
+                    if (!play(input, outBits, mono, blocksOnly, wrapSize, res)) {
+                        return 1;
+                    }
+                    if (res.pcm != expected) {
+                        size_t diff = 0;
+                        while (diff < std::min(res.pcm.size(), expected.size()) && res.pcm[diff] == expected[diff]) {
+                            diff++;
+                        }
+                        fprintf(stderr, "%s: %d-bit%s%s output differs from the expected one at byte %zu "
+                            "(%zu vs %zu bytes)\n", input.name.c_str(), outBits, mono ? " mono" : "",
+                            blocksOnly ? " block" : "", diff, res.pcm.size(), expected.size());
+                        return 1;
+                    }
+                    if (input.data != original) {
+                        fprintf(stderr, "%s: %d-bit output: the source data was modified\n",
+                            input.name.c_str(), outBits);
+                        return 1;
+                    }
+                    // all but the sample frames split at the wrap-around point
+                    if (!blocksOnly && canPassthrough && res.passthrough < (int64_t)res.pcm.size() * 9 / 10) {
+                        fprintf(stderr, "%s: %d-bit output: only %lld of %zu bytes passed through\n",
+                            input.name.c_str(), outBits, (long long)res.passthrough, res.pcm.size());
+                        return 1;
+                    }
+                    if (mono || (outBits == 24 && input.bits == 16)) {
+                        continue; // timed with stereo output, once per output format
+                    }
+                    for (int i = 1; i < repeats; i++) {
+                        Result rerun;
+                        play(input, outBits, mono, blocksOnly, wrapSize, rerun);
+                        res.usElapsed = std::min(res.usElapsed, rerun.usElapsed);
+                    }
+                    double seconds = (double)input.samples.size() / input.channels / input.samplerate;
+                    printf("%s, %d-bit output, %s: %.0f%% passed through, %.0f us/s of audio\n",
+                        input.name.c_str(), outBits, blocksOnly ? "blocks" : "buffers",
+                        100.0 * res.passthrough / res.pcm.size(), res.usElapsed / seconds);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -125,7 +125,7 @@ void A2dpInputNode::doStop()
 A2dpInputNode::~A2dpInputNode()
 {
 }
-AudioNode::StreamError A2dpInputNode::pullData(DataPullReq& dpr, int timeout)
+AudioNode::StreamError A2dpInputNode::doPullData(DataPullReq& dpr, int timeout)
 {
     auto ret = mRingBuf.contigRead(dpr.buf, dpr.size, timeout);
     if (ret > 0) {
@@ -12,6 +12,7 @@
 #include "esp_log.h"
 #include "esp_a2dp_api.h"
 #include "audioNode.hpp"
+#include "spscRingBuf.hpp"
 #include "bluetooth.hpp"
 
 class A2dpInputNode: public AudioNodeWithState
@@ -25,7 +26,7 @@ public:
     };
 protected:
     static A2dpInputNode* gSelf; // bluetooth callbacks don't have a user pointer
-    RingBuf mRingBuf;
+    SpscRingBuf mRingBuf; // written only by the BT callback, read only by the output task
     StreamFormat mFormat;
     static void eventCallback(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param);
     static void dataCallback(const uint8_t* data, uint32_t len);
@@ -35,7 +36,7 @@ public:
     virtual Type type() const override { return AudioNode::kTypeA2dpIn; }
     A2dpInputNode(const char* btName);
     ~A2dpInputNode();
-    virtual StreamError pullData(DataPullReq& dpr, int timeout);
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout);
     virtual void confirmRead(int amount);
 };
 
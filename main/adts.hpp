@@ -0,0 +1,72 @@
+#ifndef ADTS_HPP
+#define ADTS_HPP
+#include <stdint.h>
+
+/* Header of an ADTS (Audio Data Transport Stream) frame, the framing of raw AAC
+ * streams, as served by internet radio stations with audio/aac(p) content type
+ */
+struct AdtsHeader
+{
+    enum {
+        kHeaderSize = 7, // without the optional CRC
+        kMaxFrameSize = 6144 / 8 * 2 + kHeaderSize + 2 // max raw data block of 6144 bits per channel, stereo
+    };
+    uint8_t mpegVersion; // 2 or 4
+    uint8_t objectType; // 1 - AAC Main, 2 - AAC LC, 3 - AAC SSR, 4 - AAC LTP
+    uint8_t channels;
+    bool hasCrc;
+    uint8_t rawBlocks; // number of raw data blocks in the frame
+    int sampleRate;
+    int frameSize; // including the header
+    // Parses the header at p, which must have at least kHeaderSize bytes.
+    // Returns false if there is no valid header there
+    bool parse(const uint8_t* p)
+    {
+        // syncword, layer must be 0
+        if (p[0] != 0xff || (p[1] & 0xf6) != 0xf0) {
+            return false;
+        }
+        sampleRate = sampleRateFromIndex((p[2] >> 2) & 0x0f);
+        if (sampleRate < 0) {
+            return false;
+        }
+        mpegVersion = (p[1] & 0x08) ? 2 : 4;
+        hasCrc = !(p[1] & 0x01);
+        objectType = (p[2] >> 6) + 1;
+        channels = ((p[2] & 0x01) << 2) | (p[3] >> 6);
+        frameSize = ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+        rawBlocks = (p[6] & 0x03) + 1;
+        // channel config 0 (defined in the stream) and multichannel are not supported.
+        // Frames of several raw data blocks are valid, but not supported by the decoder
+        return channels >= 1 && channels <= 2 && frameSize > headerSize() && frameSize <= kMaxFrameSize * rawBlocks;
+    }
+    // MPEG-4 sampling frequency index, as in ADTS headers and the AudioSpecificConfig.
+    // Returns -1 for reserved values
+    static int sampleRateFromIndex(int idx)
+    {
+        static const int kSampleRates[] = {
+            96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+        };
+        return (idx < (int)(sizeof(kSampleRates) / sizeof(kSampleRates[0]))) ? kSampleRates[idx] : -1;
+    }
+    int headerSize() const { return hasCrc ? kHeaderSize + 2 : kHeaderSize; }
+    // Whether the fields that are the same in all frames of a stream match
+    bool sameStream(const AdtsHeader& other) const
+    {
+        return mpegVersion == other.mpegVersion && objectType == other.objectType &&
+            sampleRate == other.sampleRate && channels == other.channels;
+    }
+    // Returns the offset of the first valid header in buf, or -1 if there is none
+    // that fits entirely in it
+    static int find(const uint8_t* buf, int len, AdtsHeader& hdr)
+    {
+        for (int i = 0; i <= len - kHeaderSize; i++) {
+            if (buf[i] == 0xff && hdr.parse(buf + i)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+#endif
@@ -33,7 +33,8 @@ void AudioNodeWithState::setState(State newState)
 bool AudioNodeWithTask::createAndStartTask()
 {
     mEvents.clearBits(kEvtStopRequest);
-    auto ret = xTaskCreate(sTaskFunc, mTag, mStackSize, this, mTaskPrio, &mTaskId);
+    mTerminate = false; // may be set by a previous stop()
+    auto ret = xTaskCreatePinnedToCore(sTaskFunc, mTag, mStackSize, this, mTaskPrio, &mTaskId, mCpuCore);
     if (ret == pdPASS) {
         assert(mTaskId);
         return true;
@@ -158,6 +159,13 @@ void AudioNodeWithTask::processMessages()
         }
     }
 }
+const Histogram::Bounds Histogram::kUsPullLatency = {
+    50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+const Histogram::Bounds Histogram::kMsEndToEnd = {
+    100, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 10000
+};
+
 const char* StreamFormat::codecTypeToStr(CodecType type)
 {
     switch (type) {
@@ -167,6 +175,7 @@ const char* StreamFormat::codecTypeToStr(CodecType type)
         case kCodecM4a: return "m4a";
         case kCodecFlac: return "flac";
         case kCodecOpus: return "opus";
+        case kCodecWav: return "wav";
         case kCodecUnknown: return "none";
         default: return "(unknown)";
     }
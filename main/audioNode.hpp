@@ -20,6 +20,7 @@
 #include "queue.hpp"
 #include "utils.hpp"
 #include "playlist.hpp"
+#include "latency.hpp"
 enum CodecType: uint8_t {
     kCodecUnknown = 0,
     kCodecMp3,
@@ -88,6 +89,7 @@ public:
 };
 
 class IAudioVolume;
+class PcmBlockRef;
 
 class AudioNode
 {
@@ -116,7 +118,9 @@ public:
         kTypeEqualizer,
         kTypeI2sOut,
         kTypeHttpOut,
-        kTypeA2dpOut
+        kTypeA2dpOut,
+        kTypePrefetch,
+        kTypeDemuxer
     };
     struct EventHandler
     {
@@ -131,8 +135,9 @@ protected:
     void* mUserp = nullptr;
     uint32_t mSubscribedEvents = 0;
     EventHandler* mEventHandler = nullptr;
+    Histogram mPullLatency;
     inline void sendEvent(uint32_t type, void* buf=nullptr, int bufSize=0);
-    AudioNode(const char* tag): mTag(tag) {}
+    AudioNode(const char* tag): mTag(tag), mPullLatency(Histogram::kUsPullLatency) {}
 public:
     virtual Type type() const = 0;
     virtual IAudioVolume* volumeInterface() { return nullptr; }
@@ -148,25 +153,91 @@ public:
         kStreamFlush = - 5,
         kErrNoCodec = -6,
         kErrDecode = -7,
-        kErrStreamFmt = -8
+        kErrStreamFmt = -8,
+        kErrNotSupported = -9
     };
     struct DataPullReq
     {
         char* buf;
         int size;
         StreamFormat fmt;
+        // esp_timer_get_time() of when the data that the buffer was produced from
+        // entered the pipeline, or 0 if unknown. Used to measure end-to-end latency
+        int64_t ts;
+        // Byte offset of buf in the stream, or -1 if not known. Set by DemuxNode,
+        // for the decoder to locate its frames after a seek
+        int64_t streamPos;
         DataPullReq(size_t aSize) { reset(aSize); }
         void reset(size_t aSize)
         {
             size = aSize;
             buf = nullptr;
+            ts = 0;
+            streamPos = -1;
         }
     };
-
+    // A whole codec packet, as split from its container by a demuxer
+    struct PacketPullReq: public DataPullReq
+    {
+        enum: uint8_t {
+            kFlagConfig = 1 // codec configuration (e.g. the MP4 AudioSpecificConfig), not audio
+        };
+        // Presentation time of the packet's first sample from the start of the
+        // stream, in microseconds, or -1 if not known
+        int64_t pts;
+        uint8_t flags;
+        PacketPullReq(): DataPullReq(0) { pts = -1; flags = 0; }
+    };
+protected:
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout) = 0;
+    virtual StreamError doPullBlock(PcmBlockRef& block, int timeout) { return kErrNotSupported; }
+    virtual StreamError doPullPacket(PacketPullReq& pkt, int timeout) { return kErrNotSupported; }
+public:
     // Upon return, buf is set to the internal buffer containing the data, and size is updated to the available data
     // for reading from it. Once the caller reads the amount it needs, it must call
     // confirmRead() with the actual amount read.
-    virtual StreamError pullData(DataPullReq& dpr, int timeout) = 0;
+    // The time spent in the call, including pulling from upstream nodes, is
+    // recorded in the pullLatency() histogram
+    StreamError pullData(DataPullReq& dpr, int timeout)
+    {
+        LatencyTimer timer;
+        auto ret = doPullData(dpr, timeout);
+        mPullLatency.add(timer.usElapsed());
+        return ret;
+    }
+    /* Zero-copy alternative to pullData() for PCM-producing nodes - returns a
+     * reference to a pooled block, which the caller can keep or pass on as long
+     * as it needs, without copying. No confirmRead() is needed. A block may be
+     * shared by several holders, so it must not be modified unless unique()
+     */
+    StreamError pullBlock(PcmBlockRef& block, int timeout)
+    {
+        LatencyTimer timer;
+        auto ret = doPullBlock(block, timeout);
+        mPullLatency.add(timer.usElapsed());
+        return ret;
+    }
+    // Whether pullBlock() is supported
+    virtual bool hasBlockOutput() const { return false; }
+    /* Returns the next whole codec packet of the stream, which must be released
+     * with confirmRead(pkt.size). Supported by demuxers, for the current stream,
+     * if hasPacketOutput() returns true after the stream format was pulled
+     */
+    StreamError pullPacket(PacketPullReq& pkt, int timeout)
+    {
+        LatencyTimer timer;
+        auto ret = doPullPacket(pkt, timeout);
+        mPullLatency.add(timer.usElapsed());
+        return ret;
+    }
+    virtual bool hasPacketOutput() const { return false; }
+    // Random access sources (i.e. HTTP with Range requests) restart the stream
+    // at the byte offset. The next pullData() returns kStreamFlush, and then
+    // the data from that offset. Returns false if not supported
+    virtual bool seekToByte(int64_t pos) { return false; }
+    // Length of the whole stream in bytes, or -1 if not known
+    virtual int64_t streamLength() const { return -1; }
+    Histogram& pullLatency() { return mPullLatency; }
     virtual void confirmRead(int amount) = 0;
     static StreamError threeStateStreamError(int ret) {
         if (ret > 0) {
@@ -228,6 +299,7 @@ protected:
     TaskHandle_t mTaskId = NULL;
     uint32_t mStackSize;
     UBaseType_t mTaskPrio;
+    BaseType_t mCpuCore = tskNO_AFFINITY;
     Queue<Command, 4> mCmdQueue;
     static void sTaskFunc(void* ctx);
     bool createAndStartTask();
@@ -245,6 +317,8 @@ public:
     :AudioNodeWithState(tag), mStackSize(stackSize), mTaskPrio(prio)
     {}
     void setPriority(UBaseType_t prio) { mTaskPrio = prio; }
+    // Pins the node's task to the specified core, takes effect when the task is (re)started
+    void setCpuCore(BaseType_t core) { mCpuCore = core; }
 };
 
 inline void AudioNode::sendEvent(uint32_t type, void *buf, int bufSize)
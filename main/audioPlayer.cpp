@@ -5,9 +5,11 @@
 #include "audioPlayer.hpp"
 #include "httpNode.hpp"
 #include "i2sSinkNode.hpp"
+#include "demuxNode.hpp"
 #include "decoderNode.hpp"
 #include "equalizerNode.hpp"
 #include "a2dpInputNode.hpp"
+#include "prefetchNode.hpp"
 #include <stdfonts.hpp>
 
 #define LOCK_PLAYER() MutexLocker locker(mutex)
@@ -96,18 +98,38 @@ bool AudioPlayer::createPipeline(AudioNode::Type inType, AudioNode::Type outType
 {
     ESP_LOGI(TAG, "Creating audio pipeline");
     AudioNode* pcmSource = nullptr;
+    int prefetchFrames = (inType == AudioNode::kTypeHttpIn)
+        ? std::min((int)mNvsHandle.readDefault<uint8_t>("decFrames", 0), (int)PrefetchNode::kMaxFrames)
+        : 0;
+    bool eqOnDecoderTask = mNvsHandle.readDefault<uint8_t>("decTaskEq", 1);
+    auto addEqualizer = [&]() {
+        mEqualizer.reset(new EqualizerNode(sDefaultEqGains));
+        mEqualizer->linkToPrev(pcmSource);
+        pcmSource = mEqualizer.get();
+    };
     switch(inType) {
     case AudioNode::kTypeHttpIn:
         mStreamIn.reset(new HttpNode(kHttpBufSize));
         mStreamIn->subscribeToEvents(HttpNode::kEventTrackInfo | HttpNode::kEventConnecting | HttpNode::kEventConnected);
         mStreamIn->setEventHandler(this);
 
-        mDecoder.reset(new DecoderNode);
-        mDecoder->linkToPrev(mStreamIn.get());
+        mDemux.reset(new DemuxNode());
+        mDemux->linkToPrev(mStreamIn.get());
+        mDecoder.reset(new DecoderNode(prefetchFrames, mNvsHandle.readDefault<uint8_t>("decBatch", 1)));
+        mDecoder->linkToPrev(mDemux.get());
+        if (mNvsHandle.readDefault<uint8_t>("decPar", 0)) {
+            // second channel on the core that doesn't run the decoder task
+            mDecoder->enableParallelDecode(1 - mNvsHandle.readDefault<uint8_t>("decCore", 1));
+        }
+        mDecoder->setQuality((Decoder::Quality)mNvsHandle.readDefault<uint8_t>("decQual", Decoder::kQualityFull),
+            mNvsHandle.readDefault<uint8_t>("decBands", Decoder::kMaxBands));
+        mDecoder->setMonoOutput(mNvsHandle.readDefault<uint8_t>("decMono", 0));
+        mDecoder->setDither(mNvsHandle.readDefault<uint8_t>("decDither", 0));
         pcmSource = mDecoder.get();
         break;
     case AudioNode::kTypeA2dpIn:
         mStreamIn.reset(new A2dpInputNode("NetPlayer"));
+        mDemux.reset();
         mDecoder.reset();
         pcmSource = mStreamIn.get();
         break;
@@ -115,10 +137,18 @@ bool AudioPlayer::createPipeline(AudioNode::Type inType, AudioNode::Type outType
         ESP_LOGE(TAG, "Unknown pipeline input node type %d", inType);
         return false;
     }
-    if (mFlags & kFlagUseEqualizer) {
-        mEqualizer.reset(new EqualizerNode(sDefaultEqGains));
-        mEqualizer->linkToPrev(pcmSource);
-        pcmSource = mEqualizer.get();
+    bool useEq = mFlags & kFlagUseEqualizer;
+    if (useEq && (!prefetchFrames || eqOnDecoderTask)) {
+        addEqualizer();
+    }
+    if (prefetchFrames) {
+        mPrefetch.reset(new PrefetchNode(prefetchFrames,
+            mNvsHandle.readDefault<uint8_t>("decCore", 1)));
+        mPrefetch->linkToPrev(pcmSource);
+        pcmSource = mPrefetch.get();
+        if (useEq && !eqOnDecoderTask) {
+            addEqualizer();
+        }
     }
     switch(outType) {
     case AudioNode::kTypeI2sOut:
@@ -211,6 +241,28 @@ void AudioPlayer::changeInput(AudioNode::Type inType)
     initFromNvs();
 }
 
+void AudioPlayer::setDecoderTask(int prefetchFrames, int cpuCore, bool eqOnDecoderTask, bool parallel,
+    int framesPerBlock)
+{
+    destroyPipeline();
+    mNvsHandle.write("decBatch", (uint8_t)framesPerBlock);
+    mNvsHandle.write("decFrames", (uint8_t)prefetchFrames);
+    mNvsHandle.write("decCore", (uint8_t)cpuCore);
+    mNvsHandle.write("decTaskEq", (uint8_t)eqOnDecoderTask);
+    mNvsHandle.write("decPar", (uint8_t)parallel);
+    initFromNvs();
+}
+
+void AudioPlayer::setDecoderQuality(uint8_t quality, int maxBands, bool mono, bool dither)
+{
+    destroyPipeline();
+    mNvsHandle.write("decQual", quality);
+    mNvsHandle.write("decBands", (uint8_t)maxBands);
+    mNvsHandle.write("decMono", (uint8_t)mono);
+    mNvsHandle.write("decDither", (uint8_t)dither);
+    initFromNvs();
+}
+
 void AudioPlayer::loadSettings()
 {
     if (mVolumeInterface) {
@@ -253,7 +305,9 @@ void AudioPlayer::destroyPipeline()
     }
     stop();
     mStreamIn.reset();
+    mPrefetch.reset(); // holds blocks from the decoder's pool
     mDecoder.reset();
+    mDemux.reset();
     mEqualizer.reset();
     mStreamOut.reset();
 }
@@ -294,6 +348,9 @@ void AudioPlayer::play()
 {
     LOCK_PLAYER();
     mStreamIn->run();
+    if (mPrefetch) {
+        mPrefetch->run();
+    }
     mStreamOut->run();
     lcdUpdatePlayState();
 }
@@ -302,6 +359,9 @@ void AudioPlayer::pause()
 {
     LOCK_PLAYER();
     mStreamIn->pause();
+    if (mPrefetch) {
+        mPrefetch->pause();
+    }
     mStreamOut->pause();
     mStreamIn->waitForState(AudioNodeWithTask::kStatePaused);
     mStreamOut->waitForState(AudioNodeWithTask::kStatePaused);
@@ -313,12 +373,29 @@ void AudioPlayer::resume()
     play();
 }
 
+// Seeks in the current file, by the MP3 seek table or bitrate. Live streams can't be seeked
+bool AudioPlayer::seek(int ms)
+{
+    LOCK_PLAYER();
+    if (!mDemux || !mDemux->seekToTime(ms)) {
+        ESP_LOGW(TAG, "Seek is not supported for the current stream");
+        return false;
+    }
+    return true;
+}
+
 void AudioPlayer::stop()
 {
    LOCK_PLAYER();
    mStreamIn->stop(false);
+   if (mPrefetch) {
+       mPrefetch->stop(false);
+   }
    mStreamOut->stop(false);
    mStreamIn->waitForStop();
+   if (mPrefetch) {
+       mPrefetch->waitForStop();
+   }
    mStreamOut->waitForStop();
    mTitleScrollTimer.cancel();
    if (mVolumeInterface) {
@@ -484,6 +561,24 @@ esp_err_t AudioPlayer::pauseUrlHandler(httpd_req_t *req)
     return ESP_OK;
 }
 
+// ms=N - position to seek to in the current file
+esp_err_t AudioPlayer::seekUrlHandler(httpd_req_t *req)
+{
+    auto self = static_cast<AudioPlayer*>(req->user_ctx);
+    UrlParams params(req);
+    auto ms = params.intVal("ms", -1);
+    if (ms < 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid 'ms' parameter");
+        return ESP_OK;
+    }
+    if (!self->seek(ms)) {
+        httpd_resp_send_err(req, HTTPD_501_METHOD_NOT_IMPLEMENTED, "Stream can't be seeked");
+        return ESP_OK;
+    }
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
 void AudioPlayer::registerHttpGetHandler(httpd_handle_t server,
     const char* path, esp_err_t(*handler)(httpd_req_t*))
 {
@@ -604,20 +699,136 @@ esp_err_t AudioPlayer::getStatusUrlHandler(httpd_req_t* req)
             if (icy.trackName()) {
                 buf.printf(",\"track\":\"%s\"", icy.trackName());
             }
+            auto wakeups = http->bufWakeupStats();
+            buf.printf(",\"rbwake\":%u,\"rbspur\":%u", wakeups.wakeups, wakeups.spurious);
     }
     buf.printf("}");
     httpd_resp_sendstr(req, buf.buf());
     return ESP_OK;
 }
 
+// Per-node pullData() latency histograms (in us, inclusive of upstream nodes),
+// the latency of the last seek and the network-to-i2s latency histogram (in ms).
+// The 'reset' param clears the histograms
+esp_err_t AudioPlayer::getStatsUrlHandler(httpd_req_t* req)
+{
+    auto self = static_cast<AudioPlayer*>(req->user_ctx);
+    MutexLocker locker(self->mutex);
+    UrlParams params(req);
+    bool reset = params.intVal("reset", 0);
+    DynBuffer buf(512);
+    AudioNode* nodes[] = { self->mStreamIn.get(), self->mDemux.get(), self->mDecoder.get(),
+        self->mEqualizer.get(), self->mPrefetch.get() };
+    bool first = true;
+    buf.printf("{\"pull\":{");
+    for (auto node: nodes) {
+        if (!node) {
+            continue;
+        }
+        buf.printf(first ? "\"%s\":" : ",\"%s\":", node->tag());
+        first = false;
+        node->pullLatency().toJson(buf);
+        if (reset) {
+            node->pullLatency().reset();
+        }
+    }
+    buf.printf("},\"pullBounds\":");
+    Histogram::boundsToJson(buf, Histogram::kUsPullLatency);
+    if (self->mDemux) {
+        buf.printf(",\"seekMs\":%d", self->mDemux->lastSeekLatencyMs());
+    }
+    if (self->mPrefetch) {
+        buf.printf(",\"prefetch\":{\"queued\":%d,\"underruns\":%u}",
+            self->mPrefetch->queuedFrames(), self->mPrefetch->underruns());
+    }
+    auto out = self->mStreamOut.get();
+    if (out && out->type() == AudioNode::kTypeI2sOut) {
+        auto i2s = static_cast<I2sOutputNode*>(out);
+        buf.printf(",\"i2sUnderruns\":%u", i2s->underruns());
+        auto& e2e = i2s->endToEndLatency();
+        buf.printf(",\"e2e\":");
+        e2e.toJson(buf);
+        buf.printf(",\"e2eBounds\":");
+        Histogram::boundsToJson(buf, Histogram::kMsEndToEnd);
+        if (reset) {
+            e2e.reset();
+        }
+    }
+    buf.printf("}");
+    httpd_resp_sendstr(req, buf.buf());
+    return ESP_OK;
+}
+
+// frames=N - frames to decode ahead in a separate task, 0 disables the decoder task
+// core=0|1 - the core to run the decoder task on
+// eq=0|1 - whether the equalizer runs in the decoder task
+// par=0|1 - decode the two stereo channels in parallel, on both cores
+// batch=N - frames to decode per output block, up to DecoderNode::kMaxFramesPerBlock
+esp_err_t AudioPlayer::decoderTaskUrlHandler(httpd_req_t* req)
+{
+    auto self = static_cast<AudioPlayer*>(req->user_ctx);
+    MutexLocker locker(self->mutex);
+    UrlParams params(req);
+    auto frames = params.intVal("frames", -1);
+    if (frames < 0 || frames > PrefetchNode::kMaxFrames) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid 'frames' param");
+        return ESP_OK;
+    }
+    auto core = params.intVal("core", 1);
+    auto eq = params.intVal("eq", 1);
+    auto par = params.intVal("par", 0);
+    auto batch = params.intVal("batch", 1);
+    if (batch < 1 || batch > DecoderNode::kMaxFramesPerBlock) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid 'batch' param");
+        return ESP_OK;
+    }
+    self->setDecoderTask(frames, core, eq, par, batch); // recreates the pipeline, stopping playback
+    DynBuffer buf(100);
+    buf.printf("Decoder task: %d frames, core %d, eq %d, parallel %d, batch %d", frames, core, eq, par, batch);
+    httpd_resp_send(req, buf.buf(), buf.dataSize());
+    return ESP_OK;
+}
+
+// q=0|1|2 - full quality, half samplerate, or decode only the lowest subbands
+// bands=N - the number of subbands to decode with q=2, out of 32
+// mono=0|1 - downmix stereo streams in the decoder, for a mono output
+// dither=0|1 - add TPDF dither when converting the decoded samples to 16-bit
+esp_err_t AudioPlayer::decoderQualityUrlHandler(httpd_req_t* req)
+{
+    auto self = static_cast<AudioPlayer*>(req->user_ctx);
+    MutexLocker locker(self->mutex);
+    UrlParams params(req);
+    auto quality = params.intVal("q", -1);
+    if (quality < Decoder::kQualityFull || quality > Decoder::kQualityBandLimit) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid 'q' param");
+        return ESP_OK;
+    }
+    auto bands = params.intVal("bands", Decoder::kMaxBands);
+    if (bands < 1 || bands > Decoder::kMaxBands) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid 'bands' param");
+        return ESP_OK;
+    }
+    auto mono = params.intVal("mono", 0);
+    auto dither = params.intVal("dither", 0);
+    self->setDecoderQuality(quality, bands, mono, dither); // recreates the pipeline, stopping playback
+    DynBuffer buf(70);
+    buf.printf("Decoder quality: %d, bands %d, mono %d, dither %d", quality, bands, mono, dither);
+    httpd_resp_send(req, buf.buf(), buf.dataSize());
+    return ESP_OK;
+}
+
 void AudioPlayer::registerUrlHanlers(httpd_handle_t server)
 {
     registerHttpGetHandler(server, "/play", &playUrlHandler);
     registerHttpGetHandler(server, "/pause", &pauseUrlHandler);
+    registerHttpGetHandler(server, "/seek", &seekUrlHandler);
     registerHttpGetHandler(server, "/vol", &volumeUrlHandler);
     registerHttpGetHandler(server, "/eqget", &equalizerDumpUrlHandler);
     registerHttpGetHandler(server, "/eqset", &equalizerSetUrlHandler);
     registerHttpGetHandler(server, "/status", &getStatusUrlHandler);
+    registerHttpGetHandler(server, "/stats", &getStatsUrlHandler);
+    registerHttpGetHandler(server, "/dectask", &decoderTaskUrlHandler);
+    registerHttpGetHandler(server, "/decqual", &decoderQualityUrlHandler);
 }
 
 bool AudioPlayer::onEvent(AudioNode *self, uint32_t event, void *buf, size_t bufSize)
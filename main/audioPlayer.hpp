@@ -7,8 +7,10 @@
 #include "eventGroup.hpp"
 #include <st7735.hpp>
 
+class DemuxNode;
 class DecoderNode;
 class EqualizerNode;
+class PrefetchNode;
 class ST7735Display;
 
 namespace nvs {
@@ -32,8 +34,10 @@ protected:
     static const float sDefaultEqGains[];
     Flags mFlags;
     std::unique_ptr<AudioNodeWithState> mStreamIn;
+    std::unique_ptr<DemuxNode> mDemux;
     std::unique_ptr<DecoderNode> mDecoder;
     std::unique_ptr<EqualizerNode> mEqualizer;
+    std::unique_ptr<PrefetchNode> mPrefetch; // decoder task, if enabled
     std::unique_ptr<AudioNodeWithTask> mStreamOut;
     IAudioVolume* mVolumeInterface = nullptr;
     NvsHandle mNvsHandle;
@@ -74,6 +78,7 @@ protected:
     bool createPipeline(AudioNode::Type inType, AudioNode::Type outType);
     void destroyPipeline();
     void detectVolumeNode();
+
     std::string printPipeline();
     void loadSettings();
     void initFromNvs();
@@ -90,10 +95,14 @@ protected:
     // web URL handlers
     static esp_err_t playUrlHandler(httpd_req_t *req);
     static esp_err_t pauseUrlHandler(httpd_req_t *req);
+    static esp_err_t seekUrlHandler(httpd_req_t *req);
     static esp_err_t volumeUrlHandler(httpd_req_t *req);
     static esp_err_t equalizerSetUrlHandler(httpd_req_t *req);
     static esp_err_t equalizerDumpUrlHandler(httpd_req_t *req);
     static esp_err_t getStatusUrlHandler(httpd_req_t *req);
+    static esp_err_t getStatsUrlHandler(httpd_req_t *req);
+    static esp_err_t decoderTaskUrlHandler(httpd_req_t *req);
+    static esp_err_t decoderQualityUrlHandler(httpd_req_t *req);
     void registerHttpGetHandler(httpd_handle_t server,
         const char* path, esp_err_t(*handler)(httpd_req_t*));
 public:
@@ -108,6 +117,13 @@ public:
     AudioNode::Type outputType() const { return mStreamOut->type(); }
     NvsHandle& nvs() { return mNvsHandle; }
     void changeInput(AudioNode::Type inType);
+    // Runs the decoder in a separate task pinned to cpuCore, that decodes up to
+    // prefetchFrames ahead of the output. 0 frames disables it. The equalizer runs
+    // in the decoder task if eqOnDecoderTask is set, otherwise in the output task.
+    // If parallel is set, the second stereo channel is decoded on the other core
+    void setDecoderTask(int prefetchFrames, int cpuCore, bool eqOnDecoderTask, bool parallel,
+        int framesPerBlock);
+    void setDecoderQuality(uint8_t quality, int maxBands, bool mono, bool dither); // quality is a Decoder::Quality
     void playUrl(const char* url, const char* record=nullptr);
     bool isStopped() const;
     bool isPaused() const;
@@ -116,6 +132,9 @@ public:
     void pause();
     void resume();
     void stop();
+    // Continues the current file from the position, returns false if the
+    // stream can't be seeked. The seek is done asynchronously
+    bool seek(int ms);
     int volumeGet();
     bool volumeSet(uint16_t vol);
     uint16_t volumeChange(int step);
@@ -0,0 +1,64 @@
+#include "coreWorker.hpp"
+#include <esp_log.h>
+#include "utils.hpp"
+
+static const char* TAG = "worker";
+
+CoreWorker::CoreWorker(BaseType_t core, UBaseType_t prio)
+{
+    mMadWorker.start = sMadStart;
+    mMadWorker.wait = sMadWait;
+    mMadWorker.ctx = this;
+    if (xTaskCreatePinnedToCore(sTaskFunc, "worker", kStackSize, this, prio, &mTask, core) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating worker task");
+        mTask = nullptr;
+    }
+}
+
+CoreWorker::~CoreWorker()
+{
+    if (!mTask) {
+        return;
+    }
+    mTerminate = true;
+    xTaskNotifyGive(mTask);
+    mEvents.waitForOneNoReset(kEvtExited, -1);
+}
+
+void CoreWorker::sTaskFunc(void* ctx)
+{
+    auto self = static_cast<CoreWorker*>(ctx);
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (self->mTerminate) {
+            break;
+        }
+        self->mFunc(self->mArg);
+        self->mEvents.setBits(kEvtDone);
+    }
+    self->mEvents.setBits(kEvtExited);
+    vTaskDelete(nullptr);
+}
+
+void CoreWorker::start(void (*func)(void*), void* arg)
+{
+    myassert(mTask);
+    mFunc = func;
+    mArg = arg;
+    xTaskNotifyGive(mTask);
+}
+
+void CoreWorker::wait()
+{
+    mEvents.waitForOneAndReset(kEvtDone, -1);
+}
+
+void CoreWorker::sMadStart(void* ctx, void (*func)(void*), void* arg)
+{
+    static_cast<CoreWorker*>(ctx)->start(func, arg);
+}
+
+void CoreWorker::sMadWait(void* ctx)
+{
+    static_cast<CoreWorker*>(ctx)->wait();
+}
@@ -0,0 +1,39 @@
+#ifndef CORE_WORKER_HPP
+#define CORE_WORKER_HPP
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mad.h>
+#include "eventGroup.hpp"
+
+/* A task pinned to a core, to which a function can be handed off to run in
+ * parallel with the caller. Only one function can be in flight at a time.
+ * The handoff is a direct task notification, and completion is signalled via an
+ * event group, so that it doesn't interfere with notifications that the
+ * calling task may use for other purposes
+ */
+class CoreWorker
+{
+protected:
+    enum { kStackSize = 3000 };
+    enum: EventBits_t { kEvtDone = 1, kEvtExited = 2 };
+    TaskHandle_t mTask = nullptr;
+    void (*volatile mFunc)(void*) = nullptr;
+    void* volatile mArg = nullptr;
+    volatile bool mTerminate = false;
+    EventGroup mEvents;
+    mad_worker mMadWorker;
+    static void sTaskFunc(void* ctx);
+    static void sMadStart(void* ctx, void (*func)(void*), void* arg);
+    static void sMadWait(void* ctx);
+public:
+    CoreWorker(BaseType_t core, UBaseType_t prio);
+    ~CoreWorker();
+    bool isRunning() const { return mTask != nullptr; }
+    void start(void (*func)(void*), void* arg);
+    // Blocks until the function passed to start() returns
+    void wait();
+    // Adapter for libmad's mad_frame::worker
+    const mad_worker* madWorker() const { return &mMadWorker; }
+};
+
+#endif
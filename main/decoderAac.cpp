@@ -0,0 +1,328 @@
+#include "decoderAac.hpp"
+#ifdef CONFIG_NETPLAYER_AAC
+
+static const char* TAG = "aacdec";
+
+DecoderAac::DecoderAac()
+{
+    initHelix();
+}
+DecoderAac::~DecoderAac()
+{
+    freeHelix();
+}
+void DecoderAac::initHelix()
+{
+    mHelix = AACInitDecoder();
+    if (!mHelix) {
+        ESP_LOGE(TAG, "Out of memory allocating Helix AAC decoder");
+    }
+}
+void DecoderAac::freeHelix()
+{
+    if (mHelix) {
+        AACFreeDecoder(mHelix);
+        mHelix = nullptr;
+    }
+}
+
+void DecoderAac::reset()
+{
+    mInputLen = 0;
+    mSynced = false;
+    mPcmPos = mPcmLen = 0;
+    mRawMode = false;
+    mFrameErrors = 0;
+    freeHelix();
+    initHelix();
+    mOutputFormat.reset();
+}
+
+int DecoderAac::inputBytesNeeded()
+{
+    // with part of a frame still to be output, decode() is called without input
+    return (mPcmPos < mPcmLen) ? 0 : sizeof(mInputBuf) - mInputLen;
+}
+
+int DecoderAac::decode(const char* buf, int& size)
+{
+    if (!mHelix) {
+        return AudioNode::kErrDecode;
+    }
+    if (mPcmPos < mPcmLen) {
+        size = 0;
+        return outputPcm();
+    }
+    // Bounce buffer handling is the same as in DecoderMp3::decode()
+    int copied = 0;
+    const char* src;
+    int srcLen;
+    if (mInputLen || !buf) {
+        if (buf) {
+            copied = std::min(size, (int)kInputBufSize - mInputLen);
+            memcpy(mInputBuf + mInputLen, buf, copied);
+        }
+        src = mInputBuf;
+        srcLen = mInputLen + copied;
+    } else {
+        src = buf;
+        srcLen = size;
+    }
+    int pos = 0;
+    int errors = 0;
+    for (;;) {
+        AdtsHeader hdr;
+        int skip;
+        int offset = findFrame((const uint8_t*)src + pos, srcLen - pos, hdr, skip);
+        if (offset == -2) {
+            mInputLen = 0;
+            return AudioNode::kErrDecode;
+        }
+        if (offset < 0) {
+            inputConsumed(buf, size, src, srcLen, pos + skip, copied, true);
+            return AudioNode::kNeedMoreData;
+        }
+        auto frame = (const uint8_t*)src + pos + offset;
+        pos += offset + hdr.frameSize;
+        int len = decodeToOutput(frame, hdr.frameSize, hdr.mpegVersion);
+        if (len < 0) {
+            if (++errors < kMaxFrameErrors) {
+                continue; // skip the frame
+            }
+            ESP_LOGW(TAG, "Too many consecutive frame errors");
+            mInputLen = 0;
+            return AudioNode::kErrDecode;
+        }
+        if (!mSynced) {
+            mSynced = true;
+            mStreamHeader = hdr;
+        }
+        inputConsumed(buf, size, src, srcLen, pos, copied, false);
+        return len;
+    }
+}
+
+// Whole ADTS frames from AdtsDemux, or the AudioSpecificConfig and then raw
+// access units from Mp4Demux
+int DecoderAac::decodePacket(const AudioNode::PacketPullReq& pkt)
+{
+    if (!mHelix) {
+        return AudioNode::kErrDecode;
+    }
+    auto data = (const uint8_t*)pkt.buf;
+    if (pkt.flags & AudioNode::PacketPullReq::kFlagConfig) {
+        return setRawConfig(data, pkt.size) ? (int)AudioNode::kNeedMoreData : (int)AudioNode::kErrDecode;
+    }
+    AdtsHeader hdr;
+    bool adts = !mRawMode && pkt.size >= AdtsHeader::kHeaderSize && hdr.parse(data);
+    if (adts && hdr.rawBlocks > 1) {
+        ESP_LOGW(TAG, "ADTS frames of %d raw data blocks are not supported", hdr.rawBlocks);
+        return AudioNode::kErrDecode;
+    }
+    int len = decodeToOutput(data, pkt.size, adts ? hdr.mpegVersion : 0);
+    if (len < 0) {
+        if (++mFrameErrors < kMaxFrameErrors) {
+            return AudioNode::kNeedMoreData; // skip the frame
+        }
+        ESP_LOGW(TAG, "Too many consecutive frame errors");
+        return AudioNode::kErrDecode;
+    }
+    mFrameErrors = 0;
+    return len;
+}
+
+// Decodes to the output buffer, or to mPcmBuf if the frame may not fit in it,
+// as HE-AAC frames may not. Returns the size of the output, or -1
+int DecoderAac::decodeToOutput(const uint8_t* frame, int size, int mpegVersion)
+{
+    bool inPlace = mOutputBufSize >= kMaxOutputSize;
+    if (!inPlace && !mPcmBuf) {
+        ESP_LOGI(TAG, "Output buffer smaller than %d bytes, allocating a PCM buffer", kMaxOutputSize);
+        mPcmBuf.reset(new int16_t[kMaxOutputSize / sizeof(int16_t)]);
+    }
+    int len = decodeFrame(frame, size, mpegVersion, inPlace ? (int16_t*)mOutputBuf : mPcmBuf.get());
+    if (len < 0 || inPlace) {
+        return len;
+    }
+    mPcmPos = 0;
+    mPcmLen = len;
+    return outputPcm();
+}
+
+// Sets up Helix to decode raw access units, with the parameters from the
+// MPEG-4 AudioSpecificConfig
+bool DecoderAac::setRawConfig(const uint8_t* asc, int size)
+{
+    int bitPos = 0;
+    auto bits = [&](int n) {
+        uint32_t val = 0;
+        for (int i = 0; i < n; i++, bitPos++) {
+            int byte = bitPos >> 3;
+            val = (val << 1) | ((byte < size) ? (asc[byte] >> (7 - (bitPos & 7))) & 1 : 0);
+        }
+        return val;
+    };
+    auto sampleRate = [&]() {
+        int idx = bits(4);
+        return (idx == 15) ? (int)bits(24) : AdtsHeader::sampleRateFromIndex(idx);
+    };
+    int objectType = bits(5);
+    if (objectType == 31) {
+        objectType = 32 + bits(6);
+    }
+    int rate = sampleRate();
+    int channels = bits(4);
+    if (objectType == 5 || objectType == 29) { // explicit SBR (and PS) signalling, the core follows
+        sampleRate(); // of the SBR output
+        objectType = bits(5);
+    }
+    if (objectType < 1 || objectType > 4 || rate <= 0 || channels < 1 || channels > 2) {
+        ESP_LOGW(TAG, "Unsupported AudioSpecificConfig: object type %d, samplerate %d, channel config %d",
+            objectType, rate, channels);
+        return false;
+    }
+    AACFrameInfo info = {};
+    info.nChans = channels;
+    info.sampRateCore = rate;
+    info.profile = objectType - 1;
+    auto err = AACSetRawBlockParams(mHelix, 0, &info);
+    if (err) {
+        ESP_LOGW(TAG, "AACSetRawBlockParams error %d", err);
+        return false;
+    }
+    ESP_LOGI(TAG, "Raw AAC, object type %d, %d channels, core samplerate %d Hz", objectType, channels, rate);
+    mRawMode = true;
+    mFrameErrors = 0;
+    return true;
+}
+
+// Returns the offset of the first complete frame in buf, or -1 if more data is
+// needed. In that case, sets `skip` to the amount of data before a possible
+// frame start, which can be discarded. Returns -2 if the frames are not supported
+int DecoderAac::findFrame(const uint8_t* buf, int len, AdtsHeader& hdr, int& skip)
+{
+    int pos = 0;
+    for (;;) {
+        int offset = AdtsHeader::find(buf + pos, len - pos, hdr);
+        if (offset < 0) {
+            // keep what may be the start of a header
+            skip = std::max(pos, len - (AdtsHeader::kHeaderSize - 1));
+            return -1;
+        }
+        pos += offset;
+        if (mSynced && !hdr.sameStream(mStreamHeader)) {
+            ESP_LOGI(TAG, "Frame header doesn't match the stream, resyncing");
+            mSynced = false;
+        }
+        if (pos + hdr.frameSize > len) {
+            if (hdr.frameSize > AdtsHeader::kMaxFrameSize && !mSynced) {
+                pos++; // a frame of several blocks, that can't be verified in the buffer
+                continue;
+            }
+            skip = pos;
+            return -1;
+        }
+        if (!mSynced) {
+            // A sync word in the frame data is unlikely to be followed by another
+            // valid header of the same stream
+            int next = pos + hdr.frameSize;
+            if (next + AdtsHeader::kHeaderSize > len) {
+                skip = pos;
+                return -1;
+            }
+            AdtsHeader nextHdr;
+            if (!nextHdr.parse(buf + next) || !nextHdr.sameStream(hdr)) {
+                pos++;
+                continue;
+            }
+        }
+        if (hdr.rawBlocks > 1) {
+            // Helix decodes a block per call, but the decoder outputs whole frames
+            ESP_LOGW(TAG, "ADTS frames of %d raw data blocks are not supported", hdr.rawBlocks);
+            return -2;
+        }
+        return pos;
+    }
+}
+
+// Decodes a complete frame to out, which must have space for kMaxOutputSize bytes.
+// Returns the size of the PCM output, or -1 if the frame could not be decoded
+// mpegVersion is that of the ADTS header, 0 for raw access units
+int DecoderAac::decodeFrame(const uint8_t* frame, int size, int mpegVersion, int16_t* out)
+{
+    auto inPtr = (unsigned char*)frame;
+    int bytesLeft = size;
+    auto err = AACDecode(mHelix, &inPtr, &bytesLeft, out);
+    if (err) {
+        ESP_LOGI(TAG, "AACDecode error %d, skipping frame", err);
+        return -1;
+    }
+    AACFrameInfo info;
+    AACGetLastFrameInfo(mHelix, &info);
+    int nch = info.nChans;
+    int nsamples = info.outputSamps / nch;
+    if (nch == 2 && mMonoOutput) {
+        for (int i = 0; i < nsamples; i++) {
+            out[i] = (out[2 * i] + out[2 * i + 1]) >> 1;
+        }
+        nch = 1;
+    }
+    if (mOutputFormat.samplerate != (uint32_t)info.sampRateOut || mOutputFormat.channels() != nch) {
+        mOutputFormat.codec = kCodecAac;
+        mOutputFormat.samplerate = info.sampRateOut;
+        mOutputFormat.setChannels(nch);
+        mOutputFormat.setBits(16);
+        ESP_LOGW(TAG, "%s, %s, %d channels, %d Hz (core %d Hz), %d bps",
+            (info.sampRateOut != info.sampRateCore) ? "HE-AAC" : "AAC-LC",
+            !mpegVersion ? "raw" : (mpegVersion == 2) ? "MPEG-2 ADTS" : "MPEG-4 ADTS",
+            info.nChans, info.sampRateOut, info.sampRateCore, info.bitRate);
+    }
+    return nsamples * nch * sizeof(int16_t);
+}
+
+// Outputs as much of the frame in mPcmBuf as fits in the output buffer
+int DecoderAac::outputPcm()
+{
+    int frameSize = mOutputFormat.channels() * sizeof(int16_t);
+    int len = std::min(mPcmLen - mPcmPos, mOutputBufSize);
+    len -= len % frameSize;
+    myassert(len > 0);
+    memcpy(mOutputBuf, (char*)mPcmBuf.get() + mPcmPos, len);
+    mPcmPos += len;
+    if (mPcmPos >= mPcmLen) {
+        mPcmPos = mPcmLen = 0;
+    }
+    return len;
+}
+
+// Same as DecoderMp3::inputConsumed(), `consumed` is the amount of data in src
+// that was processed
+void DecoderAac::inputConsumed(const char* buf, int& size, const char* src, int srcLen,
+    int consumed, int copied, bool needMore)
+{
+    int remaining = srcLen - consumed;
+    if (src == buf) { // decoded in place
+        if (!needMore || size >= kInputBufSize || !remaining) {
+            size = consumed;
+            return;
+        }
+        memcpy(mInputBuf, src + consumed, remaining);
+        mInputLen = remaining;
+        return; // all input consumed
+    }
+    if (consumed >= mInputLen) { // the bounce buffer is done with, back to in-place
+        size = consumed - mInputLen;
+        mInputLen = 0;
+        return;
+    }
+    if (needMore) { // append all input to the bounce buffer
+        size = copied;
+    } else { // input that was appended is not consumed, it will be passed again
+        size = 0;
+        remaining = mInputLen - consumed;
+    }
+    memmove(mInputBuf, src + consumed, remaining);
+    mInputLen = remaining;
+}
+
+#endif
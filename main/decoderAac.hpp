@@ -0,0 +1,62 @@
+#include "sdkconfig.h"
+#if !defined(DECODER_AAC_HPP) && defined(CONFIG_NETPLAYER_AAC)
+#define DECODER_AAC_HPP
+#include "decoderNode.hpp"
+#include "adts.hpp"
+#include <aacdec.h>
+
+/* AAC-LC and HE-AAC decoder for ADTS streams, based on the Helix fixed-point
+ * AAC decoder (the libhelix-aac component). The ADTS framing is done here, so
+ * that only whole frames are passed to the Helix decoder. With a demuxer
+ * upstream, it decodes whole ADTS frames, or raw access units from MP4, after
+ * the AudioSpecificConfig packet
+ */
+class DecoderAac: public Decoder
+{
+protected:
+    enum {
+        kInputBufSize = AdtsHeader::kMaxFrameSize * 2, // input window requested from upstream, and bounce buffer size
+#if CONFIG_NETPLAYER_AAC_SBR
+        kMaxSamplesPerFrame = 2048, // SBR doubles the samplerate of the AAC core
+#else
+        kMaxSamplesPerFrame = 1024,
+#endif
+        kMaxOutputSize = kMaxSamplesPerFrame * 2 * sizeof(int16_t),
+        kMaxFrameErrors = 8 // consecutive frames that fail to decode, before giving up
+    };
+    HAACDecoder mHelix = nullptr;
+    // Same as with DecoderMp3 - frames are decoded in place, and only a frame
+    // that straddles the end of the input is copied here
+    char mInputBuf[kInputBufSize];
+    int mInputLen = 0;
+    AdtsHeader mStreamHeader; // of the first decoded frame, to verify a new sync
+    bool mSynced = false;
+    bool mMonoOutput = false;
+    bool mRawMode = false; // Helix was set up for raw access units
+    int mFrameErrors = 0; // consecutive ones, when decoding packets
+    // HE-AAC frames don't fit in an output buffer sized for MP3 frames. Then the
+    // frame is decoded here, and output in parts. Allocated only when needed
+    std::unique_ptr<int16_t[]> mPcmBuf;
+    int mPcmPos = 0;
+    int mPcmLen = 0; // in bytes, including the already output part
+    int findFrame(const uint8_t* buf, int len, AdtsHeader& hdr, int& skip);
+    int decodeFrame(const uint8_t* frame, int size, int mpegVersion, int16_t* out);
+    int decodeToOutput(const uint8_t* frame, int size, int mpegVersion);
+    bool setRawConfig(const uint8_t* asc, int size);
+    int outputPcm();
+    void inputConsumed(const char* buf, int& size, const char* src, int srcLen, int consumed,
+                       int copied, bool needMore);
+    void initHelix();
+    void freeHelix();
+public:
+    virtual CodecType type() const { return kCodecAac; }
+    DecoderAac();
+    ~DecoderAac();
+    virtual int inputBytesNeeded();
+    virtual int decode(const char* buf, int& size);
+    virtual int decodePacket(const AudioNode::PacketPullReq& pkt);
+    virtual void setMonoOutput(bool mono) { mMonoOutput = mono; }
+    virtual void reset();
+};
+
+#endif
@@ -0,0 +1,787 @@
+#include "decoderFlac.hpp"
+
+static const char* TAG = "flacdec";
+
+// Refills the cache to at least 56 bits. Assumes a little-endian CPU
+inline void DecoderFlac::BitReader::refill()
+{
+    if (pos + 8 <= len) {
+        uint64_t val;
+        memcpy(&val, data + pos, 8);
+        cache |= __builtin_bswap64(val) >> bits;
+        int n = (63 - bits) >> 3;
+        pos += n;
+        bits += n * 8;
+    } else {
+        while (bits <= 55) {
+            if (pos < len) {
+                cache |= (uint64_t)data[pos] << (56 - bits);
+            }
+            pos++;
+            bits += 8;
+        }
+    }
+}
+
+inline uint32_t DecoderFlac::BitReader::read(int n)
+{
+    if (bits < n) {
+        refill();
+    }
+    uint32_t val = cache >> (64 - n);
+    skip(n);
+    return val;
+}
+
+inline int32_t DecoderFlac::BitReader::readSigned(int n)
+{
+    if (bits < n) {
+        refill();
+    }
+    int32_t val = (int64_t)cache >> (64 - n);
+    skip(n);
+    return val;
+}
+
+// Number of 0 bits before the next 1 bit
+inline uint32_t DecoderFlac::BitReader::readUnary()
+{
+    uint32_t count = 0;
+    for (;;) {
+        if (bits < 56) {
+            refill();
+        }
+        if (cache) {
+            int zeros = __builtin_clzll(cache);
+            if (zeros < bits) {
+                skip(zeros + 1);
+                return count + zeros;
+            }
+        }
+        count += bits;
+        cache = 0;
+        bits = 0;
+        if (pos > len + 8) { // only zeros past the end
+            return count;
+        }
+    }
+}
+
+// Rice code with parameter k, as an unsigned (zigzag-encoded) value. The unary
+// part and the k low bits are usually taken from the cache in one go
+inline uint32_t DecoderFlac::BitReader::readRice(int k)
+{
+    if (bits < 32) {
+        refill();
+    }
+    int q = cache ? __builtin_clzll(cache) : 64;
+    if (q + 1 + k <= bits) {
+        uint64_t rest = cache << (q + 1);
+        skip(q + 1 + k);
+        return ((uint32_t)q << k) | (uint32_t)((rest >> 1) >> (63 - k));
+    }
+    uint32_t val = readUnary() << k;
+    return k ? val | read(k) : val;
+}
+
+namespace {
+struct Crc8Table
+{
+    uint8_t entries[256];
+    Crc8Table()
+    {
+        for (int i = 0; i < 256; i++) {
+            uint8_t r = i;
+            for (int bit = 0; bit < 8; bit++) {
+                r = (r & 0x80) ? (r << 1) ^ 0x07 : (r << 1);
+            }
+            entries[i] = r;
+        }
+    }
+};
+struct Crc16Table
+{
+    uint16_t entries[256];
+    Crc16Table()
+    {
+        for (int i = 0; i < 256; i++) {
+            uint16_t r = i << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                r = (r & 0x8000) ? (r << 1) ^ 0x8005 : (r << 1);
+            }
+            entries[i] = r;
+        }
+    }
+};
+}
+
+// FLAC CRC-8 (polynomial 0x07) of the frame header
+static uint8_t crc8(const uint8_t* data, int len)
+{
+    static const Crc8Table table;
+    uint8_t crc = 0;
+    for (int i = 0; i < len; i++) {
+        crc = table.entries[crc ^ data[i]];
+    }
+    return crc;
+}
+
+// FLAC CRC-16 (polynomial 0x8005) of the whole frame
+static uint16_t crc16(const uint8_t* data, int len)
+{
+    static const Crc16Table table;
+    uint16_t crc = 0;
+    for (int i = 0; i < len; i++) {
+        crc = (crc << 8) ^ table.entries[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+// Linear prediction with a fixed order, so that the inner loop is unrolled. Acc
+// is int32_t when the sum is known not to overflow it, which is much faster
+// than a 64-bit accumulator on the ESP32
+template <typename Acc, int Order>
+static void lpcRestore(int32_t* out, int n, const int32_t* coefs, int shift)
+{
+    for (int i = Order; i < n; i++) {
+        Acc sum = 0;
+        for (int j = 0; j < Order; j++) {
+            sum += (Acc)coefs[j] * out[i - 1 - j];
+        }
+        out[i] += (int32_t)(sum >> shift);
+    }
+}
+
+template <typename Acc>
+static void lpcRestore(int32_t* out, int n, const int32_t* coefs, int order, int shift)
+{
+    switch (order) {
+        case 1: lpcRestore<Acc, 1>(out, n, coefs, shift); return;
+        case 2: lpcRestore<Acc, 2>(out, n, coefs, shift); return;
+        case 3: lpcRestore<Acc, 3>(out, n, coefs, shift); return;
+        case 4: lpcRestore<Acc, 4>(out, n, coefs, shift); return;
+        case 5: lpcRestore<Acc, 5>(out, n, coefs, shift); return;
+        case 6: lpcRestore<Acc, 6>(out, n, coefs, shift); return;
+        case 7: lpcRestore<Acc, 7>(out, n, coefs, shift); return;
+        case 8: lpcRestore<Acc, 8>(out, n, coefs, shift); return;
+        case 10: lpcRestore<Acc, 10>(out, n, coefs, shift); return;
+        case 12: lpcRestore<Acc, 12>(out, n, coefs, shift); return;
+        default: break;
+    }
+    for (int i = order; i < n; i++) {
+        Acc sum = 0;
+        for (int j = 0; j < order; j++) {
+            sum += (Acc)coefs[j] * out[i - 1 - j];
+        }
+        out[i] += (int32_t)(sum >> shift);
+    }
+}
+
+static void fixedRestore(int32_t* out, int n, int order)
+{
+    switch (order) {
+        case 1:
+            for (int i = 1; i < n; i++) {
+                out[i] += out[i - 1];
+            }
+            break;
+        case 2:
+            for (int i = 2; i < n; i++) {
+                out[i] += 2 * out[i - 1] - out[i - 2];
+            }
+            break;
+        case 3:
+            for (int i = 3; i < n; i++) {
+                out[i] += 3 * (out[i - 1] - out[i - 2]) + out[i - 3];
+            }
+            break;
+        case 4:
+            for (int i = 4; i < n; i++) {
+                out[i] += 4 * (out[i - 1] + out[i - 3]) - 6 * out[i - 2] - out[i - 4];
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void DecoderFlac::reset()
+{
+    mState = kStateMarker;
+    mSkipBytes = 0;
+    mStreamSampleRate = 0;
+    mStreamBps = 0;
+    mMaxBlockSize = 0;
+    mMaxFrameSize = 0;
+    mRetryLen = 0;
+    mInputLen = 0;
+    mOutPos = mOutLen = 0;
+    mFrameErrors = 0;
+    mOutputFormat.reset();
+}
+
+int DecoderFlac::inputBytesNeeded()
+{
+    // with part of a frame still to be output, decode() is called without input
+    return (mOutPos < mOutLen) ? 0 : mWantedBufSize - mInputLen;
+}
+
+int DecoderFlac::decode(const char* buf, int& size)
+{
+    if (mOutPos < mOutLen) {
+        size = 0;
+        return outputSamples();
+    }
+    if (!buf && !mInputLen) {
+        size = 0;
+        return AudioNode::kNeedMoreData;
+    }
+    // Bounce buffer handling is the same as in DecoderMp3::decode()
+    int copied = 0;
+    const char* src;
+    int srcLen;
+    if (mInputLen || !buf) {
+        if (buf) {
+            copied = std::min(size, mInputBufSize - mInputLen);
+            memcpy(mInputBuf.get() + mInputLen, buf, copied);
+        }
+        src = (const char*)mInputBuf.get();
+        srcLen = mInputLen + copied;
+    } else {
+        src = buf;
+        srcLen = size;
+    }
+    int pos = 0;
+    if (mState != kStateFrames || mSkipBytes) {
+        pos = parseStreamHeader((const uint8_t*)src, srcLen);
+        if (pos < 0) {
+            mInputLen = 0;
+            return AudioNode::kErrDecode;
+        }
+        if (mState != kStateFrames || mSkipBytes) {
+            inputConsumed(buf, size, src, srcLen, pos, copied, true);
+            return AudioNode::kNeedMoreData;
+        }
+    }
+    for (;;) {
+        auto data = (const uint8_t*)src + pos;
+        int avail = srcLen - pos;
+        int offset = 0;
+        while (offset + 1 < avail && !(data[offset] == 0xff && (data[offset + 1] & 0xfe) == 0xf8)) {
+            offset++;
+        }
+        pos += offset;
+        data += offset;
+        avail -= offset;
+        // Not enough data for the header, or for a frame of the max size. A frame
+        // may be shorter, but a decode attempt with an incomplete frame is wasted.
+        // If the max size is not known, an incomplete frame is retried only when
+        // the data has grown by a quarter
+        int minLen = mMaxFrameSize ? mMaxFrameSize : std::min(mRetryLen, mWantedBufSize);
+        if ((buf && (avail < kMaxFrameHeaderSize || avail < minLen)) || avail < 2) {
+            inputConsumed(buf, size, src, srcLen, pos, copied, true);
+            return AudioNode::kNeedMoreData;
+        }
+        // the last frame of the stream may be shorter than the longest header,
+        // which is then parsed from a zero-padded copy
+        uint8_t hdrBuf[kMaxFrameHeaderSize];
+        const uint8_t* hdrData = data;
+        if (avail < kMaxFrameHeaderSize) {
+            memcpy(hdrBuf, data, avail);
+            memset(hdrBuf + avail, 0, kMaxFrameHeaderSize - avail);
+            hdrData = hdrBuf;
+        }
+        int hdrSize;
+        int valid = parseFrameHeader(hdrData, mFrame, hdrSize);
+        if (valid < 0 && ++mFrameErrors >= kMaxFrameErrors) {
+            ESP_LOGE(TAG, "Unsupported frames: %d channels, %d bits, %d Hz, block of %d samples",
+                mFrame.channels, mFrame.bps, mFrame.sampleRate, mFrame.blockSize);
+            mInputLen = 0;
+            return AudioNode::kErrDecode;
+        }
+        if (valid <= 0 || hdrSize > avail) {
+            pos++;
+            continue;
+        }
+        int len = decodeFrame(data, avail, hdrSize);
+        if (len == 0) { // incomplete
+            if (mMaxFrameSize && avail >= mMaxFrameSize) {
+                len = -1; // a false sync, the frame can't be larger
+            } else if (avail >= mWantedBufSize) {
+                if (mWantedBufSize >= kMaxInputBufSize) {
+                    ESP_LOGW(TAG, "Frame larger than %d bytes", kMaxInputBufSize);
+                    len = -1;
+                } else {
+                    mWantedBufSize = std::min(mWantedBufSize * 2, (int)kMaxInputBufSize);
+                }
+            }
+            if (len == 0) {
+                mRetryLen = avail + avail / 4;
+                inputConsumed(buf, size, src, srcLen, pos, copied, true);
+                return AudioNode::kNeedMoreData;
+            }
+        }
+        mRetryLen = 0;
+        if (len < 0) {
+            if (++mFrameErrors >= kMaxFrameErrors) {
+                ESP_LOGW(TAG, "Too many consecutive frame errors");
+                mInputLen = 0;
+                return AudioNode::kErrDecode;
+            }
+            pos++; // resync
+            continue;
+        }
+        mFrameErrors = 0;
+        inputConsumed(buf, size, src, srcLen, pos + len, copied, false);
+        return outputSamples();
+    }
+}
+
+// Parses the "fLaC" marker and the metadata blocks, skipping an ID3v2 tag before
+// them. Returns the number of bytes consumed, or -1 if the stream is not supported
+int DecoderFlac::parseStreamHeader(const uint8_t* buf, int len)
+{
+    int pos = 0;
+    while (mState != kStateFrames || mSkipBytes) {
+        if (mSkipBytes) {
+            int n = std::min(mSkipBytes, len - pos);
+            pos += n;
+            mSkipBytes -= n;
+            if (mSkipBytes) {
+                return pos;
+            }
+            continue;
+        }
+        auto p = buf + pos;
+        if (mState == kStateMarker) {
+            if (len - pos < 10) {
+                return pos;
+            }
+            if (memcmp(p, "ID3", 3) == 0) {
+                mSkipBytes = 10 + ((p[6] & 0x7f) << 21 | (p[7] & 0x7f) << 14 | (p[8] & 0x7f) << 7 | (p[9] & 0x7f));
+                if (p[5] & 0x10) { // footer
+                    mSkipBytes += 10;
+                }
+                ESP_LOGI(TAG, "Skipping ID3v2 tag of %d bytes", mSkipBytes);
+            } else if (memcmp(p, "fLaC", 4) == 0) {
+                pos += 4;
+                mState = kStateMetadata;
+            } else {
+                ESP_LOGW(TAG, "No FLAC stream marker, looking for frames");
+                mState = kStateFrames;
+            }
+            continue;
+        }
+        // metadata block header
+        if (len - pos < 4) {
+            return pos;
+        }
+        bool last = p[0] & 0x80;
+        int type = p[0] & 0x7f;
+        int blockLen = (p[1] << 16) | (p[2] << 8) | p[3];
+        if (type == 0 && blockLen >= 34) { // STREAMINFO
+            if (len - pos < 4 + 34) {
+                return pos;
+            }
+            auto info = p + 4;
+            mMaxBlockSize = (info[2] << 8) | info[3];
+            mMaxFrameSize = (info[7] << 16) | (info[8] << 8) | info[9];
+            mStreamSampleRate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+            int channels = ((info[12] >> 1) & 0x07) + 1;
+            mStreamBps = (((info[12] & 0x01) << 4) | (info[13] >> 4)) + 1;
+            if (mMaxFrameSize > kMaxInputBufSize) {
+                mMaxFrameSize = 0; // frames that large fail to decode anyway
+            } else if (mMaxFrameSize) {
+                mWantedBufSize = std::max(mWantedBufSize,
+                    std::min(std::max(mMaxFrameSize * 2, (int)kMinInputBufSize), (int)kMaxInputBufSize));
+            }
+            ESP_LOGW(TAG, "FLAC, %d channels, %d Hz, %d bits, max block %d samples, max frame %d bytes",
+                channels, mStreamSampleRate, mStreamBps, mMaxBlockSize, mMaxFrameSize);
+            if (mMaxBlockSize > kMaxBlockSize) {
+                ESP_LOGE(TAG, "Blocks of %d samples are not supported, max %d", mMaxBlockSize, kMaxBlockSize);
+                return -1;
+            }
+            pos += 4 + 34;
+            mSkipBytes = blockLen - 34;
+        } else {
+            pos += 4;
+            mSkipBytes = blockLen;
+        }
+        if (last) {
+            mState = kStateFrames;
+        }
+    }
+    return pos;
+}
+
+// Parses and verifies a frame header, buf must have at least kMaxFrameHeaderSize
+// bytes. Returns 1 if it's valid, 0 if it's not a frame header, or -1 if it's
+// that of an unsupported frame
+int DecoderFlac::parseFrameHeader(const uint8_t* buf, FrameHeader& hdr, int& hdrSize)
+{
+    if ((buf[1] & 0x02) || (buf[3] & 0x01)) { // reserved bits
+        return 0;
+    }
+    int bsCode = buf[2] >> 4;
+    int srCode = buf[2] & 0x0f;
+    int chCode = buf[3] >> 4;
+    int bpsCode = (buf[3] >> 1) & 0x07;
+    if (bsCode == 0 || srCode == 15 || chCode > 10 || bpsCode == 3 || bpsCode == 7) {
+        return 0;
+    }
+    // frame or sample number, UTF-8 coded
+    int pos = 4;
+    int extra = 0;
+    uint8_t first = buf[pos++];
+    if (first & 0x80) {
+        if ((first & 0xc0) == 0x80 || first == 0xff) {
+            return 0;
+        }
+        while (first & (0x40 >> extra)) {
+            extra++;
+        }
+        for (int i = 0; i < extra; i++) {
+            if ((buf[pos++] & 0xc0) != 0x80) {
+                return 0;
+            }
+        }
+    }
+    if (bsCode == 1) {
+        hdr.blockSize = 192;
+    } else if (bsCode <= 5) {
+        hdr.blockSize = 576 << (bsCode - 2);
+    } else if (bsCode == 6) {
+        hdr.blockSize = buf[pos++] + 1;
+    } else if (bsCode == 7) {
+        hdr.blockSize = ((buf[pos] << 8) | buf[pos + 1]) + 1;
+        pos += 2;
+    } else {
+        hdr.blockSize = 256 << (bsCode - 8);
+    }
+    static const int kSampleRates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+        32000, 44100, 48000, 96000 };
+    if (srCode == 0) {
+        hdr.sampleRate = mStreamSampleRate;
+    } else if (srCode < 12) {
+        hdr.sampleRate = kSampleRates[srCode];
+    } else if (srCode == 12) {
+        hdr.sampleRate = buf[pos++] * 1000;
+    } else {
+        hdr.sampleRate = (buf[pos] << 8) | buf[pos + 1];
+        if (srCode == 14) {
+            hdr.sampleRate *= 10;
+        }
+        pos += 2;
+    }
+    static const uint8_t kBps[] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+    hdr.bps = bpsCode ? kBps[bpsCode] : mStreamBps;
+    if (chCode < 8) {
+        hdr.channels = chCode + 1;
+        hdr.mode = kIndependent;
+    } else {
+        hdr.channels = 2;
+        hdr.mode = (ChannelMode)(chCode - 7);
+    }
+    if (crc8(buf, pos) != buf[pos]) {
+        return 0;
+    }
+    hdrSize = pos + 1;
+    if (hdr.channels > 2 || hdr.bps == 0 || hdr.bps > 24 || hdr.sampleRate == 0 ||
+        hdr.blockSize > kMaxBlockSize) {
+        ESP_LOGD(TAG, "Unsupported frame: %d channels, %d bits, %d Hz, block of %d",
+            hdr.channels, hdr.bps, hdr.sampleRate, hdr.blockSize);
+        return -1;
+    }
+    return 1;
+}
+
+// Decodes the frame with the header in mFrame. Returns the size of the frame, 0
+// if it extends beyond len, or -1 if it is invalid
+int DecoderFlac::decodeFrame(const uint8_t* buf, int len, int hdrSize)
+{
+    int nsamples = mFrame.blockSize;
+    if (mSamplesSize < nsamples * mFrame.channels) {
+        mSamplesSize = std::max(nsamples, mMaxBlockSize) * mFrame.channels;
+        mSamples.reset(new int32_t[mSamplesSize]);
+    }
+    BitReader br(buf + hdrSize, len - hdrSize);
+    for (int ch = 0; ch < mFrame.channels; ch++) {
+        // the side channel has one more bit
+        bool side = (mFrame.mode == kRightSide) ? (ch == 0) : (mFrame.mode != kIndependent && ch == 1);
+        if (!decodeSubframe(br, mSamples.get() + ch * nsamples, mFrame.bps + side)) {
+            return br.overrun() ? 0 : -1;
+        }
+    }
+    br.alignToByte();
+    int end = hdrSize + br.bytePos();
+    if (br.overrun() || end + 2 > len) {
+        return 0;
+    }
+    if (crc16(buf, end) != ((buf[end] << 8) | buf[end + 1])) {
+        ESP_LOGD(TAG, "Frame CRC mismatch");
+        return -1;
+    }
+    int32_t* left = mSamples.get();
+    int32_t* right = left + nsamples;
+    switch (mFrame.mode) {
+        case kLeftSide:
+            for (int i = 0; i < nsamples; i++) {
+                right[i] = left[i] - right[i];
+            }
+            break;
+        case kRightSide:
+            for (int i = 0; i < nsamples; i++) {
+                left[i] += right[i];
+            }
+            break;
+        case kMidSide:
+            for (int i = 0; i < nsamples; i++) {
+                int32_t mid = (left[i] << 1) | (right[i] & 1);
+                int32_t side = right[i];
+                left[i] = (mid + side) >> 1;
+                right[i] = (mid - side) >> 1;
+            }
+            break;
+        default:
+            break;
+    }
+    int channels = mFrame.channels;
+    if (channels == 2 && mMonoOutput) {
+        for (int i = 0; i < nsamples; i++) {
+            left[i] = (left[i] + right[i]) >> 1;
+        }
+        channels = 1;
+    }
+    if (mOutputFormat.samplerate != (uint32_t)mFrame.sampleRate || mOutputFormat.channels() != channels ||
+        mOutputFormat.bits() != mOutputBits) {
+        mOutputFormat.codec = kCodecFlac;
+        mOutputFormat.samplerate = mFrame.sampleRate;
+        mOutputFormat.setChannels(channels);
+        mOutputFormat.setBits(mOutputBits);
+        ESP_LOGI(TAG, "Output format: %d channels, %d Hz, %d bits (stream %d bits)",
+            channels, mFrame.sampleRate, mOutputBits, mFrame.bps);
+    }
+    mOutPos = 0;
+    mOutLen = nsamples;
+    return end + 2;
+}
+
+bool DecoderFlac::decodeSubframe(BitReader& br, int32_t* out, int bps)
+{
+    if (br.read(1)) { // padding
+        return false;
+    }
+    int type = br.read(6);
+    int wasted = 0;
+    if (br.read(1)) {
+        wasted = br.readUnary() + 1;
+        bps -= wasted;
+        if (bps <= 0) {
+            return false;
+        }
+    }
+    int nsamples = mFrame.blockSize;
+    if (type == 0) { // constant
+        int32_t val = br.readSigned(bps);
+        for (int i = 0; i < nsamples; i++) {
+            out[i] = val;
+        }
+    } else if (type == 1) { // verbatim
+        for (int i = 0; i < nsamples; i++) {
+            out[i] = br.readSigned(bps);
+        }
+    } else if (type >= 8 && type <= 12) { // fixed predictor
+        int order = type - 8;
+        if (order > nsamples) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            out[i] = br.readSigned(bps);
+        }
+        if (!decodeResidual(br, out, order)) {
+            return false;
+        }
+        fixedRestore(out, nsamples, order);
+    } else if (type >= 32) { // LPC
+        int order = (type & 0x1f) + 1;
+        if (order > nsamples) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            out[i] = br.readSigned(bps);
+        }
+        int precision = br.read(4) + 1;
+        int shift = br.readSigned(5);
+        if (precision == 16 || shift < 0) {
+            return false;
+        }
+        int32_t coefs[32];
+        for (int i = 0; i < order; i++) {
+            coefs[i] = br.readSigned(precision);
+        }
+        if (!decodeResidual(br, out, order)) {
+            return false;
+        }
+        // The prediction fits in 32 bits if the sum of the sample and coefficient
+        // widths and of log2 of the order does (as in libFLAC)
+        if (bps + precision + 31 - __builtin_clz(order) <= 32) {
+            lpcRestore<int32_t>(out, nsamples, coefs, order, shift);
+        } else {
+            lpcRestore<int64_t>(out, nsamples, coefs, order, shift);
+        }
+    } else {
+        return false;
+    }
+    if (wasted) {
+        for (int i = 0; i < nsamples; i++) {
+            out[i] <<= wasted;
+        }
+    }
+    return true;
+}
+
+bool DecoderFlac::decodeResidual(BitReader& br, int32_t* out, int predOrder)
+{
+    // A local copy, so that the compiler can keep it in registers - the
+    // stores to out could alias the members otherwise
+    BitReader r = br;
+    int method = r.read(2);
+    if (method > 1) {
+        return false;
+    }
+    int paramBits = method ? 5 : 4;
+    uint32_t escape = method ? 31 : 15;
+    int partOrder = r.read(4);
+    int partSize = mFrame.blockSize >> partOrder;
+    if ((partSize << partOrder) != mFrame.blockSize || partSize < predOrder) {
+        return false;
+    }
+    int i = predOrder;
+    for (int part = 0; part < (1 << partOrder); part++) {
+        int end = (part + 1) * partSize;
+        uint32_t k = r.read(paramBits);
+        if (k == escape) { // unencoded, with a given number of bits
+            int nbits = r.read(5);
+            for (; i < end; i++) {
+                out[i] = nbits ? r.readSigned(nbits) : 0;
+            }
+            continue;
+        }
+        for (; i < end; i++) {
+            uint32_t val = r.readRice(k);
+            out[i] = (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+        }
+        if (r.overrun()) {
+            break;
+        }
+    }
+    br = r;
+    return !br.overrun();
+}
+
+// Scales a sample from the stream resolution to the output one, with rounding
+// and saturation when the resolution is reduced
+template <bool Reduce>
+static inline int32_t scaleSample(int32_t val, int shift, int32_t max)
+{
+    if (!Reduce) {
+        return val * (1 << shift);
+    }
+    val = (val + (1 << (shift - 1))) >> shift;
+    return val > max ? max : val;
+}
+
+template <int Bytes, bool Reduce>
+static void convertSamples(const int32_t* left, const int32_t* right, int nch, int n, int shift, uint8_t* out)
+{
+    const int32_t max = (1 << (Bytes * 8 - 1)) - 1;
+    for (int i = 0; i < n; i++) {
+        for (int ch = 0; ch < nch; ch++) {
+            int32_t val = scaleSample<Reduce>(ch ? right[i] : left[i], shift, max);
+            if (Bytes == 2) {
+                *(int16_t*)out = val;
+            } else {
+                out[0] = val;
+                out[1] = val >> 8;
+                out[2] = val >> 16;
+            }
+            out += Bytes;
+        }
+    }
+}
+
+// Outputs as much of the decoded frame as fits in the output buffer
+int DecoderFlac::outputSamples()
+{
+    int nch = mOutputFormat.channels();
+    int bytes = mOutputBits / 8;
+    int n = std::min(mOutLen - mOutPos, mOutputBufSize / (nch * bytes));
+    myassert(n > 0);
+    const int32_t* left = mSamples.get() + mOutPos;
+    const int32_t* right = left + mFrame.blockSize;
+    auto out = (uint8_t*)mOutputBuf;
+    int shift = mOutputBits - mFrame.bps;
+    if (bytes == 2) {
+        if (shift >= 0) {
+            convertSamples<2, false>(left, right, nch, n, shift, out);
+        } else {
+            convertSamples<2, true>(left, right, nch, n, -shift, out);
+        }
+    } else {
+        convertSamples<3, false>(left, right, nch, n, shift, out);
+    }
+    mOutPos += n;
+    if (mOutPos >= mOutLen) {
+        mOutPos = mOutLen = 0;
+    }
+    return n * nch * bytes;
+}
+
+void DecoderFlac::allocInputBuf()
+{
+    // a frame of the max size is decoded from the bounce buffer, as it's not
+    // attempted with less data
+    int bufSize = mMaxFrameSize ? std::max(mMaxFrameSize, (int)kMinInputBufSize) : mWantedBufSize;
+    if (mInputBufSize >= bufSize) {
+        return;
+    }
+    ESP_LOGI(TAG, "Allocating input buffer of %d bytes", bufSize);
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[bufSize]);
+    if (mInputLen) {
+        memcpy(buf.get(), mInputBuf.get(), mInputLen);
+    }
+    mInputBuf = std::move(buf);
+    mInputBufSize = bufSize;
+}
+
+// Same as DecoderMp3::inputConsumed(), `consumed` is the amount of data in src
+// that was processed
+void DecoderFlac::inputConsumed(const char* buf, int& size, const char* src, int srcLen,
+    int consumed, int copied, bool needMore)
+{
+    int remaining = srcLen - consumed;
+    if (src == buf) { // decoded in place
+        if (!needMore || size >= mWantedBufSize || !remaining) {
+            size = consumed;
+            return;
+        }
+        allocInputBuf();
+        memcpy(mInputBuf.get(), src + consumed, remaining);
+        mInputLen = remaining;
+        return; // all input consumed
+    }
+    if (consumed >= mInputLen) { // the bounce buffer is done with, back to in-place
+        size = consumed - mInputLen;
+        mInputLen = 0;
+        return;
+    }
+    if (needMore) { // append all input to the bounce buffer
+        size = copied;
+    } else { // input that was appended is not consumed, it will be passed again
+        size = 0;
+        remaining = mInputLen - consumed;
+    }
+    memmove(mInputBuf.get(), src + consumed, remaining);
+    mInputLen = remaining;
+    allocInputBuf(); // grow it, for a frame that didn't fit
+}
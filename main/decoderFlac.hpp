@@ -0,0 +1,103 @@
+#ifndef DECODER_FLAC_HPP
+#define DECODER_FLAC_HPP
+#include "decoderNode.hpp"
+
+/* Streaming decoder of native FLAC. Mono and stereo streams of up to 24 bits,
+ * with block sizes of up to 4608 samples (the streamable subset), are supported.
+ * Streams with larger blocks are rejected with kErrDecode, as their samples
+ * would take too much RAM.
+ * Frames are decoded in place from the input buffer, as with DecoderMp3. Since
+ * FLAC frames don't have a length field, a frame is decoded when enough data
+ * is available, and if it turns out to be incomplete, it's decoded again with
+ * more data. The frame CRC guards against false syncs. Decoded frames are
+ * output in parts, if they don't fit in the output buffer
+ */
+class DecoderFlac: public Decoder
+{
+protected:
+    enum {
+        kMaxBlockSize = 4608,
+        kMaxFrameHeaderSize = 16,
+        kMinInputBufSize = 4096,
+        kMaxInputBufSize = 32768,
+        kMaxFrameErrors = 8 // consecutive frames that fail to decode, before giving up
+    };
+    // Reads big-endian bit fields. Reading beyond the end returns zeros, the
+    // caller checks overrun() afterwards
+    struct BitReader
+    {
+        const uint8_t* data;
+        int len;
+        int pos = 0; // of the next byte to be loaded in the cache
+        uint64_t cache = 0; // MSB-aligned. The bits below `bits` are 0, or the data that follows
+        int bits = 0;
+        BitReader(const uint8_t* buf, int aLen): data(buf), len(aLen) {}
+        inline void refill();
+        inline uint32_t read(int n); // 0 < n <= 32
+        inline int32_t readSigned(int n);
+        inline uint32_t readUnary();
+        inline uint32_t readRice(int k);
+        void skip(int n) { cache <<= n; bits -= n; }
+        void alignToByte() { skip(bits & 7); }
+        int bytePos() const { return pos - bits / 8; } // when aligned to a byte
+        bool overrun() const { return pos * 8 - bits > len * 8; }
+    };
+    enum ChannelMode: uint8_t {
+        kIndependent, kLeftSide, kRightSide, kMidSide
+    };
+    struct FrameHeader
+    {
+        int blockSize;
+        int sampleRate;
+        uint8_t channels;
+        uint8_t bps;
+        ChannelMode mode;
+    };
+    // from STREAMINFO, for frame headers that refer to it
+    int mStreamSampleRate = 0;
+    uint8_t mStreamBps = 0;
+    int mMaxBlockSize = 0; // 0 if not known
+    int mMaxFrameSize = 0; // 0 if not known
+    // Stream header parsing state. Metadata blocks other than STREAMINFO are skipped,
+    // even if they don't fit in the input buffer (e.g. pictures)
+    enum { kStateMarker, kStateMetadata, kStateFrames } mState = kStateMarker;
+    int mSkipBytes = 0;
+    // Frames are decoded in place, or from here, with the same handling as in
+    // DecoderMp3. Allocated only when needed, with the max frame size of the
+    // stream. If that is not known, with the read size, which is grown if a
+    // frame doesn't fit
+    std::unique_ptr<uint8_t[]> mInputBuf;
+    int mInputBufSize = 0; // allocated
+    int mWantedBufSize = kMinInputBufSize; // read size, twice the max frame size
+    int mInputLen = 0;
+    int mRetryLen = 0; // input needed to retry decoding an incomplete frame
+    // Decoded samples of the current frame, one channel after the other. Sized
+    // by the max block size of the stream
+    std::unique_ptr<int32_t[]> mSamples;
+    int mSamplesSize = 0;
+    FrameHeader mFrame;
+    int mOutPos = 0; // samples of the current frame already output
+    int mOutLen = 0;
+    uint8_t mOutputBits = 16;
+    bool mMonoOutput = false;
+    int mFrameErrors = 0;
+    int parseStreamHeader(const uint8_t* buf, int len);
+    int parseFrameHeader(const uint8_t* buf, FrameHeader& hdr, int& hdrSize);
+    int decodeFrame(const uint8_t* buf, int len, int hdrSize);
+    bool decodeSubframe(BitReader& br, int32_t* out, int bps);
+    bool decodeResidual(BitReader& br, int32_t* out, int predOrder);
+    int outputSamples();
+    void allocInputBuf();
+    void inputConsumed(const char* buf, int& size, const char* src, int srcLen, int consumed,
+                       int copied, bool needMore);
+public:
+    virtual CodecType type() const { return kCodecFlac; }
+    virtual int inputBytesNeeded();
+    virtual int decode(const char* buf, int& size);
+    virtual void setMonoOutput(bool mono) { mMonoOutput = mono; }
+    // 16 or 24 bits, the samples are scaled to it from the resolution of the stream
+    virtual void setPcmFormat(uint8_t bits, bool dither) { mOutputBits = (bits > 16) ? 24 : 16; }
+    virtual void reset();
+};
+
+#endif
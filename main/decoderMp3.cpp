@@ -16,6 +16,8 @@ void DecoderMp3::initMadState()
     mad_stream_init(&mMadStream);
     mad_synth_init(&mMadSynth);
     mad_frame_init(&mMadFrame);
+    mMadFrame.worker = mWorker ? mWorker->madWorker() : nullptr;
+    applyOptions();
 }
 void DecoderMp3::freeMadState()
 {
@@ -24,50 +26,298 @@ void DecoderMp3::freeMadState()
     mad_frame_finish(&mMadFrame);
 }
 
+void DecoderMp3::setWorker(CoreWorker* worker)
+{
+    mWorker = worker;
+    mMadFrame.worker = worker ? worker->madWorker() : nullptr;
+}
+
+void DecoderMp3::setQuality(Quality quality, int maxBands)
+{
+    mQuality = quality;
+    mMaxBands = maxBands;
+    applyOptions();
+}
+
+void DecoderMp3::setMonoOutput(bool mono)
+{
+    mMonoOutput = mono;
+    applyOptions();
+}
+
+void DecoderMp3::applyOptions()
+{
+    int options = 0;
+    switch (mQuality) {
+    case kQualityHalfRate:
+        // synthesis outputs every second sample, which would alias the upper half of the spectrum
+        options |= MAD_OPTION_HALFSAMPLERATE;
+        mMadFrame.sblimit = kMaxBands / 2;
+        break;
+    case kQualityBandLimit:
+        mMadFrame.sblimit = mMaxBands;
+        break;
+    default:
+        mMadFrame.sblimit = kMaxBands;
+        break;
+    }
+    if (mMonoOutput) {
+        // the channels are mixed before the IMDCT, which then runs for one channel only
+        options |= MAD_OPTION_SINGLECHANNEL;
+    }
+    mad_stream_options(&mMadStream, options);
+}
+
 void DecoderMp3::reset()
 {
     mInputLen = 0;
+    resetTrackState();
     freeMadState();
     initMadState();
     mOutputFormat.reset();
 }
 
+// A seek within the track. The Info tag is kept, so that the end of the track is
+// still trimmed, if the position of the first frame after the seek is known
+void DecoderMp3::flush()
+{
+    auto audioStart = mAudioStart;
+    reset();
+    if (audioStart >= 0) {
+        mAudioStart = audioStart;
+        mCheckInfoTag = false;
+        mSeeked = true;
+    }
+}
+
+// Keeps the synthesis filterbank and the IMDCT overlap of the previous track,
+// and the output format, so that the tracks are joined without a discontinuity
+void DecoderMp3::nextTrack()
+{
+    mInputLen = 0;
+    resetTrackState();
+    mad_stream_finish(&mMadStream);
+    mad_stream_init(&mMadStream);
+    applyOptions();
+}
+
+void DecoderMp3::resetTrackState()
+{
+    mTagRemaining = 0;
+    mCheckTag = true;
+    mCheckInfoTag = true;
+    mSkipSamples = 0;
+    mSamplesLeft = -1;
+    mAudioStart = -1;
+    mSeeked = false;
+}
+
 int DecoderMp3::inputBytesNeeded()
 {
-    return sizeof(mInputBuf) - mInputLen;
+    // a tag is skipped in as large parts as upstream has
+    return mTagRemaining ? (int)std::min<int64_t>(mTagRemaining, 0x7fffffff) : kInputBufSize - mInputLen;
 }
 
-int DecoderMp3::decode(const char* buf, int size)
+// Consumes ID3v2 and APEv2 tags at the start of the stream, which libmad would
+// otherwise search for a frame sync through. Returns false if the input is audio
+bool DecoderMp3::skipTag(const char* buf, int& size)
 {
-    if (buf) {
-        myassert(mInputLen + size <= kInputBufSize);
-        memcpy(mInputBuf+mInputLen, buf, size);
-        mInputLen += size;
+    if (mTagRemaining) {
+        size = std::min<int64_t>(mTagRemaining, size);
+        mTagRemaining -= size;
+        return true;
+    }
+    if (!mCheckTag || !buf || mInputLen) {
+        return false;
+    }
+    int64_t tagSize = TagHeader::tagSize((const uint8_t*)buf, size);
+    if (tagSize <= 0) { // if the header is split by the buffer end, libmad gets it
+        mCheckTag = false;
+        return false;
+    }
+    ESP_LOGI(TAG, "Skipping %s tag of %lld bytes", TagHeader::tagName((const uint8_t*)buf), (long long)tagSize);
+    mTagRemaining = tagSize - std::min<int64_t>(tagSize, size);
+    size = tagSize - mTagRemaining;
+    return true;
+}
+
+int DecoderMp3::decode(const char* buf, int& size)
+{
+    if (skipTag(buf, size)) {
+        return AudioNode::kNeedMoreData;
+    }
+    // The bounce buffer is in use only if the previous input ended in the middle of
+    // a frame. Then the new input is appended to it, but is consumed (and actually
+    // dropped from the bounce buffer) only as far as the frame extends into it
+    int copied = 0;
+    if (mInputLen || !buf) {
+        int guard = 0;
+        if (buf) {
+            copied = std::min(size, (int)kInputBufSize - mInputLen);
+            memcpy(mInputBuf + mInputLen, buf, copied);
+        } else { // no more input, libmad decodes the last frame only if something follows it
+            guard = MAD_BUFFER_GUARD;
+            memset(mInputBuf + mInputLen, 0, guard);
+        }
+        mad_stream_buffer(&mMadStream, (const unsigned char*)mInputBuf, mInputLen + copied + guard);
+    } else {
+        mad_stream_buffer(&mMadStream, (const unsigned char*)buf, size);
     }
-    mad_stream_buffer(&mMadStream, (const unsigned char*)mInputBuf, mInputLen);
     for(;;) {
         auto ret = mad_frame_decode(&mMadFrame, &mMadStream);
         if (ret) {
             if (mMadStream.error == MAD_ERROR_BUFLEN) {
                 ESP_LOGI(TAG, "mad_frame_decode: MAD_ERROR_BUFLEN");
+                inputConsumed(buf, size, copied, true);
                 return AudioNode::kNeedMoreData;
             } else if (MAD_RECOVERABLE(mMadStream.error)) {
                 ESP_LOGI(TAG, "mad_frame_decode: recoverable '%s'", mad_stream_errorstr(&mMadStream));
                 continue;
             } else { // unrecoverable error
                 ESP_LOGI(TAG, "mad_frame_decode: UNrecoverable '%s'", mad_stream_errorstr(&mMadStream));
+                mInputLen = 0;
                 return AudioNode::kErrDecode;
             }
         }
-        mInputLen = mMadStream.bufend - mMadStream.next_frame;
-        if (mInputLen) {
-            memmove(mInputBuf, mMadStream.next_frame, mInputLen);
+        auto pos = framePos(buf);
+        inputConsumed(buf, size, copied, false);
+        ESP_LOGD(TAG, "Successfully decoded frame of size %d\n", mMadStream.next_frame - mMadStream.this_frame);
+        return outputFrame(pos);
+    }
+}
+
+// Stream offset of the frame that was just decoded from buf, or -1 if not known
+int64_t DecoderMp3::framePos(const char* buf) const
+{
+    if (mInputPos < 0) {
+        return -1;
+    }
+    int offset = mMadStream.this_frame - mMadStream.buffer;
+    // the bounce buffer data precedes buf
+    return (mMadStream.buffer == (const unsigned char*)buf) ? mInputPos + offset : mInputPos - mInputLen + offset;
+}
+
+// The first frame of a track, at stream offset pos, is checked for an Xing/Info
+// tag. Returns true if it has one
+bool DecoderMp3::parseInfoTag(int64_t pos)
+{
+    int frameSize = mMadStream.next_frame - mMadStream.this_frame;
+    if (!mInfoTag.parse(mMadStream.this_frame, frameSize)) {
+        return false;
+    }
+    mAudioStart = (pos >= 0) ? pos + frameSize : -1;
+    if (mInfoTag.flags & Mp3InfoTag::kHasGapless) {
+        int frameSamples = 32 * MAD_NSBSAMPLES(&mMadFrame.header);
+        mSkipSamples = mInfoTag.encoderDelay + Mp3InfoTag::kDecoderDelay;
+        if (mInfoTag.flags & Mp3InfoTag::kHasFrames) {
+            mSamplesLeft = std::max<int64_t>(0,
+                (int64_t)mInfoTag.frames * frameSamples - mInfoTag.encoderDelay - mInfoTag.padding);
+        }
+    }
+    ESP_LOGI(TAG, "Xing/Info tag: %u frames, encoder delay %d, padding %d", (unsigned)mInfoTag.frames,
+        mInfoTag.encoderDelay, mInfoTag.padding);
+    return true;
+}
+
+// Sets up the trimming after a seek, by the index of the first decoded frame,
+// which is at stream offset pos. The index is known from the offset only in a
+// CBR stream, whose frames differ in size only by the padding byte, or at the
+// start of the track. Otherwise nothing is trimmed, as without an Info tag
+void DecoderMp3::trimAfterSeek(int64_t pos)
+{
+    mSkipSamples = 0;
+    mSamplesLeft = -1;
+    if (pos < 0 || !(mInfoTag.flags & Mp3InfoTag::kHasGapless)) {
+        return;
+    }
+    auto& header = mMadFrame.header;
+    int frameSamples = 32 * MAD_NSBSAMPLES(&header);
+    int64_t index = 0;
+    if (pos > mAudioStart) {
+        if (!(mInfoTag.flags & Mp3InfoTag::kIsCbr) || !header.bitrate) {
+            ESP_LOGI(TAG, "Position in the VBR track not known after the seek, not trimming its end");
+            return;
+        }
+        // the average frame size is frameSamples / 8 * bitrate / samplerate
+        int64_t frameBits = (int64_t)frameSamples * header.bitrate;
+        index = ((pos - mAudioStart) * 8 * header.samplerate + frameBits / 2) / frameBits;
+    }
+    int64_t start = index * frameSamples; // decoded samples before the frame
+    int delay = mInfoTag.encoderDelay + Mp3InfoTag::kDecoderDelay;
+    mSkipSamples = std::max<int64_t>(0, delay - start);
+    if (mInfoTag.flags & Mp3InfoTag::kHasFrames) {
+        mSamplesLeft = std::max<int64_t>(0, (int64_t)mInfoTag.frames * frameSamples
+            - mInfoTag.encoderDelay - mInfoTag.padding - std::max<int64_t>(0, start - delay));
+    }
+    ESP_LOGI(TAG, "Seeked to frame %lld of the track", (long long)index);
+}
+
+// Synthesizes the decoded frame, which is at stream offset pos, and outputs it.
+// Returns the output size, or kNeedMoreData if nothing of the frame is output
+int DecoderMp3::outputFrame(int64_t pos)
+{
+    if (mCheckInfoTag) {
+        mCheckInfoTag = false;
+        if (parseInfoTag(pos)) {
+            return AudioNode::kNeedMoreData;
+        }
+    }
+    if (mSeeked) {
+        if (pos >= 0 && pos < mAudioStart) { // the Info tag frame, after a seek to the start
+            return AudioNode::kNeedMoreData;
+        }
+        mSeeked = false;
+        trimAfterSeek(pos);
+    }
+    auto& header = mMadFrame.header;
+    if (mOutputFormat.samplerate) {
+        // after nextTrack(), the synthesis state is kept only for a track of the same format
+        int rate = (mQuality == kQualityHalfRate) ? header.samplerate / 2 : header.samplerate;
+        int nch = MAD_NOUTCHANNELS(&mMadFrame);
+        if ((int)mOutputFormat.samplerate != rate || mOutputFormat.channels() != nch) {
+            mad_synth_mute(&mMadSynth);
+            mOutputFormat.samplerate = 0;
+        }
+    }
+    mad_synth_frame(&mMadSynth, &mMadFrame);
+    auto slen = output(mMadSynth.pcm);
+    return slen ? slen : (int)AudioNode::kErrDecode;
+}
+// Sets `size` to the amount of the caller's input buffer that was consumed, and
+// updates the bounce buffer. `copied` is how much of the input was appended to the
+// bounce buffer
+void DecoderMp3::inputConsumed(const char* buf, int& size, int copied, bool needMore)
+{
+    auto consumed = mMadStream.next_frame - mMadStream.buffer;
+    auto remaining = mMadStream.bufend - mMadStream.next_frame;
+    if (mMadStream.buffer == (const unsigned char*)buf) { // decoded in place
+        if (!needMore || size >= kInputBufSize || !remaining) {
+            size = consumed;
+            return;
         }
-        ESP_LOGD(TAG, "Successfully decoded frame of size %d\n", mMadStream.next_frame - mMadStream.buffer);
-        mad_synth_frame(&mMadSynth, &mMadFrame);
-        auto slen = output(mMadSynth.pcm);
-        return (slen <= 0) ? (int)AudioNode::kErrDecode : slen;
+        // Incomplete frame at the end of a short input - the input buffer wraps
+        // around there, or there is no more data. Keep the tail in the bounce buffer,
+        // so that the input buffer can be released
+        memcpy(mInputBuf, mMadStream.next_frame, remaining);
+        mInputLen = remaining;
+        return; // all input consumed
+    }
+    if (consumed >= mInputLen) { // the bounce buffer is done with, back to in-place
+        size = consumed - mInputLen;
+        mInputLen = 0;
+        return;
     }
+    if (needMore) { // append all input to the bounce buffer, without the guard bytes
+        size = copied;
+        remaining = mInputLen + copied - consumed;
+    } else { // input that was appended is not consumed, it will be passed again
+        size = 0;
+        remaining = mInputLen - consumed;
+    }
+    // drop any garbage skipped while searching for a frame, otherwise
+    // a buffer full of it would never make room for new data
+    memmove(mInputBuf, mMadStream.next_frame, remaining);
+    mInputLen = remaining;
 }
 void DecoderMp3::logEncodingInfo()
 {
@@ -84,52 +334,42 @@ void DecoderMp3::logEncodingInfo()
         mMadFrame.header.bitrate);
 }
 
-static inline uint16_t scale(mad_fixed_t sample) {
-    auto isNeg = sample & 0x80000000;
-    sample >>= (29 - 15);
-    return isNeg ? (sample | 0x8000) : (sample & 0x7fff);
-}
-
 int DecoderMp3::output(const mad_pcm& pcmData)
 {
     int nsamples = pcmData.length;
     if (nsamples > kSamplesPerFrame) {
         ESP_LOGW(TAG, "Too many samples %d decoded from frame, insufficient space in output buffer", nsamples);
     }
+    myassert(mOutputBuf);
 
     if (!mOutputFormat.samplerate) { // we haven't yet initialized output format info
         mOutputFormat.codec = kCodecMp3;
         mOutputFormat.samplerate = pcmData.samplerate;
         mOutputFormat.setChannels(pcmData.channels);
-        mOutputFormat.setBits(16);
+        mOutputFormat.setBits(mConverter.bits());
         logEncodingInfo();
     }
-
-    if (pcmData.channels == 2) {
-        auto left_ch = pcmData.samples[0];
-        auto right_ch = pcmData.samples[1];
-        int n = 0;
-        for (char* sbytes = mOutputBuf; n < nsamples; n++) {
-            uint16_t sample = scale(*left_ch++);
-            *(sbytes++) = (sample & 0xff);
-            *(sbytes++) = ((sample >> 8) & 0xff);
-
-            sample = scale(*right_ch++);
-            *(sbytes++) = (sample & 0xff);
-            *(sbytes++) = ((sample >> 8) & 0xff);
-        }
-        return nsamples * 4;
-    } else if (pcmData.channels == 1) {
-        auto samples = pcmData.samples[0];
-        int n = 0;
-        for (char* sbytes = mOutputBuf; n < nsamples;) {
-            uint32_t sample = scale(*samples++);
-            *(sbytes++) = (sample & 0xff);
-            *(sbytes++) = ((sample >> 8) & 0xff);
-        }
-        return nsamples * 2;
-    } else {
+    if (pcmData.channels != 1 && pcmData.channels != 2) {
         ESP_LOGE(TAG, "Unsupported number of channels %d", pcmData.channels);
         return AudioNode::kErrDecode;
     }
+    int start = 0;
+    if (mSkipSamples || mSamplesLeft >= 0) { // trim the encoder delay and padding
+        int frameSamples = 32 * MAD_NSBSAMPLES(&mMadFrame.header);
+        int skip = std::min(mSkipSamples, frameSamples);
+        mSkipSamples -= skip;
+        int keep = frameSamples - skip;
+        if (mSamplesLeft >= 0) {
+            keep = std::min<int64_t>(keep, mSamplesLeft);
+            mSamplesLeft -= keep;
+        }
+        // at half samplerate, only every second sample is output
+        start = skip * nsamples / frameSamples;
+        nsamples = keep * nsamples / frameSamples;
+        if (!nsamples) {
+            return AudioNode::kNeedMoreData;
+        }
+    }
+    const mad_fixed_t* channels[2] = { pcmData.samples[0] + start, pcmData.samples[1] + start };
+    return mConverter.convert(channels, pcmData.channels, nsamples, mOutputBuf);
 }
@@ -1,35 +1,69 @@
 #ifndef DECODER_MP3_HPP
 #define DECODER_MP3_HPP
 #include "decoderNode.hpp"
+#include "pcmConvert.hpp"
+#include "tagHeader.hpp"
+#include "mp3InfoTag.hpp"
 #include <mad.h>
 
 class DecoderMp3: public Decoder
 {
 protected:
     enum {
-        kInputBufSize = 3000,
-        kSamplesPerFrame = 1152,
-        kOutputBufSize = kSamplesPerFrame * 4 // each mp3 packet decodes to 1152 samples, for 16 bit stereo, multiply by 4
+        kInputBufSize = 3000, // input window requested from upstream, and bounce buffer size
+        kSamplesPerFrame = 1152
     };
     struct mad_stream mMadStream;
     struct mad_frame mMadFrame;
     struct mad_synth mMadSynth;
-    char mInputBuf[kInputBufSize];
+    // Frames are decoded in place, from the input buffer provided by the caller.
+    // Only when a frame straddles the end of that buffer (i.e. the upstream ring
+    // buffer wraps around), the unconsumed tail is copied here, and the next input
+    // is appended to it. At the end of the track, the guard bytes that libmad
+    // needs after the last frame are added
+    char mInputBuf[kInputBufSize + MAD_BUFFER_GUARD];
     int mInputLen = 0;
-    char mOutputBuf[kOutputBufSize];
+    int64_t mTagRemaining = 0; // of a tag being skipped
+    bool mCheckTag = true; // at the start of the stream, or after a tag
+    // Gapless playback - the first frame may have an Xing/Info tag with the
+    // encoder delay and padding, which are trimmed from the output
+    bool mCheckInfoTag = true;
+    Mp3InfoTag mInfoTag;
+    int mSkipSamples = 0; // at the start of the track
+    int64_t mSamplesLeft = -1; // until the padding at the end of the track, -1 if not known
+    int64_t mAudioStart = -1; // stream offset of the frame after the Info tag, -1 if not known
+    bool mSeeked = false; // the trimming is set up by the first frame after a seek
+    CoreWorker* mWorker = nullptr;
+    Quality mQuality = kQualityFull;
+    uint8_t mMaxBands = kMaxBands;
+    bool mMonoOutput = false;
+    PcmConverter mConverter;
     bool initStreamFormat(mad_header& header);
+    bool parseInfoTag(int64_t pos);
+    void trimAfterSeek(int64_t pos);
+    int64_t framePos(const char* buf) const;
+    int outputFrame(int64_t pos);
     int output(const mad_pcm& pcm);
+    void resetTrackState();
     void initMadState();
+    void applyOptions();
     void freeMadState();
+    void inputConsumed(const char* buf, int& size, int copied, bool needMore);
+    bool skipTag(const char* buf, int& size);
     void logEncodingInfo();
 public:
     virtual CodecType type() const { return kCodecMp3; }
     DecoderMp3();
     ~DecoderMp3();
     virtual int inputBytesNeeded();
-    virtual int decode(const char* buf, int size);
-    virtual char* outputBuf() { return mOutputBuf; }
+    virtual int decode(const char* buf, int& size);
+    virtual void setWorker(CoreWorker* worker);
+    virtual void setQuality(Quality quality, int maxBands);
+    virtual void setMonoOutput(bool mono);
+    virtual void setPcmFormat(uint8_t bits, bool dither) { mConverter.setFormat(bits, dither); }
     virtual void reset();
+    virtual void flush();
+    virtual void nextTrack();
 };
 
 #endif
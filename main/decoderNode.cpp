@@ -1,5 +1,9 @@
 #include "decoderNode.hpp"
 #include "decoderMp3.hpp"
+#include "decoderAac.hpp"
+#include "decoderOpus.hpp"
+#include "decoderFlac.hpp"
+#include "decoderWav.hpp"
 
 bool DecoderNode::createDecoder(CodecType type)
 {
@@ -7,6 +11,38 @@ bool DecoderNode::createDecoder(CodecType type)
     case kCodecMp3:
         ESP_LOGI(mTag, "Created MP3 decoder");
         mDecoder = new DecoderMp3();
+        mDecoder->setWorker(mWorker.get());
+        mDecoder->setQuality(mQuality, mMaxBands);
+        mDecoder->setMonoOutput(mMonoOutput);
+        mDecoder->setPcmFormat(mOutputBits, mDither);
+        return true;
+#ifdef CONFIG_NETPLAYER_AAC
+    case kCodecAac:
+        ESP_LOGI(mTag, "Created AAC decoder");
+        mDecoder = new DecoderAac();
+        mDecoder->setMonoOutput(mMonoOutput);
+        return true;
+#endif
+#ifdef CONFIG_NETPLAYER_OPUS
+    case kCodecOpus:
+    case kCodecOgg:
+        ESP_LOGI(mTag, "Created Opus decoder");
+        mDecoder = new DecoderOpus(type);
+        mDecoder->setQuality(mQuality, mMaxBands);
+        mDecoder->setMonoOutput(mMonoOutput);
+        return true;
+#endif
+    case kCodecFlac:
+        ESP_LOGI(mTag, "Created FLAC decoder");
+        mDecoder = new DecoderFlac();
+        mDecoder->setMonoOutput(mMonoOutput);
+        mDecoder->setPcmFormat(mOutputBits, mDither);
+        return true;
+    case kCodecWav:
+        ESP_LOGI(mTag, "Created WAV decoder");
+        mDecoder = new DecoderWav();
+        mDecoder->setMonoOutput(mMonoOutput);
+        mDecoder->setPcmFormat(mOutputBits, mDither);
         return true;
     default:
         ESP_LOGW(mTag, "No decoder for codec type %s", StreamFormat::codecTypeToStr(type));
@@ -14,6 +50,42 @@ bool DecoderNode::createDecoder(CodecType type)
     }
 }
 
+void DecoderNode::enableParallelDecode(BaseType_t core)
+{
+    mWorker.reset(new CoreWorker(core, kWorkerPrio));
+    if (!mWorker->isRunning()) {
+        mWorker.reset();
+    }
+    if (mDecoder) {
+        mDecoder->setWorker(mWorker.get());
+    }
+}
+
+void DecoderNode::setQuality(Decoder::Quality quality, int maxBands)
+{
+    mQuality = quality;
+    mMaxBands = std::max(1, std::min(maxBands, (int)Decoder::kMaxBands));
+    if (mDecoder) {
+        mDecoder->setQuality(mQuality, mMaxBands);
+    }
+}
+
+void DecoderNode::setMonoOutput(bool mono)
+{
+    mMonoOutput = mono;
+    if (mDecoder) {
+        mDecoder->setMonoOutput(mono);
+    }
+}
+
+void DecoderNode::setDither(bool dither)
+{
+    mDither = dither;
+    if (mDecoder) {
+        mDecoder->setPcmFormat(mOutputBits, mDither);
+    }
+}
+
 bool DecoderNode::changeDecoder(CodecType type)
 {
     if (mDecoder) {
@@ -23,14 +95,176 @@ bool DecoderNode::changeDecoder(CodecType type)
     return createDecoder(type);
 }
 
-AudioNode::StreamError DecoderNode::pullData(DataPullReq& odp, int timeout)
+// Decodes into a block from the pool, so that the output can be passed on
+// without copying. Several frames may be decoded into the same block
+int DecoderNode::decode(const char* buf, int& size, int timeout)
+{
+    if (!mOutBlock) {
+        if (!mPcmPool.acquire(mOutBlock, timeout)) {
+            ESP_LOGW(mTag, "Timeout waiting for a free PCM block");
+            size = 0;
+            return kTimeout;
+        }
+    }
+    mDecoder->setOutputBuf(mOutBlock->data + mOutSize, mPcmPool.blockSize() - mOutSize);
+    if (!buf) {
+        mDecoder->setInputPos(-1);
+    }
+    return mDecoder->decode(buf, size);
+}
+
+// Decodes the next packet from an upstream demuxer. The output block is acquired
+// before the packet is pulled, so that a timeout doesn't leave it pulled
+int DecoderNode::decodePacket(int& timeout)
+{
+    if (!mOutBlock) {
+        if (!mPcmPool.acquire(mOutBlock, timeout)) {
+            ESP_LOGW(mTag, "Timeout waiting for a free PCM block");
+            return kTimeout;
+        }
+    }
+    PacketPullReq pkt;
+    ElapsedTimer tim;
+    auto err = mPrev->pullPacket(pkt, timeout);
+    timeout -= tim.msElapsed();
+    if (err) {
+        if (err == kStreamFlush) {
+            ESP_LOGW(mTag, "kStreamFlush returned by upstream node, flushing decoder");
+            mDecoder->flush();
+        }
+        return err;
+    }
+    myassert(pkt.fmt.codec == mDecoder->type());
+    if (pkt.ts) {
+        mInputTs = pkt.ts;
+    }
+    mDecoder->setOutputBuf(mOutBlock->data + mOutSize, mPcmPool.blockSize() - mOutSize);
+    int ret = mDecoder->decodePacket(pkt);
+    mPrev->confirmRead(pkt.size);
+    return ret;
+}
+
+AudioNode::StreamError DecoderNode::outputBlock(PcmBlockRef& block)
+{
+    myassert(mOutSize <= mPcmPool.blockSize());
+    mOutBlock->size = mOutSize;
+    mOutBlock->fmt = mDecoder->outputFmt();
+    mOutBlock->ts = mInputTs;
+    mOutSize = 0;
+    block = std::move(mOutBlock);
+    return kNoError;
+}
+
+// Called when decoding stops with an error. Outputs any frames decoded so far,
+// and returns the error with the next call
+AudioNode::StreamError DecoderNode::outputPending(PcmBlockRef& block, StreamError err)
+{
+    if (!mOutSize || err == kStreamFlush) {
+        mOutSize = 0;
+        return err;
+    }
+    if (err != kTimeout) {
+        mPendingError = err;
+    }
+    return outputBlock(block);
+}
+
+AudioNode::StreamError DecoderNode::doPullData(DataPullReq& odp, int timeout)
+{
+    mPulledBlock.reset();
+    if (mDecoder && mDecoder->canPassthrough() && !mOutSize && !mPendingError) {
+        auto err = pullPassthrough(odp, timeout);
+        if (err != kNeedMoreData) {
+            return err;
+        }
+    }
+    auto err = pullFrames(mPulledBlock, odp.size, timeout);
+    if (err) {
+        return err;
+    }
+    odp.buf = mPulledBlock->data;
+    odp.size = mPulledBlock->size;
+    odp.fmt = mPulledBlock->fmt;
+    odp.ts = mPulledBlock->ts;
+    return kNoError;
+}
+
+// Returns the upstream node's buffer as it is, if the decoder can pass it through.
+// Returns kNeedMoreData if the input has to be decoded instead - on a stream
+// change, or if less than a sample frame is available before the buffer wraps
+AudioNode::StreamError DecoderNode::pullPassthrough(DataPullReq& odp, int timeout)
 {
+    DataPullReq idp(0);
+    ElapsedTimer tim;
+    auto err = mPrev->pullData(idp, timeout);
+    if (err) {
+        if (err == kStreamFlush) {
+            ESP_LOGW(mTag, "kStreamFlush returned by upstream node, flushing decoder");
+            mDecoder->flush();
+        }
+        return err;
+    }
+    if (idp.fmt.ctr != mFormatChangeCtr || idp.fmt.codec != mDecoder->type()) {
+        return kNeedMoreData;
+    }
+    if (timeout >= 0) {
+        timeout -= tim.msElapsed();
+        if (timeout <= 0) {
+            return kTimeout;
+        }
+    }
+    idp.reset(odp.size);
+    err = mPrev->pullData(idp, timeout);
+    if (err) {
+        return err;
+    }
+    int size = mDecoder->passthroughSize(idp.buf, std::min(idp.size, odp.size));
+    if (!size) {
+        mPrev->confirmRead(0);
+        return kNeedMoreData;
+    }
+    if (idp.ts) {
+        mInputTs = idp.ts;
+    }
+    odp.buf = idp.buf;
+    odp.size = size;
+    odp.fmt = mDecoder->outputFmt();
+    odp.ts = mInputTs;
+    mPassthroughSize = size;
+    return kNoError;
+}
+
+void DecoderNode::confirmRead(int size)
+{
+    if (!mPassthroughSize) {
+        return; // the output was a decoded block
+    }
+    myassert(size <= mPassthroughSize);
+    mDecoder->passthroughConsumed(size);
+    mPrev->confirmRead(size);
+    mPassthroughSize = 0;
+}
+
+AudioNode::StreamError DecoderNode::doPullBlock(PcmBlockRef& block, int timeout)
+{
+    return pullFrames(block, mPcmPool.blockSize(), timeout);
+}
+
+// Decodes frames until the next one may not fit in wantedSize, but at least one
+AudioNode::StreamError DecoderNode::pullFrames(PcmBlockRef& block, int wantedSize, int timeout)
+{
+    if (mPendingError) {
+        auto err = mPendingError;
+        mPendingError = kNoError;
+        return err;
+    }
+    wantedSize = std::min(wantedSize, mPcmPool.blockSize());
     if (timeout < 0) {
         timeout = 0x7fffffff;
     }
     for (;;) {
         if (timeout < 0) {
-            return kTimeout;
+            return outputPending(block, kTimeout);
         }
         // get only stream format, no data, but wait for data to be available (so we know the stream format)
         DataPullReq idp(0);
@@ -38,14 +272,27 @@ AudioNode::StreamError DecoderNode::pullData(DataPullReq& odp, int timeout)
         auto err = mPrev->pullData(idp, timeout);
         if (err) {
             if (err == kStreamFlush && mDecoder) {
-                ESP_LOGW(mTag, "kStreamFlush returned by upstream node, resetting decoder");
-                mDecoder->reset();
+                ESP_LOGW(mTag, "kStreamFlush returned by upstream node, flushing decoder");
+                mDecoder->flush();
+            } else if (err == kStreamStopped && mDecoder) {
+                // the decoder may still have the last frames of the stream
+                int size = 0;
+                auto ret = decode(nullptr, size, timeout);
+                if (ret > 0) {
+                    mOutSize += ret;
+                    if (mOutSize + mMaxFrameSize > wantedSize) {
+                        return outputBlock(block);
+                    }
+                    continue;
+                } else if (ret == kTimeout) {
+                    return outputPending(block, kTimeout);
+                }
             }
-            return err;
+            return outputPending(block, err);
         }
         timeout -= tim.msElapsed();
         if (timeout <= 0) {
-            return kTimeout;
+            return outputPending(block, kTimeout);
         }
         if (!mDecoder) {
             ESP_LOGI(mTag, "No decoder, creating one");
@@ -60,51 +307,71 @@ AudioNode::StreamError DecoderNode::pullData(DataPullReq& odp, int timeout)
         bool ctrChanged = idp.fmt.ctr != mFormatChangeCtr;
         bool codecChanged = idp.fmt.codec != mDecoder->type();
         if (ctrChanged || codecChanged) {
-            auto ret = mDecoder->decode(nullptr, 0);
-            if (ret <= 0) {
+            if (mOutSize) { // output the frames of the old stream first
+                return outputBlock(block);
+            }
+            int size = 0;
+            auto ret = decode(nullptr, size, timeout);
+            if (ret == kTimeout) {
+                return kTimeout;
+            } else if (ret <= 0) {
                 mFormatChangeCtr = idp.fmt.ctr;
                 if (codecChanged) {
                     ESP_LOGW(mTag, "Stream encoding changed");
                     changeDecoder(idp.fmt.codec);
                 } else {
-                    ESP_LOGW(mTag, "Stream changed, but codec not - resetting codec");
-                    mDecoder->reset();
+                    ESP_LOGW(mTag, "Stream changed, but codec not - next track");
+                    mDecoder->nextTrack();
                 }
                 continue;
             } else {
-                odp.buf = mDecoder->outputBuf();
-                odp.size = ret;
-                odp.fmt = mDecoder->outputFmt();
-                return kNoError;
+                mOutSize = ret;
+                return outputBlock(block);
             }
         }
         // do actual stream read and decode
         int bytesNeeded = mDecoder->inputBytesNeeded();
         int ret;
-        if (bytesNeeded > 0) {
+        if (bytesNeeded > 0 && mPrev->hasPacketOutput()) {
+            ret = decodePacket(timeout);
+        } else if (bytesNeeded > 0) {
             tim.reset();
             idp.reset(bytesNeeded);
             auto err = mPrev->pullData(idp, timeout);
-            if (err) {
-                return err;
+            if (err == kStreamStopped) {
+                continue; // handled with the format
+            } else if (err) {
+                if (err == kStreamFlush) {
+                    ESP_LOGW(mTag, "kStreamFlush returned by upstream node, flushing decoder");
+                    mDecoder->flush();
+                }
+                return outputPending(block, err);
             }
             timeout -= tim.msElapsed();
             myassert(idp.fmt.codec == mDecoder->type());
-            ret = mDecoder->decode(idp.buf, idp.size);
-            mPrev->confirmRead(idp.size);
+            if (idp.ts) {
+                mInputTs = idp.ts;
+            }
+            // The decoder reads directly from the upstream node's buffer, so
+            // release only what it consumed. The rest is read again next time
+            int size = idp.size;
+            mDecoder->setInputPos(idp.streamPos);
+            ret = decode(idp.buf, size, timeout);
+            mPrev->confirmRead(size);
         } else {
-            ret = mDecoder->decode(nullptr, 0);
+            int size = 0;
+            ret = decode(nullptr, size, timeout);
         }
         if (ret == kNeedMoreData) {
             ESP_LOGI(mTag, "Need more data, repeating");
             continue;
         } else if (ret < 0) {
-            return (StreamError)ret;
+            return outputPending(block, (StreamError)ret);
         }
         myassert(ret > 0);
-        odp.buf = mDecoder->outputBuf();
-        odp.size = ret;
-        odp.fmt = mDecoder->outputFmt();
-        return kNoError;
+        mOutSize += ret;
+        if (mOutSize + mMaxFrameSize > wantedSize) {
+            return outputBlock(block);
+        }
     }
 }
@@ -1,12 +1,27 @@
 #ifndef DECODER_NODE_HPP
 #define DECODER_NODE_HPP
 #include "audioNode.hpp"
+#include "pcmBlockPool.hpp"
+#include "coreWorker.hpp"
 #include <mad.h>
+#include <memory>
+#include <algorithm>
 
 class Decoder
 {
+public:
+    // Trades output quality for CPU time, e.g. for the 8-bit internal DAC
+    enum Quality: uint8_t {
+        kQualityFull = 0,
+        kQualityHalfRate = 1, // half the samplerate, subbands above the new Nyquist are skipped
+        kQualityBandLimit = 2 // only the subbands up to a limit are decoded
+    };
+    enum { kMaxBands = 32 };
 protected:
     StreamFormat mOutputFormat;
+    char* mOutputBuf = nullptr;
+    int mOutputBufSize = 0;
+    int64_t mInputPos = -1; // stream offset of the input of decode(), -1 if not known
 public:
     virtual ~Decoder() {}
     virtual CodecType type() const = 0;
@@ -16,29 +31,111 @@ public:
      */
     virtual int inputBytesNeeded() = 0;
     /** Decodes the provided data in buf, and sets the value of `size` to the number
-     * of consumed bytes. Outputs pcm data to the internal PCM buffer, returning
-     * the number of bytes written to the PCM buffer in case a frame was decoded, or
-     * a negative DecodeResult error code
+     * of consumed bytes. The decoder may read directly from buf without copying it,
+     * so unconsumed data must be passed again in the next call. Outputs pcm data to
+     * the output buffer, returning the number of bytes written to it in case a frame
+     * was decoded, or a negative DecodeResult error code
      */
-    virtual int decode(const char* buf, int size) = 0;
-    virtual char* outputBuf() = 0;
+    virtual int decode(const char* buf, int& size) = 0;
+    // Decodes a whole packet from a demuxer, as decode() does. A packet that
+    // produces no output (i.e. codec config) returns kNeedMoreData
+    virtual int decodePacket(const AudioNode::PacketPullReq& pkt) { return AudioNode::kErrNotSupported; }
+    // Sets the buffer where decode() outputs PCM data. It must be large enough
+    // for a whole decoded MP3 frame. Decoders with larger frames output them
+    // in parts, if they don't fit
+    void setOutputBuf(char* buf, int size) { mOutputBuf = buf; mOutputBufSize = size; }
+    // Sets the stream offset of the input of the next decode() call, if known
+    void setInputPos(int64_t pos) { mInputPos = pos; }
+    // Lets the decoder offload part of the work to another core, if it supports that
+    virtual void setWorker(CoreWorker* worker) {}
+    // maxBands is the number of (lowest) subbands to decode, for kQualityBandLimit
+    virtual void setQuality(Quality quality, int maxBands) {}
+    // Downmixes stereo streams to mono, decoding only one channel where possible
+    virtual void setMonoOutput(bool mono) {}
+    // Sample width of the output (16, 24 or 32), and whether to dither when
+    // reducing the sample width
+    virtual void setPcmFormat(uint8_t bits, bool dither) {}
+    // Decoders of uncompressed streams may let DecoderNode pass the input on to
+    // downstream nodes as it is, without copying it, while this returns true
+    virtual bool canPassthrough() const { return false; }
+    // How much of the input at buf, which must be whole sample frames, can be passed through
+    virtual int passthroughSize(const char* buf, int size) { return 0; }
+    // Called with the amount of the passed through input that the downstream node consumed
+    virtual void passthroughConsumed(int size) {}
     virtual void reset() = 0;
+    // Called on a kStreamFlush, i.e. a seek within the stream. Decoders may keep
+    // what they know of the track from its start
+    virtual void flush() { reset(); }
+    // Called at the start of a new stream of the same codec. Decoders that
+    // support gapless playback keep their state if the format is unchanged
+    virtual void nextTrack() { reset(); }
     StreamFormat outputFmt() const { return mOutputFormat; }
 };
 
 class DecoderNode: public AudioNode
 {
+public:
+    enum { kMaxFramesPerBlock = 4 };
 protected:
-    enum { kInputBufSize = 3000 };
+    enum { kInputBufSize = 3000,
+           kMaxFrameSamples = 1152 * 2, // largest decoded frame - 1152 stereo samples
+           kPcmBlockCount = 3,
+           kWorkerPrio = 15
+    };
     Decoder* mDecoder = nullptr;
+    int mMaxFrameSize; // initialized before the pool, which is sized by it
+    uint8_t mOutputBits;
+    PcmBlockPool mPcmPool;
+    PcmBlockRef mOutBlock; // block that the decoder outputs to
+    int mOutSize = 0; // decoded data in mOutBlock, it may hold several frames
+    bool mDither = false;
+    StreamError mPendingError = kNoError; // to be returned after the pending output
+    PcmBlockRef mPulledBlock; // returned by the last doPullData(), kept until the next call
+    std::unique_ptr<CoreWorker> mWorker;
+    Decoder::Quality mQuality = Decoder::kQualityFull;
+    uint8_t mMaxBands = Decoder::kMaxBands;
+    bool mMonoOutput = false;
     bool mFormatChangeCtr;
+    // Arrival time of the last input chunk. The decoder buffers less than a frame of
+    // input, so it approximates the arrival time of the data being output
+    int64_t mInputTs = 0;
+    // Input passed through by the last doPullData(), to be released by confirmRead()
+    int mPassthroughSize = 0;
     bool createDecoder(CodecType type);
     bool changeDecoder(CodecType type);
+    int decode(const char* buf, int& size, int timeout);
+    int decodePacket(int& timeout);
+    StreamError outputBlock(PcmBlockRef& block);
+    StreamError outputPending(PcmBlockRef& block, StreamError err);
+    StreamError pullFrames(PcmBlockRef& block, int wantedSize, int timeout);
+    StreamError pullPassthrough(DataPullReq& odp, int timeout);
 public:
-    DecoderNode(): AudioNode("decoder"){}
+    // extraPcmBlocks is the number of output blocks that downstream nodes may keep
+    // queued, on top of what a synchronous pipeline needs. Each block holds up to
+    // framesPerBlock decoded frames, which reduces the per-call overhead of the
+    // downstream nodes, at the expense of memory and latency. outputBits is the
+    // PCM sample width - 16, 24 or 32
+    DecoderNode(int extraPcmBlocks=0, int framesPerBlock=1, int outputBits=16)
+    : AudioNode("decoder"), mMaxFrameSize(kMaxFrameSamples * outputBits / 8), mOutputBits(outputBits),
+      mPcmPool(mMaxFrameSize * std::max(1, std::min(framesPerBlock, (int)kMaxFramesPerBlock)),
+               kPcmBlockCount + extraPcmBlocks) {}
     virtual Type type() const { return kTypeDecoder; }
-    virtual StreamError pullData(DataPullReq& dpr, int timeout);
-    virtual void confirmRead(int size) {}
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout);
+    virtual StreamError doPullBlock(PcmBlockRef& block, int timeout);
+    // When the decoder passes its input through, pullData() returns the upstream
+    // node's buffer (i.e. the HTTP ring buffer), which must not be modified. Nodes
+    // that process the samples in place pull blocks, which are then a copy
+    virtual bool hasBlockOutput() const { return true; }
+    // Decodes the two stereo channels in parallel, the second one on a worker task
+    // on the specified core. Must be called before the pipeline is started
+    void enableParallelDecode(BaseType_t core);
+    // Must be called before the pipeline is started
+    void setQuality(Decoder::Quality quality, int maxBands);
+    // Outputs stereo streams as mono, for mono sinks. Must be called before the pipeline is started
+    void setMonoOutput(bool mono);
+    // TPDF dither of the output samples. Must be called before the pipeline is started
+    void setDither(bool dither);
+    virtual void confirmRead(int size);
     virtual ~DecoderNode() {}
     friend class Decoder;
 };
@@ -0,0 +1,205 @@
+#include "decoderOpus.hpp"
+#ifdef CONFIG_NETPLAYER_OPUS
+
+static const char* TAG = "opusdec";
+
+DecoderOpus::DecoderOpus(CodecType type)
+: mType(type), mDemux(TAG)
+{}
+
+DecoderOpus::~DecoderOpus()
+{
+    freeOpus();
+}
+
+void DecoderOpus::freeOpus()
+{
+    if (mOpus) {
+        opus_decoder_destroy(mOpus);
+        mOpus = nullptr;
+    }
+}
+
+void DecoderOpus::reset()
+{
+    mDemux.reset();
+    freeOpus();
+    mPcmPos = mPcmLen = 0;
+    mFrameErrors = 0;
+    mOutputFormat.reset();
+}
+
+int DecoderOpus::inputBytesNeeded()
+{
+    // with part of a packet still to be output, decode() is called without input
+    return (mPcmPos < mPcmLen) ? 0 : kInputBufSize;
+}
+
+int DecoderOpus::decode(const char* buf, int& size)
+{
+    if (mPcmPos < mPcmLen) {
+        size = 0;
+        return outputPcm();
+    }
+    if (!buf) { // the demuxer keeps incomplete packets, nothing else is buffered
+        size = 0;
+        return AudioNode::kNeedMoreData;
+    }
+    int pos = 0;
+    for (;;) {
+        int len = size - pos;
+        OggDemux::Packet pkt;
+        auto ret = mDemux.parse((const uint8_t*)buf + pos, len, pkt);
+        pos += len;
+        if (ret == OggDemux::kNeedMoreData) {
+            size = pos;
+            return AudioNode::kNeedMoreData;
+        }
+        int out = handlePacket(pkt);
+        if (out != 0) {
+            size = pos;
+            return out;
+        }
+    }
+}
+
+// The demuxer flags the two header packets, the first is the identification header
+int DecoderOpus::decodePacket(const AudioNode::PacketPullReq& pkt)
+{
+    OggDemux::Packet packet;
+    packet.data = (const uint8_t*)pkt.buf;
+    packet.size = pkt.size;
+    packet.granule = -1;
+    if (pkt.flags & AudioNode::PacketPullReq::kFlagConfig) {
+        packet.index = (pkt.size >= 8 && memcmp(pkt.buf, "OpusHead", 8) == 0) ? 0 : 1;
+    } else {
+        packet.index = 2;
+    }
+    int ret = handlePacket(packet);
+    return ret ? ret : (int)AudioNode::kNeedMoreData;
+}
+
+// Returns the size of the output, 0 if there is none, or an error code
+int DecoderOpus::handlePacket(const OggDemux::Packet& pkt)
+{
+    if (pkt.index == 0) {
+        return parseHead(pkt) ? 0 : AudioNode::kErrDecode;
+    } else if (pkt.index == 1 || !mOpus) { // comment header, or no stream header received
+        return 0;
+    }
+    int len = decodeOpusPacket(pkt);
+    if (len < 0) {
+        if (++mFrameErrors < kMaxFrameErrors) {
+            return 0;
+        }
+        ESP_LOGW(TAG, "Too many consecutive packet errors");
+        return AudioNode::kErrDecode;
+    }
+    mFrameErrors = 0;
+    return len;
+}
+
+// Identification header, which starts each (chained) stream
+bool DecoderOpus::parseHead(const OggDemux::Packet& pkt)
+{
+    freeOpus();
+    auto data = pkt.data;
+    if (pkt.size < 19 || memcmp(data, "OpusHead", 8) != 0) {
+        ESP_LOGW(TAG, "Not an Opus stream");
+        return false;
+    }
+    int channels = data[9];
+    int mapping = data[18];
+    if ((data[8] & 0xf0) || channels < 1 || channels > 2 || mapping != 0) {
+        ESP_LOGW(TAG, "Unsupported Opus stream: version %d, %d channels, mapping family %d",
+            data[8], channels, mapping);
+        return false;
+    }
+    // lowest of the samplerates supported by libopus, that covers the quality setting
+    static const int kRates[] = { 8000, 12000, 16000, 24000, 48000 };
+    int minRate = (mQuality == kQualityHalfRate) ? 24000 :
+                  (mQuality == kQualityBandLimit) ? 48000 * mMaxBands / kMaxBands : 48000;
+    for (auto rate: kRates) {
+        mSampleRate = rate;
+        if (rate >= minRate) {
+            break;
+        }
+    }
+    mChannels = mMonoOutput ? 1 : channels; // libopus downmixes
+    int err;
+    mOpus = opus_decoder_create(mSampleRate, mChannels, &err);
+    if (!mOpus) {
+        ESP_LOGE(TAG, "Error %d creating Opus decoder", err);
+        return false;
+    }
+    int16_t gain = data[16] | (data[17] << 8); // Q7.8 dB
+    if (gain) {
+        opus_decoder_ctl(mOpus, OPUS_SET_GAIN(gain));
+    }
+    int preSkip = data[10] | (data[11] << 8); // at 48 kHz
+    mPreSkip = preSkip * mSampleRate / 48000;
+    mFrameErrors = 0;
+    mOutputFormat.codec = mType;
+    mOutputFormat.samplerate = mSampleRate;
+    mOutputFormat.setChannels(mChannels);
+    mOutputFormat.setBits(16);
+    ESP_LOGW(TAG, "Opus, %d channels, original samplerate %u Hz, decoding at %d Hz, pre-skip %d",
+        channels, (unsigned)OggDemux::readLe32(data + 12), mSampleRate, preSkip);
+    return true;
+}
+
+// Returns the size of the output, or -1 if the packet could not be decoded
+int DecoderOpus::decodeOpusPacket(const OggDemux::Packet& pkt)
+{
+    int nsamples = opus_packet_get_nb_samples(pkt.data, pkt.size, mSampleRate);
+    if (nsamples <= 0) {
+        ESP_LOGI(TAG, "Invalid Opus packet of size %d, skipping", pkt.size);
+        return -1;
+    }
+    int frameSize = mChannels * sizeof(int16_t);
+    int16_t* out;
+    if (nsamples * frameSize <= mOutputBufSize) {
+        out = (int16_t*)mOutputBuf;
+    } else {
+        if (mPcmBufSize < nsamples * frameSize) {
+            ESP_LOGI(TAG, "Packet of %d samples doesn't fit in output buffer, allocating a PCM buffer", nsamples);
+            mPcmBufSize = nsamples * frameSize;
+            mPcmBuf.reset(new int16_t[mPcmBufSize / sizeof(int16_t)]);
+        }
+        out = mPcmBuf.get();
+    }
+    nsamples = opus_decode(mOpus, pkt.data, pkt.size, out, nsamples, 0);
+    if (nsamples < 0) {
+        ESP_LOGI(TAG, "opus_decode error %d, skipping packet", nsamples);
+        return -1;
+    }
+    if (mPreSkip) {
+        int skip = std::min(mPreSkip, nsamples);
+        nsamples -= skip;
+        mPreSkip -= skip;
+        memmove(out, out + skip * mChannels, nsamples * frameSize);
+    }
+    if (out == (int16_t*)mOutputBuf || !nsamples) {
+        return nsamples * frameSize;
+    }
+    mPcmPos = 0;
+    mPcmLen = nsamples * frameSize;
+    return outputPcm();
+}
+
+// Outputs as much of the packet in mPcmBuf as fits in the output buffer
+int DecoderOpus::outputPcm()
+{
+    int frameSize = mChannels * sizeof(int16_t);
+    int len = std::min(mPcmLen - mPcmPos, mOutputBufSize);
+    len -= len % frameSize;
+    myassert(len > 0);
+    memcpy(mOutputBuf, (char*)mPcmBuf.get() + mPcmPos, len);
+    mPcmPos += len;
+    if (mPcmPos >= mPcmLen) {
+        mPcmPos = mPcmLen = 0;
+    }
+    return len;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "sdkconfig.h"
+#if !defined(DECODER_OPUS_HPP) && defined(CONFIG_NETPLAYER_OPUS)
+#define DECODER_OPUS_HPP
+#include "decoderNode.hpp"
+#include "oggDemux.hpp"
+#include <opus.h>
+
+/* Decoder of Opus streams in Ogg, based on libopus (the libopus component).
+ * Created for both kCodecOpus and kCodecOgg streams, the latter fail to decode
+ * if they are not Opus (i.e. Vorbis). With a demuxer upstream, it gets the Ogg
+ * packets from it, instead of demuxing them itself
+ */
+class DecoderOpus: public Decoder
+{
+protected:
+    enum {
+        kInputBufSize = 4096, // input window requested from upstream
+        kMaxFrameErrors = 8 // consecutive packets that fail to decode, before giving up
+    };
+    CodecType mType;
+    OggDemux mDemux;
+    OpusDecoder* mOpus = nullptr;
+    int mSampleRate = 48000; // output samplerate, libopus resamples to it
+    uint8_t mChannels = 0; // output channels
+    int mPreSkip = 0; // samples to drop at the start of the stream
+    int mFrameErrors = 0;
+    Quality mQuality = kQualityFull;
+    uint8_t mMaxBands = kMaxBands;
+    bool mMonoOutput = false;
+    // Packets longer than what fits in the output buffer (which is sized for an
+    // MP3 frame) are decoded here, and output in parts
+    std::unique_ptr<int16_t[]> mPcmBuf;
+    int mPcmBufSize = 0;
+    int mPcmPos = 0;
+    int mPcmLen = 0; // in bytes, including the already output part
+    int handlePacket(const OggDemux::Packet& pkt);
+    bool parseHead(const OggDemux::Packet& pkt);
+    int decodeOpusPacket(const OggDemux::Packet& pkt);
+    int outputPcm();
+    void freeOpus();
+public:
+    virtual CodecType type() const { return mType; }
+    DecoderOpus(CodecType type);
+    ~DecoderOpus();
+    virtual int inputBytesNeeded();
+    virtual int decode(const char* buf, int& size);
+    virtual int decodePacket(const AudioNode::PacketPullReq& pkt);
+    // libopus can decode at lower samplerates, which skips the synthesis of
+    // the upper bands. Takes effect from the next stream header
+    virtual void setQuality(Quality quality, int maxBands) { mQuality = quality; mMaxBands = maxBands; }
+    virtual void setMonoOutput(bool mono) { mMonoOutput = mono; }
+    virtual void reset();
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "decoderWav.hpp"
+
+static const char* TAG = "wavdec";
+
+static inline uint16_t readLe16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t readLe32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+void DecoderWav::reset()
+{
+    mState = kStateRiff;
+    mHdrLen = 0;
+    mChunkRemaining = 0;
+    mDataRemaining = 0;
+    mBlockAlign = 0;
+    mPassthrough = false;
+    mPartialLen = 0;
+    mOutputFormat.reset();
+}
+
+int DecoderWav::inputBytesNeeded()
+{
+    if (mState != kStateData || !mOutputBufSize) {
+        return 4096;
+    }
+    // as much as fills the output buffer
+    int outFrameSize = mOutputFormat.channels() * mOutputFormat.bits() / 8;
+    return mOutputBufSize / outFrameSize * mBlockAlign;
+}
+
+// Parses the RIFF header and chunks up to the start of the audio data. Returns
+// the number of bytes consumed, or -1 if the format is not supported
+int DecoderWav::parseHeader(const uint8_t* buf, int size)
+{
+    int pos = 0;
+    while (pos < size && mState != kStateData) {
+        switch (mState) {
+        case kStateRiff: {
+            int n = std::min(12 - mHdrLen, size - pos);
+            memcpy(mHdr + mHdrLen, buf + pos, n);
+            mHdrLen += n;
+            pos += n;
+            if (mHdrLen < 12) {
+                break;
+            }
+            if (memcmp(mHdr, "RIFF", 4) != 0 || memcmp(mHdr + 8, "WAVE", 4) != 0) {
+                // the 12 bytes are kept in mHdr, and output first
+                ESP_LOGW(TAG, "No RIFF/WAVE header, playing as raw 16-bit stereo PCM at 44.1 kHz");
+                setFormat(44100, 2, 16);
+                mDataRemaining = 0xffffffff;
+                mState = kStateData;
+                return pos;
+            }
+            mHdrLen = 0;
+            mState = kStateChunkHeader;
+            break;
+        }
+        case kStateChunkHeader: {
+            int n = std::min(8 - mHdrLen, size - pos);
+            memcpy(mHdr + mHdrLen, buf + pos, n);
+            mHdrLen += n;
+            pos += n;
+            if (mHdrLen < 8) {
+                break;
+            }
+            mHdrLen = 0;
+            uint32_t chunkSize = readLe32(mHdr + 4);
+            if (memcmp(mHdr, "data", 4) == 0 && mBlockAlign) {
+                // the size is 0 or 0xffffffff in live streams
+                mDataRemaining = chunkSize ? chunkSize : 0xffffffff;
+                mState = kStateData;
+                return pos;
+            }
+            mChunkRemaining = chunkSize + (chunkSize & 1); // chunks are padded to even sizes
+            if (memcmp(mHdr, "fmt ", 4) == 0) {
+                mState = kStateFmt;
+            } else {
+                ESP_LOGI(TAG, "Skipping chunk '%.4s' of %u bytes", mHdr, (unsigned)chunkSize);
+                mState = kStateSkip;
+            }
+            break;
+        }
+        case kStateFmt: {
+            int n = std::min<uint32_t>(mChunkRemaining, size - pos);
+            int keep = std::max(0, std::min(n, kMaxFmtSize - mHdrLen));
+            memcpy(mHdr + mHdrLen, buf + pos, keep);
+            mHdrLen += keep;
+            pos += n;
+            mChunkRemaining -= n;
+            if (mChunkRemaining) {
+                break;
+            }
+            if (!parseFmt()) {
+                return -1;
+            }
+            mHdrLen = 0;
+            mState = kStateChunkHeader;
+            break;
+        }
+        case kStateSkip: {
+            int n = std::min<uint32_t>(mChunkRemaining, size - pos);
+            pos += n;
+            mChunkRemaining -= n;
+            if (!mChunkRemaining) {
+                mState = kStateChunkHeader;
+            }
+            break;
+        }
+        case kStateTrailer:
+            return size;
+        default:
+            break;
+        }
+    }
+    return pos;
+}
+
+bool DecoderWav::parseFmt()
+{
+    if (mHdrLen < 16) {
+        ESP_LOGW(TAG, "fmt chunk too short");
+        return false;
+    }
+    int format = readLe16(mHdr);
+    if (format == 0xfffe && mHdrLen >= 26) { // WAVE_FORMAT_EXTENSIBLE, the first field of the subformat GUID
+        format = readLe16(mHdr + 24);
+    }
+    int channels = readLe16(mHdr + 2);
+    uint32_t samplerate = readLe32(mHdr + 4);
+    int blockAlign = readLe16(mHdr + 12);
+    int bits = readLe16(mHdr + 14);
+    if (format != 1 || channels < 1 || channels > 2 || (bits != 8 && bits != 16 && bits != 24 && bits != 32)
+        || blockAlign != channels * bits / 8 || !samplerate || samplerate >= (1 << 19)) {
+        ESP_LOGW(TAG, "Unsupported WAV format %d: %d channels, %d bits, %u Hz",
+            format, channels, bits, (unsigned)samplerate);
+        return false;
+    }
+    setFormat(samplerate, channels, bits);
+    return true;
+}
+
+void DecoderWav::setFormat(uint32_t samplerate, uint8_t channels, uint8_t bits)
+{
+    mChannels = channels;
+    mBits = bits;
+    mBlockAlign = channels * bits / 8;
+    // 16-bit samples are output as they are, others are converted to the
+    // output sample width
+    uint8_t outBits = (bits == 16) ? 16 : mOutputBits;
+    uint8_t outChannels = (mMonoOutput && channels == 2) ? 1 : channels;
+    mPassthrough = (outBits == bits && outChannels == channels);
+    mOutputFormat.codec = kCodecWav;
+    mOutputFormat.samplerate = samplerate;
+    mOutputFormat.setChannels(outChannels);
+    mOutputFormat.setBits(outBits);
+    ESP_LOGW(TAG, "WAV, %d channels, %u Hz, %d bits%s", channels, (unsigned)samplerate, bits,
+        mPassthrough ? ", passthrough" : "");
+}
+
+void DecoderWav::dataConsumed(uint32_t size)
+{
+    if (mDataRemaining == 0xffffffff) {
+        return;
+    }
+    mDataRemaining -= size;
+    if (!mDataRemaining) {
+        mState = kStateTrailer;
+    }
+}
+
+int DecoderWav::passthroughSize(const char* buf, int size)
+{
+    uint32_t len = std::min<uint32_t>(size, mDataRemaining);
+    return len - len % mBlockAlign;
+}
+
+// Converts nframes sample frames to the output format. Returns the size of the output
+int DecoderWav::convert(const uint8_t* in, int nframes, uint8_t* out)
+{
+    if (mPassthrough) {
+        memcpy(out, in, nframes * mBlockAlign);
+        return nframes * mBlockAlign;
+    }
+    int inBytes = mBits / 8;
+    int outBits = mOutputFormat.bits();
+    int outChannels = mOutputFormat.channels();
+    auto start = out;
+    for (int i = 0; i < nframes; i++) {
+        int64_t val[2];
+        for (int ch = 0; ch < mChannels; ch++) {
+            // left-aligned to 32 bits
+            uint32_t raw = 0;
+            for (int b = 0; b < inBytes; b++) {
+                raw |= (uint32_t)in[b] << (32 - 8 * inBytes + 8 * b);
+            }
+            if (inBytes == 1) {
+                raw ^= 0x80000000; // 8-bit samples are unsigned
+            }
+            val[ch] = (int32_t)raw;
+            in += inBytes;
+        }
+        if (outChannels < mChannels) {
+            val[0] = (val[0] + val[1]) >> 1;
+        }
+        for (int ch = 0; ch < outChannels; ch++) {
+            int64_t s = val[ch];
+            if (outBits < mBits) { // round, and saturate what rounds up beyond the max
+                s = std::min<int64_t>((s + ((int64_t)1 << (31 - outBits))) >> (32 - outBits),
+                    (1 << (outBits - 1)) - 1);
+            } else {
+                s >>= 32 - outBits;
+            }
+            for (int b = 0; b < outBits / 8; b++) {
+                *out++ = s >> (8 * b);
+            }
+        }
+    }
+    return out - start;
+}
+
+int DecoderWav::decode(const char* buf, int& size)
+{
+    if (!buf) { // nothing is buffered, except a partial sample frame
+        size = 0;
+        return AudioNode::kNeedMoreData;
+    }
+    auto in = (const uint8_t*)buf;
+    int pos = 0;
+    if (mState != kStateData) {
+        pos = parseHeader(in, size);
+        if (pos < 0) {
+            size = 0;
+            return AudioNode::kErrDecode;
+        }
+        if (mState != kStateData) {
+            size = pos;
+            return AudioNode::kNeedMoreData;
+        }
+    }
+    auto out = (uint8_t*)mOutputBuf;
+    int outFrameSize = mOutputFormat.channels() * mOutputFormat.bits() / 8;
+    int maxFrames = mOutputBufSize / outFrameSize;
+    int written = 0;
+    if (mHdrLen) { // the start of a raw stream, taken for a RIFF header
+        written = convert(mHdr, mHdrLen / mBlockAlign, out);
+        maxFrames -= mHdrLen / mBlockAlign;
+        mHdrLen = 0;
+        if (mPassthrough) { // DecoderNode can pass the rest through
+            size = pos;
+            return written;
+        }
+    }
+    if (mPartialLen) { // complete the sample frame split across buffers
+        int n = std::min(mBlockAlign - mPartialLen, size - pos);
+        memcpy(mPartial + mPartialLen, in + pos, n);
+        mPartialLen += n;
+        pos += n;
+        if (mPartialLen < mBlockAlign) {
+            size = pos;
+            return AudioNode::kNeedMoreData;
+        }
+        written += convert(mPartial, 1, out + written);
+        mPartialLen = 0;
+        maxFrames--;
+        dataConsumed(mBlockAlign);
+        if (mPassthrough) { // DecoderNode can pass the rest through
+            size = pos;
+            return written;
+        }
+    }
+    if (mState == kStateData) {
+        uint32_t avail = std::min<uint32_t>(size - pos, mDataRemaining);
+        int nframes = std::min<uint32_t>(avail / mBlockAlign, maxFrames);
+        written += convert(in + pos, nframes, out + written);
+        pos += nframes * mBlockAlign;
+        avail -= nframes * mBlockAlign;
+        dataConsumed(nframes * mBlockAlign);
+        if (nframes < maxFrames && avail) { // a sample frame split at the end of the buffer
+            memcpy(mPartial, in + pos, avail);
+            mPartialLen = avail;
+            pos += avail;
+        }
+    }
+    size = pos;
+    return written ? written : (int)AudioNode::kNeedMoreData;
+}
@@ -0,0 +1,58 @@
+#ifndef DECODER_WAV_HPP
+#define DECODER_WAV_HPP
+#include "decoderNode.hpp"
+
+/* Decoder of WAV (RIFF/WAVE) streams with integer PCM, of 8 to 32 bits, mono or
+ * stereo. Streams without a RIFF header are played as raw 16-bit stereo PCM at
+ * 44.1 kHz. The header is parsed incrementally, so chunks before the audio data
+ * (e.g. LIST) can have any size.
+ * Samples that the output format can take as they are (16-bit, or with the
+ * output sample width) are passed through by DecoderNode directly from the
+ * upstream node's buffer, see passthroughSize(). Otherwise, and for downstream
+ * nodes that pull blocks, decode() converts or copies them
+ */
+class DecoderWav: public Decoder
+{
+protected:
+    enum { kMaxFmtSize = 40 };
+    enum State: uint8_t {
+        kStateRiff, // RIFF header, or raw PCM
+        kStateChunkHeader,
+        kStateFmt,
+        kStateSkip, // chunk that is not needed
+        kStateData,
+        kStateTrailer // chunks after the audio data
+    };
+    State mState = kStateRiff;
+    // chunk header or fmt chunk, gathered across calls
+    uint8_t mHdr[kMaxFmtSize];
+    int mHdrLen = 0;
+    uint32_t mChunkRemaining = 0; // bytes of the current chunk, including padding
+    uint32_t mDataRemaining = 0; // 0xffffffff if the size is not known (e.g. a live stream)
+    uint16_t mBlockAlign = 0; // bytes per sample frame of the stream
+    uint8_t mBits = 0;
+    uint8_t mChannels = 0;
+    uint8_t mOutputBits = 16;
+    bool mMonoOutput = false;
+    bool mPassthrough = false;
+    // a sample frame split across input buffers
+    uint8_t mPartial[8];
+    int mPartialLen = 0;
+    int parseHeader(const uint8_t* buf, int size);
+    bool parseFmt();
+    void setFormat(uint32_t samplerate, uint8_t channels, uint8_t bits);
+    int convert(const uint8_t* in, int nframes, uint8_t* out);
+    void dataConsumed(uint32_t size);
+public:
+    virtual CodecType type() const { return kCodecWav; }
+    virtual int inputBytesNeeded();
+    virtual int decode(const char* buf, int& size);
+    virtual void setMonoOutput(bool mono) { mMonoOutput = mono; }
+    virtual void setPcmFormat(uint8_t bits, bool dither) { mOutputBits = bits; }
+    virtual bool canPassthrough() const { return mPassthrough && mState == kStateData && !mPartialLen; }
+    virtual int passthroughSize(const char* buf, int size);
+    virtual void passthroughConsumed(int size) { dataConsumed(size); }
+    virtual void reset();
+};
+
+#endif
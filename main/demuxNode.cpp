@@ -0,0 +1,425 @@
+#include "demuxNode.hpp"
+#include "framedDemux.hpp"
+#include "mp4Demux.hpp"
+#include "oggDemux.hpp"
+#include "tagHeader.hpp"
+
+// OggDemux as a Demuxer. The first two packets of a logical stream are the
+// codec headers. The granule position of a page refers to the end of its last
+// packet, and its duration is known only to the codec, so packets have no pts
+class OggPacketDemux: public Demuxer
+{
+protected:
+    OggDemux mOgg;
+    CodecType mCodec;
+public:
+    OggPacketDemux(CodecType codec): Demuxer("oggdemux"), mOgg("oggdemux"), mCodec(codec) {}
+    virtual Result parse(const uint8_t* data, int& size, Packet& packet)
+    {
+        if (!size) {
+            return kNeedMoreData;
+        }
+        OggDemux::Packet pkt;
+        auto ret = mOgg.parse(data, size, pkt);
+        mPos += size;
+        if (ret == OggDemux::kNeedMoreData) {
+            return kNeedMoreData;
+        }
+        packet.data = pkt.data;
+        packet.size = pkt.size;
+        packet.pts = -1;
+        packet.flags = (pkt.index < 2) ? AudioNode::PacketPullReq::kFlagConfig : 0;
+        return kPacket;
+    }
+    virtual CodecType codec() const { return mCodec; }
+    virtual void reset() { mOgg.reset(); mPos = 0; }
+};
+
+void DemuxNode::createDemuxer(const StreamFormat& fmt)
+{
+    mInFormat = fmt;
+    mHaveFormat = true;
+    mParsePending = false;
+    mUpstreamConsumed = 0;
+    mSkipBytes = 0;
+    mSniffMp4 = false;
+    mTimeSeekPos = -1;
+    mSeekStartTs = 0;
+    switch (fmt.codec) {
+    case kCodecM4a:
+        mDemuxer.reset(new Mp4Demux());
+        break;
+    case kCodecAac:
+        mDemuxer.reset(new AdtsDemux());
+        mSniffMp4 = true; // MP4 files are often served as audio/aac
+        break;
+    case kCodecMp3:
+        mDemuxer.reset(new MpegDemux());
+        break;
+    case kCodecOgg:
+    case kCodecOpus:
+        mDemuxer.reset(new OggPacketDemux(fmt.codec));
+        break;
+    default:
+        mDemuxer.reset();
+        break;
+    }
+    {
+        MutexLocker locker(mSeekMutex);
+        mSeekRequestMs = -1; // requested for the previous stream
+        mCanSeek = mDemuxer != nullptr;
+    }
+    mOutFormat = fmt;
+    if (mDemuxer) {
+        mOutFormat.codec = mDemuxer->codec();
+    }
+    mStreamPos = 0;
+    mCheckTag = mScanning = isPassthrough();
+    ESP_LOGI(mTag, "New %s stream, %s", fmt.codecTypeStr(), hasPacketOutput() ? "demuxing" : "passing through");
+}
+
+void DemuxNode::resetDemuxer()
+{
+    if (mDemuxer) {
+        mDemuxer->reset();
+    }
+    mParsePending = false;
+    mUpstreamConsumed = 0;
+    mSkipBytes = 0;
+    mTimeSeekPos = -1;
+    mSeekStartTs = 0;
+    // the position in the stream is not known
+    mStreamPos = 0;
+    mCheckTag = mScanning = isPassthrough();
+}
+
+// Handles a kStreamFlush from upstream. Returns true if it's that of a seek of
+// the demuxer itself, which is not passed downstream
+bool DemuxNode::handleFlush()
+{
+    if (!mSeekPending) {
+        resetDemuxer();
+        return false;
+    }
+    mSeekPending = false;
+    if (mTimeSeekPos < 0) {
+        return true;
+    }
+    mDemuxer->restartAt(mTimeSeekPos, mTimeSeekPts);
+    mStreamPos = mTimeSeekPos;
+    mTimeSeekPos = -1;
+    mParsePending = false;
+    mUpstreamConsumed = 0;
+    return false;
+}
+
+bool DemuxNode::seekToTime(int32_t ms)
+{
+    // mDemuxer is replaced by the task that pulls the data
+    MutexLocker locker(mSeekMutex);
+    if (!mCanSeek || ms < 0) {
+        return false;
+    }
+    mSeekRequestMs = ms;
+    mSeekRequestTs = esp_timer_get_time();
+    return true;
+}
+
+// Starts a requested seek by time, on the task that pulls the data. Returns
+// kStreamFlush if the seek is done by skipping data, so the flush doesn't come
+// from upstream
+AudioNode::StreamError DemuxNode::startTimeSeek()
+{
+    int32_t ms;
+    {
+        MutexLocker locker(mSeekMutex);
+        // a seek of the demuxer itself is completed first
+        if (mSeekRequestMs < 0 || mSeekPending || mSkipBytes) {
+            return kNoError;
+        }
+        ms = mSeekRequestMs;
+        mSeekRequestMs = -1;
+        mSeekStartTs = mSeekRequestTs;
+    }
+    int64_t pos = -1;
+    if (mDemuxer) {
+        mDemuxer->setStreamLength(mPrev->streamLength());
+        pos = mDemuxer->seekPosForTime(ms * 1000LL);
+    }
+    if (pos < 0) {
+        ESP_LOGW(mTag, "Can't seek to %d ms, the stream position of the time is not known", ms);
+        mSeekStartTs = 0;
+        return kNoError;
+    }
+    ESP_LOGI(mTag, "Seeking to %d ms, at byte %lld", ms, (long long)pos);
+    if (mPrev->seekToByte(pos)) {
+        mSeekPending = true;
+        mTimeSeekPos = pos;
+        mTimeSeekPts = ms * 1000LL;
+        return kNoError;
+    }
+    int64_t from = isPassthrough() ? mStreamPos : mDemuxer->pos();
+    if (pos < from) {
+        ESP_LOGW(mTag, "Upstream node can't seek back");
+        mSeekStartTs = 0;
+        return kNoError;
+    }
+    ESP_LOGI(mTag, "Upstream node can't seek, skipping %lld bytes", (long long)(pos - from));
+    mDemuxer->restartAt(pos, ms * 1000LL);
+    mParsePending = false;
+    mUpstreamConsumed = 0;
+    mSkipBytes = pos - from;
+    mScanning = false;
+    return kStreamFlush;
+}
+
+// Gets the stream format from upstream, as the decoder does before each read,
+// and creates the demuxer for a new stream
+AudioNode::StreamError DemuxNode::pullFormat(DataPullReq& dpr, int timeout)
+{
+    // the demuxer may have packets (or a seek) left after the source reached
+    // the end of the stream
+    if (mParsePending) {
+        dpr.fmt = mOutFormat;
+        return kNoError;
+    }
+    for (;;) {
+        auto err = mPrev->pullData(dpr, timeout);
+        if (err == kStreamFlush && handleFlush()) {
+            continue;
+        }
+        if (err) {
+            return err;
+        }
+        if (!mHaveFormat || dpr.fmt.ctr != mInFormat.ctr || dpr.fmt.codec != mInFormat.codec) {
+            createDemuxer(dpr.fmt);
+        }
+        dpr.fmt = mOutFormat;
+        return kNoError;
+    }
+}
+
+// Without a demuxer, the data is passed through. Otherwise, a whole packet is
+// returned, regardless of the requested size
+AudioNode::StreamError DemuxNode::doPullData(DataPullReq& dpr, int timeout)
+{
+    if (!dpr.size) {
+        return pullFormat(dpr, timeout);
+    }
+    if (!mDemuxer) {
+        return mPrev->pullData(dpr, timeout);
+    }
+    if (!mDemuxer->packetOutput()) {
+        return pullPassthrough(dpr, timeout);
+    }
+    PacketPullReq pkt;
+    auto err = doPullPacket(pkt, timeout);
+    if (err) {
+        return err;
+    }
+    dpr.buf = pkt.buf;
+    dpr.size = pkt.size;
+    dpr.fmt = pkt.fmt;
+    dpr.ts = pkt.ts;
+    return kNoError;
+}
+
+// Returns the data from upstream as it is, except for the tags at the start of
+// the stream, which are skipped - large ones (i.e. with cover art) with a seek
+AudioNode::StreamError DemuxNode::pullPassthrough(DataPullReq& dpr, int timeout)
+{
+    auto err = startTimeSeek();
+    if (err) {
+        return err;
+    }
+    ElapsedTimer tim;
+    for (;;) {
+        int remaining = timeout;
+        if (timeout >= 0 && (remaining = timeout - tim.msElapsed()) <= 0) {
+            return kTimeout;
+        }
+        DataPullReq idp(mSkipBytes ? (int)std::min<int64_t>(mSkipBytes, 0x7fffffff) : dpr.size);
+        err = mPrev->pullData(idp, remaining);
+        if (err == kStreamFlush && handleFlush()) {
+            continue;
+        }
+        if (err) {
+            return err;
+        }
+        if (mSeekPending) { // data from before the seek
+            mPrev->confirmRead(idp.size);
+            continue;
+        }
+        if (mSkipBytes) {
+            int len = std::min<int64_t>(idp.size, mSkipBytes);
+            mSkipBytes -= len;
+            mStreamPos += len;
+            mPrev->confirmRead(len);
+            continue;
+        }
+        if (mCheckTag) {
+            // if the header is split by the buffer end, the decoder gets it
+            int64_t tagSize = TagHeader::tagSize((const uint8_t*)idp.buf, idp.size);
+            if (tagSize > 0) {
+                ESP_LOGI(mTag, "Skipping %s tag of %lld bytes", TagHeader::tagName((const uint8_t*)idp.buf),
+                    (long long)tagSize);
+                mPrev->confirmRead(0);
+                int64_t end = mStreamPos + tagSize;
+                if (tagSize > Demuxer::kSkipSeekThreshold && mPrev->seekToByte(end)) {
+                    mSeekPending = true;
+                    mStreamPos = end;
+                } else {
+                    mSkipBytes = tagSize;
+                }
+                continue;
+            }
+            mCheckTag = false;
+            mDemuxer->restartAt(mStreamPos, 0);
+        }
+        if (mSeekStartTs) {
+            mSeekLatencyMs = (esp_timer_get_time() - mSeekStartTs) / 1000;
+            mSeekStartTs = 0;
+            ESP_LOGI(mTag, "Seek done, first data after %d ms", mSeekLatencyMs);
+        }
+        mScanBuf = (const uint8_t*)idp.buf;
+        dpr.buf = idp.buf;
+        dpr.size = idp.size;
+        dpr.fmt = mOutFormat;
+        dpr.ts = idp.ts;
+        dpr.streamPos = mStreamPos;
+        return kNoError;
+    }
+}
+
+// Gives the data that the decoder consumed to the demuxer, until it has found
+// what it needs for seeking, which is with its first packet
+void DemuxNode::scanConsumed(int size)
+{
+    const uint8_t* data = mScanBuf;
+    int remaining = size;
+    while (mScanning && remaining > 0) {
+        Demuxer::Packet packet;
+        int len = remaining;
+        if (mDemuxer->parse(data, len, packet) == Demuxer::kPacket) {
+            mScanning = false;
+        }
+        data += len;
+        remaining -= len;
+    }
+    mStreamPos += size;
+    mPrev->confirmRead(size);
+}
+
+AudioNode::StreamError DemuxNode::doPullPacket(PacketPullReq& pkt, int timeout)
+{
+    if (!hasPacketOutput()) {
+        return kErrNotSupported;
+    }
+    auto err = startTimeSeek();
+    if (err) {
+        return err;
+    }
+    ElapsedTimer tim;
+    for (;;) {
+        // skipped data is released as a whole, as far as the source has it
+        DataPullReq idp(mSkipBytes ? (int)std::min<int64_t>(mSkipBytes, 0x7fffffff) : kReadSize);
+        const uint8_t* data = nullptr;
+        int size = 0;
+        if (!mParsePending) {
+            int remaining = timeout;
+            if (timeout >= 0 && (remaining = timeout - tim.msElapsed()) <= 0) {
+                return kTimeout;
+            }
+            err = mPrev->pullData(idp, remaining);
+            if (err == kStreamFlush && handleFlush()) {
+                continue;
+            }
+            if (err) {
+                return err;
+            }
+            if (mSeekPending) { // data from before the seek
+                mPrev->confirmRead(idp.size);
+                continue;
+            }
+            if (idp.fmt.ctr != mInFormat.ctr || idp.fmt.codec != mInFormat.codec) {
+                // the decoder has to pull the format of the new stream first
+                mPrev->confirmRead(0);
+                return kNeedMoreData;
+            }
+            if (mSkipBytes) { // a forward seek that the source couldn't do
+                int len = std::min<int64_t>(idp.size, mSkipBytes);
+                mSkipBytes -= len;
+                mPrev->confirmRead(len);
+                continue;
+            }
+            data = (const uint8_t*)idp.buf;
+            size = idp.size;
+            if (idp.ts) {
+                mInputTs = idp.ts;
+            }
+            if (mSniffMp4) {
+                mSniffMp4 = false;
+                if (Mp4Demux::isMp4(data, size)) {
+                    ESP_LOGI(mTag, "Stream is an MP4 file");
+                    mDemuxer.reset(new Mp4Demux());
+                }
+            }
+        }
+        Demuxer::Packet packet;
+        int len = size;
+        auto ret = mDemuxer->parse(data, len, packet);
+        mParsePending = (ret == Demuxer::kPacket);
+        if (ret == Demuxer::kPacket) {
+            if (data && packet.data >= data && packet.data < data + size) {
+                mUpstreamConsumed = len; // released together with the packet
+            } else if (data) {
+                mPrev->confirmRead(len);
+            }
+            pkt.buf = (char*)packet.data;
+            pkt.size = packet.size;
+            pkt.fmt = mOutFormat;
+            pkt.ts = mInputTs;
+            pkt.pts = packet.pts;
+            pkt.flags = packet.flags;
+            if (mSeekStartTs && !mSeekPending && !mSkipBytes) {
+                mSeekLatencyMs = (esp_timer_get_time() - mSeekStartTs) / 1000;
+                mSeekStartTs = 0;
+                ESP_LOGI(mTag, "Seek done, first packet after %d ms", mSeekLatencyMs);
+            }
+            return kNoError;
+        }
+        if (data) {
+            mPrev->confirmRead(len);
+        }
+        if (ret == Demuxer::kSeek) {
+            ESP_LOGI(mTag, "Continuing the stream from byte %lld", (long long)mDemuxer->seekPos());
+            if (mPrev->seekToByte(mDemuxer->seekPos())) {
+                mSeekPending = true;
+            } else if (mDemuxer->seekPos() >= mDemuxer->seekFrom()) {
+                mSkipBytes = mDemuxer->seekPos() - mDemuxer->seekFrom();
+                ESP_LOGI(mTag, "Upstream node can't seek, skipping %lld bytes", (long long)mSkipBytes);
+            } else {
+                ESP_LOGW(mTag, "Upstream node can't seek back");
+                return kErrNotSupported;
+            }
+        } else if (ret == Demuxer::kError) {
+            return kErrDecode;
+        }
+    }
+}
+
+void DemuxNode::confirmRead(int size)
+{
+    if (!mDemuxer) {
+        mPrev->confirmRead(size);
+        return;
+    }
+    if (!mDemuxer->packetOutput()) {
+        scanConsumed(size);
+        return;
+    }
+    if (mUpstreamConsumed) {
+        mPrev->confirmRead(mUpstreamConsumed);
+        mUpstreamConsumed = 0;
+    }
+}
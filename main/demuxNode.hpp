@@ -0,0 +1,76 @@
+#ifndef DEMUX_NODE_HPP
+#define DEMUX_NODE_HPP
+#include "audioNode.hpp"
+#include "demuxer.hpp"
+#include <memory>
+
+/* Splits the compressed stream from the source node (HttpNode) into whole codec
+ * packets with timestamps, which the decoder pulls with pullPacket(), instead of
+ * finding the frames itself. The demuxer is chosen by the stream's codec - MP4
+ * (also sniffed from an ftyp box), ADTS or Ogg. Streams of other codecs (FLAC,
+ * WAV) are passed through as they are. MPEG audio is passed through too, as the
+ * decoder needs it contiguous, after skipping the tags at its start. Its demuxer
+ * only scans the data that the decoder consumed, for seeking.
+ * A demuxer may need the source to continue from another offset (i.e. to skip the
+ * mdat box of an MP4 file with the moov box at the end), which is done with
+ * seekToByte(). The data received before the resulting kStreamFlush is discarded,
+ * and the flush is not passed downstream. If the source can't seek, forward
+ * seeks are done by reading through the data.
+ * Seeking by time is done the same way, with the byte offset from the demuxer,
+ * but the flush is passed downstream, so that the decoder drops its state
+ */
+class DemuxNode: public AudioNode
+{
+protected:
+    enum { kReadSize = 4096 };
+    std::unique_ptr<Demuxer> mDemuxer;
+    StreamFormat mInFormat; // of the stream from upstream
+    StreamFormat mOutFormat; // of the packets
+    bool mHaveFormat = false;
+    bool mSeekPending = false; // waiting for the kStreamFlush of our seek
+    bool mParsePending = false; // the demuxer may have more packets without new input
+    bool mSniffMp4 = false; // check the first data of an AAC stream for an MP4 file
+    // Upstream data consumed by the demuxer for the last packet, which is in
+    // place there, so it's released by confirmRead()
+    int mUpstreamConsumed = 0;
+    int64_t mSkipBytes = 0; // discarded from upstream, when it can't seek forward
+    int64_t mInputTs = 0;
+    // Passed through stream of a demuxer without packet output
+    const uint8_t* mScanBuf = nullptr; // returned by the last pull
+    int64_t mStreamPos = 0; // of mScanBuf
+    bool mCheckTag = false; // at the start of the stream, or after a tag
+    bool mScanning = false; // the demuxer is given the consumed data
+    // Seek by time, requested by another task. Protected by mSeekMutex
+    Mutex mSeekMutex;
+    bool mCanSeek = false; // the stream has a demuxer, set with it
+    int32_t mSeekRequestMs = -1;
+    int64_t mSeekRequestTs = 0;
+    // The seek being done
+    int64_t mTimeSeekPos = -1; // byte offset, until the kStreamFlush of the seek
+    int64_t mTimeSeekPts = 0;
+    int64_t mSeekStartTs = 0; // until the first packet after the seek
+    volatile int32_t mSeekLatencyMs = -1;
+    void createDemuxer(const StreamFormat& fmt);
+    void resetDemuxer();
+    bool handleFlush();
+    StreamError startTimeSeek();
+    StreamError pullFormat(DataPullReq& dpr, int timeout);
+    StreamError pullPassthrough(DataPullReq& dpr, int timeout);
+    void scanConsumed(int size);
+    bool isPassthrough() const { return mDemuxer && !mDemuxer->packetOutput(); }
+public:
+    DemuxNode(): AudioNode("demux") {}
+    virtual Type type() const { return kTypeDemuxer; }
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout);
+    virtual StreamError doPullPacket(PacketPullReq& pkt, int timeout);
+    virtual bool hasPacketOutput() const { return mDemuxer && mDemuxer->packetOutput(); }
+    virtual void confirmRead(int size);
+    // Continues the stream from a time offset, if the demuxer can map it to a byte
+    // offset (MP3 only). Can be called from any task, the seek is done by the next
+    // pull. Returns false if the stream isn't demuxed
+    bool seekToTime(int32_t ms);
+    // From the seek request to the first data after it, -1 if there was no seek
+    int32_t lastSeekLatencyMs() const { return mSeekLatencyMs; }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DEMUXER_HPP
+#define DEMUXER_HPP
+#include <stdint.h>
+#include "audioNode.hpp"
+
+/* Base of the demuxers used by DemuxNode, which split a container or an
+ * elementary stream into whole codec packets. Data can be fed in chunks of any
+ * size. Packets that are entirely within the chunk are returned in place, only
+ * packets that span chunks are copied to an internal buffer
+ */
+class Demuxer
+{
+public:
+    struct Packet
+    {
+        const uint8_t* data;
+        int size;
+        int64_t pts; // in microseconds, -1 if not known
+        uint8_t flags; // AudioNode::PacketPullReq flags
+    };
+    enum Result: int8_t {
+        kError = -1,
+        kNeedMoreData = 0,
+        kPacket = 1,
+        kSeek = 2 // the stream has to continue from seekPos()
+    };
+    enum {
+        kSkipSeekThreshold = 32768 // skip larger gaps with a seek, instead of reading them
+    };
+protected:
+    const char* mTag;
+    int64_t mPos = 0; // stream position of the next byte to be parsed
+    int64_t mSeekPos = 0;
+    int64_t mSeekFrom = 0; // stream position when the seek was requested
+    int64_t mStreamLen = -1; // -1 if not known
+    Result seekTo(int64_t pos)
+    {
+        mSeekFrom = mPos;
+        mSeekPos = mPos = pos;
+        return kSeek;
+    }
+public:
+    Demuxer(const char* tag): mTag(tag) {}
+    virtual ~Demuxer() {}
+    /** Parses data until a packet is complete, or all data is consumed. Sets
+     * `size` to the amount of data consumed - the rest must be passed again.
+     * The returned packet is valid until the next call, or until the data is
+     * released. On kSeek, the data that follows must be from seekPos() on. If
+     * the source can't seek, a forward seek can be done by discarding the data
+     * up to seekPos()
+     */
+    virtual Result parse(const uint8_t* data, int& size, Packet& packet) = 0;
+    // The codec of the packets, which the decoder is created for
+    virtual CodecType codec() const = 0;
+    // If false, the stream is passed to the decoder as it is, and parse() is
+    // given the data that the decoder consumed, only to find what seeking needs
+    virtual bool packetOutput() const { return true; }
+    virtual void reset() = 0;
+    // Byte offset of the stream to continue from to get to a time, for seeking.
+    // Returns -1 if the demuxer can't map the time
+    virtual int64_t seekPosForTime(int64_t us) { return -1; }
+    // Continues with the data from a position returned by seekPosForTime(),
+    // which may be in the middle of a packet, with pts being its time
+    virtual void restartAt(int64_t pos, int64_t pts) { reset(); mPos = pos; }
+    void setStreamLength(int64_t len) { mStreamLen = len; }
+    int64_t pos() const { return mPos; }
+    int64_t seekPos() const { return mSeekPos; }
+    int64_t seekFrom() const { return mSeekFrom; }
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "equalizerNode.hpp"
 #include <esp_equalizer.h>
+#include "pcmBlockPool.hpp"
 
 const uint16_t EqualizerNode::bandFreqs[kBandCount] = {
     31, 62, 125, 250, 500, 1000, 2000, 4000, 8000, 16000
@@ -72,13 +73,50 @@ float EqualizerNode::bandGain(uint8_t band)
     MutexLocker locker(mMutex);
     return mGains[band];
 }
-AudioNode::StreamError EqualizerNode::pullData(DataPullReq &dpr, int timeout)
+AudioNode::StreamError EqualizerNode::doPullData(DataPullReq &dpr, int timeout)
 {
+    // The samples are processed in place, so the buffer of the upstream node is
+    // used only if it has no blocks - it may be its input, passed through
+    mPulledBlock.reset();
+    if (mPrev->hasBlockOutput()) {
+        auto ret = doPullBlock(mPulledBlock, timeout);
+        if (ret < 0) {
+            return ret;
+        }
+        dpr.buf = mPulledBlock->data;
+        dpr.size = mPulledBlock->size;
+        dpr.fmt = mPulledBlock->fmt;
+        dpr.ts = mPulledBlock->ts;
+        return kNoError;
+    }
     MutexLocker locker(mMutex);
     auto ret = mPrev->pullData(dpr, timeout);
     if (ret < 0) {
         return ret;
     }
+    return process(dpr);
+}
+
+AudioNode::StreamError EqualizerNode::doPullBlock(PcmBlockRef& block, int timeout)
+{
+    MutexLocker locker(mMutex);
+    auto ret = mPrev->pullBlock(block, timeout);
+    if (ret < 0) {
+        return ret;
+    }
+    // processed in place, so we need our own copy if someone else holds the block too
+    if (!block.makeUnique(timeout)) {
+        block.reset();
+        return kTimeout;
+    }
+    DataPullReq dpr(block->size);
+    dpr.buf = block->data;
+    dpr.fmt = block->fmt;
+    return process(dpr);
+}
+
+AudioNode::StreamError EqualizerNode::process(DataPullReq& dpr)
+{
     if (dpr.fmt != mFormat) {
         if (dpr.fmt.bits() != 16) {
             ESP_LOGE(mTag, "Only 16 bits per sample supported, but stream is %d-bit", dpr.fmt.bits());
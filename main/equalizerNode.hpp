@@ -3,6 +3,7 @@
 #include "equalizer.hpp"
 #include "audioNode.hpp"
 #include "volume.hpp"
+#include "pcmBlockPool.hpp"
 
 class EqualizerNode: public AudioNode, public DefaultVolumeImpl
 {
@@ -16,13 +17,22 @@ protected:
     uint8_t mChanCount = 0; // cached from mFormat, for performance
     void* mEqualizer = nullptr;
     float mGains[kBandCount];
+    PcmBlockRef mPulledBlock; // returned by the last doPullData(), kept until the next call
     void equalizerReinit(StreamFormat fmt);
     void updateBandGain(uint8_t band);
+    StreamError process(DataPullReq& dpr);
 public:
     EqualizerNode(const float* gains=nullptr);
     virtual Type type() const { return kTypeEqualizer; }
-    virtual StreamError pullData(DataPullReq &dpr, int timeout) override;
-    virtual void confirmRead(int size) override { mPrev->confirmRead(size); }
+    virtual StreamError doPullData(DataPullReq &dpr, int timeout) override;
+    virtual StreamError doPullBlock(PcmBlockRef& block, int timeout) override;
+    virtual bool hasBlockOutput() const override { return mPrev && mPrev->hasBlockOutput(); }
+    virtual void confirmRead(int size) override
+    {
+        if (!mPulledBlock) {
+            mPrev->confirmRead(size);
+        }
+    }
     void setBandGain(uint8_t band, float dbGain);
     void setAllGains(const float* gains);
     void zeroAllGains();
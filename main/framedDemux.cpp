@@ -0,0 +1,229 @@
+#include "framedDemux.hpp"
+
+void FramedDemux::reset()
+{
+    mBufLen = mBufDrop = 0;
+    mSynced = false;
+    mSamples = 0;
+    mSampleRate = 0;
+    mPtsBase = 0;
+    mPos = 0;
+}
+
+void FramedDemux::restartAt(int64_t pos, int64_t pts)
+{
+    FramedDemux::reset(); // not that of the subclass, which resets its stream info
+    mPos = pos;
+    mPtsBase = pts; // of the first frame found, the sample rate is set by it
+}
+
+// Returns the offset of the first complete frame in buf, or -1 if more data is
+// needed. In that case, sets `skip` to the amount of data before a possible
+// frame start, which can be discarded. Same as DecoderAac::findFrame()
+int FramedDemux::findFrame(const uint8_t* buf, int len, FrameInfo& info, int& skip)
+{
+    for (int pos = 0;; pos++) {
+        while (pos <= len - mHeaderSize && !(buf[pos] == 0xff && parseHeader(buf + pos, info))) {
+            pos++;
+        }
+        if (pos > len - mHeaderSize) {
+            // keep what may be the start of a header
+            skip = std::max(0, len - (mHeaderSize - 1));
+            return -1;
+        }
+        if (mSynced && info.streamKey != mStreamKey) {
+            ESP_LOGI(mTag, "Frame header doesn't match the stream, resyncing");
+            mSynced = false;
+        }
+        if (pos + info.size > len) {
+            skip = pos;
+            return -1;
+        }
+        if (!mSynced) {
+            // A sync word in the frame data is unlikely to be followed by another
+            // valid header of the same stream
+            int next = pos + info.size;
+            if (next + mHeaderSize > len) {
+                skip = pos;
+                return -1;
+            }
+            FrameInfo nextInfo;
+            if (!parseHeader(buf + next, nextInfo) || nextInfo.streamKey != info.streamKey) {
+                continue;
+            }
+        }
+        return pos;
+    }
+}
+
+FramedDemux::Result FramedDemux::parse(const uint8_t* data, int& size, Packet& packet)
+{
+    if (mBufDrop) { // the last packet was returned from the bounce buffer
+        mBufLen -= mBufDrop;
+        memmove(mBuf.get(), mBuf.get() + mBufDrop, mBufLen);
+        mBufDrop = 0;
+    }
+    // As with the decoders' bounce buffer, the input is appended to the frame
+    // start kept in it, and is consumed only as far as the frame extends into it
+    const uint8_t* src;
+    int srcLen;
+    int copied = 0;
+    if (mBufLen) {
+        copied = std::min(size, mBufSize - mBufLen);
+        memcpy(mBuf.get() + mBufLen, data, copied);
+        src = mBuf.get();
+        srcLen = mBufLen + copied;
+    } else {
+        src = data;
+        srcLen = size;
+    }
+    FrameInfo info;
+    int skip;
+    int offset = findFrame(src, srcLen, info, skip);
+    if (offset < 0) {
+        mBufLen = srcLen - skip;
+        memmove(mBuf.get(), src + skip, mBufLen);
+        if (src != data) {
+            size = copied;
+        }
+        mPos += size;
+        return kNeedMoreData;
+    }
+    mSynced = true;
+    mStreamKey = info.streamKey;
+    if (info.sampleRate != mSampleRate) {
+        if (mSampleRate) {
+            mPtsBase += mSamples * 1000000 / mSampleRate;
+        }
+        mSamples = 0;
+        mSampleRate = info.sampleRate;
+    }
+    packet.data = src + offset;
+    packet.size = info.size;
+    packet.pts = mPtsBase + mSamples * 1000000 / mSampleRate;
+    packet.flags = 0;
+    mSamples += info.samples;
+    int end = offset + info.size;
+    if (src == data) {
+        size = end;
+    } else if (end >= mBufLen) { // the bounce buffer is done with, back to in-place
+        size = end - mBufLen;
+        mBufLen = 0;
+    } else {
+        size = 0;
+        mBufDrop = end;
+    }
+    mPos += size;
+    return kPacket;
+}
+
+bool AdtsDemux::parseHeader(const uint8_t* p, FrameInfo& info)
+{
+    // frames of several raw data blocks are passed on, for the decoder to reject
+    // them, if they fit in the bounce buffer
+    AdtsHeader hdr;
+    if (!hdr.parse(p) || hdr.frameSize > AdtsHeader::kMaxFrameSize) {
+        return false;
+    }
+    info.size = hdr.frameSize;
+    info.samples = 1024 * hdr.rawBlocks;
+    info.sampleRate = hdr.sampleRate;
+    info.streamKey = hdr.sampleRate | (hdr.channels << 20) | (hdr.objectType << 24) | (hdr.mpegVersion << 28);
+    return true;
+}
+
+void MpegDemux::reset()
+{
+    FramedDemux::reset();
+    mAudioStart = -1;
+    mHasInfoTag = false;
+}
+
+// Keeps what's needed for seeking - the position of the first frame, its
+// Xing/VBRI tag, if any, and its bitrate
+void MpegDemux::parseFirstFrame(const Packet& packet)
+{
+    // the packet may be followed by data in the bounce buffer, that was consumed
+    mAudioStart = mPos - (mBufLen - mBufDrop) - packet.size;
+    FrameInfo info;
+    parseHeader(packet.data, info);
+    mFrameSamples = info.samples;
+    mFrameRate = info.sampleRate;
+    mBytesPerSec = (int64_t)info.size * info.sampleRate / info.samples;
+    mHasInfoTag = mInfoTag.parse(packet.data, packet.size);
+    if (mHasInfoTag) {
+        ESP_LOGI(mTag, "Xing/VBRI tag: %u frames, %u bytes, %s", (unsigned)mInfoTag.frames,
+            (unsigned)mInfoTag.bytes, (mInfoTag.flags & Mp3InfoTag::kHasToc) ? "with seek table" : "no seek table");
+    }
+}
+
+// The seek table maps percents of the duration to byte offsets. Without it, a
+// constant bitrate is assumed, and a time past the end of the stream can't be
+// sought to
+int64_t MpegDemux::seekPosForTime(int64_t us)
+{
+    if (mAudioStart < 0) {
+        return -1;
+    }
+    auto& tag = mInfoTag;
+    if (mHasInfoTag && (tag.flags & Mp3InfoTag::kHasFrames) && (tag.flags & Mp3InfoTag::kHasBytes)
+        && tag.frames && tag.bytes) {
+        int64_t duration = (int64_t)tag.frames * mFrameSamples * 1000000 / mFrameRate;
+        uint32_t time16 = (std::min(us, duration - 1) << 16) / duration;
+        if (tag.flags & Mp3InfoTag::kHasToc) {
+            return mAudioStart + tag.tocOffset(time16);
+        }
+        return mAudioStart + ((int64_t)tag.bytes * time16 >> 16); // by the average bitrate
+    }
+    int64_t pos = mAudioStart + us * mBytesPerSec / 1000000;
+    if (mStreamLen >= 0 && pos >= mStreamLen) {
+        ESP_LOGW(mTag, "Seek time is past the end of the stream");
+        return -1;
+    }
+    return pos;
+}
+
+bool MpegDemux::parseHeader(const uint8_t* p, FrameInfo& info)
+{
+    static const uint16_t kBitrates[5][15] = {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 }, // MPEG-1 layer I
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 }, // MPEG-1 layer II
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }, // MPEG-1 layer III
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 }, // MPEG-2/2.5 layer I
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } // MPEG-2/2.5 layers II and III
+    };
+    static const uint16_t kSampleRates[3] = { 44100, 48000, 32000 };
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    int version = (p[1] >> 3) & 3; // 0 - MPEG-2.5, 1 - reserved, 2 - MPEG-2, 3 - MPEG-1
+    int layer = 4 - ((p[1] >> 1) & 3);
+    int bitrateIdx = p[2] >> 4;
+    int rateIdx = (p[2] >> 2) & 3;
+    // free format (bitrate index 0) is not supported
+    if (version == 1 || layer == 4 || bitrateIdx == 0 || bitrateIdx == 15 || rateIdx == 3 || (p[3] & 3) == 2) {
+        return false;
+    }
+    bool mpeg1 = version == 3;
+    int bitrate = kBitrates[mpeg1 ? layer - 1 : (layer == 1 ? 3 : 4)][bitrateIdx] * 1000;
+    info.sampleRate = kSampleRates[rateIdx] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    int padding = (p[2] >> 1) & 1;
+    if (layer == 1) {
+        info.samples = 384;
+        info.size = (12 * bitrate / info.sampleRate + padding) * 4;
+    } else {
+        info.samples = (layer == 3 && !mpeg1) ? 576 : 1152;
+        info.size = info.samples / 8 * bitrate / info.sampleRate + padding;
+    }
+    info.streamKey = (p[1] & 0xfe) | (rateIdx << 8);
+    return true;
+}
+
+MpegDemux::Result MpegDemux::parse(const uint8_t* data, int& size, Packet& packet)
+{
+    auto ret = FramedDemux::parse(data, size, packet);
+    if (ret == kPacket && mAudioStart < 0) {
+        parseFirstFrame(packet);
+    }
+    return ret;
+}
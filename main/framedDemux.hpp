@@ -0,0 +1,83 @@
+#ifndef FRAMED_DEMUX_HPP
+#define FRAMED_DEMUX_HPP
+#include "demuxer.hpp"
+#include "adts.hpp"
+#include "mp3InfoTag.hpp"
+
+/* Demuxer of elementary streams of self-delimiting frames - ADTS and MPEG
+ * audio. Frames are located by their header, and before the first one, a sync
+ * is accepted only if another frame header of the same stream follows it, as
+ * the decoders do. Each frame is one packet
+ */
+class FramedDemux: public Demuxer
+{
+protected:
+    struct FrameInfo
+    {
+        int size; // including the header
+        int samples;
+        int sampleRate;
+        uint32_t streamKey; // header fields that are the same in all frames of a stream
+    };
+    const int mHeaderSize;
+    const int mBufSize; // bounce buffer, for frames that span chunks
+    std::unique_ptr<uint8_t[]> mBuf;
+    int mBufLen = 0;
+    int mBufDrop = 0; // bounce buffer data of the last packet, dropped with the next call
+    bool mSynced = false;
+    uint32_t mStreamKey = 0;
+    int64_t mPtsBase = 0; // of the first frame at the current sample rate
+    int64_t mSamples = 0; // output at the current sample rate, for the pts
+    int mSampleRate = 0;
+    // Returns false if there is no valid frame header at p, which has at least mHeaderSize bytes
+    virtual bool parseHeader(const uint8_t* p, FrameInfo& info) = 0;
+    int findFrame(const uint8_t* buf, int len, FrameInfo& info, int& skip);
+public:
+    FramedDemux(const char* tag, int headerSize, int maxFrameSize)
+    : Demuxer(tag), mHeaderSize(headerSize), mBufSize(maxFrameSize + headerSize),
+      mBuf(new uint8_t[mBufSize]) {}
+    virtual Result parse(const uint8_t* data, int& size, Packet& packet);
+    virtual void reset();
+    virtual void restartAt(int64_t pos, int64_t pts);
+};
+
+class AdtsDemux: public FramedDemux
+{
+protected:
+    virtual bool parseHeader(const uint8_t* p, FrameInfo& info);
+public:
+    AdtsDemux(): FramedDemux("adtsdemux", AdtsHeader::kHeaderSize, AdtsHeader::kMaxFrameSize) {}
+    virtual CodecType codec() const { return kCodecAac; }
+};
+
+// MPEG-1/2/2.5 audio, layers I to III. Free format streams are not supported.
+// Layer III frames may have their main data in the preceding frames (the bit
+// reservoir), which libmad finds only in a contiguous stream, so the stream is
+// passed to the decoder as it is. The demuxer only finds the first frame, for
+// seeking by time - by the seek table of its Xing or VBRI tag, or else by its
+// bitrate. Tags before it are skipped by DemuxNode
+class MpegDemux: public FramedDemux
+{
+protected:
+    enum {
+        kHeaderSize = 4,
+        kMaxFrameSize = 2881 // layer III, 320 kbps at 32 kHz, with padding
+    };
+    int64_t mAudioStart = -1; // stream position of the first frame
+    bool mHasInfoTag = false;
+    Mp3InfoTag mInfoTag;
+    int mFrameSamples = 0; // of the first frame
+    int mFrameRate = 0;
+    int mBytesPerSec = 0; // by the bitrate of the first frame
+    virtual bool parseHeader(const uint8_t* p, FrameInfo& info);
+    void parseFirstFrame(const Packet& packet);
+public:
+    MpegDemux(): FramedDemux("mpegdemux", kHeaderSize, kMaxFrameSize) {}
+    virtual CodecType codec() const { return kCodecMp3; }
+    virtual bool packetOutput() const { return false; }
+    virtual Result parse(const uint8_t* data, int& size, Packet& packet);
+    virtual void reset();
+    virtual int64_t seekPosForTime(int64_t us);
+};
+
+#endif
@@ -28,14 +28,22 @@ CodecType HttpNode::codecFromContentType(const char* content_type)
     }
     if (strcasecmp(content_type, "audio/aac") == 0 ||
         strcasecmp(content_type, "audio/x-aac") == 0 ||
-        strcasecmp(content_type, "audio/mp4") == 0 ||
         strcasecmp(content_type, "audio/aacp") == 0 ||
         strcasecmp(content_type, "video/MP2T") == 0) {
         return kCodecAac;
     }
+    if (strcasecmp(content_type, "audio/mp4") == 0 ||
+        strcasecmp(content_type, "audio/x-m4a") == 0 ||
+        strcasecmp(content_type, "audio/m4a") == 0) {
+        return kCodecM4a;
+    }
     if (strcasecmp(content_type, "application/ogg") == 0) {
         return kCodecOgg;
     }
+    if (strcasecmp(content_type, "audio/flac") == 0 ||
+        strcasecmp(content_type, "audio/x-flac") == 0) {
+        return kCodecFlac;
+    }
     if (strcasecmp(content_type, "audio/wav") == 0) {
         return kCodecWav;
     }
@@ -55,7 +63,7 @@ CodecType HttpNode::codecFromContentType(const char* content_type)
 
 bool HttpNode::isPlaylist()
 {
-    auto codec = mStreamFormat.codec;
+    auto codec = mRecvFormat.codec;
     if (codec == kPlaylistM3u8 || codec == kPlaylistPls) {
         return true;
     }
@@ -106,9 +114,9 @@ esp_err_t HttpNode::httpHeaderHandler(esp_http_client_event_t *evt)
     auto self = static_cast<HttpNode*>(evt->user_data);
     auto key = evt->header_key;
     if (strcasecmp(key, "Content-Type") == 0) {
-        self->mStreamFormat.codec = self->codecFromContentType(evt->header_value);
+        self->mRecvFormat.codec = self->codecFromContentType(evt->header_value);
         ESP_LOGI(TAG, "Parsed content-type '%s' as %s", evt->header_value,
-            self->mStreamFormat.codecTypeStr());
+            self->mRecvFormat.codecTypeStr());
     } else if (strcasecmp(key, "icy-metaint") == 0) {
         auto self = static_cast<HttpNode*>(evt->user_data);
         self->mIcyInterval = atoi(evt->header_value);
@@ -140,18 +148,9 @@ bool HttpNode::connect(bool isReconnect)
 
     ESP_LOGI(mTag, "Connecting to '%s'...", mUrl);
     if (!isReconnect) {
-        ESP_LOGI(mTag, "connect: Waiting for buffer to drain...");
-        // Wait till buffer is drained before changing format descriptor
-        if (mWaitingPrefill && mRingBuf.hasData()) {
-            ESP_LOGW(mTag, "Connect: Read state is kReadPrefill, but the buffer should be drained, allowing read");
-            setWaitingPrefill(false);
-        }
-        bool ret = mRingBuf.waitForEmpty();
-        if (!ret) {
+        if (!startNewFormat()) {
             return false;
         }
-        ESP_LOGI(mTag, "connect: Buffer drained");
-        mStreamFormat.reset();
         mBytePos = 0;
     }
 
@@ -169,6 +168,8 @@ bool HttpNode::connect(bool isReconnect)
         snprintf(rang_header, 32, "bytes=%lld-", mBytePos);
         esp_http_client_set_header(mClient, "Range", rang_header);
     }
+    mRangeStart = mBytePos;
+    mSkipBytes = 0;
     sendEvent(kEventConnecting, nullptr, isReconnect);
 
     for (int tries = 0; tries < 4; tries++) {
@@ -197,6 +198,11 @@ bool HttpNode::connect(bool isReconnect)
             ESP_LOGE(mTag, "Non-200 response code %d", status_code);
             return false;
         }
+        if (mBytePos && status_code == 200) {
+            ESP_LOGW(mTag, "Server ignored the Range request, skipping %lld bytes", mBytePos);
+            mSkipBytes = mBytePos;
+            mRangeStart = 0;
+        }
         ESP_LOGI(TAG, "Checking if response is a playlist");
         if (parseResponseAsPlaylist()) {
             ESP_LOGI(TAG, "Response parsed as playlist");
@@ -223,6 +229,51 @@ bool HttpNode::connect(bool isReconnect)
     return false;
 }
 
+// Marks the end of the received data as the start of a new stream. The new
+// track is received without waiting for the reader to finish the previous one,
+// so the decoder can continue with it without a gap
+bool HttpNode::startNewFormat()
+{
+    if (bytesToFormatChange() >= 0) {
+        // The previous track was shorter than the buffer, and the reader hasn't
+        // reached it yet. Only one boundary is tracked, so wait for the buffer to drain
+        ESP_LOGI(mTag, "connect: Waiting for buffer to drain...");
+        if (mWaitingPrefill && mRingBuf.hasData()) {
+            ESP_LOGW(mTag, "Connect: Read state is kReadPrefill, but the buffer should be drained, allowing read");
+            setWaitingPrefill(false);
+        }
+        if (!mRingBuf.waitForEmpty()) {
+            return false;
+        }
+        ESP_LOGI(mTag, "connect: Buffer drained");
+    }
+    MutexLocker locker(mRingBuf.mutex());
+    mRecvFormat.reset();
+    mFormatChangePos = mRingBuf.writeCount();
+    mFormatChangePending = true;
+    return true;
+}
+
+// How much can be read before the pending track boundary, or -1 if there is none
+int HttpNode::bytesToFormatChange()
+{
+    MutexLocker locker(mRingBuf.mutex());
+    return mFormatChangePending ? (int)(mFormatChangePos - mRingBuf.readCount()) : -1;
+}
+
+// Switches to the format of the new track, once the reader is at the boundary
+// and data of the new track has been received - the Content-Type header is
+// parsed before that
+void HttpNode::applyFormatChange()
+{
+    MutexLocker locker(mRingBuf.mutex());
+    if (mFormatChangePending && mRingBuf.readCount() == mFormatChangePos
+        && mRingBuf.writeCount() != mFormatChangePos) {
+        mStreamFormat = mRecvFormat;
+        mFormatChangePending = false;
+    }
+}
+
 bool HttpNode::parseResponseAsPlaylist()
 {
     if (!isPlaylist()) {
@@ -307,18 +358,22 @@ void HttpNode::recv()
                 }
                 break;
             }
+            if (rlen > 0 && mSkipBytes) {
+                int skip = std::min<int64_t>(rlen, mSkipBytes);
+                mSkipBytes -= skip;
+                rlen -= skip;
+                if (!rlen) {
+                    return;
+                }
+                memmove(buf, buf + skip, rlen);
+            }
             if (rlen > 0) {
                 if (mIcyInterval) {
                     rlen = icyProcessRecvData(buf, rlen);
                 }
+                // The recorder, if any, drains the data from the ringbuf on its own task
+                addArrivalMark(mRingBuf.writeCount());
                 mRingBuf.commitWrite(rlen);
-                // First commit the write, only after that record to SD card,
-                // to avoid blocking the stream consumer
-                // Note: The buffer is still valid, even if it has been consumed
-                // before we reach the next line - ringbuf consumers are read-only
-                if (mRecorder) {
-                    mRecorder->onData(buf, rlen);
-                }
                 mBytePos += rlen;
                 //ESP_LOGI(TAG, "Received %d bytes, wrote to ringbuf (%d)", rlen, mRingBuf.totalDataAvail());
                 //TODO: Implement IceCast metadata support
@@ -327,6 +382,10 @@ void HttpNode::recv()
                 }
                 return;
             }
+            if (isAtEnd()) {
+                ESP_LOGI(TAG, "End of file reached");
+                break;
+            }
             // even though len == 0 means graceful disconnect, i.e.
             //track end => should go to next track, this often happens when
             // network lags and stream sender aborts sending to us
@@ -348,6 +407,11 @@ void HttpNode::recv()
         connect();
     }
 }
+// Whether the whole content of a response of known length was received
+bool HttpNode::isAtEnd() const
+{
+    return mContentLen && mContentLen != (uint32_t)-1 && mBytePos - mRangeStart >= mContentLen;
+}
 int HttpNode::icyProcessRecvData(char* buf, int rlen)
 {
     if (mIcyRemaining) { // we are receiving metadata
@@ -439,7 +503,7 @@ void HttpNode::icyParseMetaData()
     ESP_LOGW(TAG, "Track title changed to: '%s'", icyMetaBuf.buf());
     sendEvent(kEventTrackInfo, icyMetaBuf.buf(), icyMetaBuf.dataSize());
     if (mRecorder && mBytePos) {
-        mRecorder->onNewTrack(icyMetaBuf.buf(), mStreamFormat);
+        mRecorder->onNewTrack(icyMetaBuf.buf(), mRecvFormat);
     }
 }
 
@@ -464,17 +528,75 @@ bool HttpNode::dispatchCommand(Command &cmd)
         doSetUrl((const char*)cmd.arg);
         free(cmd.arg);
         cmd.arg = nullptr;
-        mRingBuf.clear();
+        {
+            MutexLocker locker(mRingBuf.mutex());
+            mRingBuf.clear();
+            mFormatChangePending = false; // connect() starts the new format
+        }
         mFlushRequested = true; // request flush along the pipeline
         setWaitingPrefill(true);
         setState(kStateRunning);
         ESP_LOGI(TAG, "Url set, switched to running state");
         break;
+    case kCommandSeek:
+        doSeek(*(int64_t*)cmd.arg);
+        free(cmd.arg);
+        cmd.arg = nullptr;
+        break;
     default: return false;
     }
     return true;
 }
 
+int64_t HttpNode::streamLength() const
+{
+    if (!mContentLen || mContentLen == (uint32_t)-1 || mIcyInterval) {
+        return -1;
+    }
+    // after a Range request, the content length is that of the rest
+    return mRangeStart + mContentLen;
+}
+
+bool HttpNode::seekToByte(int64_t pos)
+{
+    // only files can be seeked - live streams have no content length, and
+    // reconnecting to them loses data
+    if (!mTaskId || !mContentLen || mContentLen == (uint32_t)-1 || mIcyInterval) {
+        return false;
+    }
+    if (pos >= streamLength()) {
+        ESP_LOGW(mTag, "Seek position is past the end of the stream");
+        return false;
+    }
+    // the next track is already being received, the connection is not for this one
+    if (bytesToFormatChange() >= 0) {
+        return false;
+    }
+    auto arg = (int64_t*)malloc(sizeof(int64_t));
+    *arg = pos;
+    ESP_LOGI(mTag, "Posting seek command");
+    mCmdQueue.post(kCommandSeek, arg);
+    return true;
+}
+
+// Continues the same stream from another position. The consumer gets kStreamFlush,
+// but the stream format is unchanged
+void HttpNode::doSeek(int64_t pos)
+{
+    ESP_LOGI(mTag, "Seeking to byte %lld", (long long)pos);
+    destroyClient();
+    mRingBuf.clear();
+    mFlushRequested = true;
+    // the consumer is waiting for specific data, don't delay it with a prefill
+    setWaitingPrefill(false);
+    mBytePos = pos;
+    setState(kStateRunning);
+    if (!connect(true)) {
+        ESP_LOGE(mTag, "Error reconnecting for seek");
+        setState(kStatePaused);
+    }
+}
+
 void HttpNode::nodeThreadFunc()
 {
     ESP_LOGI(TAG, "Task started");
@@ -510,12 +632,12 @@ HttpNode::~HttpNode()
 }
 
 HttpNode::HttpNode(size_t bufSize)
-: AudioNodeWithTask("node-http", kStackSize), mRingBuf(bufSize),
+: AudioNodeWithTask("node-http", kStackSize), mRingBuf(bufSize, kMaxContigRead),
   mPrefillAmount(bufSize * 3 / 4)
 {
 }
 
-AudioNode::StreamError HttpNode::pullData(DataPullReq& dp, int timeout)
+AudioNode::StreamError HttpNode::doPullData(DataPullReq& dp, int timeout)
 {
     ElapsedTimer tim;
     if (mFlushRequested) {
@@ -541,24 +663,82 @@ AudioNode::StreamError HttpNode::pullData(DataPullReq& dp, int timeout)
         } else if (ret == 0) {
             return kTimeout;
         }
+        if (mFlushRequested) { // a seek cleared the buffer while waiting
+            mFlushRequested = false;
+            return kStreamFlush;
+        }
+        applyFormatChange();
         dp.fmt = mStreamFormat;
         return kNoError;
     }
+    // a read never spans a track boundary
+    auto toFormatChange = bytesToFormatChange();
+    if (toFormatChange > 0 && dp.size > toFormatChange) {
+        dp.size = toFormatChange;
+    }
     tim.reset();
-    auto ret = mRingBuf.contigRead(dp.buf, dp.size, timeout);
+    // Sleep until the requested amount (usually a whole frame for the decoder) is
+    // buffered, rather than waking up the caller for every received chunk
+    auto ret = mRingBuf.waitForData(std::min(dp.size, mRingBuf.size() / 4), timeout);
     if (tim.msElapsed() > timeout) {
         ESP_LOGW(mTag, "RingBuf read took more than timeout: took %d, timeout %d", tim.msElapsed(), timeout);
     }
+    if (ret == 0 && mRingBuf.totalDataAvail() > 0) {
+        ret = 1; // a stall, return what is buffered, less than requested
+    }
+    if (ret > 0 && mFlushRequested) {
+        mFlushRequested = false;
+        return kStreamFlush;
+    }
+    if (ret > 0) {
+        if (!toFormatChange) {
+            applyFormatChange();
+        }
+        ret = mRingBuf.contigRead(dp.buf, dp.size, 0);
+    }
     if (ret < 0) {
         return kStreamStopped;
     } else if (ret == 0){
         return kTimeout;
     } else {
         dp.size = ret;
+        dp.fmt = mStreamFormat;
+        dp.ts = arrivalTime(mRingBuf.readCount());
         return kNoError;
     }
 }
 
+void HttpNode::addArrivalMark(uint32_t streamPos)
+{
+    MutexLocker locker(mRingBuf.mutex());
+    auto& last = mArrivalMarks[mLastArrivalMark];
+    if (last.ts && (int32_t)(streamPos - last.streamPos) < mRingBuf.size() / kArrivalMarkCount) {
+        return;
+    }
+    mLastArrivalMark = (mLastArrivalMark + 1) % kArrivalMarkCount;
+    auto& mark = mArrivalMarks[mLastArrivalMark];
+    mark.streamPos = streamPos;
+    mark.ts = esp_timer_get_time();
+}
+
+int64_t HttpNode::arrivalTime(uint32_t streamPos)
+{
+    MutexLocker locker(mRingBuf.mutex());
+    // find the latest mark at or before the stream position
+    int idx = mLastArrivalMark;
+    for (int i = 0; i < kArrivalMarkCount; i++) {
+        auto& mark = mArrivalMarks[idx];
+        if (!mark.ts) {
+            break;
+        }
+        if ((int32_t)(streamPos - mark.streamPos) >= 0) {
+            return mark.ts;
+        }
+        idx = (idx + kArrivalMarkCount - 1) % kArrivalMarkCount;
+    }
+    return 0;
+}
+
 void HttpNode::confirmRead(int size)
 {
     mRingBuf.commitContigRead(size);
@@ -599,7 +779,7 @@ void HttpNode::IcyInfo::clear()
 
 void HttpNode::startRecording(const char* stationName) {
     if (!mRecorder) {
-        mRecorder.reset(new TrackRecorder("/sdcard/rec"));
+        mRecorder.reset(new TrackRecorder("/sdcard/rec", mRingBuf));
     }
     mRecorder->setStation(stationName);
 }
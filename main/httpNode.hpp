@@ -24,15 +24,25 @@ class HttpNode: public AudioNodeWithTask
 {
 protected:
     enum { kPollTimeoutMs = 1000, kClientBufSize = 512, kReadSize = 1024,
-           kStackSize = 3600 };
+           kStackSize = 3600,
+           kMaxContigRead = 3000 // Ringbuf mirror size - max read that is never split by the wrap-around
+    };
     enum: uint8_t { kCommandSetUrl = AudioNodeWithTask::kCommandLast + 1,
-                    kCommandNotifyFlushed };
+                    kCommandNotifyFlushed, kCommandSeek };
     // Read mode dictates how the pullData() caller behaves. Since it may
     // need to wait for the read mode to change to a specific value, the enum values
     // are flags
     enum: uint8_t { kEvtPrefillChange = kEvtLast << 1 };
     char* mUrl = nullptr;
+    // The format of the data being read. The next track is received while the
+    // reader is still on the previous one, so the format of the data being
+    // received is kept separately, and becomes the read format when the reader
+    // reaches the track boundary. The boundary state is protected by the
+    // ringbuf's mutex
     StreamFormat mStreamFormat;
+    StreamFormat mRecvFormat;
+    uint32_t mFormatChangePos = 0; // ringbuf stream position of the track boundary
+    bool mFormatChangePending = false;
     esp_http_client_handle_t mClient = nullptr;
     bool mAutoNextTrack = true; /* connect next track without open/close */
     Playlist mPlaylist; /* media playlist */
@@ -41,10 +51,25 @@ protected:
     volatile bool mWaitingPrefill = true;
     volatile bool mFlushRequested = false;
     int mPrefillAmount;
-    uint32_t mContentLen;
+    uint32_t mContentLen = 0;
+    int64_t mRangeStart = 0; // stream position that the response starts at
+    int64_t mSkipBytes = 0; // the server ignored a Range request, skip to the position
     int32_t mIcyCtr = 0;
     int32_t mIcyInterval = 0;
     int16_t mIcyRemaining = 0;
+    // Arrival times of the data in the ringbuf, for end-to-end latency measurement.
+    // A mark is recorded every size/kArrivalMarkCount bytes, so that the marks
+    // always cover the whole ringbuf. Protected by the ringbuf's mutex
+    struct ArrivalMark
+    {
+        uint32_t streamPos;
+        int64_t ts;
+    };
+    enum { kArrivalMarkCount = 64 };
+    ArrivalMark mArrivalMarks[kArrivalMarkCount] = {};
+    uint8_t mLastArrivalMark = 0;
+    void addArrivalMark(uint32_t streamPos);
+    int64_t arrivalTime(uint32_t streamPos);
     void clearAllIcyInfo();
     std::unique_ptr<TrackRecorder> mRecorder;
     static esp_err_t httpHeaderHandler(esp_http_client_event_t *evt);
@@ -56,7 +81,12 @@ protected:
     bool parseContentType();
     bool parseResponseAsPlaylist();
     void doSetUrl(const char* url);
+    void doSeek(int64_t pos);
+    bool isAtEnd() const;
     bool connect(bool isReconnect=false);
+    bool startNewFormat();
+    int bytesToFormatChange();
+    void applyFormatChange();
     void disconnect();
     void destroyClient();
     bool nextTrack();
@@ -98,10 +128,14 @@ public:
     HttpNode(size_t bufSize);
     virtual ~HttpNode();
     virtual Type type() const { return kTypeHttpIn; }
-    virtual StreamError pullData(DataPullReq &dp, int timeout);
+    virtual StreamError doPullData(DataPullReq &dp, int timeout);
     virtual void confirmRead(int size);
+    // Reconnects with a Range request for the position. Fails for live streams
+    virtual bool seekToByte(int64_t pos);
+    virtual int64_t streamLength() const;
     void setUrl(const char* url);
     bool isConnected() const;
     const char* trackName() const;
+    RingBuf::WakeupStats bufWakeupStats() { return mRingBuf.wakeupStats(); }
     void startRecording(const char* stationName);
 };
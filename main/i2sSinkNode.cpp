@@ -24,6 +24,33 @@ void I2sOutputNode::adjustSamplesForInternalDac(char* sBuff, int len)
     }
 }
 
+// If the samples are to be modified in place, pulls a pooled block if the upstream
+// node supports it. Otherwise the upstream node's buffer is used (i.e. the input
+// that DecoderNode passes through), and must be released with confirmRead()
+AudioNode::StreamError I2sOutputNode::pullInput(DataPullReq& dpr, PcmBlockRef& block, bool inPlace)
+{
+    if (!inPlace || !mPrev->hasBlockOutput()) {
+        return mPrev->pullData(dpr, -1);
+    }
+    auto err = mPrev->pullBlock(block, -1);
+    if (err) {
+        return err;
+    }
+    block.makeUnique(-1); // we modify the samples in place
+    dpr.buf = block->data;
+    dpr.size = block->size;
+    dpr.fmt = block->fmt;
+    dpr.ts = block->ts;
+    return kNoError;
+}
+
+// The task reports kStateStopped when it exits, which is after the pending pull
+// returns, so that upstream nodes aren't destroyed while it's in progress
+void I2sOutputNode::doStop()
+{
+    mCmdQueue.post(kCommandWake); // in case the task is blocked waiting for a command
+}
+
 void I2sOutputNode::nodeThreadFunc()
 {
     for (;;) {
@@ -32,9 +59,17 @@ void I2sOutputNode::nodeThreadFunc()
             return;
         }
         myassert(mState == kStateRunning);
+        bool playing = false; // whether the DMA buffers are filled with stream data
         while (!mTerminate && (mCmdQueue.numMessages() == 0)) {
             DataPullReq dpr(10240); // read all available data
-            auto err = mPrev->pullData(dpr, -1);
+            PcmBlockRef block;
+            LatencyTimer timer;
+            bool inPlace = mUseInternalDac || mVolume != kVolumeDiv;
+            auto err = pullInput(dpr, block, inPlace);
+            if (playing && timer.usElapsed() > mReadTimeout * 1000) {
+                mUnderruns++;
+            }
+            playing = !err;
             if (err == kTimeout || err == kStreamFlush) {
                 ESP_LOGW(mTag, "Read timeout, sending silence");
                 i2s_zero_dma_buffer(mPort);
@@ -48,14 +83,17 @@ void I2sOutputNode::nodeThreadFunc()
                 setFormat(dpr.fmt);
             }
 
-            processVolume(dpr);
-
+            if (inPlace) {
+                processVolume(dpr);
+            }
             if (mUseInternalDac) {
                 adjustSamplesForInternalDac(dpr.buf, dpr.size);
             }
             size_t written;
             auto espErr = i2s_write(mPort, dpr.buf, dpr.size, &written, portMAX_DELAY);
-            mPrev->confirmRead(dpr.size);
+            if (!block) {
+                mPrev->confirmRead(dpr.size);
+            }
             if (espErr != ESP_OK) {
                 ESP_LOGE(mTag, "i2s_write error: %s", esp_err_to_name(espErr));
                 continue;
@@ -63,6 +101,9 @@ void I2sOutputNode::nodeThreadFunc()
             if (written != dpr.size) {
                 ESP_LOGE(mTag, "is2_write() wrote less than requested with infinite timeout");
             }
+            if (dpr.ts) {
+                mEndToEndLatency.add((esp_timer_get_time() - dpr.ts) / 1000);
+            }
         }
     }
 }
@@ -110,7 +151,8 @@ void I2sOutputNode::recalcReadTimeout(int samplerate)
 }
 
 I2sOutputNode::I2sOutputNode(int port, i2s_pin_config_t* pinCfg)
-:AudioNodeWithTask("node-i2s-out", kStackSize, 16), mFormat(kDefaultSamplerate, 16, 2)
+:AudioNodeWithTask("node-i2s-out", kStackSize, 16), mFormat(kDefaultSamplerate, 16, 2),
+  mEndToEndLatency(Histogram::kMsEndToEnd)
 {
     if (port == 0xff) {
         mUseInternalDac = true;
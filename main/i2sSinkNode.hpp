@@ -5,6 +5,7 @@
 #include "audioNode.hpp"
 #include <driver/i2s.h>
 #include "volume.hpp"
+#include "pcmBlockPool.hpp"
 
 class I2sOutputNode: public AudioNodeWithTask, public DefaultVolumeImpl
 {
@@ -13,21 +14,30 @@ protected:
     bool mUseInternalDac;
     StreamFormat mFormat;
     int mReadTimeout;
+    // Time from network arrival of the data to its queueing to the i2s DMA, in ms
+    Histogram mEndToEndLatency;
+    // Number of times getting the next data took longer than the DMA buffers last
+    uint32_t mUnderruns = 0;
     enum { kDmaBufLen = 600, kDmaBufCnt = 3,
            kStackSize = 9000, kDefaultSamplerate = 44100
     };
+    enum: uint8_t { kCommandWake = AudioNodeWithTask::kCommandLast + 1 };
     virtual void nodeThreadFunc();
+    virtual void doStop();
     void adjustSamplesForInternalDac(char* sBuff, int len);
     void dmaFillWithSilence();
     bool setFormat(StreamFormat fmt);
     void recalcReadTimeout(int samplerate);
+    StreamError pullInput(DataPullReq& dpr, PcmBlockRef& block, bool inPlace);
 public:
     I2sOutputNode(int port, i2s_pin_config_t* pinCfg);
     ~I2sOutputNode();
     virtual Type type() const { return kTypeI2sOut; }
     virtual IAudioVolume* volumeInterface() override { return this; }
-    virtual StreamError pullData(DataPullReq& dpr, int timeout) { return kTimeout; }
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout) { return kTimeout; }
     virtual void confirmRead(int amount) {}
+    Histogram& endToEndLatency() { return mEndToEndLatency; }
+    uint32_t underruns() const { return mUnderruns; }
 };
 
 #endif
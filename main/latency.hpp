@@ -0,0 +1,87 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+#include <stdint.h>
+#include <esp_timer.h>
+#include "buffer.hpp"
+
+/* Timer for measuring intervals. Uses esp_timer, which unlike the CPU cycle
+ * counter is the same on both cores and doesn't wrap around
+ */
+class LatencyTimer
+{
+protected:
+    int64_t mStart;
+public:
+    LatencyTimer(): mStart(esp_timer_get_time()) {}
+    void reset() { mStart = esp_timer_get_time(); }
+    uint32_t usElapsed() const
+    {
+        int64_t elapsed = esp_timer_get_time() - mStart;
+        return elapsed < UINT32_MAX ? elapsed : UINT32_MAX;
+    }
+};
+
+/* Histogram with fixed bucket bounds. Updated by a single task, may be read by
+ * others - a reader may see a sample counted in the total but not yet in its bucket
+ */
+class Histogram
+{
+public:
+    enum { kBucketCount = 12 };
+    // upper bounds (exclusive) of the buckets, the last bucket has no upper bound
+    typedef uint32_t Bounds[kBucketCount - 1];
+    static const Bounds kUsPullLatency;
+    static const Bounds kMsEndToEnd;
+protected:
+    const Bounds& mBounds;
+    volatile uint32_t mBuckets[kBucketCount];
+    volatile uint32_t mCount;
+    volatile uint32_t mMax;
+    volatile uint64_t mSum;
+public:
+    Histogram(const Bounds& bounds): mBounds(bounds) { reset(); }
+    void reset()
+    {
+        for (auto& bucket: mBuckets) {
+            bucket = 0;
+        }
+        mCount = mMax = 0;
+        mSum = 0;
+    }
+    void add(uint32_t val)
+    {
+        int idx = 0;
+        while (idx < kBucketCount - 1 && val >= mBounds[idx]) {
+            idx++;
+        }
+        mBuckets[idx]++;
+        mCount++;
+        mSum += val;
+        if (val > mMax) {
+            mMax = val;
+        }
+    }
+    uint32_t count() const { return mCount; }
+    uint32_t max() const { return mMax; }
+    uint32_t avg() const { return mCount ? mSum / mCount : 0; }
+    // Appends the histogram as a json object: {"n":..,"avg":..,"max":..,"hist":[..]}
+    void toJson(DynBuffer& buf) const
+    {
+        buf.printf("{\"n\":%u,\"avg\":%u,\"max\":%u,\"hist\":[", count(), avg(), max());
+        for (int i = 0; i < kBucketCount; i++) {
+            buf.printf(i ? ",%u" : "%u", mBuckets[i]);
+        }
+        buf.printf("]}");
+    }
+    // Appends the bucket bounds as a json array
+    static void boundsToJson(DynBuffer& buf, const Bounds& bounds)
+    {
+        buf.printf("[");
+        for (int i = 0; i < kBucketCount - 1; i++) {
+            buf.printf(i ? ",%u" : "%u", bounds[i]);
+        }
+        buf.printf("]");
+    }
+};
+
+#endif
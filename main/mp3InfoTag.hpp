@@ -0,0 +1,154 @@
+#ifndef MP3_INFO_TAG_HPP
+#define MP3_INFO_TAG_HPP
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+/* Xing/Info tag, in place of the audio data of the first frame of VBR (Xing)
+ * and CBR (Info) MP3 files, with the LAME extension that encoders write after
+ * it. The frame itself decodes to silence, so it must not be output. The LAME
+ * extension has the encoder delay and padding, which are trimmed for gapless
+ * playback. The VBRI tag of the Fraunhofer encoder is also parsed, with its
+ * seek table converted to the Xing one
+ */
+struct Mp3InfoTag
+{
+    enum: uint8_t {
+        kHasFrames = 1,
+        kHasBytes = 2,
+        kHasToc = 4,
+        kIsCbr = 0x40, // an Info tag, which LAME writes for CBR files
+        kHasGapless = 0x80 // encoder delay and padding from the LAME extension
+    };
+    enum {
+        kDecoderDelay = 529 // of the synthesis filterbank, samples
+    };
+    uint8_t flags;
+    uint32_t frames; // audio frames, excluding the one with the tag
+    uint32_t bytes; // of the whole file, including the tag frame
+    uint8_t toc[100]; // seek table, toc[i] * bytes / 256 is the offset of i% of the duration,
+                      // from the start of the tag frame
+    uint16_t encoderDelay; // samples
+    uint16_t padding; // samples
+    // Parses the tag in a whole frame of `size` bytes. Returns false if the frame
+    // has no tag
+    bool parse(const uint8_t* frame, int size)
+    {
+        if (size < 4) {
+            return false;
+        }
+        if (parseVbri(frame, size)) {
+            return true;
+        }
+        bool mpeg1 = ((frame[1] >> 3) & 3) == 3;
+        bool mono = (frame[3] >> 6) == 3;
+        // after the side info
+        int pos = 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17)) + ((frame[1] & 1) ? 0 : 2);
+        if (pos + 8 > size || (memcmp(frame + pos, "Xing", 4) != 0 && memcmp(frame + pos, "Info", 4) != 0)) {
+            return false;
+        }
+        uint32_t xingFlags = readBe32(frame + pos + 4);
+        flags = (frame[pos] == 'I') ? kIsCbr : 0;
+        pos += 8;
+        frames = bytes = 0;
+        encoderDelay = padding = 0;
+        if (xingFlags & kHasFrames) {
+            if (pos + 4 > size) {
+                return false;
+            }
+            frames = readBe32(frame + pos);
+            flags |= kHasFrames;
+            pos += 4;
+        }
+        if (xingFlags & kHasBytes) {
+            if (pos + 4 > size) {
+                return false;
+            }
+            bytes = readBe32(frame + pos);
+            flags |= kHasBytes;
+            pos += 4;
+        }
+        if (xingFlags & kHasToc) {
+            if (pos + 100 > size) {
+                return false;
+            }
+            memcpy(toc, frame + pos, 100);
+            flags |= kHasToc;
+            pos += 100;
+        }
+        if (xingFlags & 8) { // VBR quality
+            pos += 4;
+        }
+        // LAME extension, also written by FFmpeg (with a "Lavc"/"Lavf" encoder string)
+        if (pos + 24 <= size && (memcmp(frame + pos, "LAME", 4) == 0 || memcmp(frame + pos, "Lav", 3) == 0)) {
+            auto p = frame + pos + 21;
+            encoderDelay = (p[0] << 4) | (p[1] >> 4);
+            padding = ((p[1] & 0x0f) << 8) | p[2];
+            flags |= kHasGapless;
+        }
+        return true;
+    }
+    // Byte offset from the start of the tag frame of a time, given as a fraction
+    // of the duration scaled by 65536, interpolated in the seek table
+    uint32_t tocOffset(uint32_t time16) const
+    {
+        int idx = time16 * 100 >> 16;
+        uint32_t frac = (time16 * 100) & 0xffff; // between the two entries
+        int a = toc[idx];
+        int b = (idx < 99) ? toc[idx + 1] : 256;
+        return ((uint64_t)a * 65536 + (uint64_t)(b - a) * frac) * bytes >> 24;
+    }
+protected:
+    // VBRI tag, always right after the 32 bytes of side info. Its table has the
+    // byte size of each part of framesPerEntry frames
+    bool parseVbri(const uint8_t* frame, int size)
+    {
+        enum { kVbriPos = 36, kTocPos = kVbriPos + 26 };
+        if (kTocPos > size || memcmp(frame + kVbriPos, "VBRI", 4) != 0) {
+            return false;
+        }
+        auto p = frame + kVbriPos;
+        bytes = readBe32(p + 10);
+        frames = readBe32(p + 14);
+        int entries = (p[18] << 8) | p[19];
+        int scale = (p[20] << 8) | p[21];
+        int entrySize = (p[22] << 8) | p[23];
+        int framesPerEntry = (p[24] << 8) | p[25];
+        if (!bytes || !frames || !framesPerEntry || entrySize < 1 || entrySize > 4
+            || kTocPos + entries * entrySize > size) {
+            return false;
+        }
+        flags = kHasFrames | kHasBytes | kHasToc;
+        encoderDelay = padding = 0;
+        uint64_t sum = 0; // byte offset of entry k
+        int k = 0;
+        for (int i = 0; i < 100; i++) {
+            uint32_t target = (uint64_t)i * frames / 100; // frame at i% of the duration
+            while (k < entries && (uint32_t)(k + 1) * framesPerEntry <= target) {
+                sum += vbriEntry(frame + kTocPos, k++, entrySize) * scale;
+            }
+            uint64_t pos = sum;
+            if (k < entries) {
+                pos += (uint64_t)vbriEntry(frame + kTocPos, k, entrySize) * scale
+                    * (target - k * framesPerEntry) / framesPerEntry;
+            }
+            toc[i] = std::min<uint64_t>(255, pos * 256 / bytes);
+        }
+        return true;
+    }
+    static uint32_t vbriEntry(const uint8_t* table, int k, int entrySize)
+    {
+        uint32_t val = 0;
+        for (int i = 0; i < entrySize; i++) {
+            val = (val << 8) | table[k * entrySize + i];
+        }
+        return val;
+    }
+public:
+    static uint32_t readBe32(const uint8_t* p)
+    {
+        return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+};
+
+#endif
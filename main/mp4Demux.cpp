@@ -0,0 +1,587 @@
+#include "mp4Demux.hpp"
+
+static constexpr uint32_t fourcc(const char* s)
+{
+    return ((uint32_t)s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+}
+
+// Allocates a sample table, within the limit of the total size of the tables
+template <class T>
+T* Mp4Demux::allocTable(uint32_t count)
+{
+    uint64_t size = (uint64_t)count * sizeof(T);
+    if (mTablesSize + size > kMaxTablesSize) {
+        ESP_LOGE(mTag, "Sample tables of more than %d KB are not supported, the %c%c%c%c box has %u entries",
+            kMaxTablesSize / 1024, (char)(mBoxType >> 24), (char)(mBoxType >> 16), (char)(mBoxType >> 8),
+            (char)mBoxType, (unsigned)count);
+        return nullptr;
+    }
+    auto table = (T*)malloc(size);
+    if (!table) {
+        ESP_LOGE(mTag, "Out of memory for a sample table of %u entries", (unsigned)count);
+        return nullptr;
+    }
+    mTablesSize += size;
+    return table;
+}
+
+// Reads the tag and length of an MPEG-4 descriptor. Returns the length, or -1
+static int readDescriptor(const uint8_t*& p, const uint8_t* end, int& tag)
+{
+    if (p >= end) {
+        return -1;
+    }
+    tag = *p++;
+    int len = 0;
+    for (int i = 0; i < 4; i++) {
+        if (p >= end) {
+            return -1;
+        }
+        uint8_t b = *p++;
+        len = (len << 7) | (b & 0x7f);
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return (p + len <= end) ? len : -1;
+}
+
+void Mp4Demux::reset()
+{
+    freeTrack();
+    mState = kStateBoxHeader;
+    mDepth = 0;
+    mHdrLen = 0;
+    mTrakType = kTrakUnknown;
+    mHaveTrack = false;
+    mSampleBuf.reset();
+    mSampleLen = 0;
+    mPos = 0;
+}
+
+void Mp4Demux::freeTrack()
+{
+    mTimescale = 0;
+    mAscLen = 0;
+    mSampleSizes.free();
+    mSampleCount = 0;
+    mConstSampleSize = 0;
+    mMaxSampleSize = 0;
+    mChunkOffsets.free();
+    mChunkCount = 0;
+    mStsc.free();
+    mStscCount = 0;
+    mStts.free();
+    mSttsCount = 0;
+    mTablesSize = 0;
+}
+
+Mp4Demux::Result Mp4Demux::parse(const uint8_t* data, int& size, Packet& packet)
+{
+    int pos = 0;
+    Result ret = kNeedMoreData;
+    for (;;) {
+        if (mState == kStateBoxHeader) {
+            while (mDepth && mPos >= mBoxes[mDepth - 1].end && ret == kNeedMoreData) {
+                ret = endBox();
+            }
+            if (ret != kNeedMoreData) {
+                break;
+            }
+        }
+        if (mState == kStateConfig) {
+            packet.data = mAsc;
+            packet.size = mAscLen;
+            packet.pts = 0;
+            packet.flags = AudioNode::PacketPullReq::kFlagConfig;
+            startSamples();
+            ret = kPacket;
+            break;
+        }
+        if (mState == kStateSamples) {
+            ret = parseSamples(data, size, pos, packet);
+            break;
+        }
+        if (pos >= size) {
+            break;
+        }
+        switch (mState) {
+        case kStateBoxHeader:
+            // 64-bit size follows if the 32-bit one is 1
+            if (gather(data, size, pos, 8) && (be32(mHdr) != 1 || gather(data, size, pos, 16))) {
+                ret = onBoxHeader();
+            }
+            break;
+        case kStateLeaf:
+            if (gather(data, size, pos, mWant)) {
+                ret = parseLeaf();
+            }
+            break;
+        case kStateTableHeader:
+            if (gather(data, size, pos, mWant)) {
+                ret = startTable();
+            }
+            break;
+        case kStateTable:
+            if (gather(data, size, pos, mEntrySize)) {
+                mHdrLen = 0;
+                if (!addTableEntry()) {
+                    ret = kError;
+                } else if (++mTableIdx >= mTableLen) {
+                    ret = skipTo(mBoxEnd);
+                }
+            }
+            break;
+        case kStateSkip: {
+            int len = (int)std::min<int64_t>(size - pos, mSkipEnd - mPos);
+            pos += len;
+            mPos += len;
+            if (mPos >= mSkipEnd) {
+                mState = kStateBoxHeader;
+            }
+            break;
+        }
+        default: // kStateDone
+            mPos += size - pos;
+            pos = size;
+            break;
+        }
+        if (ret != kNeedMoreData) {
+            break;
+        }
+    }
+    size = pos;
+    return ret;
+}
+
+// Gathers data in mHdr, until it has `want` bytes. Returns whether it has
+bool Mp4Demux::gather(const uint8_t* data, int size, int& pos, int want)
+{
+    int len = std::min(want - mHdrLen, size - pos);
+    if (len > 0) {
+        memcpy(mHdr + mHdrLen, data + pos, len);
+        mHdrLen += len;
+        pos += len;
+        mPos += len;
+    }
+    return mHdrLen >= want;
+}
+
+Mp4Demux::Result Mp4Demux::onBoxHeader()
+{
+    int hdrLen = mHdrLen;
+    mHdrLen = 0;
+    uint64_t boxSize = be32(mHdr);
+    uint32_t type = be32(mHdr + 4);
+    if (boxSize == 1) {
+        boxSize = be64(mHdr + 8);
+    }
+    int64_t end;
+    if (boxSize == 0) {
+        end = INT64_MAX; // extends to the end of the file
+    } else if (boxSize < (uint64_t)hdrLen || boxSize > (uint64_t)INT64_MAX / 2) {
+        ESP_LOGW(mTag, "Invalid size of box '%.4s'", mHdr + 4);
+        return kError;
+    } else {
+        end = mPos - hdrLen + boxSize;
+    }
+    switch (type) {
+    case fourcc("trak"):
+        if (mHaveTrack) { // only the first audio track is played
+            return skipTo(end);
+        }
+        freeTrack(); // of a previous incomplete audio track
+        mTrakType = kTrakUnknown;
+        // fall through
+    case fourcc("moov"):
+    case fourcc("mdia"):
+    case fourcc("minf"):
+    case fourcc("stbl"):
+        if (mDepth >= kMaxDepth) {
+            return skipTo(end);
+        }
+        mBoxes[mDepth].type = type;
+        mBoxes[mDepth].end = end;
+        mDepth++;
+        return kNeedMoreData;
+    case fourcc("mdhd"):
+    case fourcc("hdlr"):
+    case fourcc("stsd"):
+        mBoxType = type;
+        mBoxEnd = end;
+        mWant = (int)std::min<int64_t>(end - mPos, kMaxLeafSize);
+        mState = kStateLeaf;
+        return kNeedMoreData;
+    case fourcc("stsz"):
+    case fourcc("stco"):
+    case fourcc("co64"):
+    case fourcc("stsc"):
+    case fourcc("stts"):
+        if (mTrakType != kTrakAudio) {
+            return skipTo(end);
+        }
+        mBoxType = type;
+        mBoxEnd = end;
+        mWant = (type == fourcc("stsz")) ? 12 : 8; // with the constant sample size
+        if (end - mPos < mWant) {
+            return kError;
+        }
+        mState = kStateTableHeader;
+        return kNeedMoreData;
+    case fourcc("mdat"):
+        // after the moov box, samples are read by their offsets, so this is before it
+        if (end == INT64_MAX) {
+            ESP_LOGW(mTag, "mdat box of unknown size before moov");
+            return kError;
+        }
+        ESP_LOGI(mTag, "mdat box before moov, skipping %lld bytes", (long long)(end - mPos));
+        return skipTo(end);
+    case fourcc("moof"):
+        ESP_LOGW(mTag, "Fragmented MP4 is not supported");
+        return kError;
+    default:
+        return skipTo(end);
+    }
+}
+
+// Called when the end of the innermost open box is reached
+Mp4Demux::Result Mp4Demux::endBox()
+{
+    uint32_t type = mBoxes[--mDepth].type;
+    if (type == fourcc("trak") && mTrakType == kTrakAudio) {
+        if (mTimescale && mAscLen && mSampleCount && mChunkCount && mStscCount) {
+            mHaveTrack = true;
+        } else {
+            ESP_LOGW(mTag, "Incomplete audio track, ignoring it");
+            freeTrack();
+        }
+    } else if (type == fourcc("moov")) {
+        if (!mHaveTrack) {
+            ESP_LOGW(mTag, "No AAC audio track found");
+            return kError;
+        }
+        mState = kStateConfig;
+    }
+    return kNeedMoreData;
+}
+
+Mp4Demux::Result Mp4Demux::skipTo(int64_t end)
+{
+    if (end == INT64_MAX) {
+        mState = kStateDone;
+        return kNeedMoreData;
+    }
+    mState = kStateBoxHeader;
+    if (end - mPos > kSkipSeekThreshold) {
+        return seekTo(end);
+    }
+    if (end > mPos) {
+        mSkipEnd = end;
+        mState = kStateSkip;
+    }
+    return kNeedMoreData;
+}
+
+// Skips the rest of the current track, which is not audio, or not AAC
+Mp4Demux::Result Mp4Demux::skipTrak()
+{
+    freeTrack();
+    mTrakType = kTrakSkipped;
+    for (int i = mDepth - 1; i >= 0; i--) {
+        if (mBoxes[i].type == fourcc("trak")) {
+            mDepth = i;
+            return skipTo(mBoxes[i].end);
+        }
+    }
+    return kError;
+}
+
+Mp4Demux::Result Mp4Demux::parseLeaf()
+{
+    int len = mHdrLen;
+    mHdrLen = 0;
+    switch (mBoxType) {
+    case fourcc("mdhd"): {
+        int offs = (mHdr[0] == 1) ? 20 : 12; // after the creation and modification times
+        if (len < offs + 4) {
+            return kError;
+        }
+        mTimescale = be32(mHdr + offs);
+        break;
+    }
+    case fourcc("hdlr"):
+        if (len < 12 || be32(mHdr + 8) != fourcc("soun")) {
+            return skipTrak();
+        }
+        mTrakType = kTrakAudio;
+        break;
+    case fourcc("stsd"):
+        if (mTrakType == kTrakAudio && !parseStsd(mHdr, len)) {
+            return skipTrak();
+        }
+        break;
+    default:
+        break;
+    }
+    return skipTo(mBoxEnd);
+}
+
+// Gets the AudioSpecificConfig from the esds box of the first sample entry
+bool Mp4Demux::parseStsd(const uint8_t* p, int len)
+{
+    // full box header and entry count, then the sample entry
+    if (len < 8 + 36) {
+        return false;
+    }
+    p += 8;
+    len = std::min<uint32_t>(len - 8, be32(p));
+    if (be32(p + 4) != fourcc("mp4a")) {
+        ESP_LOGW(mTag, "Unsupported audio codec '%.4s'", p + 4);
+        return false;
+    }
+    // box header, SampleEntry and AudioSampleEntry fields, more of them in
+    // QuickTime sound descriptions version 1 and 2
+    int version = (p[16] << 8) | p[17];
+    int offs = 36 + ((version == 1) ? 16 : (version == 2) ? 36 : 0);
+    while (offs + 12 <= len && be32(p + offs + 4) != fourcc("esds")) {
+        uint32_t boxSize = be32(p + offs);
+        if (boxSize < 8) {
+            break;
+        }
+        offs += boxSize;
+    }
+    if (offs + 12 > len) {
+        ESP_LOGW(mTag, "No esds box in the mp4a sample entry");
+        return false;
+    }
+    // ES descriptor, after the full box header
+    auto end = p + std::min<uint32_t>(len, offs + be32(p + offs));
+    p += offs + 12;
+    int tag = 0;
+    int dlen = readDescriptor(p, end, tag);
+    if (tag == 3 && dlen >= 3) {
+        uint8_t flags = p[2];
+        p += 3;
+        if (flags & 0x80) { // dependsOn_ES_ID
+            p += 2;
+        }
+        if ((flags & 0x40) && p < end) { // URL
+            p += 1 + *p;
+        }
+        if (flags & 0x20) { // OCR_ES_ID
+            p += 2;
+        }
+        dlen = readDescriptor(p, end, tag);
+    }
+    if (tag != 4 || dlen < 13) {
+        ESP_LOGW(mTag, "No DecoderConfigDescriptor in esds");
+        return false;
+    }
+    // MPEG-4 audio, or the MPEG-2 AAC profiles
+    if (p[0] != 0x40 && (p[0] < 0x66 || p[0] > 0x68)) {
+        ESP_LOGW(mTag, "Unsupported object type 0x%02x in mp4a", p[0]);
+        return false;
+    }
+    p += 13;
+    dlen = readDescriptor(p, end, tag);
+    if (tag != 5 || dlen <= 0 || dlen > kMaxAscSize) {
+        ESP_LOGW(mTag, "No valid DecoderSpecificInfo in esds");
+        return false;
+    }
+    memcpy(mAsc, p, dlen);
+    mAscLen = dlen;
+    return true;
+}
+
+Mp4Demux::Result Mp4Demux::startTable()
+{
+    mHdrLen = 0;
+    uint32_t count = be32(mHdr + mWant - 4);
+    mTableIdx = 0;
+    mTableLen = count;
+    bool allocated = true;
+    switch (mBoxType) {
+    case fourcc("stsz"):
+        mSampleCount = count;
+        mConstSampleSize = be32(mHdr + 4);
+        if (mConstSampleSize) { // no table
+            mMaxSampleSize = mConstSampleSize;
+            mTableLen = 0;
+        } else {
+            mEntrySize = 4;
+            mSampleSizes.freeAndReset(allocTable<uint16_t>(count));
+            allocated = mSampleSizes;
+        }
+        break;
+    case fourcc("stco"):
+    case fourcc("co64"):
+        mEntrySize = (mBoxType == fourcc("co64")) ? 8 : 4;
+        mChunkCount = count;
+        mChunkOffsets.freeAndReset(allocTable<uint32_t>(count));
+        allocated = mChunkOffsets;
+        break;
+    case fourcc("stsc"):
+        mEntrySize = 12;
+        mStscCount = count;
+        mStsc.freeAndReset(allocTable<StscEntry>(count));
+        allocated = mStsc;
+        break;
+    default: // stts
+        mEntrySize = 8;
+        mSttsCount = count;
+        mStts.freeAndReset(allocTable<SttsEntry>(count));
+        allocated = mStts;
+        break;
+    }
+    if (mTableLen && !allocated) {
+        return kError;
+    }
+    if (!mTableLen) {
+        return skipTo(mBoxEnd);
+    }
+    if (mBoxEnd - mPos < (int64_t)mTableLen * mEntrySize) {
+        ESP_LOGW(mTag, "Sample table box is truncated");
+        return kError;
+    }
+    mState = kStateTable;
+    return kNeedMoreData;
+}
+
+bool Mp4Demux::addTableEntry()
+{
+    auto idx = mTableIdx;
+    switch (mBoxType) {
+    case fourcc("stsz"): {
+        uint32_t size = be32(mHdr);
+        if (size > 0xffff) {
+            ESP_LOGW(mTag, "Sample of %u bytes is too large", (unsigned)size);
+            return false;
+        }
+        mSampleSizes.ptr()[idx] = size;
+        mMaxSampleSize = std::max(mMaxSampleSize, (int)size);
+        return true;
+    }
+    case fourcc("stco"):
+        mChunkOffsets.ptr()[idx] = be32(mHdr);
+        return true;
+    case fourcc("co64"): {
+        uint64_t offset = be64(mHdr);
+        if (offset >> 32) {
+            ESP_LOGW(mTag, "Chunk offsets beyond 4 GB are not supported");
+            return false;
+        }
+        mChunkOffsets.ptr()[idx] = offset;
+        return true;
+    }
+    case fourcc("stsc"):
+        mStsc.ptr()[idx].firstChunk = be32(mHdr);
+        mStsc.ptr()[idx].samplesPerChunk = be32(mHdr + 4);
+        return true;
+    default: // stts
+        mStts.ptr()[idx].count = be32(mHdr);
+        mStts.ptr()[idx].delta = be32(mHdr + 4);
+        return true;
+    }
+}
+
+void Mp4Demux::startSamples()
+{
+    ESP_LOGI(mTag, "Audio track of %u samples in %u chunks, timescale %u",
+        (unsigned)mSampleCount, (unsigned)mChunkCount, (unsigned)mTimescale);
+    mSampleIdx = mChunkIdx = mChunkSampleIdx = 0;
+    mStscIdx = mSttsIdx = 0;
+    mSamplesInChunk = mStsc.ptr()[0].samplesPerChunk;
+    mSttsLeft = mSttsCount ? mStts.ptr()[0].count : 0;
+    mSamplePos = mChunkOffsets.ptr()[0];
+    mDts = 0;
+    mSampleBuf.reset(new uint8_t[std::max(mMaxSampleSize, 1)]);
+    mSampleLen = 0;
+    mState = kStateSamples;
+}
+
+// Advances to the next sample in the sample table
+void Mp4Demux::nextSample()
+{
+    mSamplePos += sampleSize(mSampleIdx);
+    mSampleIdx++;
+    if (mSttsCount) {
+        mDts += mStts.ptr()[mSttsIdx].delta;
+        if (mSttsLeft) {
+            mSttsLeft--;
+        }
+        if (!mSttsLeft && mSttsIdx + 1 < mSttsCount) {
+            mSttsLeft = mStts.ptr()[++mSttsIdx].count;
+        }
+    }
+    if (++mChunkSampleIdx < mSamplesInChunk) {
+        return;
+    }
+    mChunkSampleIdx = 0;
+    if (++mChunkIdx >= mChunkCount) {
+        mSampleCount = mSampleIdx; // the sample table refers to more chunks than there are
+        return;
+    }
+    // stsc chunk numbers are 1-based
+    if (mStscIdx + 1 < mStscCount && mChunkIdx + 1 >= mStsc.ptr()[mStscIdx + 1].firstChunk) {
+        mStscIdx++;
+    }
+    mSamplesInChunk = mStsc.ptr()[mStscIdx].samplesPerChunk;
+    mSamplePos = mChunkOffsets.ptr()[mChunkIdx];
+}
+
+// Returns samples in place, or copied to mSampleBuf if they span input chunks.
+// Data between chunks is skipped
+Mp4Demux::Result Mp4Demux::parseSamples(const uint8_t* data, int size, int& pos, Packet& packet)
+{
+    while (mSampleIdx < mSampleCount) {
+        int sampleLen = sampleSize(mSampleIdx);
+        if (!sampleLen) {
+            nextSample();
+            continue;
+        }
+        const uint8_t* sample;
+        if (mSampleLen) { // completing a sample that spans input chunks
+            int len = std::min(sampleLen - mSampleLen, size - pos);
+            memcpy(mSampleBuf.get() + mSampleLen, data + pos, len);
+            mSampleLen += len;
+            pos += len;
+            mPos += len;
+            if (mSampleLen < sampleLen) {
+                return kNeedMoreData;
+            }
+            mSampleLen = 0;
+            sample = mSampleBuf.get();
+        } else {
+            if (mPos > mSamplePos || mSamplePos - mPos > kSkipSeekThreshold) {
+                return seekTo(mSamplePos);
+            }
+            int skip = (int)std::min<int64_t>(mSamplePos - mPos, size - pos);
+            pos += skip;
+            mPos += skip;
+            if (mPos < mSamplePos || pos >= size) {
+                return kNeedMoreData;
+            }
+            if (size - pos < sampleLen) {
+                mSampleLen = size - pos;
+                memcpy(mSampleBuf.get(), data + pos, mSampleLen);
+                mPos += mSampleLen;
+                pos = size;
+                return kNeedMoreData;
+            }
+            sample = data + pos;
+            pos += sampleLen;
+            mPos += sampleLen;
+        }
+        packet.data = sample;
+        packet.size = sampleLen;
+        packet.pts = mSttsCount ? mDts * 1000000 / mTimescale : -1;
+        packet.flags = 0;
+        nextSample();
+        return kPacket;
+    }
+    ESP_LOGI(mTag, "End of the audio track");
+    mState = kStateDone;
+    mPos += size - pos;
+    pos = size;
+    return kNeedMoreData;
+}
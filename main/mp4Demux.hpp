@@ -0,0 +1,122 @@
+#ifndef MP4_DEMUX_HPP
+#define MP4_DEMUX_HPP
+#include "demuxer.hpp"
+#include "buffer.hpp"
+
+/* Streaming demuxer of MP4/M4A files with an AAC audio track. The boxes are
+ * parsed as they arrive, keeping only what is needed of the first audio track -
+ * the decoder config and the sample table. If the moov box is at the end of the
+ * file, the mdat box before it is skipped with a seek (an HTTP Range request),
+ * and the samples are then read with a seek back to the first chunk. The first
+ * packet is the AudioSpecificConfig, flagged kFlagConfig, then each sample is a
+ * raw AAC access unit. Fragmented MP4 is not supported, and neither are files
+ * whose sample tables exceed kMaxTablesSize
+ */
+class Mp4Demux: public Demuxer
+{
+protected:
+    enum {
+        kMaxDepth = 6, // moov/trak/mdia/minf/stbl
+        kMaxLeafSize = 256, // max parsed size of a header box (mdhd, hdlr, stsd)
+        kMaxAscSize = 64,
+        // The sample tables are kept whole in RAM. This fits about an hour of
+        // AAC at 44.1 kHz, longer files are rejected
+        kMaxTablesSize = 384 * 1024
+    };
+    enum State: uint8_t {
+        kStateBoxHeader,
+        kStateLeaf, // gathering a header box
+        kStateTableHeader, // gathering the header of a sample table box
+        kStateTable, // gathering table entries
+        kStateSkip, // skipping to mSkipEnd
+        kStateConfig, // the moov box was parsed, output the decoder config
+        kStateSamples,
+        kStateDone // all samples were output, skip the rest of the file
+    };
+    enum TrakType: uint8_t { kTrakUnknown, kTrakAudio, kTrakSkipped };
+    struct Box
+    {
+        uint32_t type;
+        int64_t end;
+    };
+    struct StscEntry
+    {
+        uint32_t firstChunk; // 1-based
+        uint32_t samplesPerChunk;
+    };
+    struct SttsEntry
+    {
+        uint32_t count;
+        uint32_t delta;
+    };
+    State mState = kStateBoxHeader;
+    Box mBoxes[kMaxDepth];
+    int mDepth = 0;
+    uint8_t mHdr[kMaxLeafSize]; // box header, header box or table entry being gathered
+    int mHdrLen = 0;
+    int mWant = 0; // size to gather in mHdr
+    uint32_t mBoxType = 0; // of the box being gathered
+    int64_t mBoxEnd = 0;
+    int64_t mSkipEnd = 0;
+    TrakType mTrakType = kTrakUnknown;
+    bool mHaveTrack = false; // an audio track with a complete sample table was parsed
+    // of the audio track
+    uint32_t mTimescale = 0;
+    uint8_t mAsc[kMaxAscSize]; // AudioSpecificConfig
+    int mAscLen = 0;
+    int mEntrySize = 0;
+    uint32_t mTableIdx = 0;
+    uint32_t mTableLen = 0;
+    // Sample sizes are kept as 16-bit, which AAC frames always fit in. If
+    // mConstSampleSize is set, all samples are of that size
+    BufPtr<uint16_t> mSampleSizes = nullptr;
+    uint32_t mSampleCount = 0;
+    uint32_t mConstSampleSize = 0;
+    int mMaxSampleSize = 0;
+    BufPtr<uint32_t> mChunkOffsets = nullptr; // 64-bit offsets beyond 4 GB are not supported
+    uint32_t mChunkCount = 0;
+    BufPtr<StscEntry> mStsc = nullptr;
+    uint32_t mStscCount = 0;
+    BufPtr<SttsEntry> mStts = nullptr;
+    uint32_t mSttsCount = 0;
+    uint32_t mTablesSize = 0; // allocated for the above
+    // sample iteration
+    uint32_t mSampleIdx = 0;
+    uint32_t mChunkIdx = 0;
+    uint32_t mChunkSampleIdx = 0; // index of the sample in its chunk
+    uint32_t mSamplesInChunk = 0;
+    uint32_t mStscIdx = 0;
+    uint32_t mSttsIdx = 0;
+    uint32_t mSttsLeft = 0;
+    int64_t mSamplePos = 0; // file offset of the current sample
+    int64_t mDts = 0; // in mTimescale units
+    std::unique_ptr<uint8_t[]> mSampleBuf; // for samples that span chunks of input
+    int mSampleLen = 0;
+    bool gather(const uint8_t* data, int size, int& pos, int want);
+    Result onBoxHeader();
+    Result endBox();
+    Result skipTo(int64_t end);
+    Result skipTrak();
+    Result parseLeaf();
+    bool parseStsd(const uint8_t* p, int len);
+    template <class T>
+    T* allocTable(uint32_t count);
+    Result startTable();
+    bool addTableEntry();
+    void freeTrack();
+    void startSamples();
+    void nextSample();
+    uint32_t sampleSize(uint32_t idx) const { return mConstSampleSize ? mConstSampleSize : mSampleSizes.ptr()[idx]; }
+    Result parseSamples(const uint8_t* data, int size, int& pos, Packet& packet);
+    static uint32_t be32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+    static uint64_t be64(const uint8_t* p) { return ((uint64_t)be32(p) << 32) | be32(p + 4); }
+public:
+    Mp4Demux(): Demuxer("mp4demux") {}
+    virtual Result parse(const uint8_t* data, int& size, Packet& packet);
+    virtual CodecType codec() const { return kCodecAac; }
+    virtual void reset();
+    // Whether the data looks like the start of an MP4 file - an ftyp box
+    static bool isMp4(const uint8_t* data, int size) { return size >= 8 && memcmp(data + 4, "ftyp", 4) == 0; }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "oggDemux.hpp"
+#include <string.h>
+#include <algorithm>
+#include <esp_log.h>
+
+void OggDemux::reset()
+{
+    mHeaderLen = 0;
+    mPacketLen = 0;
+    mDropPacket = false;
+    mPacketIdx = 0;
+}
+
+// Ogg CRC-32: polynomial 0x04c11db7, no bit reflection, initial value and final xor 0
+uint32_t OggDemux::crcUpdate(uint32_t crc, const uint8_t* data, int len)
+{
+    struct Table
+    {
+        uint32_t entries[256];
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t r = i << 24;
+                for (int bit = 0; bit < 8; bit++) {
+                    r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+                }
+                entries[i] = r;
+            }
+        }
+    };
+    static const Table table;
+    for (int i = 0; i < len; i++) {
+        crc = (crc << 8) ^ table.entries[(crc >> 24) ^ data[i]];
+    }
+    return crc;
+}
+
+// Called when the page header, including the segment table, has been read
+bool OggDemux::startPage()
+{
+    if (mHeader[4] != 0) {
+        ESP_LOGW(mTag, "Unsupported Ogg version %d, resyncing", mHeader[4]);
+        return false;
+    }
+    auto serial = readLe32(mHeader + 14);
+    auto pageSeq = readLe32(mHeader + 18);
+    if (flags() & kFlagBos) {
+        if (mPacketLen || mDropPacket) {
+            ESP_LOGW(mTag, "New logical stream while in a packet, dropping it");
+        }
+        mPacketIdx = 0;
+        mPacketLen = 0;
+        mDropPacket = false;
+        mSerial = serial;
+    } else if (serial != mSerial) {
+        // e.g. a multiplexed stream - only the first logical stream is supported
+        ESP_LOGD(mTag, "Skipping page of stream %x", serial);
+    } else if (pageSeq != mPageSeq + 1) {
+        ESP_LOGW(mTag, "Lost %d Ogg pages", pageSeq - mPageSeq - 1);
+        if (mPacketLen) {
+            mPacketLen = 0;
+            mDropPacket = true;
+        }
+    }
+    if (serial == mSerial) {
+        mPageSeq = pageSeq;
+        if ((flags() & kFlagContinued) == 0 && (mPacketLen || mDropPacket)) {
+            ESP_LOGW(mTag, "Packet not continued on the next page, dropping it");
+            mPacketLen = 0;
+            mDropPacket = false;
+            mPacketIdx++;
+        } else if ((flags() & kFlagContinued) && !mPacketLen) {
+            mDropPacket = true; // we don't have the start of the packet
+        }
+    }
+    mSegIdx = mSegPos = 0;
+    uint8_t crcField[4];
+    memcpy(crcField, mHeader + 22, 4);
+    memset(mHeader + 22, 0, 4);
+    mCrc = crcUpdate(0, mHeader, mHeaderLen);
+    memcpy(mHeader + 22, crcField, 4);
+    return true;
+}
+
+// Number of bytes from the current position to the end of the current packet,
+// or of the page, if the packet continues on the next page
+int OggDemux::bytesToPacketEnd(bool& endsPacket) const
+{
+    const uint8_t* lacing = mHeader + kPageHeaderSize;
+    int len = -mSegPos;
+    for (int i = mSegIdx; i < segmentCount(); i++) {
+        len += lacing[i];
+        if (lacing[i] < 255) {
+            endsPacket = true;
+            return len;
+        }
+    }
+    endsPacket = false;
+    return len;
+}
+
+void OggDemux::advance(int len)
+{
+    const uint8_t* lacing = mHeader + kPageHeaderSize;
+    mSegPos += len;
+    while (mSegIdx < segmentCount() && mSegPos >= lacing[mSegIdx]) {
+        mSegPos -= lacing[mSegIdx];
+        mSegIdx++;
+        // zero-length segments end a packet, step over them only when consumed
+        if (lacing[mSegIdx - 1] < 255) {
+            break;
+        }
+    }
+}
+
+void OggDemux::appendToPacket(const uint8_t* data, int len)
+{
+    if (mDropPacket) {
+        return;
+    }
+    if (mPacketLen + len > kMaxPacketSize) {
+        ESP_LOGW(mTag, "Packet larger than %d bytes, dropping it", kMaxPacketSize);
+        mDropPacket = true;
+        mPacketLen = 0;
+        return;
+    }
+    if (!mPacketBuf) {
+        mPacketBuf.reset(new uint8_t[kMaxPacketSize]);
+    }
+    memcpy(mPacketBuf.get() + mPacketLen, data, len);
+    mPacketLen += len;
+}
+
+OggDemux::Result OggDemux::parse(const uint8_t* data, int& size, Packet& packet)
+{
+    int pos = 0;
+    while (pos < size) {
+        // page header
+        if (mHeaderLen < 4) {
+            uint8_t byte = data[pos++];
+            if (byte == (uint8_t)"OggS"[mHeaderLen]) {
+                mHeader[mHeaderLen++] = byte;
+            } else {
+                mHeaderLen = (byte == 'O') ? 1 : 0;
+                mHeader[0] = byte;
+            }
+            continue;
+        }
+        int headerSize = kPageHeaderSize + (mHeaderLen >= kPageHeaderSize ? segmentCount() : 0);
+        if (mHeaderLen < headerSize) {
+            int len = std::min(headerSize - mHeaderLen, size - pos);
+            memcpy(mHeader + mHeaderLen, data + pos, len);
+            mHeaderLen += len;
+            pos += len;
+            if (mHeaderLen == kPageHeaderSize + segmentCount() && !startPage()) {
+                mHeaderLen = 0;
+            }
+            continue;
+        }
+        // page body
+        if (mSegIdx >= segmentCount()) { // end of page
+            if (mCrc != readLe32(mHeader + 22)) {
+                mCrcErrors++;
+                ESP_LOGW(mTag, "Ogg page CRC mismatch");
+            }
+            mHeaderLen = 0;
+            continue;
+        }
+        bool endsPacket;
+        int len = bytesToPacketEnd(endsPacket);
+        int avail = std::min(len, size - pos);
+        bool ours = readLe32(mHeader + 14) == mSerial;
+        const uint8_t* start = data + pos;
+        mCrc = crcUpdate(mCrc, start, avail);
+        advance(avail);
+        pos += avail;
+        if (!ours) {
+            continue;
+        }
+        if (avail < len) { // packet continues in the next chunk
+            appendToPacket(start, avail);
+            break;
+        }
+        if (!endsPacket) { // packet continues on the next page
+            appendToPacket(start, avail);
+            continue;
+        }
+        if (mDropPacket) {
+            mDropPacket = false;
+            mPacketIdx++;
+            continue;
+        }
+        if (mPacketLen) {
+            appendToPacket(start, avail);
+            if (mDropPacket) { // became too large
+                mDropPacket = false;
+                mPacketIdx++;
+                continue;
+            }
+            packet.data = mPacketBuf.get();
+            packet.size = mPacketLen;
+            mPacketLen = 0;
+        } else { // the whole packet is in the input
+            packet.data = start;
+            packet.size = avail;
+        }
+        packet.index = mPacketIdx++;
+        bool lastOnPage = true;
+        const uint8_t* lacing = mHeader + kPageHeaderSize;
+        for (int i = mSegIdx; i < segmentCount(); i++) {
+            if (lacing[i] < 255) {
+                lastOnPage = false;
+                break;
+            }
+        }
+        packet.granule = lastOnPage ? readLe64(mHeader + 6) : -1;
+        size = pos;
+        return kPacket;
+    }
+    size = pos;
+    return kNeedMoreData;
+}
@@ -0,0 +1,69 @@
+#ifndef OGG_DEMUX_HPP
+#define OGG_DEMUX_HPP
+#include <stdint.h>
+#include <memory>
+
+/* Streaming demuxer of Ogg pages into packets, for a single logical stream at
+ * a time (chained streams, i.e. a new stream starting at the end of the previous
+ * one, as internet radio does at track changes, are supported). Data can be fed
+ * in chunks of any size. Packets that are entirely within the chunk are returned
+ * in place, only packets that span pages or chunks are copied to an internal
+ * buffer. Page CRCs are verified, but since packets are returned as they are
+ * parsed, a CRC error is only logged
+ */
+class OggDemux
+{
+public:
+    struct Packet
+    {
+        const uint8_t* data;
+        int size;
+        // Sequence number of the packet in its logical stream, 0 is the first
+        // (header) packet. Packets that were dropped are counted as well
+        int index;
+        // Granule position of the page, if this is the last packet that ends on
+        // it, otherwise -1
+        int64_t granule;
+    };
+    enum Result: int8_t { kNeedMoreData = 0, kPacket = 1 };
+    enum { kMaxPacketSize = 8192 }; // larger packets that have to be copied are dropped
+protected:
+    enum {
+        kPageHeaderSize = 27,
+        kFlagContinued = 1,
+        kFlagBos = 2
+    };
+    const char* mTag;
+    uint8_t mHeader[kPageHeaderSize + 255]; // with the segment table
+    int mHeaderLen = 0;
+    int mSegIdx = 0; // current segment in the page
+    int mSegPos = 0; // offset in the current segment
+    uint32_t mSerial = 0;
+    uint32_t mPageSeq = 0;
+    uint32_t mCrc = 0;
+    int mPacketIdx = 0;
+    std::unique_ptr<uint8_t[]> mPacketBuf; // allocated on first use
+    int mPacketLen = 0;
+    bool mDropPacket = false; // the current packet is incomplete or too large
+    int mCrcErrors = 0;
+    int segmentCount() const { return mHeader[26]; }
+    uint8_t flags() const { return mHeader[5]; }
+    bool startPage();
+    int bytesToPacketEnd(bool& endsPacket) const;
+    void advance(int len);
+    void appendToPacket(const uint8_t* data, int len);
+    static uint32_t crcUpdate(uint32_t crc, const uint8_t* data, int len);
+public:
+    OggDemux(const char* tag): mTag(tag) {}
+    /** Parses data until a packet is complete, or all data is consumed. Sets
+     * `size` to the amount of data consumed - the rest must be passed again.
+     * The returned packet is valid until the next call, or until data is released
+     */
+    Result parse(const uint8_t* data, int& size, Packet& packet);
+    void reset();
+    int crcErrors() const { return mCrcErrors; }
+    static int64_t readLe64(const uint8_t* p) { return (int64_t)readLe32(p) | ((int64_t)readLe32(p + 4) << 32); }
+    static uint32_t readLe32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+};
+
+#endif
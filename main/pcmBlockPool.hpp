@@ -0,0 +1,208 @@
+#ifndef PCM_BLOCK_POOL_HPP
+#define PCM_BLOCK_POOL_HPP
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "audioNode.hpp"
+#include "mutex.hpp"
+#include "eventGroup.hpp"
+#include "utils.hpp"
+
+class PcmBlockPool;
+
+/* A buffer of PCM data, allocated from a PcmBlockPool. It is passed along the
+ * pipeline by PcmBlockRef handles, so that any number of consumers can hold it
+ * without copying. It returns to the pool when the last handle is released
+ */
+struct PcmBlock
+{
+    char* data;
+    int size; // amount of valid data
+    StreamFormat fmt;
+    int64_t ts; // same as DataPullReq::ts
+protected:
+    friend class PcmBlockPool;
+    friend class PcmBlockRef;
+    PcmBlockPool* mPool;
+    std::atomic<int> mRefCount;
+public:
+    PcmBlockPool& pool() const { return *mPool; }
+};
+
+/* Ref-counting handle to a PcmBlock. Copying it shares the block, moving it
+ * transfers the reference. Neither allocates
+ */
+class PcmBlockRef
+{
+protected:
+    PcmBlock* mBlock = nullptr;
+    friend class PcmBlockPool;
+public:
+    PcmBlockRef() {}
+    PcmBlockRef(const PcmBlockRef& other): mBlock(other.mBlock)
+    {
+        if (mBlock) {
+            mBlock->mRefCount++;
+        }
+    }
+    PcmBlockRef(PcmBlockRef&& other): mBlock(other.mBlock) { other.mBlock = nullptr; }
+    ~PcmBlockRef() { reset(); }
+    PcmBlockRef& operator=(const PcmBlockRef& other)
+    {
+        if (other.mBlock) {
+            other.mBlock->mRefCount++;
+        }
+        reset();
+        mBlock = other.mBlock;
+        return *this;
+    }
+    PcmBlockRef& operator=(PcmBlockRef&& other)
+    {
+        if (this != &other) {
+            reset();
+            mBlock = other.mBlock;
+            other.mBlock = nullptr;
+        }
+        return *this;
+    }
+    inline void reset();
+    // Gives up ownership of the block without releasing it, e.g. to pass it
+    // through a FreeRTOS queue. It must be re-attached to a PcmBlockRef later
+    PcmBlock* detach()
+    {
+        auto block = mBlock;
+        mBlock = nullptr;
+        return block;
+    }
+    void attach(PcmBlock* block)
+    {
+        reset();
+        mBlock = block;
+    }
+    PcmBlock* get() const { return mBlock; }
+    PcmBlock* operator->() const { return mBlock; }
+    PcmBlock& operator*() const { return *mBlock; }
+    explicit operator bool() const { return mBlock != nullptr; }
+    // Whether we are the only holder of the block, i.e. can modify it in place
+    bool unique() const { return mBlock->mRefCount == 1; }
+    // If the block is shared, replaces it with a private copy from the same pool.
+    // Returns false if no free block became available within the timeout
+    inline bool makeUnique(int msTimeout);
+};
+
+/* Fixed-size pool of PCM blocks. All memory is allocated by the constructor,
+ * acquiring and releasing blocks does not touch the heap
+ */
+class PcmBlockPool
+{
+protected:
+    enum: EventBits_t { kEvtBlockFreed = 1 };
+    Mutex mMutex;
+    EventGroup mEvents;
+    char* mStorage;
+    PcmBlock* mBlocks;
+    PcmBlock** mFreeList;
+    int mBlockSize;
+    int mBlockCount;
+    int mFreeCount;
+    uint32_t mWaitCount = 0;
+    friend class PcmBlockRef;
+    void release(PcmBlock* block)
+    {
+        if (--block->mRefCount > 0) {
+            return;
+        }
+        MutexLocker locker(mMutex);
+        myassert(mFreeCount < mBlockCount);
+        mFreeList[mFreeCount++] = block;
+        mEvents.setBits(kEvtBlockFreed);
+    }
+public:
+    PcmBlockPool(int blockSize, int blockCount)
+    : mStorage((char*)malloc(blockSize * blockCount)), mBlocks(new PcmBlock[blockCount]),
+      mFreeList(new PcmBlock*[blockCount]), mBlockSize(blockSize), mBlockCount(blockCount),
+      mFreeCount(blockCount)
+    {
+        myassert(mStorage);
+        for (int i = 0; i < blockCount; i++) {
+            auto& block = mBlocks[i];
+            block.data = mStorage + i * blockSize;
+            block.mPool = this;
+            block.mRefCount = 0;
+            mFreeList[i] = &block;
+        }
+    }
+    ~PcmBlockPool()
+    {
+        myassert(mFreeCount == mBlockCount); // no block must outlive the pool
+        delete[] mFreeList;
+        delete[] mBlocks;
+        free(mStorage);
+    }
+    /* Gets a free block into ref, releasing what ref held before. Waits up to
+     * msTimeout (-1 means forever) for a block to be released if there is none
+     * free. Returns false on timeout
+     */
+    bool acquire(PcmBlockRef& ref, int msTimeout)
+    {
+        ref.reset();
+        ElapsedTimer timer;
+        for (;;) {
+            {
+                MutexLocker locker(mMutex);
+                if (mFreeCount) {
+                    auto block = mFreeList[--mFreeCount];
+                    block->mRefCount = 1;
+                    block->size = 0;
+                    block->fmt = StreamFormat();
+                    block->ts = 0;
+                    ref.mBlock = block;
+                    return true;
+                }
+                mEvents.clearBits(kEvtBlockFreed);
+                mWaitCount++;
+            }
+            int remaining = (msTimeout < 0) ? -1 : msTimeout - timer.msElapsed();
+            if (msTimeout >= 0 && remaining <= 0) {
+                return false;
+            }
+            mEvents.waitForOneAndReset(kEvtBlockFreed, remaining);
+        }
+    }
+    int blockSize() const { return mBlockSize; }
+    int blockCount() const { return mBlockCount; }
+    int freeCount()
+    {
+        MutexLocker locker(mMutex);
+        return mFreeCount;
+    }
+    // Number of times acquire() found the pool empty
+    uint32_t waitCount() const { return mWaitCount; }
+};
+
+void PcmBlockRef::reset()
+{
+    if (mBlock) {
+        mBlock->mPool->release(mBlock);
+        mBlock = nullptr;
+    }
+}
+
+bool PcmBlockRef::makeUnique(int msTimeout)
+{
+    if (unique()) {
+        return true;
+    }
+    PcmBlockRef copy;
+    if (!mBlock->mPool->acquire(copy, msTimeout)) {
+        return false;
+    }
+    memcpy(copy->data, mBlock->data, mBlock->size);
+    copy->size = mBlock->size;
+    copy->fmt = mBlock->fmt;
+    copy->ts = mBlock->ts;
+    *this = std::move(copy);
+    return true;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef PCM_CONVERT_HPP
+#define PCM_CONVERT_HPP
+#include <stdint.h>
+#include <string.h>
+#include <mad.h>
+
+/* Converts libmad fixed-point samples to interleaved integer PCM, with rounding,
+ * saturation and optional TPDF dither. The inner loops have no branches and no
+ * dependencies between iterations (the dither noise is a hash of the sample
+ * index), so that the compiler can vectorize them.
+ * The output level is the same as that of the original conversion: 1 bit of
+ * headroom, i.e. libmad's full scale of 1.0 maps to half of the PCM full scale,
+ * and only samples beyond 2.0 are clipped
+ */
+class PcmConverter
+{
+public:
+    enum { kHeadroomBits = 1 };
+protected:
+    uint8_t mBits;
+    bool mDither;
+    uint32_t mDitherPos = 0;
+    // libmad sample value that maps to the PCM full scale
+    static constexpr int32_t kClipLevel = 1 << (MAD_F_FRACBITS + kHeadroomBits);
+    template <int Bits>
+    static constexpr int shift() { return MAD_F_FRACBITS + kHeadroomBits + 1 - Bits; }
+    static inline int32_t clamp(int32_t x, int32_t lo, int32_t hi)
+    {
+        return x < lo ? lo : (x > hi ? hi : x);
+    }
+    // Triangular noise in the range (-1, 1) LSB, with fracBits bits below the LSB.
+    // Two uniform 16-bit values are taken from a hash of n, and subtracted
+    static inline int32_t tpdf(uint32_t n, int fracBits)
+    {
+        n *= 0x9e3779b1;
+        n ^= n >> 16;
+        n *= 0x85ebca6b;
+        n ^= n >> 13;
+        return ((int32_t)(n & 0xffff) - (int32_t)(n >> 16)) >> (16 - fracBits);
+    }
+    // Pre-shifting to fracBits below the output LSB leaves enough room to add
+    // the rounding and dither without overflow, so a single clamp is needed
+    template <int Bits, bool Dither>
+    static inline int32_t sample(mad_fixed_t x, uint32_t n)
+    {
+        enum {
+            kShift = shift<Bits>(),
+            kFracBits = kShift - 1 < 8 ? kShift - 1 : 8,
+            kMax = (int32_t)((1u << (Bits - 1)) - 1)
+        };
+        x >>= kShift - kFracBits;
+        x += (1 << (kFracBits - 1)) + (Dither ? tpdf(n, kFracBits) : 0);
+        return clamp(x >> kFracBits, -kMax - 1, kMax);
+    }
+    template <bool Dither>
+    void convert16(const mad_fixed_t* const* in, int nch, int nsamples, int16_t* __restrict out)
+    {
+        uint32_t pos = mDitherPos;
+        if (nch == 2) {
+            const mad_fixed_t* __restrict left = in[0];
+            const mad_fixed_t* __restrict right = in[1];
+            for (int i = 0; i < nsamples; i++) {
+                out[2 * i] = sample<16, Dither>(left[i], pos + 2 * i);
+                out[2 * i + 1] = sample<16, Dither>(right[i], pos + 2 * i + 1);
+            }
+        } else {
+            const mad_fixed_t* __restrict mono = in[0];
+            for (int i = 0; i < nsamples; i++) {
+                out[i] = sample<16, Dither>(mono[i], pos + i);
+            }
+        }
+    }
+    // Packed 3-byte little-endian samples. The conversion is done in chunks to
+    // a 32-bit buffer, so that it can be vectorized, and then packed
+    template <bool Dither>
+    void convert24(const mad_fixed_t* const* in, int nch, int nsamples, uint8_t* __restrict out)
+    {
+        enum { kChunk = 64 };
+        int32_t buf[kChunk * 2];
+        uint32_t pos = mDitherPos;
+        for (int start = 0; start < nsamples; start += kChunk) {
+            int len = nsamples - start < kChunk ? nsamples - start : kChunk;
+            for (int ch = 0; ch < nch; ch++) {
+                const mad_fixed_t* __restrict src = in[ch] + start;
+                for (int i = 0; i < len; i++) {
+                    buf[nch * i + ch] = sample<24, Dither>(src[i], pos + nch * (start + i) + ch);
+                }
+            }
+            for (int i = 0; i < len * nch; i++) {
+                out[0] = buf[i];
+                out[1] = buf[i] >> 8;
+                out[2] = buf[i] >> 16;
+                out += 3;
+            }
+        }
+    }
+    // There are enough bits for the full precision, so no rounding and dither
+    void convert32(const mad_fixed_t* const* in, int nch, int nsamples, int32_t* __restrict out)
+    {
+        enum { kShift = -shift<32>() };
+        for (int ch = 0; ch < nch; ch++) {
+            const mad_fixed_t* __restrict src = in[ch];
+            for (int i = 0; i < nsamples; i++) {
+                int32_t x = clamp(src[i], -kClipLevel, kClipLevel - 1);
+                out[nch * i + ch] = (int32_t)((uint32_t)x << kShift);
+            }
+        }
+    }
+public:
+    // bits is 16, 24 or 32
+    PcmConverter(uint8_t bits = 16, bool dither = false): mBits(bits), mDither(dither) {}
+    void setFormat(uint8_t bits, bool dither) { mBits = bits; mDither = dither; }
+    uint8_t bits() const { return mBits; }
+    bool dither() const { return mDither; }
+    // Converts nsamples samples of each of the nch (1 or 2) channel buffers in `in`.
+    // Returns the number of bytes written to out
+    int convert(const mad_fixed_t* const* in, int nch, int nsamples, void* out)
+    {
+        switch (mBits) {
+        case 24:
+            if (mDither) {
+                convert24<true>(in, nch, nsamples, (uint8_t*)out);
+            } else {
+                convert24<false>(in, nch, nsamples, (uint8_t*)out);
+            }
+            break;
+        case 32:
+            convert32(in, nch, nsamples, (int32_t*)out);
+            break;
+        default:
+            if (mDither) {
+                convert16<true>(in, nch, nsamples, (int16_t*)out);
+            } else {
+                convert16<false>(in, nch, nsamples, (int16_t*)out);
+            }
+            break;
+        }
+        mDitherPos += nch * nsamples;
+        return nch * nsamples * (mBits / 8);
+    }
+};
+
+#endif
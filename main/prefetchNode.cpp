@@ -0,0 +1,123 @@
+#include "prefetchNode.hpp"
+
+PrefetchNode::PrefetchNode(int maxFrames, BaseType_t cpuCore)
+: AudioNodeWithTask("prefetch", kStackSize), mMaxFrames(std::min((int)kMaxFrames, maxFrames))
+{
+    mCpuCore = cpuCore;
+}
+
+PrefetchNode::~PrefetchNode()
+{
+    stop();
+    discardQueued();
+}
+
+void PrefetchNode::doStop()
+{
+    mCmdQueue.post(kCommandWake); // in case the task is blocked waiting for a command
+}
+
+void PrefetchNode::discardQueued()
+{
+    Item item;
+    PcmBlockRef block;
+    while (mQueue.get(item, 0)) {
+        block.attach(item.block);
+    }
+}
+
+// Waits until there are less than mMaxFrames queued, giving up if a command arrives
+bool PrefetchNode::postItem(PcmBlock* block, StreamError err)
+{
+    Item item = { block, err };
+    while (!mTerminate && mCmdQueue.numMessages() == 0) {
+        mEvents.clearBits(kEvtDequeued);
+        if ((int)mQueue.numMessages() < mMaxFrames) {
+            auto ok = mQueue.tryPost(item, 0);
+            myassert(ok); // the queue has room for kMaxFrames
+            return true;
+        }
+        mEvents.waitForOneAndReset(kEvtDequeued | kEvtStopRequest, kPollMs);
+    }
+    return false;
+}
+
+void PrefetchNode::nodeThreadFunc()
+{
+    discardQueued(); // left over from before a stop()
+    for (;;) {
+        processMessages();
+        if (mTerminate) {
+            return;
+        }
+        myassert(mState == kStateRunning);
+        while (!mTerminate && (mCmdQueue.numMessages() == 0)) {
+            PcmBlockRef block;
+            auto err = mPrev->pullBlock(block, kPollMs);
+            if (err == kTimeout) {
+                continue;
+            }
+            if (err == kStreamFlush) {
+                // blocks queued from the old stream should not be played
+                discardQueued();
+            }
+            auto ptr = block.detach();
+            if (!postItem(ptr, err)) {
+                block.attach(ptr);
+                break;
+            }
+            if (err && err != kStreamFlush) {
+                setState(kStatePaused);
+                break;
+            }
+        }
+    }
+}
+
+AudioNode::StreamError PrefetchNode::doPullBlock(PcmBlockRef& block, int timeout)
+{
+    if (mPrimed && mQueue.numMessages() == 0 && mState == kStateRunning) {
+        mUnderruns++;
+    }
+    // Waits in slices, so that the consumer isn't blocked forever once our task
+    // has paused or is stopping, and won't queue anything more
+    Item item;
+    ElapsedTimer tim;
+    for (;;) {
+        int wait = kPollMs;
+        if (timeout >= 0) {
+            wait = std::max(0, std::min(timeout - tim.msElapsed(), (int)kPollMs));
+        }
+        if (mQueue.get(item, wait)) {
+            break;
+        }
+        if (mTerminate || mState == kStateStopped) {
+            return kStreamStopped;
+        }
+        if (mState != kStateRunning || (timeout >= 0 && tim.msElapsed() >= timeout)) {
+            return kTimeout;
+        }
+    }
+    mEvents.setBits(kEvtDequeued);
+    if (item.err) {
+        mPrimed = false;
+        return item.err;
+    }
+    mPrimed = true;
+    block.attach(item.block);
+    return kNoError;
+}
+
+AudioNode::StreamError PrefetchNode::doPullData(DataPullReq& dpr, int timeout)
+{
+    mPulledBlock.reset();
+    auto err = doPullBlock(mPulledBlock, timeout);
+    if (err) {
+        return err;
+    }
+    dpr.buf = mPulledBlock->data;
+    dpr.size = mPulledBlock->size;
+    dpr.fmt = mPulledBlock->fmt;
+    dpr.ts = mPulledBlock->ts;
+    return kNoError;
+}
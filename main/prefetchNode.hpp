@@ -0,0 +1,51 @@
+#ifndef PREFETCH_NODE_HPP
+#define PREFETCH_NODE_HPP
+#include "audioNode.hpp"
+#include "pcmBlockPool.hpp"
+
+/* Runs the upstream PCM-producing nodes (the decoder and optionally the equalizer)
+ * in its own task, which can be pinned to a core, and keeps up to maxFrames
+ * decoded blocks queued ahead of the consumer. The consumer then only takes ready
+ * blocks, so decode time spikes don't stall the output as long as the queue
+ * is not empty.
+ * The upstream node must support pullBlock(), and its block pool must have
+ * maxFrames more blocks than it needs on its own
+ */
+class PrefetchNode: public AudioNodeWithTask
+{
+public:
+    enum { kMaxFrames = 16 };
+protected:
+    enum { kStackSize = 9000, kPollMs = 100 };
+    enum: uint8_t { kCommandWake = AudioNodeWithTask::kCommandLast + 1 };
+    enum { kEvtDequeued = kEvtLast << 1 };
+    // Queued blocks are detached from their PcmBlockRef-s. Errors from upstream
+    // are queued in-band, so they reach the consumer in stream order
+    struct Item
+    {
+        PcmBlock* block;
+        StreamError err;
+    };
+    Queue<Item, kMaxFrames> mQueue;
+    int mMaxFrames;
+    PcmBlockRef mPulledBlock; // returned by the last doPullData(), kept until the next call
+    bool mPrimed = false; // consumer got data since the last start or flush
+    uint32_t mUnderruns = 0;
+    void discardQueued();
+    bool postItem(PcmBlock* block, StreamError err);
+    virtual void nodeThreadFunc();
+    virtual void doStop();
+    virtual StreamError doPullData(DataPullReq& dpr, int timeout);
+    virtual StreamError doPullBlock(PcmBlockRef& block, int timeout);
+public:
+    PrefetchNode(int maxFrames, BaseType_t cpuCore=tskNO_AFFINITY);
+    ~PrefetchNode();
+    virtual Type type() const { return kTypePrefetch; }
+    virtual void confirmRead(int size) {}
+    virtual bool hasBlockOutput() const { return true; }
+    // Number of times the consumer found no decoded data ready during playback
+    uint32_t underruns() const { return mUnderruns; }
+    int queuedFrames() { return mQueue.numMessages(); }
+};
+
+#endif
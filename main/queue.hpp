@@ -23,6 +23,12 @@ public:
         Item item(args...);
         post(item);
     }
+    bool tryPost(const Item& item, int msTimeout)
+    {
+        auto ret = xQueueSendToBack(mHandle, &item,
+            (msTimeout < 0) ? portMAX_DELAY: msTimeout / portTICK_PERIOD_MS);
+        return ret == pdTRUE;
+    }
     bool get(Item& item, int msTimeout)
     {
         auto ret = xQueueReceive(mHandle, &item,
@@ -8,20 +8,120 @@
 
 static const char* TAG = "Rec";
 
-TrackRecorder::TrackRecorder(const char *rootPath)
+TrackRecorder::TrackRecorder(const char *rootPath, RingBuf& ringBuf)
+: mRingBuf(ringBuf), mReaderId(ringBuf.addReader())
 {
     if (createDirIfNotExist(rootPath)) {
         mRootPath = rootPath;
     }
+    if (mReaderId < 0) {
+        ESP_LOGE(TAG, "Could not register as a stream reader, will not record");
+        return;
+    }
+    if (xTaskCreate(sTaskFunc, "recorder", kStackSize, this, kPrio, &mTaskId) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating recorder task");
+        mTaskId = nullptr;
+        mRingBuf.removeReader(mReaderId);
+        mReaderId = -1;
+    }
+}
+
+TrackRecorder::~TrackRecorder()
+{
+    if (mTaskId) {
+        mTerminate = true;
+        mRingBuf.removeReader(mReaderId); // wakes the task if blocked on the ringbuf
+        mEvents.waitForOneNoReset(kEvtTaskExited, -1);
+    }
+    Command cmd;
+    while (mCmdQueue.get(cmd, 0)) {
+        free(cmd.arg);
+    }
 }
 
 void TrackRecorder::setStation(const char* name)
+{
+    mCmdQueue.post(kCommandSetStation, mRingBuf.writeCount(), strdup(name));
+}
+
+void TrackRecorder::onNewTrack(const char* trackName, StreamFormat fmt)
+{
+    mCmdQueue.post(kCommandNewTrack, mRingBuf.writeCount(), strdup(trackName), fmt.codec);
+}
+
+void TrackRecorder::abortTrack()
+{
+    mCmdQueue.post(kCommandAbortTrack, mRingBuf.writeCount());
+}
+
+void TrackRecorder::sTaskFunc(void* ctx)
+{
+    auto self = static_cast<TrackRecorder*>(ctx);
+    self->taskFunc();
+    self->mEvents.setBits(kEvtTaskExited);
+    vTaskDelete(nullptr);
+}
+
+void TrackRecorder::taskFunc()
+{
+    Command cmd;
+    bool hasCmd = false;
+    while (!mTerminate) {
+        if (!hasCmd) {
+            hasCmd = mCmdQueue.get(cmd, 0);
+        }
+        int maxSize = kMaxWriteSize;
+        if (hasCmd) {
+            // write out the data that precedes the command in the stream
+            int32_t pending = cmd.streamPos - mRingBuf.readCount(mReaderId);
+            if (pending <= 0) {
+                dispatchCommand(cmd);
+                hasCmd = false;
+                continue;
+            }
+            maxSize = std::min(maxSize, (int)pending);
+        }
+        char* buf;
+        int len = mRingBuf.contigRead(mReaderId, buf, maxSize, kPollMs);
+        if (len > 0) {
+            writeData(buf, len);
+            mRingBuf.commitContigRead(mReaderId, len);
+        } else if (len < 0) { // stream stopped or we are terminating
+            vTaskDelay(kPollMs / portTICK_PERIOD_MS);
+        }
+    }
+    if (hasCmd) {
+        free(cmd.arg);
+    }
+    doAbortTrack();
+}
+
+void TrackRecorder::dispatchCommand(Command& cmd)
+{
+    switch (cmd.opcode) {
+    case kCommandSetStation:
+        doSetStation(cmd.arg);
+        break;
+    case kCommandNewTrack:
+        doOnNewTrack(cmd.arg, cmd.codec);
+        break;
+    case kCommandAbortTrack:
+        doAbortTrack();
+        break;
+    default:
+        myassert(false);
+    }
+    free(cmd.arg);
+    cmd.arg = nullptr;
+}
+
+void TrackRecorder::doSetStation(const char* name)
 {
     if (mRootPath.empty()) {
         ESP_LOGE(TAG, "setStation: Root path does not exist, aborting");
         return;
     }
-    abortTrack();
+    doAbortTrack();
     mStationName.clear();
     if (!createDirIfNotExist((mRootPath + "/" + name).c_str())) {
         return;
@@ -75,7 +175,7 @@ void TrackRecorder::commit()
     ESP_LOGI(TAG, "Recorded track %s on station %s", mCurrTrackName.c_str(), mStationName.c_str());
 }
 
-void TrackRecorder::onNewTrack(const char* trackName, StreamFormat fmt)
+void TrackRecorder::doOnNewTrack(const char* trackName, CodecType codec)
 {
     if (mStationName.empty()) {
         return;
@@ -99,10 +199,10 @@ void TrackRecorder::onNewTrack(const char* trackName, StreamFormat fmt)
     }
     mCurrTrackName = trackName;
     mCurrTrackName += '.';
-    mCurrTrackName.append(fmt.codecTypeStr());
+    mCurrTrackName.append(StreamFormat(codec).codecTypeStr());
     ESP_LOGI(TAG, "Starting to record track %s on station %s", mCurrTrackName.c_str(), mStationName.c_str());
 }
-void TrackRecorder::onData(const void* data, int dataLen)
+void TrackRecorder::writeData(const void* data, int dataLen)
 {
     if (!mSinkFile) {
         return;
@@ -110,7 +210,7 @@ void TrackRecorder::onData(const void* data, int dataLen)
     ElapsedTimer timer;
     int ret = fwrite(data, 1, dataLen, mSinkFile);
     if (ret != dataLen) {
-        abortTrack();
+        doAbortTrack();
         ESP_LOGE(TAG, "Error writing to stream sink file: %s", strerror(errno));
     }
     auto msElapsed = timer.msElapsed();
@@ -118,7 +218,7 @@ void TrackRecorder::onData(const void* data, int dataLen)
         ESP_LOGW(TAG, "SDCard write took %d ms", msElapsed);
     }
 }
-void TrackRecorder::abortTrack()
+void TrackRecorder::doAbortTrack()
 {
     if (mSinkFile) {
         fclose(mSinkFile);
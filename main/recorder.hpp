@@ -3,23 +3,57 @@
 #include <string>
 #include <stdio.h>
 #include "audioNode.hpp"
+#include "ringbuf.hpp"
+#include "queue.hpp"
+#include "eventGroup.hpp"
 
+/* Records the stream to the SD card. Drains the stream ringbuffer as an extra
+ * reader, on its own task, so that slow SD card writes don't block the network
+ * task. Commands are executed when the recorder reaches the stream position at
+ * which they were issued, so track boundaries are kept in sync with the data
+ */
 class TrackRecorder
 {
 protected:
+    enum { kStackSize = 3000, kPrio = 3, kMaxWriteSize = 4096, kPollMs = 200 };
+    enum: uint8_t { kCommandSetStation = 1, kCommandNewTrack, kCommandAbortTrack };
+    enum: EventBits_t { kEvtTaskExited = 1 };
+    struct Command
+    {
+        uint8_t opcode;
+        CodecType codec;
+        uint32_t streamPos;
+        char* arg;
+        Command(uint8_t aOpcode, uint32_t aStreamPos, char* aArg=nullptr, CodecType aCodec=kCodecUnknown)
+        : opcode(aOpcode), codec(aCodec), streamPos(aStreamPos), arg(aArg) {}
+        Command() {} // no init, used for retrieving commands
+    };
+    RingBuf& mRingBuf;
+    int mReaderId;
     std::string mRootPath;
     std::string mStationName;
     std::string mCurrTrackName;
     FILE* mSinkFile = nullptr;
+    Queue<Command, 8> mCmdQueue;
+    EventGroup mEvents;
+    TaskHandle_t mTaskId = nullptr;
+    volatile bool mTerminate = false;
+    static void sTaskFunc(void* ctx);
+    void taskFunc();
+    void dispatchCommand(Command& cmd);
+    void doSetStation(const char* name);
+    void doOnNewTrack(const char* trackName, CodecType codec);
+    void doAbortTrack();
+    void writeData(const void* data, int dataLen);
     void commit();
     std::string sinkFileName() const { return mRootPath + "/stream.dat"; }
     std::string trackNameToPath(const char* trackName) const;
     bool createDirIfNotExist(const char* dirname) const;
 public:
-    TrackRecorder(const char* rootPath);
+    TrackRecorder(const char* rootPath, RingBuf& ringBuf);
+    ~TrackRecorder();
     void setStation(const char* name);
     void onNewTrack(const char* trackName, StreamFormat fmt);
-    void onData(const void* data, int dataLen);
     void abortTrack();
 };
 
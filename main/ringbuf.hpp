@@ -22,13 +22,39 @@ struct ReadBuf
     inline ~ReadBuf();
 };
 
+/* Ring buffer with one primary reader and optionally up to kMaxExtraReaders
+ * additional readers. Each extra reader has its own read cursor and consumes
+ * the same data at its own pace, without copying. The free space for the writer
+ * is determined by the slowest reader.
+ */
 class RingBuf
 {
+public:
+    enum { kMaxExtraReaders = 2 };
+    struct WakeupStats
+    {
+        uint32_t wakeups = 0;  // number of times a blocked reader or writer was woken up
+        uint32_t spurious = 0; // ...and still didn't have what it waited for
+    };
 protected:
-    enum: uint8_t { kFlagHasData = 1, kFlagIsEmpty = 2, kFlagHasEmpty = 4,
-                    kFlagWriteOp = 8, kFlagReadOp = 16, kFlagStop = 32 };
+    enum: EventBits_t { kFlagHasData = 1, kFlagIsEmpty = 2, kFlagHasEmpty = 4,
+                    kFlagWriteOp = 8, kFlagReadOp = 16, kFlagStop = 32,
+                    kFlagDataThreshold = 64, kFlagSpaceThreshold = 128,
+                    kFlagExtraReaderData = 256, // shifted left by the reader id
+                    kFlagsAll = 0xffff };
+    struct ExtraReader
+    {
+        char* readPtr;
+        int dataSize = 0;
+        bool active = false;
+        bool holdsBuf = false; // between contigRead() and commitContigRead()
+        bool clearPending = false; // clear() was called while holdsBuf was set
+    };
     char* mBuf;
     char* mBufEnd;
+    // Optional area after mBufEnd that mirrors the first mMirrorSize bytes of
+    // the buffer, so that data that wraps around can still be read contiguously
+    int mMirrorSize;
     char* mWritePtr;
     char* mReadPtr;
     Mutex mMutex;
@@ -36,51 +62,82 @@ protected:
     // buffer returned by contigRead()
     Mutex mReadBufMutex;
     int mDataSize;
+    // Low-watermarks requested by a blocked reader/writer. The other side sets
+    // the corresponding threshold flag only once the watermark is crossed,
+    // instead of on every operation. Zero means nobody is waiting
+    int mReadThreshold = 0;
+    int mWriteThreshold = 0;
+    // Set while the writer waits for the buffer to drain. Readers must not wait
+    // for more data in that case
+    bool mDraining = false;
+    WakeupStats mWakeupStats;
+    ExtraReader mExtraReaders[kMaxExtraReaders];
+    // Total number of bytes ever written, allows aligning out-of-band events
+    // with positions in the stream. Wraps around
+    uint32_t mWriteCount = 0;
     EventGroup mEvents;
     int bufSize() const { return mBufEnd - mBuf; }
-    int availableForContigRead()
+    int contigDataAvail(char* readPtr, int dataSize)
     {
-        if (mWritePtr > mReadPtr) { // none wrapped
-            return mWritePtr - mReadPtr;
-        } else if (mReadPtr > mWritePtr) { // write wrapped, read didn't
-            return mBufEnd - mReadPtr;
-        } else if (mEvents.get() & kFlagHasEmpty) { // empty
-            return 0;
-        } else { // full
-            myassert(mEvents.get() & kFlagHasData);
-            return mBufEnd - mReadPtr;
+        int avail = std::min(dataSize, (int)(mBufEnd - readPtr));
+        if (mMirrorSize && avail < dataSize) { // data continues at mBuf
+            avail = std::min(dataSize, avail + mMirrorSize);
         }
+        return avail;
     }
+    int availableForContigRead() { return contigDataAvail(mReadPtr, mDataSize); }
     int maxPossibleContigReadSize() { return mBufEnd - mReadPtr; }
+    char* advanceReadPtr(char* readPtr, int size)
+    {
+        readPtr += size;
+        if (readPtr >= mBufEnd) { // may have read past the end, from the mirror area
+            rbassert(readPtr <= mBufEnd + mMirrorSize);
+            readPtr -= bufSize();
+        }
+        return readPtr;
+    }
+    // The amount of data that the slowest reader has not yet consumed
+    int usedSize()
+    {
+        int used = mDataSize;
+        for (auto& reader: mExtraReaders) {
+            if (reader.active && reader.dataSize > used) {
+                used = reader.dataSize;
+            }
+        }
+        return used;
+    }
     int availableForContigWrite()
     {
-        if (mWritePtr > mReadPtr) {
-            return mBufEnd - mWritePtr;
-        } else if (mWritePtr < mReadPtr){
-            return mReadPtr - mWritePtr; // Removed: artificially leave 1 byte to distinguish between empty and full
-        } else { // empty or full
-            return (mDataSize == 0) ? (mBufEnd - mWritePtr) : 0;
+        return std::min(bufSize() - usedSize(), (int)(mBufEnd - mWritePtr));
+    }
+    void notifySpaceFreed()
+    {
+        EventBits_t bitsToSet = kFlagReadOp | kFlagHasEmpty;
+        if (mWriteThreshold && availableForContigWrite() >= mWriteThreshold) {
+            mWriteThreshold = 0;
+            bitsToSet |= kFlagSpaceThreshold;
         }
+        mEvents.setBits(bitsToSet);
     }
     void doCommitContigRead(int size)
     {
         rbassert(size <= availableForContigRead());
-        mReadPtr += size;
-        if (mReadPtr == mBufEnd) {
-            mReadPtr = mBuf;
-        } else {
-            assert(mReadPtr < mBufEnd);
-        }
+        mReadPtr = advanceReadPtr(mReadPtr, size);
         mDataSize -= size;
-        if (mWritePtr == mReadPtr) {
+        if (!mDataSize) { // read and write pointers are also equal when full
             mEvents.clearBits(kFlagHasData);
             mEvents.setBits(kFlagIsEmpty);
         }
-        mEvents.setBits(kFlagReadOp|kFlagHasEmpty);
+        notifySpaceFreed();
     }
     void commitContigWrite(int size)
     {
         rbassert(size <= availableForContigWrite());
+        if (mWritePtr < mBuf + mMirrorSize) { // keep the mirror area in sync
+            auto end = std::min(mWritePtr + size, mBuf + mMirrorSize);
+            memcpy(mBufEnd + (mWritePtr - mBuf), mWritePtr, end - mWritePtr);
+        }
         mWritePtr += size;
         if (mWritePtr >= mBufEnd) {
             myassert(mWritePtr == mBufEnd);
@@ -89,12 +146,25 @@ protected:
             rbassert(mWritePtr < mBufEnd);
         }
         mDataSize += size;
+        mWriteCount += size;
+        EventBits_t bitsToSet = kFlagWriteOp | kFlagHasData;
+        for (int i = 0; i < kMaxExtraReaders; i++) {
+            auto& reader = mExtraReaders[i];
+            if (reader.active) {
+                reader.dataSize += size;
+                bitsToSet |= kFlagExtraReaderData << i;
+            }
+        }
         EventBits_t bitsToClear = kFlagIsEmpty;
-        if (mWritePtr == mReadPtr) {
+        if (usedSize() == bufSize()) {
             bitsToClear |= kFlagHasEmpty;
         }
         mEvents.clearBits(bitsToClear);
-        mEvents.setBits(kFlagWriteOp | kFlagHasData);
+        if (mReadThreshold && mDataSize >= mReadThreshold) {
+            mReadThreshold = 0;
+            bitsToSet |= kFlagDataThreshold;
+        }
+        mEvents.setBits(bitsToSet);
     }
     // -1: stopped, 0: timeout, 1: event occurred
     int8_t waitFor(uint32_t flag, int msTimeout)
@@ -108,6 +178,13 @@ protected:
         assert(bits == flag);
         return 1;
     }
+    void countWakeup(bool isSpurious)
+    {
+        mWakeupStats.wakeups++;
+        if (isSpurious) {
+            mWakeupStats.spurious++;
+        }
+    }
     int8_t waitAndReset(EventBits_t flag, int msTimeout)
     {
         auto bits = mEvents.waitForOneAndReset(flag | kFlagStop, msTimeout);
@@ -130,13 +207,57 @@ protected:
     }
     int totalEmptySpace_nolock()
     {
-        return size() - mDataSize;
+        return size() - usedSize();
+    }
+    /* Waits, with mMutex locked, until `cond` becomes true. The other side
+     * is expected to set `flag` once `threshold` is crossed
+     * @returns 1 if cond became true, 0 upon timeout, -1 if stop was signalled
+     */
+    template <class F>
+    int8_t waitThreshold(int& threshold, EventBits_t flag, int required, F&& cond, int msTimeout)
+    {
+        while (!cond()) {
+            threshold = required;
+            mEvents.clearBits(flag);
+            int64_t tsStart = esp_timer_get_time();
+            int8_t ret;
+            {
+                MutexUnlocker unlocker(mMutex);
+                ret = waitAndReset(flag, msTimeout);
+            }
+            if (ret <= 0) {
+                threshold = 0;
+                return ret;
+            }
+            mWakeupStats.wakeups++;
+            if (!cond()) {
+                mWakeupStats.spurious++;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout <= 0) {
+                    threshold = 0;
+                    return cond() ? 1 : 0;
+                }
+            }
+        }
+        return 1;
     }
     void doClear()
     {
+        // The write pointer is not reset, as extra readers may still be using
+        // the buffer returned by contigRead()
         mDataSize = 0;
-        mWritePtr = mReadPtr = mBuf;
-        mEvents.clearBits(0xff);
+        mReadPtr = mWritePtr;
+        for (auto& reader: mExtraReaders) {
+            if (reader.holdsBuf) {
+                reader.clearPending = true;
+            } else {
+                reader.readPtr = mWritePtr;
+                reader.dataSize = 0;
+            }
+        }
+        mEvents.clearBits(kFlagsAll);
         mEvents.setBits(kFlagHasEmpty|kFlagIsEmpty|kFlagReadOp);
         assert(mEvents.get() == (kFlagHasEmpty|kFlagIsEmpty|kFlagReadOp));
     }
@@ -144,14 +265,21 @@ public:
     // If user wants to keep some external state in sync with the ringbuffer,
     // they can use the ringbuf's mutex to protect that state
     Mutex& mutex() { return mMutex; }
-    RingBuf(size_t bufSize)
-    : mBuf((char*)malloc(bufSize)), mEvents(kFlagStop)
+    /* @param mirrorSize If non-zero, the buffer is allocated with a mirror area of
+     * that size after its end. Then contigRead() never returns less than
+     * min(maxSize, mirrorSize, totalDataAvail()), even if the data wraps around,
+     * at the cost of copying the first mirrorSize bytes of the buffer upon write
+     */
+    RingBuf(size_t bufSize, int mirrorSize=0)
+    : mBuf((char*)malloc(bufSize + mirrorSize)), mMirrorSize(mirrorSize), mEvents(kFlagStop)
     {
+        myassert(mirrorSize <= (int)bufSize);
         if (!mBuf) {
             ESP_LOGE("RINGBUF", "Out of memory allocation %zu bytes", bufSize);
             return;
         }
         mBufEnd = mBuf + bufSize;
+        mWritePtr = mBuf;
         doClear();
     }
     ~RingBuf()
@@ -161,6 +289,7 @@ public:
         }
     }
     int size() const { return mBufEnd - mBuf; }
+    int mirrorSize() const { return mMirrorSize; }
     void clear()
     {
         MutexLocker locker(mMutex);
@@ -220,7 +349,8 @@ public:
      * than sizeWanted. If no data is available for reading, blocks until data becomes
      * available or timeout elapses
      * @returns the amount of data in the returned buffer, 0 for timeout or -1 if stop
-     * was signalled
+     * was signalled. If the buffer has a mirror area, data that wraps around is
+     * returned in one piece, up to the mirror size
      */
     int contigRead(char*& buf, int maxSize, int msTimeout)
     {
@@ -228,25 +358,31 @@ public:
         int avail;
         if (msTimeout < 0) {
             while ((avail = availableForContigRead()) < 1) {
-                MutexUnlocker unlocker(mMutex);
-                ESP_LOGI("RB", "underflow");
-                if (waitForWriteOp(-1) <= 0) {
-                    return -1;
+                {
+                    MutexUnlocker unlocker(mMutex);
+                    ESP_LOGI("RB", "underflow");
+                    if (waitForWriteOp(-1) <= 0) {
+                        return -1;
+                    }
                 }
+                countWakeup(availableForContigRead() < 1);
             }
         } else {
             while ((avail = availableForContigRead()) < 1) {
                 int64_t tsStart = esp_timer_get_time();
-                MutexUnlocker unlocker(mMutex);
-                ESP_LOGI("RB", "underflow");
-                int ret = waitForWriteOp(msTimeout);
-                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
-                if (ret < 0) {
-                    return ret;
-                }
-                if (msTimeout < 0) {
-                    return 0;
+                {
+                    MutexUnlocker unlocker(mMutex);
+                    ESP_LOGI("RB", "underflow");
+                    int ret = waitForWriteOp(msTimeout);
+                    msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                    if (ret < 0) {
+                        return ret;
+                    }
+                    if (msTimeout < 0) {
+                        return 0;
+                    }
                 }
+                countWakeup(availableForContigRead() < 1);
             }
         }
         mReadBufMutex.lock();
@@ -288,27 +424,26 @@ public:
         mMutex.unlock();
         return true;
     }
-    int getWriteBuf(char*& buf, int reqSize)
+    /* Returns a contiguous buffer for writing, blocking until at least `minFree`
+     * contiguous bytes are free. `minFree` is capped to the space till the end of the
+     * buffer. The reader wakes us only once that much space has been freed.
+     * @returns the size of the returned buffer, which may be more than `minFree`,
+     * or -1 if stop was signalled
+     */
+    int getWriteBuf(char*& buf, int minFree)
     {
         MutexLocker locker(mMutex);
         int maxPossible = mBufEnd - mWritePtr;
-        if (reqSize > maxPossible) {
-            reqSize = maxPossible;
+        if (minFree > maxPossible) {
+            minFree = maxPossible;
         }
-        for (;;) {
-            auto contig = availableForContigWrite();
-            if (contig >= reqSize) {
-                buf = mWritePtr;
-                return contig;
-            }
-            {
-                MutexUnlocker unlocker(mMutex);
-                auto ret = waitForReadOp(-1);
-                if (ret <= 0) {
-                    return -1;
-                }
-            }
+        auto ret = waitThreshold(mWriteThreshold, kFlagSpaceThreshold, minFree,
+            [this, minFree]() { return availableForContigWrite() >= minFree; }, -1);
+        if (ret <= 0) {
+            return -1;
         }
+        buf = mWritePtr;
+        return availableForContigWrite();
     }
     void commitWrite(int size) {
         MutexLocker locker(mMutex);
@@ -338,11 +473,147 @@ public:
     {
         return waitFor(kFlagHasData, msTimeout);
     }
+    /* Blocks until at least `minBytes` are available for reading. The writer signals
+     * the reader only once that low-watermark is crossed, rather than on every write.
+     * `minBytes` is capped to the buffer size. If the writer is waiting for the buffer
+     * to drain (i.e. at the end of a stream), returns as soon as there is any data.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    int8_t waitForData(int minBytes, int msTimeout)
+    {
+        MutexLocker locker(mMutex);
+        if (minBytes > size()) {
+            minBytes = size();
+        }
+        return waitThreshold(mReadThreshold, kFlagDataThreshold, minBytes, [this, minBytes]() {
+            return mDataSize >= (mDraining ? 1 : minBytes);
+        }, msTimeout);
+    }
     bool waitForEmpty()
     {
-        return waitFor(kFlagIsEmpty, -1) >= 0;
+        {
+            MutexLocker locker(mMutex);
+            mDraining = true;
+            if (mReadThreshold) { // release a reader that waits for more data
+                mReadThreshold = 0;
+                mEvents.setBits(kFlagDataThreshold);
+            }
+        }
+        bool ret = waitFor(kFlagIsEmpty, -1) >= 0;
+        MutexLocker locker(mMutex);
+        mDraining = false;
+        return ret;
+    }
+    WakeupStats wakeupStats()
+    {
+        MutexLocker locker(mMutex);
+        return mWakeupStats;
     }
     int8_t waitForWriteOp(int msTimeout) { return waitAndReset(kFlagWriteOp, msTimeout); }
+    /* Registers an extra reader. It starts at the current write position and
+     * is accessed via the functions that take a reader id. The writer blocks
+     * if any reader is too far behind
+     * @returns the reader id, or -1 if all reader slots are taken
+     */
+    int addReader()
+    {
+        MutexLocker locker(mMutex);
+        for (int i = 0; i < kMaxExtraReaders; i++) {
+            auto& reader = mExtraReaders[i];
+            if (!reader.active) {
+                reader.active = true;
+                reader.holdsBuf = reader.clearPending = false;
+                reader.readPtr = mWritePtr;
+                reader.dataSize = 0;
+                mEvents.clearBits(kFlagExtraReaderData << i);
+                return i;
+            }
+        }
+        ESP_LOGE("RINGBUF", "No free reader slots");
+        return -1;
+    }
+    /* Unregisters an extra reader and frees the space it was holding. If it is
+     * blocked in contigRead(), it is woken up and gets -1
+     */
+    void removeReader(int id)
+    {
+        MutexLocker locker(mMutex);
+        mExtraReaders[id].active = false;
+        mEvents.setBits(kFlagExtraReaderData << id);
+        notifySpaceFreed();
+    }
+    /* contigRead() for an extra reader. Only the primary reader's stop signal
+     * and clear() apply to extra readers as well
+     * @returns the amount of data in the returned buffer, 0 for timeout or -1 if stop
+     * was signalled or the reader was removed
+     */
+    int contigRead(int id, char*& buf, int maxSize, int msTimeout)
+    {
+        MutexLocker locker(mMutex);
+        auto& reader = mExtraReaders[id];
+        int avail;
+        while (reader.active && (avail = contigDataAvail(reader.readPtr, reader.dataSize)) < 1) {
+            int64_t tsStart = esp_timer_get_time();
+            int8_t ret;
+            {
+                MutexUnlocker unlocker(mMutex);
+                ret = waitAndReset(kFlagExtraReaderData << id, msTimeout);
+            }
+            if (ret <= 0) {
+                return ret;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout < 0) {
+                    msTimeout = 0; // make one more check without blocking
+                }
+            }
+        }
+        if (!reader.active) {
+            return -1;
+        }
+        reader.holdsBuf = true;
+        buf = reader.readPtr;
+        return std::min(avail, maxSize);
+    }
+    void commitContigRead(int id, int size)
+    {
+        MutexLocker locker(mMutex);
+        auto& reader = mExtraReaders[id];
+        reader.holdsBuf = false;
+        if (!reader.active) {
+            return;
+        }
+        if (reader.clearPending) {
+            reader.clearPending = false;
+            reader.readPtr = mWritePtr;
+            reader.dataSize = 0;
+        } else {
+            rbassert(size <= contigDataAvail(reader.readPtr, reader.dataSize));
+            reader.readPtr = advanceReadPtr(reader.readPtr, size);
+            reader.dataSize -= size;
+        }
+        notifySpaceFreed();
+    }
+    /* Stream position up to which the primary reader has consumed the data */
+    uint32_t readCount()
+    {
+        MutexLocker locker(mMutex);
+        return mWriteCount - mDataSize;
+    }
+    /* Stream position (in terms of the total amount of data written) up to which
+     * the extra reader has consumed the data. Can be compared to writeCount()
+     */
+    uint32_t readCount(int id)
+    {
+        MutexLocker locker(mMutex);
+        return mWriteCount - mExtraReaders[id].dataSize;
+    }
+    uint32_t writeCount()
+    {
+        MutexLocker locker(mMutex);
+        return mWriteCount;
+    }
     int8_t waitForReadOp(int msTimeout) { return waitAndReset(kFlagReadOp, msTimeout); }
 };
 
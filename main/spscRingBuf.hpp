@@ -0,0 +1,249 @@
+#ifndef SPSC_RINGBUF_HPP
+#define SPSC_RINGBUF_HPP
+
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "utils.hpp"
+
+/* Lock-free single-producer/single-consumer variant of RingBuf, with the same
+ * read/write API. The read and write positions are atomics, each one modified
+ * only by its owner side, so the data path takes no mutex and makes no event group
+ * calls. A side that needs to block publishes its task handle and sleeps on a
+ * direct-to-task notification, which the other side sends only if someone is
+ * actually waiting.
+ * Exactly one task may write to the buffer, and exactly one task may read from it.
+ * Since the waits use the task's notification value, the reader and writer tasks
+ * must not use task notifications for anything else.
+ */
+class SpscRingBuf
+{
+protected:
+    char* mBuf;
+    int mSize;
+    // Positions run in [0, 2 * mSize), which allows to distinguish a full buffer
+    // from an empty one without sacrificing a byte
+    std::atomic<int> mWritePos;
+    std::atomic<int> mReadPos;
+    // clear() is executed by the consumer, the producer only posts a request
+    std::atomic<int> mClearPos;
+    std::atomic<uint16_t> mClearCtr;
+    uint16_t mClearCtrSeen = 0; // owned by the consumer
+    std::atomic<TaskHandle_t> mReaderWaiting;
+    std::atomic<TaskHandle_t> mWriterWaiting;
+    std::atomic<bool> mStop;
+
+    int wrapPos(int pos) const { return (pos >= 2 * mSize) ? pos - 2 * mSize : pos; }
+    int posToOffset(int pos) const { return (pos >= mSize) ? pos - mSize : pos; }
+    int dataSize(int wpos, int rpos) const
+    {
+        int size = wpos - rpos;
+        return (size < 0) ? size + 2 * mSize : size;
+    }
+    static void wake(std::atomic<TaskHandle_t>& waiter)
+    {
+        auto task = waiter.load();
+        if (task) {
+            xTaskNotifyGive(task);
+        }
+    }
+    // Consumer only. @returns true if a clear request was processed
+    bool applyClear()
+    {
+        auto ctr = mClearCtr.load();
+        if (ctr == mClearCtrSeen) {
+            return false;
+        }
+        mClearCtrSeen = ctr;
+        mReadPos = mClearPos.load();
+        wake(mWriterWaiting);
+        return true;
+    }
+    // Consumer only
+    int readableSize()
+    {
+        int wpos = mWritePos;
+        if (applyClear()) {
+            wpos = mWritePos; // clear position may be newer than wpos
+        }
+        return dataSize(wpos, mReadPos);
+    }
+    // Consumer only. Does not process pending clear requests
+    int availableForContigRead()
+    {
+        int rpos = mReadPos;
+        return std::min(dataSize(mWritePos, rpos), mSize - posToOffset(rpos));
+    }
+    // Producer only
+    int availableForContigWrite()
+    {
+        int wpos = mWritePos;
+        int free = mSize - dataSize(wpos, mReadPos);
+        int toEnd = mSize - posToOffset(wpos);
+        return std::min(free, toEnd);
+    }
+    /* Blocks the calling task until cond() returns true
+     * @param waiter The slot where the calling task publishes its handle, so that
+     * the other side can notify it
+     * @returns 1 if cond() became true, 0 upon timeout, -1 if stop was signalled
+     */
+    template <class F>
+    int8_t waitUntil(std::atomic<TaskHandle_t>& waiter, F&& cond, int msTimeout)
+    {
+        if (cond()) {
+            return 1;
+        }
+        int64_t tsEnd = (msTimeout < 0) ? 0 : esp_timer_get_time() + (int64_t)msTimeout * 1000;
+        auto self = xTaskGetCurrentTaskHandle();
+        for (;;) {
+            // Publish ourselves before re-checking the condition, so that an update
+            // between the check and the sleep is guaranteed to notify us
+            waiter = self;
+            if (mStop) {
+                waiter = nullptr;
+                return -1;
+            }
+            if (cond()) {
+                waiter = nullptr;
+                return 1;
+            }
+            TickType_t ticks;
+            if (msTimeout < 0) {
+                ticks = portMAX_DELAY;
+            } else {
+                int64_t remaining = tsEnd - esp_timer_get_time();
+                if (remaining <= 0) {
+                    waiter = nullptr;
+                    return 0;
+                }
+                ticks = (remaining / 1000 + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+            }
+            // may return on a stale notification, the loop re-checks the condition
+            ulTaskNotifyTake(pdTRUE, ticks);
+        }
+    }
+    void doCommitWrite(int size)
+    {
+        myassert(size <= availableForContigWrite());
+        mWritePos = wrapPos(mWritePos + size);
+        wake(mReaderWaiting);
+    }
+    void doCommitRead(int size)
+    {
+        myassert(size <= availableForContigRead());
+        mReadPos = wrapPos(mReadPos + size);
+        wake(mWriterWaiting);
+    }
+    void doWrite(const char* buf, int size)
+    {
+        while (size > 0) {
+            int wlen = std::min(size, availableForContigWrite());
+            memcpy(mBuf + posToOffset(mWritePos), buf, wlen);
+            doCommitWrite(wlen);
+            buf += wlen;
+            size -= wlen;
+        }
+    }
+public:
+    SpscRingBuf(size_t bufSize)
+    : mBuf((char*)malloc(bufSize)), mSize(bufSize), mWritePos(0), mReadPos(0),
+      mClearPos(0), mClearCtr(0), mReaderWaiting(nullptr), mWriterWaiting(nullptr),
+      mStop(false)
+    {
+        if (!mBuf) {
+            ESP_LOGE("RINGBUF", "Out of memory allocation %zu bytes", bufSize);
+            mSize = 0;
+        }
+    }
+    ~SpscRingBuf()
+    {
+        if (mBuf) {
+            free(mBuf);
+        }
+    }
+    int size() const { return mSize; }
+    /* Discards all data in the buffer. Can be called by either side. The space
+     * is actually reclaimed when the consumer next accesses the buffer
+     */
+    void clear()
+    {
+        mClearPos = mWritePos.load();
+        mClearCtr++;
+        wake(mReaderWaiting);
+    }
+    int totalDataAvail() const { return dataSize(mWritePos, mReadPos); }
+    int totalEmptySpace() const { return mSize - totalDataAvail(); }
+    bool hasData() const { return totalDataAvail() > 0; }
+    /* Read requested amount and block if needed.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    int8_t read(char* buf, int size, int msTimeout)
+    {
+        auto ret = waitUntil(mReaderWaiting, [this, size]() { return readableSize() >= size; }, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        while (size > 0) {
+            int rlen = std::min(size, availableForContigRead());
+            memcpy(buf, mBuf + posToOffset(mReadPos), rlen);
+            doCommitRead(rlen);
+            buf += rlen;
+            size -= rlen;
+        }
+        return 1;
+    }
+    /* Returns a contiguous buffer with data for reading, which may be shorter
+     * than maxSize. If no data is available for reading, blocks until data becomes
+     * available or timeout elapses
+     * @returns the amount of data in the returned buffer, 0 for timeout or -1 if stop
+     * was signalled
+     */
+    int contigRead(char*& buf, int maxSize, int msTimeout)
+    {
+        auto ret = waitUntil(mReaderWaiting, [this]() { return readableSize() > 0; }, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        buf = mBuf + posToOffset(mReadPos);
+        return std::min(availableForContigRead(), maxSize);
+    }
+    void commitContigRead(int size) { doCommitRead(size); }
+    bool write(const char* buf, int size)
+    {
+        if (waitUntil(mWriterWaiting, [this, size]() { return totalEmptySpace() >= size; }, -1) < 0) {
+            return false;
+        }
+        doWrite(buf, size);
+        return true;
+    }
+    int getWriteBuf(char*& buf, int reqSize)
+    {
+        reqSize = std::min(reqSize, mSize - posToOffset(mWritePos));
+        if (waitUntil(mWriterWaiting, [this, reqSize]() { return availableForContigWrite() >= reqSize; }, -1) < 0) {
+            return -1;
+        }
+        buf = mBuf + posToOffset(mWritePos);
+        return availableForContigWrite();
+    }
+    void commitWrite(int size) { doCommitWrite(size); }
+    void setStopSignal()
+    {
+        mStop = true;
+        wake(mReaderWaiting);
+        wake(mWriterWaiting);
+    }
+    void clearStopSignal() { mStop = false; }
+    int8_t waitForData(int msTimeout)
+    {
+        return waitUntil(mReaderWaiting, [this]() { return readableSize() > 0; }, msTimeout);
+    }
+    bool waitForEmpty()
+    {
+        return waitUntil(mWriterWaiting, [this]() { return totalDataAvail() == 0; }, -1) >= 0;
+    }
+};
+
+#endif
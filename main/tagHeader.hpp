@@ -0,0 +1,56 @@
+#ifndef TAG_HEADER_HPP
+#define TAG_HEADER_HPP
+#include <stdint.h>
+#include <string.h>
+
+/* Headers of the metadata tags that can precede the audio of MP3 files - ID3v2,
+ * and less often APEv2. Nothing in them is needed for playback, and with
+ * embedded cover art they can be hundreds of KB, so they are skipped as a whole
+ * instead of letting the decoder search for a frame sync through them
+ */
+struct TagHeader
+{
+    enum {
+        kId3HeaderSize = 10,
+        kApeHeaderSize = 32,
+        kMaxHeaderSize = kApeHeaderSize
+    };
+    // Returns the total size of the tag that starts at p, 0 if there is no tag
+    // there, or -1 if len is too short to tell
+    static int64_t tagSize(const uint8_t* p, int len)
+    {
+        if (startsWith(p, len, "ID3", 3)) {
+            if (len < kId3HeaderSize) {
+                return -1;
+            }
+            // version and revision are never 0xff, the size is syncsafe
+            if (p[3] == 0xff || p[4] == 0xff || ((p[6] | p[7] | p[8] | p[9]) & 0x80)) {
+                return 0;
+            }
+            int64_t size = kId3HeaderSize + (((uint32_t)p[6] << 21) | (p[7] << 14) | (p[8] << 7) | p[9]);
+            return (p[5] & 0x10) ? size + kId3HeaderSize : size; // with a footer
+        }
+        if (startsWith(p, len, "APETAGEX", 8)) {
+            if (len < kApeHeaderSize) {
+                return -1;
+            }
+            // the size excludes the header, flag bit 29 marks this as the header
+            uint32_t flags = readLe32(p + 20);
+            return (flags & (1u << 29)) ? kApeHeaderSize + (int64_t)readLe32(p + 12) : 0;
+        }
+        return 0;
+    }
+    static const char* tagName(const uint8_t* p) { return (p[0] == 'I') ? "ID3v2" : "APEv2"; }
+protected:
+    // Whether p starts with the id, or with the part of it that fits in len
+    static bool startsWith(const uint8_t* p, int len, const char* id, int idLen)
+    {
+        return len > 0 && memcmp(p, id, (len < idLen) ? len : idLen) == 0;
+    }
+    static uint32_t readLe32(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <esp_http_server.h>
 #include <vector>
+#include <string>
 #include <stdarg.h>
 #include <esp_log.h>
 #include <freertos/semphr.h>
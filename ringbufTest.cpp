@@ -0,0 +1,392 @@
+// Host-side stress test and benchmark for RingBuf and SpscRingBuf
+// g++ -o ringbufTest ./ringbufTest.cpp ./host/freertosShim.cpp -I ./host -I ./main -O2 -g -lpthread
+// Usage: ringbufTest [stress|bench] [megabytes]
+// RingBuf is run three times - the second time ("RingBuf/thr") the reader first waits for
+// its whole chunk via waitForData(minBytes), and the wakeup counters are printed.
+// The third time ("RingBuf/mir") the buffer has a mirror area, and the reader checks
+// that no read is split at the wrap-around point. The "RingBuf/fan" test drains
+// the same stream with the primary and two extra readers concurrently
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+#include <ringbuf.hpp>
+#include <spscRingBuf.hpp>
+
+enum { kBufSize = 20 * 1024 };
+
+struct MirroredRingBuf: public RingBuf
+{
+    enum { kMirrorSize = 4096 };
+    MirroredRingBuf(size_t size): RingBuf(size, kMirrorSize) {}
+};
+
+// Deterministic byte stream, so the reader can verify what it got
+static inline char streamByte(int64_t pos) { return (char)((pos * 7 + (pos >> 9)) & 0xff); }
+// Deterministic pseudo-random chunk sizes
+static inline int chunkSize(uint32_t& seed, int maxSize)
+{
+    seed = seed * 1103515245 + 12345;
+    return 1 + (seed >> 8) % maxSize;
+}
+
+template <class RB>
+struct TestCtx
+{
+    RB rb;
+    int64_t total;
+    int chunkMax;
+    bool stress;
+    bool threshold;
+    volatile bool writerDone = false;
+    volatile bool readerDone = false;
+    int64_t errors = 0;
+    TestCtx(int64_t aTotal, int aChunkMax, bool aStress, bool aThreshold)
+    : rb(kBufSize), total(aTotal), chunkMax(aChunkMax), stress(aStress), threshold(aThreshold) {}
+};
+
+template <class RB>
+void writerTask(void* arg)
+{
+    auto& ctx = *static_cast<TestCtx<RB>*>(arg);
+    uint32_t seed = 1;
+    char tmp[kBufSize];
+    for (int64_t pos = 0; pos < ctx.total;) {
+        int len = std::min<int64_t>(chunkSize(seed, ctx.chunkMax), ctx.total - pos);
+        if (ctx.stress && (seed & 0x100)) { // exercise the copying write() too
+            for (int i = 0; i < len; i++) {
+                tmp[i] = streamByte(pos + i);
+            }
+            ctx.rb.write(tmp, len);
+        } else {
+            char* buf;
+            int avail = ctx.rb.getWriteBuf(buf, len);
+            len = std::min(len, avail);
+            if (ctx.stress) {
+                for (int i = 0; i < len; i++) {
+                    buf[i] = streamByte(pos + i);
+                }
+            }
+            ctx.rb.commitWrite(len);
+        }
+        pos += len;
+    }
+    ctx.writerDone = true;
+    vTaskDelete(nullptr);
+}
+
+template <class RB>
+void readerTask(void* arg)
+{
+    auto& ctx = *static_cast<TestCtx<RB>*>(arg);
+    uint32_t seed = 2;
+    char tmp[kBufSize];
+    for (int64_t pos = 0; pos < ctx.total;) {
+        int len = std::min<int64_t>(chunkSize(seed, ctx.chunkMax), ctx.total - pos);
+        if (ctx.stress && (seed & 0x100)) {
+            if (ctx.rb.read(tmp, len, -1) <= 0) {
+                break;
+            }
+            for (int i = 0; i < len; i++) {
+                if (tmp[i] != streamByte(pos + i)) {
+                    ctx.errors++;
+                }
+            }
+        } else {
+            if constexpr (std::is_same<RB, RingBuf>::value) {
+                if (ctx.threshold && ctx.rb.waitForData(len, -1) <= 0) {
+                    break;
+                }
+            }
+            char* buf;
+            int reqLen = len;
+            int availBefore = ctx.rb.totalDataAvail();
+            len = ctx.rb.contigRead(buf, len, -1);
+            if (len <= 0) {
+                break;
+            }
+            if constexpr (std::is_same<RB, MirroredRingBuf>::value) {
+                // the mirror must make a wrapped read come in one piece
+                if (len < std::min(reqLen, availBefore)) {
+                    ctx.errors++;
+                }
+            }
+            if (ctx.stress) {
+                for (int i = 0; i < len; i++) {
+                    if (buf[i] != streamByte(pos + i)) {
+                        ctx.errors++;
+                    }
+                }
+            }
+            ctx.rb.commitContigRead(len);
+        }
+        pos += len;
+    }
+    ctx.readerDone = true;
+    vTaskDelete(nullptr);
+}
+
+template <class RB>
+bool runTest(const char* name, int64_t total, int chunkMax, bool stress, bool threshold=false)
+{
+    TestCtx<RB> ctx(total, chunkMax, stress, threshold);
+    ElapsedTimer timer;
+    xTaskCreate(readerTask<RB>, "reader", 4096, &ctx, 5, nullptr);
+    xTaskCreate(writerTask<RB>, "writer", 4096, &ctx, 5, nullptr);
+    while (!ctx.writerDone || !ctx.readerDone) {
+        vTaskDelay(1);
+    }
+    auto us = timer.usElapsed();
+    printf("%-12s chunk<=%-5d %7.1f MB/s (%lld bytes in %lld us), errors: %lld\n",
+        name, chunkMax, (double)total / us, (long long)total, (long long)us, (long long)ctx.errors);
+    if constexpr (std::is_base_of<RingBuf, RB>::value) {
+        auto wakeups = ctx.rb.wakeupStats();
+        printf("%-12s wakeups: %u, spurious: %u\n", "", wakeups.wakeups, wakeups.spurious);
+    }
+    return ctx.errors == 0;
+}
+
+// Verifies that a reader waiting for a low-watermark is woken only once it is
+// crossed, and is released when the writer waits for the buffer to drain
+bool testThreshold()
+{
+    RingBuf rb(1024);
+    struct Ctx { RingBuf* rb; volatile int ret = 0; volatile bool done = false; } ctx;
+    ctx.rb = &rb;
+    auto waiter = [](void* arg) {
+        auto& c = *static_cast<Ctx*>(arg);
+        c.ret = c.rb->waitForData(300, 2000);
+        c.done = true;
+        vTaskDelete(nullptr);
+    };
+    bool ok = true;
+    char data[100] = {0};
+    xTaskCreate(waiter, "thr", 4096, &ctx, 5, nullptr);
+    for (int i = 0; i < 2; i++) {
+        vTaskDelay(20);
+        rb.write(data, sizeof(data));
+    }
+    vTaskDelay(20);
+    if (ctx.done) {
+        printf("waitForData(300) returned with only 200 bytes available\n");
+        ok = false;
+    }
+    rb.write(data, sizeof(data));
+    for (int i = 0; i < 100 && !ctx.done; i++) {
+        vTaskDelay(10);
+    }
+    if (!ctx.done || ctx.ret != 1) {
+        printf("waitForData(300) did not return when 300 bytes became available\n");
+        ok = false;
+    }
+    auto wakeups = rb.wakeupStats();
+    if (wakeups.wakeups != 1 || wakeups.spurious != 0) {
+        printf("Threshold wait: expected 1 wakeup, got %u (%u spurious)\n", wakeups.wakeups, wakeups.spurious);
+        ok = false;
+    }
+    // a reader waiting for more data must not block a writer waiting for the buffer to drain
+    ctx.done = false;
+    xTaskCreate([](void* arg) {
+        auto& c = *static_cast<Ctx*>(arg);
+        c.ret = c.rb->waitForData(1000, -1);
+        char* buf;
+        int len = c.rb->contigRead(buf, 1024, 0);
+        c.rb->commitContigRead(len);
+        c.done = true;
+        vTaskDelete(nullptr);
+    }, "drain", 4096, &ctx, 5, nullptr);
+    vTaskDelay(20);
+    rb.waitForEmpty();
+    for (int i = 0; i < 100 && !ctx.done; i++) {
+        vTaskDelay(10);
+    }
+    if (!ctx.done || ctx.ret != 1) {
+        printf("Reader waiting for a watermark was not released by waitForEmpty()\n");
+        ok = false;
+    }
+    return ok;
+}
+
+// One writer and three readers - the primary one and two extra readers, one of
+// which is slowed down - all verify the complete stream
+struct FanOutCtx
+{
+    MirroredRingBuf rb;
+    int64_t total;
+    volatile int done = 0;
+    int64_t errors = 0;
+    FanOutCtx(int64_t aTotal): rb(kBufSize), total(aTotal) {}
+};
+struct FanOutReader
+{
+    FanOutCtx* ctx;
+    int id; // -1 for the primary reader
+    int delayEvery;
+};
+void fanOutReaderTask(void* arg)
+{
+    auto& rd = *static_cast<FanOutReader*>(arg);
+    auto& ctx = *rd.ctx;
+    uint32_t seed = 3 + rd.id;
+    int64_t errors = 0;
+    for (int64_t pos = 0; pos < ctx.total;) {
+        int len = std::min<int64_t>(chunkSize(seed, 4096), ctx.total - pos);
+        char* buf;
+        len = (rd.id < 0) ? ctx.rb.contigRead(buf, len, -1) : ctx.rb.contigRead(rd.id, buf, len, -1);
+        if (len <= 0) {
+            errors++;
+            break;
+        }
+        for (int i = 0; i < len; i++) {
+            if (buf[i] != streamByte(pos + i)) {
+                errors++;
+            }
+        }
+        if (rd.delayEvery && (seed % rd.delayEvery) == 0) {
+            vTaskDelay(1); // keep the buffer pinned while the other readers proceed
+        }
+        if (rd.id < 0) {
+            ctx.rb.commitContigRead(len);
+        } else {
+            ctx.rb.commitContigRead(rd.id, len);
+        }
+        pos += len;
+    }
+    MutexLocker locker(ctx.rb.mutex());
+    ctx.errors += errors;
+    ctx.done++;
+    vTaskDelete(nullptr);
+}
+bool testFanOut(int64_t total)
+{
+    FanOutCtx ctx(total);
+    FanOutReader readers[3] = {{&ctx, -1, 0}, {&ctx, ctx.rb.addReader(), 0}, {&ctx, ctx.rb.addReader(), 64}};
+    bool ok = true;
+    if (readers[1].id < 0 || readers[2].id < 0 || ctx.rb.addReader() >= 0) {
+        printf("Fan-out: reader registration failed\n");
+        return false;
+    }
+    ElapsedTimer timer;
+    for (auto& rd: readers) {
+        xTaskCreate(fanOutReaderTask, "reader", 4096, &rd, 5, nullptr);
+    }
+    uint32_t seed = 1;
+    for (int64_t pos = 0; pos < total;) {
+        int len = std::min<int64_t>(chunkSize(seed, 1024), total - pos);
+        char* buf;
+        len = std::min(len, ctx.rb.getWriteBuf(buf, len));
+        for (int i = 0; i < len; i++) {
+            buf[i] = streamByte(pos + i);
+        }
+        ctx.rb.commitWrite(len);
+        pos += len;
+        if (ctx.rb.totalEmptySpace() < 0) {
+            ok = false;
+        }
+    }
+    while (ctx.done < 3) {
+        vTaskDelay(1);
+    }
+    if (ctx.rb.readCount(readers[1].id) != (uint32_t)total || ctx.rb.writeCount() != (uint32_t)total) {
+        printf("Fan-out: stream position mismatch\n");
+        ok = false;
+    }
+    printf("%-12s 3 readers   %7.1f MB/s, errors: %lld\n", "RingBuf/fan",
+        (double)total / timer.usElapsed(), (long long)ctx.errors);
+    // clear() while an extra reader holds a buffer, and removal of a blocked reader
+    char data[100] = {0};
+    ctx.rb.write(data, sizeof(data));
+    char* buf;
+    int len = ctx.rb.contigRead(readers[1].id, buf, 1000, 0);
+    ctx.rb.clear();
+    ctx.rb.commitContigRead(readers[1].id, len);
+    if (len != sizeof(data) || ctx.rb.contigRead(readers[1].id, buf, 1000, 10) != 0) {
+        printf("Fan-out: clear() did not discard data of extra reader\n");
+        ok = false;
+    }
+    struct { RingBuf* rb; int id; volatile int ret = 0; } rctx = { &ctx.rb, readers[2].id };
+    xTaskCreate([](void* arg) {
+        auto& c = *static_cast<decltype(rctx)*>(arg);
+        char* b;
+        c.ret = c.rb->contigRead(c.id, b, 10, -1);
+        vTaskDelete(nullptr);
+    }, "removed", 4096, &rctx, 5, nullptr);
+    vTaskDelay(20);
+    ctx.rb.removeReader(readers[2].id);
+    for (int i = 0; i < 100 && !rctx.ret; i++) {
+        vTaskDelay(10);
+    }
+    if (rctx.ret != -1) {
+        printf("Fan-out: removeReader() did not wake the blocked reader\n");
+        ok = false;
+    }
+    return ok && ctx.errors == 0;
+}
+
+// Verifies that a clear() from the producer side drops the old data, and that
+// a stop signal wakes a blocked reader
+template <class RB>
+bool testClearAndStop(const char* name)
+{
+    RB rb(1024);
+    char data[100];
+    memset(data, 1, sizeof(data));
+    rb.write(data, sizeof(data));
+    rb.clear();
+    memset(data, 2, sizeof(data));
+    rb.write(data, 10);
+    char* buf;
+    bool ok = true;
+    int len = rb.contigRead(buf, 1024, 100);
+    if (len != 10 || buf[0] != 2) {
+        printf("%s: clear() did not discard old data (got %d bytes)\n", name, len);
+        ok = false;
+    } else {
+        rb.commitContigRead(len);
+    }
+    struct StopCtx { RB* rb; volatile int ret = 1; volatile bool done = false; } sctx;
+    sctx.rb = &rb;
+    xTaskCreate([](void* arg) {
+        auto& c = *static_cast<StopCtx*>(arg);
+        char* b;
+        c.ret = c.rb->contigRead(b, 10, -1);
+        c.done = true;
+        vTaskDelete(nullptr);
+    }, "stopper", 4096, &sctx, 5, nullptr);
+    vTaskDelay(50);
+    rb.setStopSignal();
+    for (int i = 0; i < 1000 && !sctx.done; i++) {
+        vTaskDelay(1);
+    }
+    if (!sctx.done || sctx.ret != -1) {
+        printf("%s: stop signal did not wake reader\n", name);
+        ok = false;
+    }
+    rb.clearStopSignal();
+    if (rb.contigRead(buf, 10, 10) != 0) {
+        printf("%s: read of empty buffer did not time out\n", name);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    bool stress = argc < 2 || strcmp(argv[1], "bench") != 0;
+    int64_t total = (int64_t)((argc > 2) ? atoi(argv[2]) : (stress ? 64 : 256)) * 1024 * 1024;
+    bool ok = true;
+    if (stress) {
+        ok &= testClearAndStop<RingBuf>("RingBuf");
+        ok &= testClearAndStop<SpscRingBuf>("SpscRingBuf");
+        ok &= testThreshold();
+    }
+    ok &= testFanOut(total);
+    for (int chunk: {512, 1024, 4096}) {
+        ok &= runTest<RingBuf>("RingBuf", total, chunk, stress);
+        ok &= runTest<RingBuf>("RingBuf/thr", total, chunk, stress, true);
+        ok &= runTest<MirroredRingBuf>("RingBuf/mir", total, chunk, stress);
+        ok &= runTest<SpscRingBuf>("SpscRingBuf", total, chunk, stress);
+    }
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}